@@ -1,10 +1,14 @@
 from typing import List
+from typing import Optional
 from typing import Tuple
 
 import numpy as np
 
+from _pynear import HNSWL2Index as HNSWL2Index
 from _pynear import IVFFlatBinaryIndex as IVFFlatBinaryIndex
+from _pynear import IVFFlatL2Index as IVFFlatL2Index
 from _pynear import MIHBinaryIndex as MIHBinaryIndex
+from _pynear import SegmentedVPTreeL2Index as SegmentedVPTreeL2Index
 from _pynear import BKTreeBinaryIndex64
 from _pynear import BKTreeBinaryIndex128
 from _pynear import BKTreeBinaryIndex256
@@ -25,9 +29,11 @@ from _pynear import dist_hamming_256
 from _pynear import dist_hamming_512
 from _pynear import dist_l1
 from _pynear import dist_l2
+from _pynear import simd_level
 
 from ._version import __version__
-from .forest import IVFFlatL2Index
+from .async_search import search_async
+from .knn_graph import build_knn_graph
 
 try:
     from .sklearn_adapter import PyNearKNeighborsClassifier
@@ -53,30 +59,80 @@ def dist_hamming(a: List, b: List):
         raise ValueError("invalid data dimension: hamming distance only supports 64, 32, 16 or 8 bytes of data")
 
 
+def _empty_knn_result(
+    n: int, k: int, out: Optional[Tuple[np.ndarray, np.ndarray]] = None
+) -> Tuple[np.ndarray, np.ndarray]:
+    """All-padding binary top-k result, matching what the native indexes write for missing neighbours."""
+    if out is None:
+        out = (np.empty((n, k), dtype=np.int64), np.empty((n, k), dtype=np.int64))
+    out[0][...] = -1
+    out[1][...] = np.iinfo(np.int64).max
+    return out[0], out[1]
+
+
 class VPTreeBinaryIndex:
-    def __init__(self) -> None:
+    def __init__(self, leaf_size: int = 16, sampled_split: int = 0) -> None:
+        if leaf_size < 1:
+            raise ValueError("invalid leaf size: must be at least 1")
+        if sampled_split != 0 and sampled_split < 4096:
+            raise ValueError("invalid sampled split: must be 0 or at least 4096")
         self._index = None
         self._dimension = None
+        self._leaf_size = leaf_size
+        self._sampled_split = sampled_split
 
     def set(self, data: np.ndarray) -> None:
         self._validate(data)
 
         dim = data.shape[1]
         if dim == 64:
-            self._index = VPTreeBinaryIndex512()
+            self._index = VPTreeBinaryIndex512(self._leaf_size, self._sampled_split)
         elif dim == 32:
-            self._index = VPTreeBinaryIndex256()
+            self._index = VPTreeBinaryIndex256(self._leaf_size, self._sampled_split)
         elif dim == 16:
-            self._index = VPTreeBinaryIndex128()
+            self._index = VPTreeBinaryIndex128(self._leaf_size, self._sampled_split)
         elif dim == 8:
-            self._index = VPTreeBinaryIndex64()
+            self._index = VPTreeBinaryIndex64(self._leaf_size, self._sampled_split)
         else:
-            self._index = VPTreeBinaryIndexN()
+            self._index = VPTreeBinaryIndexN(self._leaf_size, self._sampled_split)
 
         self._dimension = dim
         self._index.set(data)
 
-    def searchKNN(self, queries: np.ndarray, k: int) -> Tuple[list, list]:
+    def add(self, data: np.ndarray) -> np.ndarray:
+        if self._index is None:
+            self.set(data)
+            return np.arange(len(data), dtype=np.int64)
+
+        self._validate(data)
+        if data.shape[1] != self._dimension:
+            raise ValueError(
+                f"invalid data dimension: added data must have the index dimension {self._dimension}, got {data.shape[1]}"
+            )
+        return self._index.add(data)
+
+    def remove(self, ids: np.ndarray) -> None:
+        if self._index is None:
+            if len(ids) > 0:
+                raise ValueError("cannot remove ids from an empty index")
+            return
+
+        self._index.remove(ids)
+
+    def compact(self) -> None:
+        if self._index is not None:
+            self._index.compact()
+
+    def size(self) -> int:
+        return 0 if self._index is None else self._index.size()
+
+    def searchKNN(
+        self,
+        queries: np.ndarray,
+        k: int,
+        out: Optional[Tuple[np.ndarray, np.ndarray]] = None,
+        filter: Optional[np.ndarray] = None,
+    ) -> Tuple[np.ndarray, np.ndarray]:
         dim = queries.shape[1]
         if dim != self._dimension:
             raise ValueError(
@@ -84,18 +140,65 @@ class VPTreeBinaryIndex:
             )
 
         if self._index is None:
-            return [], []
+            return _empty_knn_result(len(queries), k, out)
 
         self._validate(queries)
-        return self._index.searchKNN(queries, k)
+        return self._index.searchKNN(queries, k, out=out, filter=filter)
 
-    def search1NN(self, queries: np.ndarray) -> Tuple[list, list]:
+    def search1NN(self, queries: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
         if self._index is None:
-            return [], []
+            indices, distances = _empty_knn_result(len(queries), 1)
+            return indices[:, 0], distances[:, 0]
 
         self._validate(queries)
         return self._index.search1NN(queries)
 
+    def allKNN(
+        self, k: int, exclude_self: bool = True, out: Optional[Tuple[np.ndarray, np.ndarray]] = None
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        if self._index is None:
+            return _empty_knn_result(0, k, out)
+
+        return self._index.allKNN(k, exclude_self=exclude_self, out=out)
+
+    def searchRadius(self, queries: np.ndarray, radius: int, max_results: Optional[int] = None) -> Tuple[np.ndarray, np.ndarray, np.ndarray]:
+        if self._index is None:
+            empty = np.zeros(0, dtype=np.int64)
+            return np.zeros(len(queries) + 1, dtype=np.int64), empty, empty
+
+        self._validate(queries)
+        return self._index.searchRadius(queries, radius, max_results=max_results)
+
+    def searchKNNBudgeted(
+        self,
+        queries: np.ndarray,
+        k: int,
+        max_visits: int = 0,
+        max_time_us: int = 0,
+        out: Optional[Tuple[np.ndarray, np.ndarray]] = None,
+    ) -> Tuple[np.ndarray, np.ndarray, np.ndarray]:
+        if self._index is None:
+            return _empty_knn_result(len(queries), k, out) + (np.ones(len(queries), dtype=bool),)
+
+        self._validate(queries)
+        return self._index.searchKNNBudgeted(queries, k, max_visits=max_visits, max_time_us=max_time_us, out=out)
+
+    def search1NNBudgeted(
+        self, queries: np.ndarray, max_visits: int = 0, max_time_us: int = 0
+    ) -> Tuple[np.ndarray, np.ndarray, np.ndarray]:
+        if self._index is None:
+            indices, distances = _empty_knn_result(len(queries), 1)
+            return indices[:, 0], distances[:, 0], np.ones(len(queries), dtype=bool)
+
+        self._validate(queries)
+        return self._index.search1NNBudgeted(queries, max_visits=max_visits, max_time_us=max_time_us)
+
+    def leaf_size(self) -> int:
+        return self._leaf_size
+
+    def split_imbalance(self) -> float:
+        return 0.0 if self._index is None else self._index.split_imbalance()
+
     def _validate(self, data: np.ndarray) -> None:
         if len(data.shape) != 2:
             raise ValueError("invalid data shape: binary indexes must be 2D")
@@ -127,7 +230,7 @@ class BKTreeBinaryIndex:
         self._dimension = dim
         self._index.set(data)
 
-    def find_threshold(self, queries: np.ndarray, threshold: int) -> Tuple[list, list]:
+    def find_threshold(self, queries: np.ndarray, threshold: int) -> Tuple[np.ndarray, np.ndarray, np.ndarray]:
         dim = queries.shape[1]
         if dim != self._dimension:
             raise ValueError(
@@ -135,7 +238,8 @@ class BKTreeBinaryIndex:
             )
 
         if self._index is None:
-            return [], []
+            empty = np.zeros(0, dtype=np.int64)
+            return np.zeros(len(queries) + 1, dtype=np.int64), empty, empty
 
         self._validate(queries)
         return self._index.find_threshold(queries, threshold)
@@ -0,0 +1,69 @@
+"""
+Run index searches off the calling thread.
+
+The native indexes release the GIL while they search, so searches submitted
+from several threads (or several asyncio tasks) execute in parallel.
+``search_async`` wraps any index method in a future:
+
+* inside a running event loop it returns an awaitable ``asyncio.Future``
+  scheduled on the loop's executor (or the one given);
+* otherwise it returns a ``concurrent.futures.Future`` from a shared
+  thread pool.
+
+Example::
+
+    indices, distances = await pynear.search_async(index, queries, k=10)
+
+Searches on the same index run concurrently with each other.  A ``set()`` on
+that index waits for the searches in flight and holds back new ones until the
+index is rebuilt, so every search sees either the old index or the new one.
+"""
+
+import asyncio
+import functools
+import os
+import threading
+from concurrent.futures import Executor
+from concurrent.futures import ThreadPoolExecutor
+from typing import Optional
+
+_default_executor = None
+_default_executor_lock = threading.Lock()
+
+
+def _shared_executor() -> ThreadPoolExecutor:
+    global _default_executor
+    with _default_executor_lock:
+        if _default_executor is None:
+            _default_executor = ThreadPoolExecutor(max_workers=os.cpu_count() or 1, thread_name_prefix="pynear")
+        return _default_executor
+
+
+def search_async(
+    index, queries, k: Optional[int] = None, *, method: str = "searchKNN", executor: Optional[Executor] = None, **kwargs
+):
+    """
+    Call ``index.<method>(queries, k, **kwargs)`` on a worker thread and return a future.
+
+    Parameters
+    ----------
+    index : any PyNear index
+    queries : np.ndarray
+    k : int, optional
+        Neighbour count; omitted for methods that do not take one (e.g. ``search1NN``).
+    method : str, default='searchKNN'
+        Name of the search method to call, e.g. ``'search1NN'`` or ``'searchRadius'``.
+    executor : concurrent.futures.Executor, optional
+        Where to run the search.  Defaults to the event loop's default executor
+        inside a running loop, and to a shared thread pool otherwise.
+    **kwargs
+        Forwarded to the search method (``epsilon``, ``out``, ``radius``...).
+    """
+    args = (queries,) if k is None else (queries, k)
+    call = functools.partial(getattr(index, method), *args, **kwargs)
+
+    try:
+        loop = asyncio.get_running_loop()
+    except RuntimeError:
+        return (executor or _shared_executor()).submit(call)
+    return loop.run_in_executor(executor, call)
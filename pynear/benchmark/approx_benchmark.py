@@ -4,6 +4,7 @@ Approximate search benchmark: IVFFlatL2Index vs Faiss IndexIVFFlat.
 Measures both query latency and recall@k across:
   - multiple dimensionalities (128, 256, 512, 1024)
   - multiple n_probe values (to build a recall vs speed Pareto curve)
+  - multiple epsilon values for (1+eps)-approximate VPTreeL2Index search
 
 Output images are written to ./results/approximate-l2-high-dimensionality/
 """
@@ -26,6 +27,7 @@ DIMENSIONS = [128, 256, 512, 1024]
 N_QUERIES = 32
 K = 10
 N_PROBE_VALUES = [1, 5, 10, 20, 40, 80]
+EPSILON_VALUES = [0.0, 0.1, 0.25, 0.5, 1.0, 2.0]
 NUM_AVG_RUNS = 5
 NUM_BUILD_RUNS = 3
 OUTPUT_DIR = "./results/approximate-l2-high-dimensionality"
@@ -80,14 +82,15 @@ def build_exact_ground_truth(data, queries, k):
 def benchmark_dimension(dim, data, queries, k):
     """
     Returns a dict with keys 'vpforest' and 'faiss_ivf', each a list of
-    {n_probe, time, recall} dicts, plus 'build_time' with per-library ms.
+    {n_probe, time, recall} dicts, 'vptree_eps', a list of
+    {epsilon, time, qps, recall} dicts, plus 'build_time' with per-library ms.
     """
     print(f"  [dim={dim}] computing ground truth ... ", end="", flush=True)
     exact = build_exact_ground_truth(data, queries, k)
     print("done")
 
     n_clusters = max(10, int(np.sqrt(len(data))))
-    results = {"vpforest": [], "faiss_ivf": [], "build_time": {}}
+    results = {"vpforest": [], "faiss_ivf": [], "vptree_eps": [], "build_time": {}}
 
     # ── Build time (measured once, independent of n_probe) ─────────────────
     def build_pynear():
@@ -138,6 +141,22 @@ def benchmark_dimension(dim, data, queries, k):
         print(f"  [dim={dim}] FaissIVF  n_probe={n_probe_clamped:3d}  "
               f"time={t*1000:.1f}ms  recall={recall:.3f}")
 
+    # ── VPTreeL2 epsilon sweep ────────────────────────────────────────────────
+    vptree = pynear.VPTreeL2Index()
+    vptree.set(data)
+
+    for epsilon in EPSILON_VALUES:
+
+        def vpt_search(q, k_):
+            return vptree.searchKNN(q, k_, epsilon=epsilon)
+
+        t, res = timed_search(vpt_search, queries, k, NUM_AVG_RUNS)
+        recall = compute_recall(res[0], exact, k)
+        qps = len(queries) / t
+        results["vptree_eps"].append({"epsilon": epsilon, "time": t, "qps": qps, "recall": recall})
+        print(f"  [dim={dim}] VPTreeL2  epsilon={epsilon:4.2f}  "
+              f"time={t*1000:.1f}ms  qps={qps:.0f}  recall={recall:.3f}")
+
     return results
 
 
@@ -184,6 +203,42 @@ def plot_recall_vs_time(all_results, output_dir):
     print(f"  saved {path}")
 
 
+def plot_vptree_epsilon(all_results, output_dir):
+    """Recall@k vs QPS for VPTreeL2Index across the epsilon sweep, one line per dim."""
+    fig, ax = plt.subplots(figsize=(7, 4))
+    ax.set_title(
+        f"VPTreeL2 (1+eps) search  |  Recall@{K} vs QPS  |  N={DATASET_SIZE:,}",
+        fontsize=11,
+    )
+
+    for dim in DIMENSIONS:
+        pts = all_results[dim]["vptree_eps"]
+        qps = [p["qps"] for p in pts]
+        recalls = [p["recall"] for p in pts]
+        line, = ax.plot(qps, recalls, "o-", label=f"{dim}-D", linewidth=2)
+        for p, x, r in zip(pts, qps, recalls):
+            ax.annotate(
+                f"{p['epsilon']:g}",
+                (x, r),
+                textcoords="offset points",
+                xytext=(4, 4),
+                fontsize=7,
+                color=line.get_color(),
+            )
+
+    ax.set_xscale("log")
+    ax.set_xlabel("Queries per second")
+    ax.set_ylabel(f"Recall@{K}")
+    ax.set_ylim(0, 1.05)
+    ax.legend()
+    ax.grid(True, alpha=0.3)
+    plt.tight_layout()
+    path = os.path.join(output_dir, "vptree_epsilon_recall_vs_qps.png")
+    plt.savefig(path, dpi=150)
+    plt.clf()
+    print(f"  saved {path}")
+
+
 def plot_time_vs_dim(all_results, output_dir):
     """Query latency vs dimensionality at a fixed n_probe."""
     target_n_probe = 20
@@ -293,6 +348,7 @@ def main():
 
     print("\nGenerating plots ...")
     plot_recall_vs_time(all_results, OUTPUT_DIR)
+    plot_vptree_epsilon(all_results, OUTPUT_DIR)
     plot_time_vs_dim(all_results, OUTPUT_DIR)
     plot_recall_vs_dim(all_results, OUTPUT_DIR)
     plot_build_time_vs_dim(all_results, OUTPUT_DIR)
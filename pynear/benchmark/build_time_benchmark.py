@@ -11,10 +11,17 @@ Fixed dimensionality:
 
 Data sizes: 10k, 50k, 100k, 250k, 500k, 1 000 000
 
+Thread scaling: VPTreeL2Index build time at N = 1 000 000, d = 32 for 1, 2, 4, ... threads up
+to the machine's core count.  Each thread count runs in its own process, since OpenMP reads
+OMP_NUM_THREADS once at start-up.
+
 Output: results printed to stdout + saved to ./results/build_time/
 """
 
 import os
+import subprocess
+import sys
+import tempfile
 import time
 
 import faiss
@@ -30,6 +37,19 @@ EXACT_DIM     = 32
 APPROX_DIM    = 128
 DATASET_CLUSTERS = 50
 OUTPUT_DIR    = "./results/build_time"
+SCALING_N     = 1_000_000
+SCALING_RUNS  = 3
+
+
+def thread_counts() -> list:
+    """Powers of two up to the core count, plus the core count itself."""
+    cores = os.cpu_count() or 1
+    counts = [1]
+    while counts[-1] * 2 < cores:
+        counts.append(counts[-1] * 2)
+    if counts[-1] != cores:
+        counts.append(cores)
+    return counts
 
 
 def n_runs_for(n: int) -> int:
@@ -96,6 +116,37 @@ def benchmark_approx(data: np.ndarray) -> dict:
     return {"ivfflat": t_pynear, "faiss_ivf": t_faiss_ivf}
 
 
+# ── Thread scaling ─────────────────────────────────────────────────────────────
+
+def scaling_worker(data_path: str) -> None:
+    """Entry point of one scaling process: print the best VPTreeL2Index build time."""
+    data = np.load(data_path)
+    times = []
+    for _ in range(SCALING_RUNS):
+        t0 = time.perf_counter()
+        pynear.VPTreeL2Index().set(data)
+        times.append(time.perf_counter() - t0)
+    print(min(times))
+
+
+def benchmark_thread_scaling() -> dict:
+    data = generate_gaussian_dataset(SCALING_N, DATASET_CLUSTERS, EXACT_DIM, data_type=np.float32)
+    results = {}
+    with tempfile.TemporaryDirectory() as tmp:
+        data_path = os.path.join(tmp, "data.npy")
+        np.save(data_path, data)
+        for threads in thread_counts():
+            env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+            out = subprocess.run(
+                [sys.executable, "-m", "pynear.benchmark.build_time_benchmark", "--scaling-worker", data_path],
+                env=env, check=True, capture_output=True, text=True,
+            )
+            results[threads] = float(out.stdout.strip().splitlines()[-1])
+            print(f"  threads={threads:>3}  VPTree={results[threads]*1000:>8.0f}ms  "
+                  f"speedup={results[1] / results[threads]:.2f}x", flush=True)
+    return results
+
+
 # ── Main ───────────────────────────────────────────────────────────────────────
 
 def main():
@@ -149,6 +200,15 @@ def main():
         f.write(header + "\n" + "\n".join(rows) + "\n")
     print(f"\nSaved {csv_path}")
 
+    print(f"\nThread scaling, VPTreeL2Index, N={SCALING_N:,}, d={EXACT_DIM}:")
+    scaling = benchmark_thread_scaling()
+    scaling_path = os.path.join(OUTPUT_DIR, "build_thread_scaling.csv")
+    with open(scaling_path, "w") as f:
+        f.write("threads,vptree_ms,speedup\n")
+        for threads, seconds in scaling.items():
+            f.write(f"{threads},{seconds*1000:.1f},{scaling[1] / seconds:.2f}\n")
+    print(f"Saved {scaling_path}")
+
     # ── Print LaTeX-ready table rows ──────────────────────────────────────────
     print("\n--- LaTeX table rows ---")
     print("N  &  VPTreeL2  &  Faiss Flat  &  IVFFlatL2  &  Faiss IVF  \\\\")
@@ -172,4 +232,7 @@ def main():
 
 
 if __name__ == "__main__":
-    main()
+    if len(sys.argv) == 3 and sys.argv[1] == "--scaling-worker":
+        scaling_worker(sys.argv[2])
+    else:
+        main()
@@ -135,7 +135,7 @@ class AnnoyHammingAdapter(IndexAdapter):
 
 
 class IVFFlatL2Adapter(IndexAdapter):
-    """Approximate L2 index using IVFFlatL2Index (IVF-style flat BLAS scan)."""
+    """Approximate L2 index using IVFFlatL2Index (IVF-style flat GEMM scan)."""
 
     def __init__(self, n_probe: int = 10):
         self._n_probe = n_probe
@@ -156,6 +156,24 @@ class IVFFlatL2Adapter(IndexAdapter):
         return self._index.searchKNN(query, k)
 
 
+class HNSWL2Adapter(IndexAdapter):
+    """Approximate L2 index using HNSWL2Index (hierarchical small-world graph)."""
+
+    def __init__(self, ef_search: int = 64):
+        self._ef_search = ef_search
+        self._index = None
+
+    def build_index(self, data: np.ndarray):
+        self._index = pynear.HNSWL2Index(M=16, ef_construction=200, ef_search=self._ef_search)
+        self._index.set(data)
+
+    def _search_implementation(self, query, k: int):
+        self._index.searchKNN(query, k)
+
+    def search(self, query: np.ndarray, k: int):
+        return self._index.searchKNN(query, k)
+
+
 class FaissIVFAdapter(IndexAdapter):
     """Approximate L2 index using Faiss IndexIVFFlat (standard IVF baseline)."""
 
@@ -213,6 +231,7 @@ def create_index_adapter(index_name: str):
     Supported names:
       VPTreeL2Index, VPTreeL1Index, VPTreeBinaryIndex, VPTreeChebyshevIndex
       IVFFlatL2Index, IVFFlatL2Index_nprobeN   (approximate, n_probe=N)
+      HNSWL2Index, HNSWL2Index_efN             (approximate, ef_search=N)
       FaissIndexFlatL2, FaissIndexBinaryFlat
       FaissIVFL2, FaissIVFL2_nprobeN             (approximate, n_probe=N)
       AnnoyL2, AnnoyManhattan, AnnoyHamming
@@ -222,6 +241,10 @@ def create_index_adapter(index_name: str):
         n_probe = int(index_name.split("_nprobe")[1]) if "_nprobe" in index_name else 10
         return IVFFlatL2Adapter(n_probe=n_probe)
 
+    if index_name.startswith("HNSWL2Index"):
+        ef_search = int(index_name.split("_ef")[1]) if "_ef" in index_name else 64
+        return HNSWL2Adapter(ef_search=ef_search)
+
     if index_name.startswith("FaissIVFL2"):
         n_probe = int(index_name.split("_nprobe")[1]) if "_nprobe" in index_name else 10
         return FaissIVFAdapter(n_probe=n_probe)
@@ -0,0 +1,120 @@
+/*
+ *  MIT Licence
+ *  Copyright 2021 Pablo Carneiro Elias
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace vptree {
+
+// Allocator whose blocks start on an Alignment byte boundary, e.g. a cache line
+template <typename V, size_t Alignment> struct AlignedAllocator {
+    using value_type = V;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    V *allocate(size_t n) { return static_cast<V *>(::operator new(n * sizeof(V), std::align_val_t(Alignment))); }
+    void deallocate(V *p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <typename V, typename Alloc = std::allocator<V>> class ArrayStore {
+    /*
+     * Contiguous array that either owns its elements (a std::vector) or borrows them from an
+     * external buffer such as a memory-mapped file.  A borrowed store keeps the buffer alive
+     * through a shared owner handle, so copies of it share the same memory.  Borrowed memory is
+     * never written: the first write copies the elements into owned storage.
+     */
+public:
+    using vector_type = std::vector<V, Alloc>;
+
+    ArrayStore() = default;
+
+    ArrayStore(vector_type values) : _owned(std::move(values)) { pointAtOwned(); }
+
+    ArrayStore(const V *data, size_t size, std::shared_ptr<const void> owner)
+        : _data(data), _size(size), _owner(std::move(owner)) {}
+
+    ArrayStore(const ArrayStore &other) : _owned(other._owned), _owner(other._owner) {
+        if (_owner) {
+            _data = other._data;
+            _size = other._size;
+        } else {
+            pointAtOwned();
+        }
+    }
+
+    ArrayStore(ArrayStore &&other) noexcept
+        : _owned(std::move(other._owned)), _data(other._data), _size(other._size), _owner(std::move(other._owner)) {
+        other._data = nullptr;
+        other._size = 0;
+    }
+
+    ArrayStore &operator=(ArrayStore other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    void swap(ArrayStore &other) noexcept {
+        std::swap(_owned, other._owned);
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+        std::swap(_owner, other._owner);
+    }
+
+    void clear() { *this = ArrayStore(); }
+
+    const V &operator[](size_t i) const { return _data[i]; }
+    const V *data() const { return _data; }
+    const V *begin() const { return _data; }
+    const V *end() const { return _data + _size; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // true when the elements live in an external buffer rather than in this object
+    bool borrowed() const { return _owner != nullptr; }
+
+    std::vector<V> toVector() const { return std::vector<V>(begin(), end()); }
+
+    // Writable elements; the pointer stays valid until the next append
+    V *mutableData() {
+        detach();
+        return _owned.data();
+    }
+
+    void append(const V *values, size_t count) {
+        detach();
+        _owned.insert(_owned.end(), values, values + count);
+        pointAtOwned();
+    }
+
+private:
+    void detach() {
+        if (!_owner) return;
+        _owned.assign(_data, _data + _size);
+        _owner.reset();
+        pointAtOwned();
+    }
+
+    void pointAtOwned() {
+        _data = _owned.data();
+        _size = _owned.size();
+    }
+
+    vector_type _owned;
+    const V *_data = nullptr;
+    size_t _size = 0;
+    std::shared_ptr<const void> _owner;
+};
+
+} // namespace vptree
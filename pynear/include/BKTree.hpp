@@ -1,6 +1,7 @@
 #include <deque>
 #include <map>
 #include <optional>
+#include <utility>
 
 typedef int64_t index_t;
 
@@ -17,10 +18,10 @@ public:
     std::map<distance_t, BKNode<key_t, distance_t> *> leaves;
     std::optional<distance_t> max_distance;
 
-    BKNode(key_t key, index_t index) : key(key), index(index) {}
+    BKNode(key_t key, index_t index) : key(std::move(key)), index(index) {}
 
     void add_leaf(distance_t distance, key_t key, index_t index) {
-        leaves[distance] = new BKNode<key_t, distance_t>(key, index);
+        leaves[distance] = new BKNode<key_t, distance_t>(std::move(key), index);
         max_distance = std::max<distance_t>(distance, max_distance.value_or(0));
     }
 
@@ -43,7 +44,7 @@ public:
 
     void add(key_t key) {
         if (root == nullptr) {
-            root = new BKNode<key_t, distance_t>(key, index);
+            root = new BKNode<key_t, distance_t>(std::move(key), index);
         } else {
             BKNode<key_t, distance_t> *node = root;
             distance_t dist;
@@ -57,18 +58,24 @@ public:
                 node = next_it->second;
             }
 
-            node->add_leaf(dist, key, index);
+            node->add_leaf(dist, std::move(key), index);
         }
         ++index;
     }
 
-    void update(std::vector<key_t> keys) {
+    void update(const std::vector<key_t> &keys) {
         for (auto const &key : keys) {
             add(key);
         }
     }
 
-    std::tuple<std::vector<index_t>, std::vector<distance_t>, std::vector<key_t>> find(key_t key, distance_t threshold) {
+    /*
+     * Queries may be of any type the metric measures against key_t, e.g. a view of a code in
+     * the caller's buffer.
+     */
+    template <typename query_t>
+    std::tuple<std::vector<index_t>, std::vector<distance_t>, std::vector<key_t>> find(const query_t &key,
+                                                                                      distance_t threshold) {
         static_assert(std::is_signed<distance_t>::value, "Arithmetic required signed distances");
 
         BKNode<key_t, distance_t> *node = root;
@@ -114,8 +121,9 @@ public:
         return std::make_tuple(indices, distances, keys);
     }
 
+    template <typename query_t>
     std::tuple<std::vector<std::vector<index_t>>, std::vector<std::vector<distance_t>>, std::vector<std::vector<key_t>>>
-    find_batch(const std::vector<key_t> &keys, distance_t threshold) {
+    find_batch(const std::vector<query_t> &keys, distance_t threshold) {
         std::vector<std::vector<index_t>> indices_out(keys.size());
         std::vector<std::vector<distance_t>> distances_out(keys.size());
         std::vector<std::vector<key_t>> keys_out(keys.size());
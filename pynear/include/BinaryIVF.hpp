@@ -24,6 +24,7 @@
  */
 
 #include <DistanceFunctions.hpp>
+#include <SearchFilter.hpp>
 #include <algorithm>
 #include <limits>
 #include <queue>
@@ -45,46 +46,51 @@ public:
                                 uint32_t seed   = 42)
         : _nlist(nlist), _nprobe(nprobe), _max_iter(max_iter), _seed(seed) {}
 
-    /* Add vectors to the index (replaces any existing content). */
-    void set(const ndarrayli& data) {
-        if (data.empty()) {
-            _db.clear();
-            _centroids.clear();
-            _invlists.clear();
-            _nbytes = 0;
-            return;
-        }
-        _nbytes = data[0].size();
-        _db     = data;
-        _build();
+    /*
+     * Add n row-major codes of nbytes bytes each (replaces any existing
+     * content).  The codes are copied into one contiguous buffer.
+     */
+    void set(const uint8_t* data, size_t n, size_t nbytes) {
+        _centroids.clear();
+        _invlists.clear();
+        _n      = n;
+        _nbytes = (n > 0) ? nbytes : 0;
+        _db.assign(data, data + _n * _nbytes);
+        if (_n > 0) _build();
     }
 
-    /* Batch top-k search.  Returns (indices, distances). */
-    std::tuple<std::vector<std::vector<int64_t>>,
-               std::vector<std::vector<int64_t>>>
-    searchKNN(const ndarrayli& queries, size_t k) const {
-        size_t nq = queries.size();
-        std::vector<std::vector<int64_t>> all_idx(nq), all_dist(nq);
-
-        int32_t nprobe = std::min(_nprobe, (int32_t)_centroids.size());
+    /*
+     * Batch top-k search of nq row-major queries of nbytes() bytes into
+     * row-major (nq x k) buffers, nearest first.  Missing slots get index -1
+     * and distance INT64_MAX.  Points the filter rejects are skipped before
+     * their distance is computed.
+     */
+    void searchKNN(const uint8_t* queries, size_t nq, size_t k, int64_t* indices,
+                   int64_t* distances, const SearchFilter& filter = SearchFilter()) const {
+        const DistanceKernels& kernels = distance_kernels();
+        int32_t nc = (int32_t)_invlists.size();
+        int32_t nprobe = std::min(_nprobe, nc);
 
         for (size_t qi = 0; qi < nq; ++qi) {
+            const uint8_t* query = queries + qi * _nbytes;
+
             // ── Find nprobe nearest centroids ────────────────────────────────
-            int32_t nc = (int32_t)_centroids.size();
             std::vector<std::pair<int64_t, int32_t>> cdists(nc);
             for (int32_t c = 0; c < nc; ++c)
-                cdists[c] = {dist_hamming(queries[qi], _centroids[c]), c};
+                cdists[c] = {kernels.hamming(query, _centroid(c), _nbytes), c};
             std::partial_sort(cdists.begin(), cdists.begin() + nprobe,
                               cdists.end());
 
             // ── Scan chosen clusters, keep top-k in a max-heap ───────────────
             using Elem = std::pair<int64_t, int64_t>; // (distance, original_idx)
             std::priority_queue<Elem> heap;
+            const SearchFilter allowed = filter.row(qi);
 
             for (int32_t p = 0; p < nprobe; ++p) {
                 int32_t c = cdists[p].second;
                 for (int32_t idx : _invlists[c]) {
-                    int64_t d = dist_hamming(queries[qi], _db[idx]);
+                    if (!allowed.allows(idx)) continue;
+                    int64_t d = kernels.hamming(query, _code(idx), _nbytes);
                     if ((int64_t)heap.size() < (int64_t)k ||
                         d < heap.top().first) {
                         heap.push({d, (int64_t)idx});
@@ -93,54 +99,62 @@ public:
                 }
             }
 
-            // ── Extract results in ascending distance order ──────────────────
-            std::vector<int64_t> idxs, dists;
-            idxs.reserve(heap.size());
-            dists.reserve(heap.size());
-            while (!heap.empty()) {
-                idxs.push_back(heap.top().second);
-                dists.push_back(heap.top().first);
+            // ── Write the row nearest first, padding missing slots ───────────
+            int64_t* row_idx  = indices   + qi * k;
+            int64_t* row_dist = distances + qi * k;
+            for (size_t j = heap.size(); j < k; ++j) {
+                row_idx[j]  = -1;
+                row_dist[j] = std::numeric_limits<int64_t>::max();
+            }
+            for (size_t j = heap.size(); j-- > 0;) {
+                row_idx[j]  = heap.top().second;
+                row_dist[j] = heap.top().first;
                 heap.pop();
             }
-            std::reverse(idxs.begin(), idxs.end());
-            std::reverse(dists.begin(), dists.end());
-            all_idx[qi]  = std::move(idxs);
-            all_dist[qi] = std::move(dists);
         }
-        return {std::move(all_idx), std::move(all_dist)};
     }
 
     int32_t nlist()  const { return _nlist; }
     int32_t nprobe() const { return _nprobe; }
+    size_t  nbytes() const { return _nbytes; }
     void set_nprobe(int32_t nprobe) { _nprobe = nprobe; }
 
 private:
     int32_t  _nlist, _nprobe, _max_iter;
     uint32_t _seed;
-    size_t   _nbytes = 0;
+    size_t   _nbytes = 0, _n = 0;
 
-    ndarrayli _db;
-    ndarrayli _centroids;
+    // codes and centroids, row-major with _nbytes bytes per row
+    std::vector<uint8_t> _db;
+    std::vector<uint8_t> _centroids;
     std::vector<std::vector<int32_t>> _invlists;
 
+    const uint8_t* _code(size_t i) const { return _db.data() + i * _nbytes; }
+    const uint8_t* _centroid(int32_t c) const { return _centroids.data() + (size_t)c * _nbytes; }
+
+    void _copy_to_centroid(int32_t c, size_t i) {
+        std::copy(_code(i), _code(i) + _nbytes, _centroids.begin() + (size_t)c * _nbytes);
+    }
+
     // ── Binary k-means with K-Means++ initialisation ─────────────────────────
     void _build() {
-        size_t n = _db.size();
+        const DistanceKernels& kernels = distance_kernels();
+        size_t n = _n;
         int32_t k = std::min(_nlist, (int32_t)n);
 
         std::mt19937 rng(_seed);
         std::uniform_int_distribution<size_t> pick(0, n - 1);
 
         // ── K-Means++ init ───────────────────────────────────────────────────
-        _centroids.resize(k);
-        _centroids[0] = _db[pick(rng)];
+        _centroids.assign((size_t)k * _nbytes, 0);
+        _copy_to_centroid(0, pick(rng));
 
         std::vector<int64_t> min_d(n, std::numeric_limits<int64_t>::max());
 
         for (int32_t ci = 1; ci < k; ++ci) {
-            const arrayli& prev = _centroids[ci - 1];
+            const uint8_t* prev = _centroid(ci - 1);
             for (size_t i = 0; i < n; ++i) {
-                int64_t d = dist_hamming(_db[i], prev);
+                int64_t d = kernels.hamming(_code(i), prev, _nbytes);
                 if (d < min_d[i]) min_d[i] = d;
             }
             int64_t total = 0;
@@ -155,7 +169,7 @@ private:
                     if (cum > r) { chosen = i; break; }
                 }
             }
-            _centroids[ci] = _db[chosen];
+            _copy_to_centroid(ci, chosen);
         }
 
         // ── Lloyd iterations ─────────────────────────────────────────────────
@@ -176,7 +190,7 @@ private:
                 int64_t best_d = std::numeric_limits<int64_t>::max();
                 int32_t best_c = 0;
                 for (int32_t c = 0; c < k; ++c) {
-                    int64_t d = dist_hamming(_db[i], _centroids[c]);
+                    int64_t d = kernels.hamming(_code(i), _centroid(c), _nbytes);
                     if (d < best_d) { best_d = d; best_c = c; }
                 }
                 if (labels[i] != best_c) {
@@ -194,8 +208,9 @@ private:
             for (size_t i = 0; i < n; ++i) {
                 int32_t c = labels[i];
                 ++cluster_counts[c];
+                const uint8_t* code = _code(i);
                 for (size_t b = 0; b < _nbytes; ++b) {
-                    uint8_t byte = _db[i][b];
+                    uint8_t byte = code[b];
                     for (int bit = 0; bit < 8; ++bit)
                         if ((byte >> bit) & 1)
                             ++bit_counts[c][b * 8 + bit];
@@ -203,12 +218,11 @@ private:
             }
 
             for (int32_t c = 0; c < k; ++c) {
-                arrayli& cent = _centroids[c];
-                cent.assign(_nbytes, 0);
                 if (cluster_counts[c] == 0) {
-                    cent = _db[pick(rng)];
+                    _copy_to_centroid(c, pick(rng));
                     continue;
                 }
+                uint8_t* cent = _centroids.data() + (size_t)c * _nbytes;
                 int32_t half = cluster_counts[c] / 2;
                 for (size_t b = 0; b < _nbytes; ++b) {
                     uint8_t byte = 0;
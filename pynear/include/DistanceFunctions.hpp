@@ -11,10 +11,14 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
 
 // Portable population count — maps to hardware popcount on every supported arch
 #if defined(_MSC_VER)
@@ -33,6 +37,15 @@ struct FlatSpan {
     const float* data() const { return ptr; }
 };
 
+// View of one binary code inside a contiguous buffer, the uint8 counterpart of FlatSpan
+struct CodeSpan {
+    const uint8_t* ptr;
+    size_t sz;
+    size_t size() const { return sz; }
+    uint8_t operator[](size_t i) const { return ptr[i]; }
+    const uint8_t* data() const { return ptr; }
+};
+
 using arrayd = std::vector<double>;
 using arrayf = FlatSpan;
 using arrayli = std::vector<uint8_t>;
@@ -46,129 +59,7 @@ using ndarrayli = std::vector<arrayli>;
 #define ALIGN_AS(bits) __attribute__((__aligned__(bits)))
 #endif
 
-/* Hamming distances for multiples of 64 bits */
-int64_t hamming_u64(const arrayli &p1, const arrayli &p2) {
-    assert(p1.size() == p2.size());
-    assert(p1.size() % 8 == 0);
-
-    const uint64_t *bs1 = reinterpret_cast<const uint64_t *>(p1.data());
-    const uint64_t *bs2 = reinterpret_cast<const uint64_t *>(p2.data());
-
-    const size_t nwords = p1.size() / 8;
-    size_t i;
-    int64_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT64(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-template <size_t nbits> int64_t hamming_u64(const uint64_t *bs1, const uint64_t *bs2) {
-    const size_t nwords = nbits / 64;
-    size_t i;
-    int64_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT64(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-/* Hamming distances for multiples of 32 bits */
-int32_t hamming_u32(const arrayli &p1, const arrayli &p2) {
-    assert(p1.size() == p2.size());
-    assert(p1.size() % 4 == 0);
-
-    const uint32_t *bs1 = reinterpret_cast<const uint32_t *>(p1.data());
-    const uint32_t *bs2 = reinterpret_cast<const uint32_t *>(p2.data());
-
-    const size_t nwords = p1.size() / 4;
-    size_t i;
-    int32_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT32(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-template <size_t nbits> int32_t hamming_u32(const uint32_t *bs1, const uint32_t *bs2) {
-    const size_t nwords = nbits / 32;
-    size_t i;
-    int32_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT32(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-/* Hamming distances for multiples of 16 bits */
-int16_t hamming_u16(const arrayli &p1, const arrayli &p2) {
-    assert(p1.size() == p2.size());
-    assert(p1.size() % 2 == 0);
-
-    const uint16_t *bs1 = reinterpret_cast<const uint16_t *>(p1.data());
-    const uint16_t *bs2 = reinterpret_cast<const uint16_t *>(p2.data());
-
-    const size_t nwords = p1.size() / 2;
-    size_t i;
-    int16_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT32(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-template <size_t nbits> int16_t hamming_u16(const uint16_t *bs1, const uint16_t *bs2) {
-    const size_t nwords = nbits / 16;
-    size_t i;
-    int16_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT32(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-/* Hamming distances for multiples of 8 bits */
-int8_t hamming_u8(const arrayli &p1, const arrayli &p2) {
-    assert(p1.size() == p2.size());
-
-    const uint8_t *bs1 = p1.data();
-    const uint8_t *bs2 = p2.data();
-
-    const size_t nwords = p1.size();
-    size_t i;
-    int8_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT32(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-template <size_t nbits> int8_t hamming_u8(const uint8_t *bs1, const uint8_t *bs2) {
-    const size_t nwords = nbits / 8;
-    size_t i;
-    int8_t h = 0;
-    for (i = 0; i < nwords; i++)
-        h += PYNEAR_POPCNT32(bs1[i] ^ bs2[i]);
-    return h;
-}
-
-/* specialized (optimized) hamming functions — portable, no AVX needed */
-template <> inline int8_t hamming_u8<8>(const uint8_t *pa, const uint8_t *pb) { return PYNEAR_POPCNT32(pa[0] ^ pb[0]); }
-
-template <> inline int16_t hamming_u16<16>(const uint16_t *pa, const uint16_t *pb) { return PYNEAR_POPCNT32(pa[0] ^ pb[0]); }
-
-template <> inline int32_t hamming_u32<32>(const uint32_t *pa, const uint32_t *pb) { return PYNEAR_POPCNT32(pa[0] ^ pb[0]); }
-
-template <> inline int64_t hamming_u64<64>(const uint64_t *pa, const uint64_t *pb) { return PYNEAR_POPCNT64(pa[0] ^ pb[0]); }
-
-template <> inline int64_t hamming_u64<128>(const uint64_t *pa, const uint64_t *pb) {
-    return PYNEAR_POPCNT64(pa[0] ^ pb[0]) + PYNEAR_POPCNT64(pa[1] ^ pb[1]);
-}
-
-template <> inline int64_t hamming_u64<256>(const uint64_t *pa, const uint64_t *pb) {
-    return PYNEAR_POPCNT64(pa[0] ^ pb[0]) + PYNEAR_POPCNT64(pa[1] ^ pb[1]) +
-           PYNEAR_POPCNT64(pa[2] ^ pb[2]) + PYNEAR_POPCNT64(pa[3] ^ pb[3]);
-}
-
-template <> inline int64_t hamming_u64<512>(const uint64_t *pa, const uint64_t *pb) {
-    return PYNEAR_POPCNT64(pa[0] ^ pb[0]) + PYNEAR_POPCNT64(pa[1] ^ pb[1]) + PYNEAR_POPCNT64(pa[2] ^ pb[2]) + PYNEAR_POPCNT64(pa[3] ^ pb[3]) +
-           PYNEAR_POPCNT64(pa[4] ^ pb[4]) + PYNEAR_POPCNT64(pa[5] ^ pb[5]) + PYNEAR_POPCNT64(pa[6] ^ pb[6]) + PYNEAR_POPCNT64(pa[7] ^ pb[7]);
-}
-
-/* Scalar distance functions — always compiled, referenced by AVX #else fallbacks */
+/* Scalar reference distance functions */
 
 double dist_l2_d(const arrayd &p1, const arrayd &p2) {
 
@@ -182,7 +73,7 @@ double dist_l2_d(const arrayd &p1, const arrayd &p2) {
     return std::sqrt(result);
 }
 
-float dist_l2_f(const arrayf &p1, const arrayf &p2) {
+float dist_l2sq_f(const arrayf &p1, const arrayf &p2) {
 
     float result = 0.;
     size_t i = p1.size();
@@ -191,9 +82,11 @@ float dist_l2_f(const arrayf &p1, const arrayf &p2) {
         result += d * d;
     }
 
-    return std::sqrt(result);
+    return result;
 }
 
+float dist_l2_f(const arrayf &p1, const arrayf &p2) { return std::sqrt(dist_l2sq_f(p1, p2)); }
+
 float dist_l1_f(const arrayf &p1, const arrayf &p2) {
     /* L1 metric, also called Manhattan or taxicab metric */
 
@@ -221,257 +114,577 @@ float dist_chebyshev_f(const arrayf &p1, const arrayf &p2) {
     return result;
 }
 
-/* AVX/AVX2 accelerated distance functions */
-#if defined(__AVX__) || defined(__AVX2__)
+/*
+ * Runtime-dispatched SIMD kernels
+ * ───────────────────────────────
+ * The extension is compiled for the baseline instruction set of the platform, so one
+ * wheel runs on every x86-64 CPU.  Each kernel is compiled once per instruction set
+ * (DistanceKernels.hpp, included into one namespace per level with the matching target
+ * attribute) and the best level the CPU and OS support is picked once, at load time.
+ * Setting PYNEAR_SIMD=scalar|sse4.2|avx2|avx512 in the environment caps the level.
+ *
+ *   Scalar   one float per step, compiler popcount builtin; the only level off x86-64
+ *   SSE4.2   4-float SSE kernels, hardware popcnt
+ *   AVX2     8-float kernels with FMA; Harley–Seal / pshufb Hamming for long codes
+ *   AVX512   16-float AVX-512F kernels; Hamming uses VPOPCNTDQ when the CPU has it
+ *
+ * All levels implement identical semantics, including the early-abandon contract of the
+ * bounded variants, and within a level single and block kernels agree bit for bit.
+ */
+enum class SimdLevel : int { Scalar = 0, SSE42 = 1, AVX2 = 2, AVX512 = 3 };
+
+inline const char *simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE42:
+        return "sse4.2";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
 
-inline double sum4(__m256d v) {
-    __m128d vlow = _mm256_castpd256_pd128(v);
-    __m128d vhigh = _mm256_extractf128_pd(v, 1); // high 128
-    vlow = _mm_add_pd(vlow, vhigh);              // reduce down to 128
+// One kernel table per instruction set; block kernels take the query, its dimension, n rows and out
+struct DistanceKernels {
+    SimdLevel level;
 
-    __m128d high64 = _mm_unpackhi_pd(vlow, vlow);
-    return _mm_cvtsd_f64(_mm_add_sd(vlow, high64)); // reduce to scalar
-}
+    float (*l2sq)(const float *, const float *, size_t);
+    float (*l1)(const float *, const float *, size_t);
+    float (*chebyshev)(const float *, const float *, size_t);
 
-inline float sum8(__m256 x) {
-    // hiQuad = ( x7, x6, x5, x4 )
-    const __m128 hiQuad = _mm256_extractf128_ps(x, 1);
-    // loQuad = ( x3, x2, x1, x0 )
-    const __m128 loQuad = _mm256_castps256_ps128(x);
-    // sumQuad = ( x3 + x7, x2 + x6, x1 + x5, x0 + x4 )
-    const __m128 sumQuad = _mm_add_ps(loQuad, hiQuad);
-    // loDual = ( -, -, x1 + x5, x0 + x4 )
-    const __m128 loDual = sumQuad;
-    // hiDual = ( -, -, x3 + x7, x2 + x6 )
-    const __m128 hiDual = _mm_movehl_ps(sumQuad, sumQuad);
-    // sumDual = ( -, -, x1 + x3 + x5 + x7, x0 + x2 + x4 + x6 )
-    const __m128 sumDual = _mm_add_ps(loDual, hiDual);
-    // lo = ( -, -, -, x0 + x2 + x4 + x6 )
-    const __m128 lo = sumDual;
-    // hi = ( -, -, -, x1 + x3 + x5 + x7 )
-    const __m128 hi = _mm_shuffle_ps(sumDual, sumDual, 0x1);
-    // sum = ( -, -, -, x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7 )
-    const __m128 sum = _mm_add_ss(lo, hi);
-    return _mm_cvtss_f32(sum);
-}
+    float (*l2sq_bounded)(const float *, const float *, size_t, float);
+    float (*l1_bounded)(const float *, const float *, size_t, float);
+    float (*chebyshev_bounded)(const float *, const float *, size_t, float);
 
-double dist_l2_d_avx2(const arrayd &p1, const arrayd &p2) {
+    void (*l2sq_block)(const float *, size_t, const float *, size_t, float *, float);
+    void (*l1_block)(const float *, size_t, const float *, size_t, float *, float);
+    void (*chebyshev_block)(const float *, size_t, const float *, size_t, float *, float);
 
-    unsigned int i = p1.size() / 4;
-    __m256d result = _mm256_set_pd(0, 0, 0, 0);
+    void (*l2sq_block_bounded)(const float *, size_t, const float *, size_t, float *, float);
+    void (*l1_block_bounded)(const float *, size_t, const float *, size_t, float *, float);
+    void (*chebyshev_block_bounded)(const float *, size_t, const float *, size_t, float *, float);
 
-    while (i--) {
-        __m256d x = _mm256_loadu_pd(&p1[4 * i]);
-        __m256d y = _mm256_loadu_pd(&p2[4 * i]);
+    // inner products of m queries of dimension d with n rows, out is (m x n) row-major
+    void (*dot_cross)(const float *, size_t, size_t, const float *, size_t, float *);
 
-        /* Compute the difference between the two vectors */
-        __m256d diff = _mm256_sub_pd(x, y);
+    int64_t (*hamming)(const uint8_t *, const uint8_t *, size_t);
+    int64_t (*hamming_64)(const uint8_t *, const uint8_t *);
+    int64_t (*hamming_128)(const uint8_t *, const uint8_t *);
+    int64_t (*hamming_256)(const uint8_t *, const uint8_t *);
+    int64_t (*hamming_512)(const uint8_t *, const uint8_t *);
+};
 
-        __m256d temp = _mm256_mul_pd(diff, diff);
-        result = _mm256_add_pd(temp, result);
-        /* Multipl_mm256_mul_psy and add to result */
-        /* result = _mm256_fmadd_pd(diff, diff, result); */
-    }
+#if defined(__x86_64__) || defined(_M_X64)
+#define PYNEAR_SIMD_X86 1
+#endif
 
-    double out = sum4(result);
+#if defined(__GNUC__) || defined(__clang__)
+#define PYNEAR_TARGET(isa) __attribute__((target(isa)))
+#else
+// MSVC emits any intrinsic regardless of /arch, so no attribute is needed
+#define PYNEAR_TARGET(isa)
+#endif
 
-    // Handle remainder elements (when size % 4 != 0)
-    size_t processed = (p1.size() / 4) * 4;
-    double remain = 0.0;
-    for (size_t r = processed; r < p1.size(); r++) {
-        double d = p1[r] - p2[r];
-        remain += d * d;
+namespace simd {
+
+namespace scalar {
+struct Ops {
+    using reg = float;
+    static constexpr size_t W = 1;
+
+    static reg zero() { return 0.f; }
+    static reg load(const float *p) { return *p; }
+    static reg loadPartial(const float *p, size_t) { return *p; }
+    static reg sub(reg a, reg b) { return a - b; }
+    static reg add(reg a, reg b) { return a + b; }
+    static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+    static reg abs(reg a) { return std::fabs(a); }
+    static reg max(reg a, reg b) { return a < b ? b : a; }
+    static float sum(reg a) { return a; }
+    static float hmax(reg a) { return a; }
+
+    static int64_t popcount(uint64_t x) { return PYNEAR_POPCNT64(x); }
+};
+#define PYNEAR_KERNEL inline
+#include "DistanceKernels.hpp"
+#undef PYNEAR_KERNEL
+} // namespace scalar
+
+#ifdef PYNEAR_SIMD_X86
+
+namespace sse42 {
+#define PYNEAR_KERNEL inline PYNEAR_TARGET("sse4.2,popcnt")
+struct Ops {
+    using reg = __m128;
+    static constexpr size_t W = 4;
+
+    PYNEAR_KERNEL static reg zero() { return _mm_setzero_ps(); }
+    PYNEAR_KERNEL static reg load(const float *p) { return _mm_loadu_ps(p); }
+    PYNEAR_KERNEL static reg loadPartial(const float *p, size_t n) {
+        ALIGN_AS(16) float buf[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i < n; i++)
+            buf[i] = p[i];
+        return _mm_load_ps(buf);
+    }
+    PYNEAR_KERNEL static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+    PYNEAR_KERNEL static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+    PYNEAR_KERNEL static reg fmadd(reg a, reg b, reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    PYNEAR_KERNEL static reg abs(reg a) { return _mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF))); }
+    PYNEAR_KERNEL static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+    PYNEAR_KERNEL static float sum(reg a) {
+        __m128 shuf = _mm_movehdup_ps(a);
+        __m128 sums = _mm_add_ps(a, shuf);
+        shuf = _mm_movehl_ps(shuf, sums);
+        return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+    }
+    PYNEAR_KERNEL static float hmax(reg a) {
+        __m128 shuf = _mm_movehdup_ps(a);
+        __m128 maxs = _mm_max_ps(a, shuf);
+        shuf = _mm_movehl_ps(shuf, maxs);
+        return _mm_cvtss_f32(_mm_max_ss(maxs, shuf));
+    }
+    PYNEAR_KERNEL static int64_t popcount(uint64_t x) { return static_cast<int64_t>(_mm_popcnt_u64(x)); }
+};
+#include "DistanceKernels.hpp"
+#undef PYNEAR_KERNEL
+} // namespace sse42
+
+namespace avx2 {
+#define PYNEAR_KERNEL inline PYNEAR_TARGET("avx2,fma,popcnt")
+struct Ops {
+    using reg = __m256;
+    static constexpr size_t W = 8;
+
+    PYNEAR_KERNEL static reg zero() { return _mm256_setzero_ps(); }
+    PYNEAR_KERNEL static reg load(const float *p) { return _mm256_loadu_ps(p); }
+    PYNEAR_KERNEL static reg loadPartial(const float *p, size_t n) {
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        return _mm256_maskload_ps(p, _mm256_cmpgt_epi32(_mm256_set1_epi32((int)n), lanes));
+    }
+    PYNEAR_KERNEL static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    PYNEAR_KERNEL static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    PYNEAR_KERNEL static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+    PYNEAR_KERNEL static reg abs(reg a) { return _mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF))); }
+    PYNEAR_KERNEL static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+    PYNEAR_KERNEL static float sum(reg a) {
+        __m128 v = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        __m128 shuf = _mm_movehdup_ps(v);
+        __m128 sums = _mm_add_ps(v, shuf);
+        shuf = _mm_movehl_ps(shuf, sums);
+        return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+    }
+    PYNEAR_KERNEL static float hmax(reg a) {
+        __m128 v = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        __m128 shuf = _mm_movehdup_ps(v);
+        __m128 maxs = _mm_max_ps(v, shuf);
+        shuf = _mm_movehl_ps(shuf, maxs);
+        return _mm_cvtss_f32(_mm_max_ss(maxs, shuf));
     }
-    return std::sqrt(out + remain);
+    PYNEAR_KERNEL static int64_t popcount(uint64_t x) { return static_cast<int64_t>(_mm_popcnt_u64(x)); }
+};
+#include "DistanceKernels.hpp"
+
+// Muła's nibble-lookup popcount: per-byte counts from two pshufb lookups, summed into four 64-bit lanes
+PYNEAR_KERNEL __m256i popcount256(__m256i v) {
+    const __m256i lookup =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, nibble));
+    const __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
 }
 
-// reads 0 <= d < 4 floats as __m128
-static inline __m128 masked_read(int d, const float *x) {
-    assert(0 <= d && d < 4);
-    ALIGN_AS(16) float buf[4] = {0, 0, 0, 0};
-    switch (d) {
-    case 3:
-        buf[2] = x[2];
-    case 2:
-        buf[1] = x[1];
-    case 1:
-        buf[0] = x[0];
-    }
-    return _mm_load_ps(buf);
-    // cannot use AVX2 _mm_mask_set1_epi32
+// carry-save adder: high and low bits of the bitwise sum a + b + c
+PYNEAR_KERNEL void csa(__m256i &high, __m256i &low, __m256i a, __m256i b, __m256i c) {
+    const __m256i u = _mm256_xor_si256(a, b);
+    high = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    low = _mm256_xor_si256(u, c);
 }
 
-float dist_l2_f_avx2(const arrayf &p1, const arrayf &p2) {
-    unsigned int d = p1.size();
-    __m256 msum1 = _mm256_setzero_ps();
+PYNEAR_KERNEL __m256i xorAt(const uint8_t *a, const uint8_t *b, size_t i) {
+    return _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)));
+}
 
-    const float *x = p1.data();
-    const float *y = p2.data();
+/*
+ * Hamming distance for long codes.  Harley–Seal: 256-byte blocks are folded by carry-save
+ * adders into ones/twos/fours/eights bit planes and only eights is popcounted per block;
+ * the planes left over, whole 32-byte chunks and the tail follow.  Short codes are faster
+ * with scalar popcnt.
+ */
+PYNEAR_KERNEL int64_t hammingHarleySeal(const uint8_t *a, const uint8_t *b, size_t bytes) {
+    if (bytes < 64) return hamming(a, b, bytes);
 
-    while (d >= 8) {
-        __m256 mx = _mm256_loadu_ps(x);
-        x += 8;
-        __m256 my = _mm256_loadu_ps(y);
-        y += 8;
-        const __m256 a_m_b1 = _mm256_sub_ps(mx, my);
-        msum1 = _mm256_fmadd_ps(a_m_b1, a_m_b1, msum1);  // FMA: 1 insn vs 2
-        d -= 8;
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    if (bytes >= 256) {
+        __m256i ones = _mm256_setzero_si256(), twos = _mm256_setzero_si256(), fours = _mm256_setzero_si256();
+        __m256i eightsTotal = _mm256_setzero_si256();
+        for (; i + 256 <= bytes; i += 256) {
+            __m256i twosA, twosB, foursA, foursB, eights;
+            csa(twosA, ones, ones, xorAt(a, b, i), xorAt(a, b, i + 32));
+            csa(twosB, ones, ones, xorAt(a, b, i + 64), xorAt(a, b, i + 96));
+            csa(foursA, twos, twos, twosA, twosB);
+            csa(twosA, ones, ones, xorAt(a, b, i + 128), xorAt(a, b, i + 160));
+            csa(twosB, ones, ones, xorAt(a, b, i + 192), xorAt(a, b, i + 224));
+            csa(foursB, twos, twos, twosA, twosB);
+            csa(eights, fours, fours, foursA, foursB);
+            eightsTotal = _mm256_add_epi64(eightsTotal, popcount256(eights));
+        }
+        total = _mm256_slli_epi64(eightsTotal, 3);
+        total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+        total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+        total = _mm256_add_epi64(total, popcount256(ones));
     }
+    for (; i + 32 <= bytes; i += 32)
+        total = _mm256_add_epi64(total, popcount256(xorAt(a, b, i)));
 
-    __m128 msum2 = _mm256_extractf128_ps(msum1, 1);
-    msum2 = _mm_add_ps(msum2, _mm256_extractf128_ps(msum1, 0));
-
-    if (d >= 4) {
-        __m128 mx = _mm_loadu_ps(x);
-        x += 4;
-        __m128 my = _mm_loadu_ps(y);
-        y += 4;
-        const __m128 a_m_b1 = _mm_sub_ps(mx, my);
-        msum2 = _mm_add_ps(msum2, _mm_mul_ps(a_m_b1, a_m_b1));
-        d -= 4;
+    const __m128i pair = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    return _mm_cvtsi128_si64(pair) + _mm_extract_epi64(pair, 1) + hamming(a + i, b + i, bytes - i);
+}
+#undef PYNEAR_KERNEL
+} // namespace avx2
+
+namespace avx512 {
+#define PYNEAR_KERNEL inline PYNEAR_TARGET("avx512f,avx2,fma,popcnt")
+struct Ops {
+    using reg = __m512;
+    static constexpr size_t W = 16;
+
+    PYNEAR_KERNEL static reg zero() { return _mm512_setzero_ps(); }
+    PYNEAR_KERNEL static reg load(const float *p) { return _mm512_loadu_ps(p); }
+    PYNEAR_KERNEL static reg loadPartial(const float *p, size_t n) {
+        return _mm512_maskz_loadu_ps((__mmask16)((1u << n) - 1), p);
     }
-
-    if (d > 0) {
-        __m128 mx = masked_read(d, x);
-        __m128 my = masked_read(d, y);
-        const __m128 a_m_b1 = _mm_sub_ps(mx, my);
-        msum2 = _mm_add_ps(msum2, _mm_mul_ps(a_m_b1, a_m_b1));
+    PYNEAR_KERNEL static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+    PYNEAR_KERNEL static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    PYNEAR_KERNEL static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+    PYNEAR_KERNEL static reg abs(reg a) { return _mm512_abs_ps(a); }
+    // masked forms of max and the half extracts: the plain ones trip -Wuninitialized in GCC 12 headers
+    PYNEAR_KERNEL static reg max(reg a, reg b) { return _mm512_maskz_max_ps(0xFFFF, a, b); }
+    template <int half> PYNEAR_KERNEL static __m256 extract(reg a) {
+        return _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, _mm512_castps_pd(a), half));
     }
+    PYNEAR_KERNEL static float sum(reg a) { return avx2::Ops::sum(_mm256_add_ps(extract<0>(a), extract<1>(a))); }
+    PYNEAR_KERNEL static float hmax(reg a) { return avx2::Ops::hmax(_mm256_max_ps(extract<0>(a), extract<1>(a))); }
+    PYNEAR_KERNEL static int64_t popcount(uint64_t x) { return static_cast<int64_t>(_mm_popcnt_u64(x)); }
+};
+#include "DistanceKernels.hpp"
 
-    msum2 = _mm_hadd_ps(msum2, msum2);
-    msum2 = _mm_hadd_ps(msum2, msum2);
-    float result = _mm_cvtss_f32(msum2);
-    return std::sqrt(result);
+PYNEAR_KERNEL int64_t sumLanes(__m512i v) {
+    const __m256i folded = _mm256_add_epi64(_mm512_mask_extracti64x4_epi64(_mm256_setzero_si256(), 0xF, v, 0),
+                                            _mm512_mask_extracti64x4_epi64(_mm256_setzero_si256(), 0xF, v, 1));
+    const __m128i pair = _mm_add_epi64(_mm256_castsi256_si128(folded), _mm256_extracti128_si256(folded, 1));
+    return _mm_cvtsi128_si64(pair) + _mm_extract_epi64(pair, 1);
 }
+#undef PYNEAR_KERNEL
 
-float dist_l1_f_avx2(const arrayf &p1, const arrayf &p2) {
-    /* SIMD L1 metric, also called Manhattan or taxicab metric */
-
-    const float *vec1 = p1.data();
-    const float *vec2 = p2.data();
-    size_t size = p1.size();
+// Hamming with VPOPCNTDQ over 64-byte chunks and a masked tail load; Skylake-X lacks VPOPCNTDQ
+#define PYNEAR_VPOPCNT_KERNEL inline PYNEAR_TARGET("avx512f,avx512bw,avx512vpopcntdq,avx2,popcnt")
+PYNEAR_VPOPCNT_KERNEL int64_t hammingVpopcnt(const uint8_t *a, const uint8_t *b, size_t bytes) {
+    if (bytes < 32) return hamming(a, b, bytes);
 
-    const size_t blocksize = 8;
+    __m512i acc = _mm512_setzero_si512();
     size_t i = 0;
-
-    __m256 sum = _mm256_setzero_ps();
-    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
-
-    for (; i + blocksize <= size; i += blocksize) {
-        __m256 v1 = _mm256_loadu_ps(&vec1[i]);
-        __m256 v2 = _mm256_loadu_ps(&vec2[i]);
-
-        __m256 diff = _mm256_sub_ps(v1, v2);
-        sum = _mm256_add_ps(sum, _mm256_and_ps(diff, abs_mask));
+    for (; i + 64 <= bytes; i += 64) {
+        const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    if (i < bytes) {
+        const __mmask64 tail = (~0ULL) >> (64 - (bytes - i));
+        const __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi8(tail, a + i), _mm512_maskz_loadu_epi8(tail, b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
     }
+    return sumLanes(acc);
+}
 
-    ALIGN_AS(32) float result[8];
-    _mm256_store_ps(result, sum);
+PYNEAR_VPOPCNT_KERNEL int64_t hammingVpopcnt512(const uint8_t *a, const uint8_t *b) {
+    const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a), _mm512_loadu_si512(b));
+    return sumLanes(_mm512_popcnt_epi64(x));
+}
+#undef PYNEAR_VPOPCNT_KERNEL
+} // namespace avx512
 
-    float total_sum = 0.;
-    for (int j = 0; j < 8; ++j) {
-        total_sum += result[j];
-    }
+#endif // PYNEAR_SIMD_X86
 
-    // Calculate the remaining elements
-    for (; i < size; ++i) {
-        total_sum += std::fabs(vec1[i] - vec2[i]);
+#define PYNEAR_KERNEL_TABLE(ns, lvl, hammingAny)                                                                       \
+    DistanceKernels {                                                                                                  \
+        lvl, &ns::l2sq, &ns::l1, &ns::chebyshev, &ns::l2sqBounded, &ns::l1Bounded, &ns::chebyshevBounded,             \
+            &ns::l2sqBlock, &ns::l1Block, &ns::chebyshevBlock, &ns::l2sqBlockBounded, &ns::l1BlockBounded,             \
+            &ns::chebyshevBlockBounded, &ns::dotCross, &hammingAny, &ns::hammingFixed<64>, &ns::hammingFixed<128>,     \
+            &ns::hammingFixed<256>, &ns::hammingFixed<512>                                                             \
     }
 
-    return total_sum;
-}
-
-float dist_chebyshev_f_avx2(const arrayf &p1, const arrayf &p2) {
-    /* SIMD Chebyshev distance metric, also called maximum metric or L_inf metric */
+inline const DistanceKernels scalarKernels = PYNEAR_KERNEL_TABLE(scalar, SimdLevel::Scalar, scalar::hamming);
+#ifdef PYNEAR_SIMD_X86
+inline const DistanceKernels sse42Kernels = PYNEAR_KERNEL_TABLE(sse42, SimdLevel::SSE42, sse42::hamming);
+inline const DistanceKernels avx2Kernels = PYNEAR_KERNEL_TABLE(avx2, SimdLevel::AVX2, avx2::hammingHarleySeal);
+inline const DistanceKernels avx512Kernels = PYNEAR_KERNEL_TABLE(avx512, SimdLevel::AVX512, avx2::hammingHarleySeal);
+inline const DistanceKernels avx512VpopcntKernels = [] {
+    DistanceKernels kernels = avx512Kernels;
+    kernels.hamming = &avx512::hammingVpopcnt;
+    kernels.hamming_512 = &avx512::hammingVpopcnt512;
+    return kernels;
+}();
+#endif
 
-    const float *vec1 = p1.data();
-    const float *vec2 = p2.data();
-    size_t size = p1.size();
+#undef PYNEAR_KERNEL_TABLE
 
-    const size_t blocksize = 8;
-    size_t i = 0;
+struct CpuFeatures {
+    bool sse42 = false;
+    bool popcnt = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool vpopcntdq = false;
+};
 
-    __m256 max_diff = _mm256_setzero_ps();
-    const __m256 abs_mask_cheb = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+// What both the CPU and the OS (saved register state) support
+inline CpuFeatures detectCpuFeatures() {
+    CpuFeatures f;
+#if defined(PYNEAR_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    f.sse42 = __builtin_cpu_supports("sse4.2");
+    f.popcnt = __builtin_cpu_supports("popcnt");
+    f.avx2 = __builtin_cpu_supports("avx2");
+    f.fma = __builtin_cpu_supports("fma");
+    f.avx512f = __builtin_cpu_supports("avx512f");
+    f.avx512bw = __builtin_cpu_supports("avx512bw");
+    f.vpopcntdq = __builtin_cpu_supports("avx512vpopcntdq");
+#elif defined(PYNEAR_SIMD_X86) && defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    const int maxLeaf = r[0];
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] >> 27) & 1;
+    f.sse42 = (r[2] >> 20) & 1;
+    f.popcnt = (r[2] >> 23) & 1;
+    const bool fma = (r[2] >> 12) & 1;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool ymmState = (xcr0 & 0x6) == 0x6;
+    const bool zmmState = (xcr0 & 0xE6) == 0xE6;
+    if (maxLeaf >= 7) {
+        __cpuidex(r, 7, 0);
+        f.avx2 = ymmState && ((r[1] >> 5) & 1);
+        f.fma = ymmState && fma;
+        f.avx512f = zmmState && ((r[1] >> 16) & 1);
+        f.avx512bw = zmmState && ((r[1] >> 30) & 1);
+        f.vpopcntdq = zmmState && ((r[2] >> 14) & 1);
+    }
+#endif
+    return f;
+}
 
-    for (; i + blocksize <= size; i += blocksize) {
-        __m256 v1 = _mm256_loadu_ps(&vec1[i]);
-        __m256 v2 = _mm256_loadu_ps(&vec2[i]);
-        __m256 diff = _mm256_sub_ps(v1, v2);
-        diff = _mm256_and_ps(diff, abs_mask_cheb); // Absolute value
-        max_diff = _mm256_max_ps(max_diff, diff);
+inline bool supportsLevel(const CpuFeatures &f, SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Scalar:
+        return true;
+    case SimdLevel::SSE42:
+        return f.sse42 && f.popcnt;
+    case SimdLevel::AVX2:
+        return f.sse42 && f.popcnt && f.avx2 && f.fma;
+    case SimdLevel::AVX512:
+        return f.sse42 && f.popcnt && f.avx2 && f.fma && f.avx512f;
     }
+    return false;
+}
 
-    ALIGN_AS(32) float result[8];
-    _mm256_store_ps(result, max_diff);
+inline const CpuFeatures cpuFeatures = detectCpuFeatures();
 
-    float max_distance = result[0];
-    for (int i = 1; i < 8; ++i) {
-        max_distance = std::max(max_distance, result[i]);
+inline SimdLevel initialLevel() {
+    SimdLevel cap = SimdLevel::AVX512;
+    if (const char *env = std::getenv("PYNEAR_SIMD")) {
+        const std::string requested(env);
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE42, SimdLevel::AVX2, SimdLevel::AVX512})
+            if (requested == simd_level_name(level)) cap = level;
     }
+    SimdLevel level = cap;
+    while (!supportsLevel(cpuFeatures, level))
+        level = static_cast<SimdLevel>(static_cast<int>(level) - 1);
+    return level;
+}
 
-    // Calculate the remaining elements
-    for (; i < size; ++i) {
-        float diff = std::fabs(vec1[i] - vec2[i]);
-        max_distance = std::max(max_distance, diff);
+} // namespace simd
+
+// true when this CPU can run the kernels of level
+inline bool simd_level_supported(SimdLevel level) { return simd::supportsLevel(simd::cpuFeatures, level); }
+
+// kernel table of level; the caller checks simd_level_supported first
+inline const DistanceKernels &distance_kernels_for(SimdLevel level) {
+#ifdef PYNEAR_SIMD_X86
+    switch (level) {
+    case SimdLevel::SSE42:
+        return simd::sse42Kernels;
+    case SimdLevel::AVX2:
+        return simd::avx2Kernels;
+    case SimdLevel::AVX512:
+        return simd::cpuFeatures.vpopcntdq && simd::cpuFeatures.avx512bw ? simd::avx512VpopcntKernels
+                                                                          : simd::avx512Kernels;
+    default:
+        break;
     }
+#endif
+    return simd::scalarKernels;
+}
+
+namespace simd {
+inline std::atomic<const DistanceKernels *> activeKernels{&distance_kernels_for(initialLevel())};
+} // namespace simd
+
+// the kernel table every dispatched distance function calls through
+inline const DistanceKernels &distance_kernels() { return *simd::activeKernels.load(std::memory_order_relaxed); }
 
-    return max_distance;
+// switches all distance functions to level; false (and no change) when the CPU lacks it
+inline bool set_simd_level(SimdLevel level) {
+    if (!simd_level_supported(level)) return false;
+    simd::activeKernels.store(&distance_kernels_for(level), std::memory_order_relaxed);
+    return true;
 }
 
-#else // !(__AVX__ || __AVX2__) — scalar fallbacks for non-x86 platforms (e.g. arm64)
+/*
+ * Float distance functions used as index template arguments.  They dispatch through the
+ * active kernel table; the _avx2 suffix predates runtime dispatch and is kept so the
+ * index instantiations and their pickles keep their names.
+ */
+inline float dist_l2sq_f_avx2(const arrayf &p1, const arrayf &p2) {
+    return distance_kernels().l2sq(p1.data(), p2.data(), p1.size());
+}
+inline float dist_l2_f_avx2(const arrayf &p1, const arrayf &p2) { return std::sqrt(dist_l2sq_f_avx2(p1, p2)); }
+inline float dist_l1_f_avx2(const arrayf &p1, const arrayf &p2) {
+    return distance_kernels().l1(p1.data(), p2.data(), p1.size());
+}
+inline float dist_chebyshev_f_avx2(const arrayf &p1, const arrayf &p2) {
+    return distance_kernels().chebyshev(p1.data(), p2.data(), p1.size());
+}
 
+// double precision is only used by tests and is not dispatched
 double dist_l2_d_avx2(const arrayd &p1, const arrayd &p2) { return dist_l2_d(p1, p2); }
-float  dist_l2_f_avx2(const arrayf &p1, const arrayf &p2) { return dist_l2_f(p1, p2); }
-float  dist_l1_f_avx2(const arrayf &p1, const arrayf &p2) { return dist_l1_f(p1, p2); }
-float  dist_chebyshev_f_avx2(const arrayf &p1, const arrayf &p2) { return dist_chebyshev_f(p1, p2); }
 
-#endif // __AVX__
+/*
+ * Compile-time hooks that let VPTree pick a specialised kernel for a distance function.
+ * The generic version evaluates one-to-many distances row by row and ignores bounds;
+ * SIMD metrics override it with block and early-abandon kernels.
+ */
+template <auto distance> struct distance_traits {
+    // true when distance returns squared L2; VPTree then keeps radii and tau squared
+    static constexpr bool squared = false;
+
+    // true when codes() measures binary codes by pointer; VPTree then packs them in one buffer
+    static constexpr bool packed = false;
+
+    // distance(a, b), or any value > bound when the distance is known to exceed bound
+    template <typename T, typename D> static D bounded(const T &a, const T &b, D /*bound*/) { return distance(a, b); }
+
+    static void one_to_many(const arrayf &q, const float *block, size_t n, float *out) {
+        const size_t d = q.size();
+        for (size_t i = 0; i < n; i++)
+            out[i] = distance(q, FlatSpan{block + i * d, d});
+    }
 
-int64_t dist_hamming(const arrayli &p1, const arrayli &p2) {
-    size_t size = p1.size();
+    static void one_to_many_bounded(const arrayf &q, const float *block, size_t n, float *out, float /*bound*/) {
+        one_to_many(q, block, n, out);
+    }
+};
 
-    if (size % 8 == 0) {
-        return hamming_u64(p1, p2);
-    } else if (size % 4 == 0) {
-        return static_cast<int64_t>(hamming_u32(p1, p2));
-    } else if (size % 2 == 0) {
-        return static_cast<int64_t>(hamming_u16(p1, p2));
-    } else {
-        return static_cast<int64_t>(hamming_u8(p1, p2));
+template <> struct distance_traits<dist_l2sq_f_avx2> {
+    static constexpr bool squared = true;
+    static float bounded(const arrayf &a, const arrayf &b, float bound) {
+        return distance_kernels().l2sq_bounded(a.data(), b.data(), a.size(), bound);
     }
-}
+    static void one_to_many(const arrayf &q, const float *block, size_t n, float *out) {
+        distance_kernels().l2sq_block(q.data(), q.size(), block, n, out, 0.f);
+    }
+    static void one_to_many_bounded(const arrayf &q, const float *block, size_t n, float *out, float bound) {
+        distance_kernels().l2sq_block_bounded(q.data(), q.size(), block, n, out, bound);
+    }
+};
 
-inline int64_t dist_hamming_512(const arrayli &p1, const arrayli &p2) {
+template <> struct distance_traits<dist_l2_f_avx2> {
+    static constexpr bool squared = false;
+    static float bounded(const arrayf &a, const arrayf &b, float bound) {
+        return std::sqrt(distance_kernels().l2sq_bounded(a.data(), b.data(), a.size(), bound * bound));
+    }
+    static void one_to_many(const arrayf &q, const float *block, size_t n, float *out) {
+        distance_kernels().l2sq_block(q.data(), q.size(), block, n, out, 0.f);
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::sqrt(out[i]);
+    }
+    static void one_to_many_bounded(const arrayf &q, const float *block, size_t n, float *out, float bound) {
+        distance_kernels().l2sq_block_bounded(q.data(), q.size(), block, n, out, bound * bound);
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::sqrt(out[i]);
+    }
+};
 
-    return hamming_u64<512>(reinterpret_cast<const uint64_t *>(&p1[0]), reinterpret_cast<const uint64_t *>(&p2[0]));
-}
+template <> struct distance_traits<dist_l1_f_avx2> {
+    static constexpr bool squared = false;
+    static float bounded(const arrayf &a, const arrayf &b, float bound) {
+        return distance_kernels().l1_bounded(a.data(), b.data(), a.size(), bound);
+    }
+    static void one_to_many(const arrayf &q, const float *block, size_t n, float *out) {
+        distance_kernels().l1_block(q.data(), q.size(), block, n, out, 0.f);
+    }
+    static void one_to_many_bounded(const arrayf &q, const float *block, size_t n, float *out, float bound) {
+        distance_kernels().l1_block_bounded(q.data(), q.size(), block, n, out, bound);
+    }
+};
 
-inline int64_t dist_hamming_256(const arrayli &p1, const arrayli &p2) {
+template <> struct distance_traits<dist_chebyshev_f_avx2> {
+    static constexpr bool squared = false;
+    static float bounded(const arrayf &a, const arrayf &b, float bound) {
+        return distance_kernels().chebyshev_bounded(a.data(), b.data(), a.size(), bound);
+    }
+    static void one_to_many(const arrayf &q, const float *block, size_t n, float *out) {
+        distance_kernels().chebyshev_block(q.data(), q.size(), block, n, out, 0.f);
+    }
+    static void one_to_many_bounded(const arrayf &q, const float *block, size_t n, float *out, float bound) {
+        distance_kernels().chebyshev_block_bounded(q.data(), q.size(), block, n, out, bound);
+    }
+};
 
-    return hamming_u64<256>(reinterpret_cast<const uint64_t *>(&p1[0]), reinterpret_cast<const uint64_t *>(&p2[0]));
+/* Hamming distances, dispatched like the float kernels */
+inline int64_t dist_hamming(const arrayli &p1, const arrayli &p2) {
+    assert(p1.size() == p2.size());
+    return distance_kernels().hamming(p1.data(), p2.data(), p1.size());
 }
 
-inline int64_t dist_hamming_128(const arrayli &p1, const arrayli &p2) {
+inline int64_t dist_hamming_512(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming_512(p1.data(), p2.data()); }
 
-    return hamming_u64<128>(reinterpret_cast<const uint64_t *>(&p1[0]), reinterpret_cast<const uint64_t *>(&p2[0]));
-}
+inline int64_t dist_hamming_256(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming_256(p1.data(), p2.data()); }
 
-inline int64_t dist_hamming_64(const arrayli &p1, const arrayli &p2) {
-    return hamming_u64<64>(reinterpret_cast<const uint64_t *>(&p1[0]), reinterpret_cast<const uint64_t *>(&p2[0]));
-}
+inline int64_t dist_hamming_128(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming_128(p1.data(), p2.data()); }
 
-inline int64_t dist_hamming_32(const arrayli &p1, const arrayli &p2) {
+inline int64_t dist_hamming_64(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming_64(p1.data(), p2.data()); }
 
-    return static_cast<int64_t>(hamming_u32<32>(reinterpret_cast<const uint32_t *>(&p1[0]), reinterpret_cast<const uint32_t *>(&p2[0])));
-}
+inline int64_t dist_hamming_32(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming(p1.data(), p2.data(), 4); }
 
-inline int64_t dist_hamming_16(const arrayli &p1, const arrayli &p2) {
+inline int64_t dist_hamming_16(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming(p1.data(), p2.data(), 2); }
 
-    return static_cast<int64_t>(hamming_u16<16>(reinterpret_cast<const uint16_t *>(&p1[0]), reinterpret_cast<const uint16_t *>(&p2[0])));
-}
+inline int64_t dist_hamming_8(const arrayli &p1, const arrayli &p2) { return distance_kernels().hamming(p1.data(), p2.data(), 1); }
 
-inline int64_t dist_hamming_8(const arrayli &p1, const arrayli &p2) {
+/*
+ * Pointer forms of the Hamming functions, so VPTree can keep binary codes in one contiguous
+ * buffer instead of one std::vector per point.  bytes is the code length of the index.
+ */
+#define PYNEAR_HAMMING_TRAITS(function, call)                                                                  \
+    template <> struct distance_traits<function> {                                                             \
+        static constexpr bool squared = false;                                                                 \
+        static constexpr bool packed = true;                                                                   \
+        static int64_t codes(const uint8_t *a, const uint8_t *b, size_t bytes) {                               \
+            (void)bytes;                                                                                       \
+            return distance_kernels().call;                                                                    \
+        }                                                                                                      \
+    };
 
-    return static_cast<int64_t>(hamming_u8<8>(reinterpret_cast<const uint8_t *>(&p1[0]), reinterpret_cast<const uint8_t *>(&p2[0])));
-}
+PYNEAR_HAMMING_TRAITS(dist_hamming, hamming(a, b, bytes))
+PYNEAR_HAMMING_TRAITS(dist_hamming_512, hamming_512(a, b))
+PYNEAR_HAMMING_TRAITS(dist_hamming_256, hamming_256(a, b))
+PYNEAR_HAMMING_TRAITS(dist_hamming_128, hamming_128(a, b))
+PYNEAR_HAMMING_TRAITS(dist_hamming_64, hamming_64(a, b))
+PYNEAR_HAMMING_TRAITS(dist_hamming_32, hamming(a, b, 4))
+PYNEAR_HAMMING_TRAITS(dist_hamming_16, hamming(a, b, 2))
+PYNEAR_HAMMING_TRAITS(dist_hamming_8, hamming(a, b, 1))
+
+#undef PYNEAR_HAMMING_TRAITS
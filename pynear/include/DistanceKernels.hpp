@@ -0,0 +1,251 @@
+/*
+ *  MIT Licence
+ *  Copyright 2021 Pablo Carneiro Elias
+ */
+
+// No include guard: DistanceFunctions.hpp includes this file once per instruction set, inside
+// a namespace that first defines
+//   - Ops: the vector type `reg`, its width W in floats and the primitive operations below
+//   - PYNEAR_KERNEL: the function specifier compiling a kernel for that instruction set
+// The kernels only ever call Ops and each other, so every copy is built for its own target.
+
+/*
+ * Float kernels come in two flavours selected by the `bounded` template flag.  Bounded
+ * variants compare the running value against `bound` every 32 floats and return the
+ * partial value as soon as it exceeds it.  Partials are reduced in the same order as the
+ * final value and every lane only grows, so a partial never exceeds the full distance:
+ * a result > bound means "farther than bound", a result <= bound is the exact distance.
+ *
+ * Tails shorter than one vector are read zero-filled, which adds nothing to any of the
+ * three metrics, so the tail goes through the same lanes and reduction as the body.
+ */
+static constexpr size_t ABANDON_CHECK_STEPS = (32 / Ops::W > 0) ? 32 / Ops::W : 1;
+
+struct L2Sq {
+    PYNEAR_KERNEL static Ops::reg step(Ops::reg acc, Ops::reg x, Ops::reg y) {
+        const Ops::reg diff = Ops::sub(x, y);
+        return Ops::fmadd(diff, diff, acc);
+    }
+    PYNEAR_KERNEL static float reduce(Ops::reg acc) { return Ops::sum(acc); }
+};
+
+struct L1 {
+    PYNEAR_KERNEL static Ops::reg step(Ops::reg acc, Ops::reg x, Ops::reg y) {
+        return Ops::add(acc, Ops::abs(Ops::sub(x, y)));
+    }
+    PYNEAR_KERNEL static float reduce(Ops::reg acc) { return Ops::sum(acc); }
+};
+
+struct Chebyshev {
+    PYNEAR_KERNEL static Ops::reg step(Ops::reg acc, Ops::reg x, Ops::reg y) {
+        return Ops::max(acc, Ops::abs(Ops::sub(x, y)));
+    }
+    PYNEAR_KERNEL static float reduce(Ops::reg acc) { return Ops::hmax(acc); }
+};
+
+// Inner product, for callers that expand ‖x − y‖² into ‖x‖² + ‖y‖² − 2 x·y over precomputed norms
+struct Dot {
+    PYNEAR_KERNEL static Ops::reg step(Ops::reg acc, Ops::reg x, Ops::reg y) { return Ops::fmadd(x, y, acc); }
+    PYNEAR_KERNEL static float reduce(Ops::reg acc) { return Ops::sum(acc); }
+};
+
+template <typename Metric, bool bounded>
+PYNEAR_KERNEL float pairDistance(const float *x, const float *y, size_t d, float bound) {
+    Ops::reg acc = Ops::zero();
+    size_t j = 0;
+    size_t step = 0;
+    for (; j + Ops::W <= d; j += Ops::W) {
+        acc = Metric::step(acc, Ops::load(x + j), Ops::load(y + j));
+        if constexpr (bounded) {
+            if (++step == ABANDON_CHECK_STEPS) {
+                step = 0;
+                const float partial = Metric::reduce(acc);
+                if (partial > bound) return partial;
+            }
+        }
+    }
+    if (j < d) acc = Metric::step(acc, Ops::loadPartial(x + j, d - j), Ops::loadPartial(y + j, d - j));
+    return Metric::reduce(acc);
+}
+
+/*
+ * One-to-many kernel: distances from query x to n contiguous rows of d floats.  Four rows
+ * are processed per pass so each query register load is shared by four accumulators,
+ * which is what makes scanning a VP-tree leaf bucket cheaper than n independent calls.
+ * Results match pairDistance bit for bit.  Bounded variants give up on a group of four
+ * rows once all of them exceed bound.
+ */
+template <typename Metric, bool bounded>
+PYNEAR_KERNEL void blockDistance(const float *x, size_t d, const float *block, size_t n, float *out, float bound) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *rows[4] = {block + i * d, block + (i + 1) * d, block + (i + 2) * d, block + (i + 3) * d};
+        Ops::reg acc[4] = {Ops::zero(), Ops::zero(), Ops::zero(), Ops::zero()};
+
+        bool abandoned = false;
+        size_t step = 0;
+        size_t j = 0;
+        for (; j + Ops::W <= d; j += Ops::W) {
+            const Ops::reg q = Ops::load(x + j);
+            for (int r = 0; r < 4; r++)
+                acc[r] = Metric::step(acc[r], q, Ops::load(rows[r] + j));
+
+            if constexpr (bounded) {
+                if (++step == ABANDON_CHECK_STEPS) {
+                    step = 0;
+                    float partial[4];
+                    for (int r = 0; r < 4; r++)
+                        partial[r] = Metric::reduce(acc[r]);
+                    if (partial[0] > bound && partial[1] > bound && partial[2] > bound && partial[3] > bound) {
+                        std::copy(partial, partial + 4, out + i);
+                        abandoned = true;
+                        break;
+                    }
+                }
+            }
+        }
+        if (abandoned) continue;
+
+        if (j < d) {
+            const Ops::reg q = Ops::loadPartial(x + j, d - j);
+            for (int r = 0; r < 4; r++)
+                acc[r] = Metric::step(acc[r], q, Ops::loadPartial(rows[r] + j, d - j));
+        }
+        for (int r = 0; r < 4; r++)
+            out[i + r] = Metric::reduce(acc[r]);
+    }
+
+    for (; i < n; i++)
+        out[i] = pairDistance<Metric, bounded>(x, block + i * d, d, bound);
+}
+
+// Accumulators of one crossDistance pass, a query pair (a, b) against four rows; named rather
+// than indexed so they stay in registers without relying on loop unrolling
+struct CrossAcc {
+    Ops::reg a0, a1, a2, a3, b0, b1, b2, b3;
+};
+
+template <typename Metric>
+PYNEAR_KERNEL void crossStep(CrossAcc &acc, Ops::reg qa, Ops::reg qb, Ops::reg r0, Ops::reg r1, Ops::reg r2,
+                             Ops::reg r3) {
+    acc.a0 = Metric::step(acc.a0, qa, r0);
+    acc.b0 = Metric::step(acc.b0, qb, r0);
+    acc.a1 = Metric::step(acc.a1, qa, r1);
+    acc.b1 = Metric::step(acc.b1, qb, r1);
+    acc.a2 = Metric::step(acc.a2, qa, r2);
+    acc.b2 = Metric::step(acc.b2, qb, r2);
+    acc.a3 = Metric::step(acc.a3, qa, r3);
+    acc.b3 = Metric::step(acc.b3, qb, r3);
+}
+
+/*
+ * Many-to-many kernel: values of Metric from m contiguous queries to n contiguous rows, written
+ * row-major (m x n).  Rows are taken four at a time and every query pair passes over them while
+ * they sit in L1, each row load feeding two accumulators, so a block scanned by several queries
+ * is read from memory once rather than once per query.  Results match pairDistance bit for bit.
+ */
+template <typename Metric>
+PYNEAR_KERNEL void crossDistance(const float *x, size_t m, size_t d, const float *block, size_t n, float *out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *r0 = block + i * d;
+        const float *r1 = r0 + d;
+        const float *r2 = r1 + d;
+        const float *r3 = r2 + d;
+        size_t q = 0;
+        for (; q + 2 <= m; q += 2) {
+            const float *xa = x + q * d;
+            const float *xb = xa + d;
+            const Ops::reg zero = Ops::zero();
+            CrossAcc acc{zero, zero, zero, zero, zero, zero, zero, zero};
+
+            size_t j = 0;
+            for (; j + Ops::W <= d; j += Ops::W)
+                crossStep<Metric>(acc, Ops::load(xa + j), Ops::load(xb + j), Ops::load(r0 + j), Ops::load(r1 + j),
+                                  Ops::load(r2 + j), Ops::load(r3 + j));
+            if (j < d) {
+                const size_t tail = d - j;
+                crossStep<Metric>(acc, Ops::loadPartial(xa + j, tail), Ops::loadPartial(xb + j, tail),
+                                  Ops::loadPartial(r0 + j, tail), Ops::loadPartial(r1 + j, tail),
+                                  Ops::loadPartial(r2 + j, tail), Ops::loadPartial(r3 + j, tail));
+            }
+
+            float *outa = out + q * n + i;
+            float *outb = outa + n;
+            outa[0] = Metric::reduce(acc.a0);
+            outa[1] = Metric::reduce(acc.a1);
+            outa[2] = Metric::reduce(acc.a2);
+            outa[3] = Metric::reduce(acc.a3);
+            outb[0] = Metric::reduce(acc.b0);
+            outb[1] = Metric::reduce(acc.b1);
+            outb[2] = Metric::reduce(acc.b2);
+            outb[3] = Metric::reduce(acc.b3);
+        }
+        if (q < m) blockDistance<Metric, false>(x + q * d, d, r0, 4, out + q * n + i, 0.f);
+    }
+
+    for (; i < n; i++)
+        for (size_t q = 0; q < m; q++)
+            out[q * n + i] = pairDistance<Metric, false>(x + q * d, block + i * d, d, 0.f);
+}
+
+PYNEAR_KERNEL float l2sq(const float *x, const float *y, size_t d) { return pairDistance<L2Sq, false>(x, y, d, 0.f); }
+PYNEAR_KERNEL float l1(const float *x, const float *y, size_t d) { return pairDistance<L1, false>(x, y, d, 0.f); }
+PYNEAR_KERNEL float chebyshev(const float *x, const float *y, size_t d) {
+    return pairDistance<Chebyshev, false>(x, y, d, 0.f);
+}
+
+PYNEAR_KERNEL float l2sqBounded(const float *x, const float *y, size_t d, float bound) {
+    return pairDistance<L2Sq, true>(x, y, d, bound);
+}
+PYNEAR_KERNEL float l1Bounded(const float *x, const float *y, size_t d, float bound) {
+    return pairDistance<L1, true>(x, y, d, bound);
+}
+PYNEAR_KERNEL float chebyshevBounded(const float *x, const float *y, size_t d, float bound) {
+    return pairDistance<Chebyshev, true>(x, y, d, bound);
+}
+
+PYNEAR_KERNEL void l2sqBlock(const float *x, size_t d, const float *block, size_t n, float *out, float bound) {
+    blockDistance<L2Sq, false>(x, d, block, n, out, bound);
+}
+PYNEAR_KERNEL void l1Block(const float *x, size_t d, const float *block, size_t n, float *out, float bound) {
+    blockDistance<L1, false>(x, d, block, n, out, bound);
+}
+PYNEAR_KERNEL void chebyshevBlock(const float *x, size_t d, const float *block, size_t n, float *out, float bound) {
+    blockDistance<Chebyshev, false>(x, d, block, n, out, bound);
+}
+
+PYNEAR_KERNEL void dotCross(const float *x, size_t m, size_t d, const float *block, size_t n, float *out) {
+    crossDistance<Dot>(x, m, d, block, n, out);
+}
+
+PYNEAR_KERNEL void l2sqBlockBounded(const float *x, size_t d, const float *block, size_t n, float *out, float bound) {
+    blockDistance<L2Sq, true>(x, d, block, n, out, bound);
+}
+PYNEAR_KERNEL void l1BlockBounded(const float *x, size_t d, const float *block, size_t n, float *out, float bound) {
+    blockDistance<L1, true>(x, d, block, n, out, bound);
+}
+PYNEAR_KERNEL void chebyshevBlockBounded(const float *x, size_t d, const float *block, size_t n, float *out,
+                                         float bound) {
+    blockDistance<Chebyshev, true>(x, d, block, n, out, bound);
+}
+
+/* Hamming distance over any number of bytes: 64-bit words, then the remaining bytes */
+PYNEAR_KERNEL int64_t hamming(const uint8_t *a, const uint8_t *b, size_t bytes) {
+    int64_t h = 0;
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        h += Ops::popcount(x ^ y);
+    }
+    for (; i < bytes; i++)
+        h += Ops::popcount((uint64_t)(a[i] ^ b[i]));
+    return h;
+}
+
+// Fixed-size versions the compiler fully unrolls, for the binary indexes of 64 to 512 bits
+template <size_t bits> PYNEAR_KERNEL int64_t hammingFixed(const uint8_t *a, const uint8_t *b) {
+    return hamming(a, b, bits / 8);
+}
@@ -0,0 +1,245 @@
+#pragma once
+/*
+ * IVFFlatL2Index — Inverted File Index for float32 vectors under L2.
+ *
+ * Build
+ * ─────
+ *   1. kmeans_l2 (K-Means++ init, Lloyd iterations) over the database.
+ *   2. Copy every cluster into one contiguous row-major block, with the
+ *      squared norm of each row precomputed.  Empty clusters are dropped.
+ *
+ * Search
+ * ──────
+ *   Queries are processed in tiles of QUERY_TILE rows, one tile per thread.
+ *   1. Query-centroid distances for the whole tile come from one inner
+ *      product kernel call using ‖q−x‖² = ‖q‖² + ‖x‖² − 2 qᵀx; each query
+ *      keeps its nprobe nearest.
+ *   2. For every cluster probed by the tile, the queries that probe it are
+ *      gathered and scored against the cluster block with a second call.
+ *   3. Each query keeps its top-k in a fixed-capacity max-heap.
+ *
+ * The kernel is the runtime-dispatched dot_cross of DistanceFunctions.hpp,
+ * so a portable build scans at the CPU's widest instruction set.
+ *
+ * Distances are squared L2.
+ *
+ * Complexity
+ * ──────────
+ *   Build   kmeans_l2: O(iter × N × nlist × d)
+ *   Query   O(nlist × d + nprobe × cluster_size × d)
+ */
+
+#include <DistanceFunctions.hpp>
+#include <KMeans.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+class IVFFlatL2Index {
+public:
+    static constexpr size_t QUERY_TILE = 64;
+
+    /*
+     * nlist    – number of clusters (Voronoi cells); capped at the database size
+     * nprobe   – clusters scanned per query (accuracy ↑ as nprobe ↑)
+     * max_iter – maximum k-means iterations
+     * seed     – RNG seed for k-means++ initialisation
+     */
+    explicit IVFFlatL2Index(int32_t nlist    = 100,
+                            int32_t nprobe   = 10,
+                            int32_t max_iter = 100,
+                            uint32_t seed    = 42)
+        : _nlist(nlist), _nprobe(nprobe), _max_iter(max_iter), _seed(seed) {}
+
+    /* Index n row-major vectors of dimension d (replaces any existing content). */
+    void set(const float* data, size_t n, size_t d) {
+        _dim = d;
+        _centroids.clear();
+        _blocks.clear();
+        _norms.clear();
+        _offsets.assign(1, 0);
+        _ids.clear();
+        if (n == 0 || d == 0) return;
+
+        size_t k = std::min((size_t)std::max(_nlist, 1), n);
+        KMeansResult km = kmeans_l2(data, n, d, k, (size_t)_max_iter, _seed);
+
+        std::vector<int64_t> counts(k, 0);
+        for (int32_t label : km.labels) ++counts[label];
+
+        // Remap non-empty clusters to consecutive ids
+        std::vector<int32_t> remap(k, -1);
+        for (size_t c = 0; c < k; ++c) {
+            if (counts[c] == 0) continue;
+            remap[c] = (int32_t)(_offsets.size() - 1);
+            _centroids.insert(_centroids.end(), km.centroids.begin() + c * d,
+                              km.centroids.begin() + (c + 1) * d);
+            _offsets.push_back(_offsets.back() + counts[c]);
+        }
+
+        std::vector<int64_t> fill(_offsets.begin(), _offsets.end() - 1);
+        _blocks.resize(n * d);
+        _norms.resize(n);
+        _ids.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            int64_t pos = fill[remap[km.labels[i]]]++;
+            std::memcpy(_blocks.data() + pos * d, data + i * d, d * sizeof(float));
+            _ids[pos] = (int64_t)i;
+        }
+
+        _computeNorms();
+    }
+
+    /*
+     * Batch top-k search into row-major (nq x k) buffers, nearest first.
+     * Missing slots get index -1 and distance +inf.
+     */
+    void searchKNN(const float* queries, size_t nq, size_t k, int64_t* indices,
+                   float* distances) const {
+        if (k == 0) return;
+        const size_t ntiles = (nq + QUERY_TILE - 1) / QUERY_TILE;
+
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int64_t t = 0; t < (int64_t)ntiles; ++t) {
+            size_t q0 = (size_t)t * QUERY_TILE;
+            size_t m  = std::min(QUERY_TILE, nq - q0);
+            _searchTile(queries + q0 * _dim, m, k, indices + q0 * k, distances + q0 * k);
+        }
+    }
+
+    int32_t nlist()      const { return _nlist; }
+    int32_t nprobe()     const { return _nprobe; }
+    void set_nprobe(int32_t nprobe) { _nprobe = nprobe; }
+    size_t  dim()        const { return _dim; }
+    size_t  size()       const { return _ids.size(); }
+    bool    empty()      const { return _ids.empty(); }
+    // clusters actually built: at most nlist, fewer when some came out empty
+    size_t  n_clusters() const { return _offsets.size() - 1; }
+
+    // ── State access for serialization ───────────────────────────────────────
+    const std::vector<float>&   centroids() const { return _centroids; }
+    const std::vector<float>&   blocks()    const { return _blocks; }
+    const std::vector<int64_t>& offsets()   const { return _offsets; }
+    const std::vector<int64_t>& ids()       const { return _ids; }
+
+    void initFromSerialized(size_t dim, std::vector<float> centroids, std::vector<float> blocks,
+                            std::vector<int64_t> offsets, std::vector<int64_t> ids) {
+        if (offsets.empty() || (size_t)offsets.back() != ids.size() || blocks.size() != ids.size() * dim ||
+            centroids.size() != (offsets.size() - 1) * dim)
+            throw std::invalid_argument("invalid IVFFlatL2Index state");
+        _dim       = dim;
+        _centroids = std::move(centroids);
+        _blocks    = std::move(blocks);
+        _offsets   = std::move(offsets);
+        _ids       = std::move(ids);
+        _computeNorms();
+    }
+
+private:
+    using Candidate = std::pair<float, int64_t>; // (distance, original_idx)
+
+    int32_t  _nlist, _nprobe, _max_iter;
+    uint32_t _seed;
+    size_t   _dim = 0;
+
+    std::vector<float>   _centroids;         // (n_clusters, dim)
+    std::vector<float>   _centroid_norms;    // ‖c‖² per centroid
+    std::vector<float>   _blocks;            // (N, dim), cluster-contiguous
+    std::vector<float>   _norms;             // ‖x‖² per row of _blocks
+    std::vector<int64_t> _offsets{0};        // cluster c spans rows [_offsets[c], _offsets[c + 1])
+    std::vector<int64_t> _ids;               // row of _blocks → original index
+
+    // ‖x‖² of each of n rows
+    static void _squaredNorms(const float* rows, size_t n, size_t dim, float* out) {
+        const DistanceKernels& kernels = distance_kernels();
+        for (size_t i = 0; i < n; ++i)
+            kernels.dot_cross(rows + i * dim, 1, dim, rows + i * dim, 1, out + i);
+    }
+
+    void _computeNorms() {
+        _centroid_norms.resize(n_clusters());
+        _squaredNorms(_centroids.data(), n_clusters(), _dim, _centroid_norms.data());
+        _norms.resize(_ids.size());
+        _squaredNorms(_blocks.data(), _ids.size(), _dim, _norms.data());
+    }
+
+    void _searchTile(const float* queries, size_t m, size_t k, int64_t* indices,
+                     float* distances) const {
+        const DistanceKernels& kernels = distance_kernels();
+        const size_t nc = n_clusters();
+        const size_t nprobe = std::min((size_t)std::max(_nprobe, 0), nc);
+
+        std::vector<float> qnorms(m);
+        _squaredNorms(queries, m, _dim, qnorms.data());
+
+        // ── Probe lists: nprobe nearest centroids per query ──────────────────
+        std::vector<std::vector<int32_t>> probers(nc); // cluster → tile queries probing it
+        if (nprobe > 0) {
+            std::vector<float> cross(m * nc);
+            kernels.dot_cross(queries, m, _dim, _centroids.data(), nc, cross.data());
+            std::vector<std::pair<float, int32_t>> cdists(nc);
+            for (size_t qi = 0; qi < m; ++qi) {
+                for (size_t c = 0; c < nc; ++c)
+                    cdists[c] = {_centroid_norms[c] - 2.f * cross[qi * nc + c], (int32_t)c};
+                std::partial_sort(cdists.begin(), cdists.begin() + nprobe, cdists.end());
+                for (size_t p = 0; p < nprobe; ++p)
+                    probers[cdists[p].second].push_back((int32_t)qi);
+            }
+        }
+
+        // ── Scan probed clusters, one kernel call per (cluster, query subset) ──
+        std::vector<std::vector<Candidate>> heaps(m);
+        for (auto& heap : heaps) heap.reserve(k);
+
+        std::vector<float> sub, scores;
+        for (size_t c = 0; c < nc; ++c) {
+            const std::vector<int32_t>& qs = probers[c];
+            if (qs.empty()) continue;
+
+            const int64_t begin = _offsets[c];
+            const int64_t rows  = _offsets[c + 1] - begin;
+            sub.resize(qs.size() * _dim);
+            for (size_t j = 0; j < qs.size(); ++j)
+                std::memcpy(sub.data() + j * _dim, queries + qs[j] * _dim, _dim * sizeof(float));
+            // (|qs| x rows) inner products
+            scores.resize(qs.size() * (size_t)rows);
+            kernels.dot_cross(sub.data(), qs.size(), _dim, _blocks.data() + begin * _dim, (size_t)rows,
+                              scores.data());
+
+            for (size_t j = 0; j < qs.size(); ++j) {
+                std::vector<Candidate>& heap = heaps[qs[j]];
+                const float qn = qnorms[qs[j]];
+                const float* row_scores = scores.data() + j * rows;
+                for (int64_t r = 0; r < rows; ++r) {
+                    float d = std::max(0.f, qn + _norms[begin + r] - 2.f * row_scores[r]);
+                    if (heap.size() < k) {
+                        heap.push_back({d, _ids[begin + r]});
+                        std::push_heap(heap.begin(), heap.end());
+                    } else if (d < heap.front().first) {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.back() = {d, _ids[begin + r]};
+                        std::push_heap(heap.begin(), heap.end());
+                    }
+                }
+            }
+        }
+
+        // ── Write rows nearest first, padding missing slots ──────────────────
+        for (size_t qi = 0; qi < m; ++qi) {
+            std::vector<Candidate>& heap = heaps[qi];
+            std::sort_heap(heap.begin(), heap.end());
+            int64_t* row_idx  = indices   + qi * k;
+            float*   row_dist = distances + qi * k;
+            for (size_t j = 0; j < k; ++j) {
+                row_idx[j]  = j < heap.size() ? heap[j].second : -1;
+                row_dist[j] = j < heap.size() ? heap[j].first : std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+};
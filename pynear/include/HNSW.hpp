@@ -0,0 +1,423 @@
+#pragma once
+/*
+ * HNSWIndex — Hierarchical Navigable Small World graph (Malkov & Yashunin,
+ * 2016) for approximate KNN over float32 vectors.
+ *
+ * Storage
+ * ───────
+ *   Vectors live in one contiguous row-major store.  Neighbour lists of every
+ *   node live in one int32 arena: node i owns a block at _linkOffset[i] holding
+ *   its layer 0 list ([count, 2M ids]) followed by one [count, M ids] list per
+ *   upper layer.  Blocks are allocated when a node is added and never move
+ *   while the graph is being built.
+ *
+ * Build
+ * ─────
+ *   Layers are drawn up front, then nodes are inserted in parallel.  Each node
+ *   has a mutex guarding its lists; the entry point is swapped under a global
+ *   mutex.  Neighbours are chosen with the diversity heuristic and back links
+ *   are pruned with the same heuristic once a list is full.
+ *
+ * Search
+ * ──────
+ *   Greedy descent through the upper layers, then a best-first beam of width
+ *   max(ef, k) on layer 0.  Larger ef gives higher recall at higher cost.
+ */
+
+#include <DistanceFunctions.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+template <float (*distance)(const FlatSpan &, const FlatSpan &)> class HNSWIndex {
+public:
+    /*
+     * M               – neighbours per node on upper layers (2M on layer 0)
+     * ef_construction – beam width while inserting (build quality ↑ as it grows)
+     * ef_search       – default beam width for searchKNN
+     * seed            – RNG seed for layer assignment
+     */
+    explicit HNSWIndex(int32_t M               = 16,
+                       int32_t ef_construction = 200,
+                       int32_t ef_search       = 50,
+                       uint32_t seed           = 42)
+        : _M(M), _M0(2 * M), _efConstruction(ef_construction), _efSearch(ef_search), _seed(seed),
+          _levelMult(1.0 / std::log((double)std::max(M, 2))), _rng(seed) {
+        if (M < 2) throw std::invalid_argument("M must be at least 2");
+        if (ef_construction < 1 || ef_search < 1) throw std::invalid_argument("ef must be at least 1");
+    }
+
+    /* Index n row-major vectors of dimension d (replaces any existing content). */
+    void set(const float* data, size_t n, size_t d) {
+        _vectors.clear();
+        _levels.clear();
+        _linkOffset.clear();
+        _links.clear();
+        _entry    = -1;
+        _maxLevel = -1;
+        _dim      = d;
+        _rng.seed(_seed);
+        add(data, n, d);
+    }
+
+    /* Insert n more vectors; they get ids size() .. size() + n - 1. */
+    void add(const float* data, size_t n, size_t d) {
+        if (n == 0) return;
+        if (empty()) _dim = d;
+        if (d != _dim)
+            throw std::invalid_argument("vectors have dimension " + std::to_string(d) + ", index has " +
+                                        std::to_string(_dim));
+
+        const size_t first = size();
+        _vectors.insert(_vectors.end(), data, data + n * d);
+        for (size_t i = 0; i < n; ++i) {
+            int32_t level = _drawLevel();
+            _levels.push_back(level);
+            _linkOffset.push_back(_links.size());
+            _links.resize(_links.size() + _blockSize(level), 0);
+        }
+        _locks = std::make_unique<std::mutex[]>(size());
+
+        size_t start = first;
+        if (_entry < 0) {
+            _entry    = (int32_t)first;
+            _maxLevel = _levels[first];
+            ++start;
+        }
+
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(dynamic, 64)
+#endif
+        for (int64_t i = (int64_t)start; i < (int64_t)(first + n); ++i)
+            _insert((int32_t)i);
+    }
+
+    /*
+     * Batch top-k search into row-major (nq x k) buffers, nearest first.
+     * ef <= 0 uses ef_search.  Missing slots get index -1 and distance +inf.
+     */
+    void searchKNN(const float* queries, size_t nq, size_t k, int32_t ef, int64_t* indices,
+                   float* distances) const {
+        if (k == 0) return;
+        const size_t beam = std::max((size_t)(ef > 0 ? ef : _efSearch), k);
+
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(dynamic, 4)
+#endif
+        for (int64_t qi = 0; qi < (int64_t)nq; ++qi) {
+            int64_t* row_idx  = indices   + qi * k;
+            float*   row_dist = distances + qi * k;
+            std::vector<Candidate> found;
+            if (!empty()) {
+                FlatSpan q{queries + qi * _dim, _dim};
+                int32_t ep     = _entry;
+                float   epDist = distance(q, _point(ep));
+                for (int32_t lvl = _maxLevel; lvl > 0; --lvl)
+                    _greedy<false>(q, ep, epDist, lvl);
+                found = _searchLayer<false>(q, ep, epDist, beam, 0);
+            }
+            for (size_t j = 0; j < k; ++j) {
+                row_idx[j]  = j < found.size() ? found[j].second : -1;
+                row_dist[j] = j < found.size() ? _reported(found[j].first)
+                                               : std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+
+    size_t  size()            const { return _levels.size(); }
+    bool    empty()           const { return _levels.empty(); }
+    size_t  dim()             const { return _dim; }
+    int32_t M()               const { return _M; }
+    int32_t ef_construction() const { return _efConstruction; }
+    int32_t ef_search()       const { return _efSearch; }
+    void set_ef_search(int32_t ef) {
+        if (ef < 1) throw std::invalid_argument("ef must be at least 1");
+        _efSearch = ef;
+    }
+
+    // ── State access for serialization ───────────────────────────────────────
+    const std::vector<float>&   vectors() const { return _vectors; }
+    const std::vector<int32_t>& levels()  const { return _levels; }
+    const std::vector<int32_t>& links()   const { return _links; }
+    int32_t entryPoint()                  const { return _entry; }
+
+    void initFromSerialized(size_t dim, std::vector<float> vectors, std::vector<int32_t> levels,
+                            std::vector<int32_t> links, int32_t entry) {
+        size_t n = levels.size();
+        size_t expected = 0;
+        for (int32_t level : levels) expected += _blockSize(level);
+        if (vectors.size() != n * dim || links.size() != expected || entry >= (int32_t)n || (n > 0) != (entry >= 0))
+            throw std::invalid_argument("invalid HNSW state");
+
+        _dim     = dim;
+        _vectors = std::move(vectors);
+        _levels  = std::move(levels);
+        _links   = std::move(links);
+        _linkOffset.resize(n);
+        for (size_t i = 0, offset = 0; i < n; offset += _blockSize(_levels[i]), ++i)
+            _linkOffset[i] = offset;
+        _locks = std::make_unique<std::mutex[]>(n);
+        _entry    = entry;
+        _maxLevel = n > 0 ? _levels[entry] : -1;
+    }
+
+private:
+    using Candidate = std::pair<float, int32_t>; // (distance, node)
+
+    /* Reusable visited marks: a node is visited when its tag equals the current epoch. */
+    struct VisitedList {
+        std::vector<uint32_t> tags;
+        uint32_t epoch = 0;
+
+        void reset(size_t n) {
+            if (tags.size() < n) tags.resize(n, 0);
+            if (++epoch == 0) {
+                std::fill(tags.begin(), tags.end(), 0);
+                epoch = 1;
+            }
+        }
+        bool visit(int32_t i) {
+            if (tags[i] == epoch) return false;
+            tags[i] = epoch;
+            return true;
+        }
+    };
+
+    int32_t  _M, _M0, _efConstruction, _efSearch;
+    uint32_t _seed;
+    double   _levelMult;
+    std::mt19937 _rng;
+
+    size_t _dim = 0;
+    std::vector<float>   _vectors;    // (size, dim) row-major
+    std::vector<int32_t> _levels;     // top layer of each node
+    std::vector<size_t>  _linkOffset; // start of each node's block in _links
+    std::vector<int32_t> _links;      // neighbour list arena
+    int32_t _entry    = -1;
+    int32_t _maxLevel = -1;
+
+    // Mutexes are held through pointers so the index stays movable
+    std::unique_ptr<std::mutex[]> _locks;  // one per node, guards its neighbour lists during build
+    std::unique_ptr<std::mutex> _entryLock   = std::make_unique<std::mutex>();
+    std::unique_ptr<std::mutex> _visitedLock = std::make_unique<std::mutex>();
+    mutable std::vector<std::unique_ptr<VisitedList>> _visitedPool;
+
+    FlatSpan _point(int32_t i) const { return FlatSpan{_vectors.data() + (size_t)i * _dim, _dim}; }
+
+    float _reported(float d) const {
+        if constexpr (distance_traits<distance>::squared) return std::sqrt(d);
+        return d;
+    }
+
+    size_t _blockSize(int32_t level) const { return (size_t)(_M0 + 1) + (size_t)level * (_M + 1); }
+
+    int32_t _capacity(int32_t lvl) const { return lvl == 0 ? _M0 : _M; }
+
+    // [count, ids...] list of node i on layer lvl
+    int32_t* _list(int32_t i, int32_t lvl) {
+        int32_t* base = _links.data() + _linkOffset[i];
+        return lvl == 0 ? base : base + (_M0 + 1) + (size_t)(lvl - 1) * (_M + 1);
+    }
+    const int32_t* _list(int32_t i, int32_t lvl) const {
+        return const_cast<HNSWIndex*>(this)->_list(i, lvl);
+    }
+
+    int32_t _drawLevel() {
+        std::uniform_real_distribution<double> unif(std::numeric_limits<double>::min(), 1.0);
+        return (int32_t)(-std::log(unif(_rng)) * _levelMult);
+    }
+
+    std::unique_ptr<VisitedList> _acquireVisited() const {
+        std::unique_ptr<VisitedList> v;
+        {
+            std::lock_guard<std::mutex> guard(*_visitedLock);
+            if (!_visitedPool.empty()) {
+                v = std::move(_visitedPool.back());
+                _visitedPool.pop_back();
+            }
+        }
+        if (!v) v = std::make_unique<VisitedList>();
+        v->reset(size());
+        return v;
+    }
+
+    void _releaseVisited(std::unique_ptr<VisitedList> v) const {
+        std::lock_guard<std::mutex> guard(*_visitedLock);
+        _visitedPool.push_back(std::move(v));
+    }
+
+    // Copy of node i's list on layer lvl; locked while the graph may be changing
+    template <bool locked> void _neighbours(int32_t i, int32_t lvl, std::vector<int32_t>& out) const {
+        const int32_t* list = _list(i, lvl);
+        if constexpr (locked) {
+            std::lock_guard<std::mutex> guard(_locks[i]);
+            out.assign(list + 1, list + 1 + list[0]);
+        } else {
+            out.assign(list + 1, list + 1 + list[0]);
+        }
+    }
+
+    template <bool locked> void _greedy(const FlatSpan& q, int32_t& ep, float& epDist, int32_t lvl) const {
+        std::vector<int32_t> nbs;
+        for (bool changed = true; changed;) {
+            changed = false;
+            _neighbours<locked>(ep, lvl, nbs);
+            for (int32_t nb : nbs) {
+                float d = distance(q, _point(nb));
+                if (d < epDist) {
+                    ep      = nb;
+                    epDist  = d;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Best-first beam search of width ef on layer lvl; returns candidates nearest first
+    template <bool locked>
+    std::vector<Candidate> _searchLayer(const FlatSpan& q, int32_t ep, float epDist, size_t ef,
+                                        int32_t lvl) const {
+        std::unique_ptr<VisitedList> visited = _acquireVisited();
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+        std::priority_queue<Candidate> best;
+
+        visited->visit(ep);
+        frontier.push({epDist, ep});
+        best.push({epDist, ep});
+
+        std::vector<int32_t> nbs;
+        while (!frontier.empty()) {
+            Candidate cur = frontier.top();
+            if (cur.first > best.top().first && best.size() >= ef) break;
+            frontier.pop();
+
+            _neighbours<locked>(cur.second, lvl, nbs);
+            for (int32_t nb : nbs) {
+                if (!visited->visit(nb)) continue;
+                float d = distance(q, _point(nb));
+                if (best.size() < ef || d < best.top().first) {
+                    frontier.push({d, nb});
+                    best.push({d, nb});
+                    if (best.size() > ef) best.pop();
+                }
+            }
+        }
+        _releaseVisited(std::move(visited));
+
+        std::vector<Candidate> result(best.size());
+        for (size_t j = result.size(); j-- > 0; best.pop())
+            result[j] = best.top();
+        return result;
+    }
+
+    /*
+     * Diversity heuristic: walking candidates nearest first, keep one only if it is
+     * closer to the base point than to every neighbour already kept.
+     */
+    void _selectNeighbours(std::vector<Candidate>& candidates, size_t m) const {
+        if (candidates.size() <= m) return;
+        std::vector<Candidate> kept;
+        kept.reserve(m);
+        for (const Candidate& c : candidates) {
+            if (kept.size() >= m) break;
+            bool diverse = true;
+            for (const Candidate& s : kept) {
+                if (distance(_point(c.second), _point(s.second)) < c.first) {
+                    diverse = false;
+                    break;
+                }
+            }
+            if (diverse) kept.push_back(c);
+        }
+        candidates.swap(kept);
+    }
+
+    // Add a link nb -> i on layer lvl, pruning nb's list when it is full
+    void _connect(int32_t nb, int32_t i, float dist, int32_t lvl) {
+        std::lock_guard<std::mutex> guard(_locks[nb]);
+        int32_t* list = _list(nb, lvl);
+        const int32_t cap = _capacity(lvl);
+        if (list[0] < cap) {
+            list[1 + list[0]++] = i;
+            return;
+        }
+
+        std::vector<Candidate> candidates;
+        candidates.reserve(cap + 1);
+        candidates.push_back({dist, i});
+        for (int32_t j = 0; j < list[0]; ++j)
+            candidates.push_back({distance(_point(nb), _point(list[1 + j])), list[1 + j]});
+        std::sort(candidates.begin(), candidates.end());
+        _selectNeighbours(candidates, (size_t)cap);
+
+        list[0] = (int32_t)candidates.size();
+        for (size_t j = 0; j < candidates.size(); ++j)
+            list[1 + j] = candidates[j].second;
+    }
+
+    /*
+     * Write the neighbours chosen for node i on layer lvl.  Concurrent inserts may already
+     * have linked to i there (it was reachable as an entry point from the layer above), so
+     * those links are merged in rather than overwritten.
+     */
+    void _setList(int32_t i, int32_t lvl, const std::vector<Candidate>& chosen) {
+        std::lock_guard<std::mutex> guard(_locks[i]);
+        int32_t* list = _list(i, lvl);
+        std::vector<Candidate> merged(chosen);
+        for (int32_t j = 0; j < list[0]; ++j) {
+            int32_t nb = list[1 + j];
+            bool known = std::any_of(chosen.begin(), chosen.end(), [nb](const Candidate& c) { return c.second == nb; });
+            if (!known) merged.push_back({distance(_point(i), _point(nb)), nb});
+        }
+        if (merged.size() > (size_t)_capacity(lvl)) {
+            std::sort(merged.begin(), merged.end());
+            _selectNeighbours(merged, (size_t)_capacity(lvl));
+        }
+        list[0] = (int32_t)merged.size();
+        for (size_t j = 0; j < merged.size(); ++j)
+            list[1 + j] = merged[j].second;
+    }
+
+    void _insert(int32_t i) {
+        const int32_t level = _levels[i];
+        std::unique_lock<std::mutex> entryGuard(*_entryLock);
+        int32_t ep       = _entry;
+        int32_t maxLevel = _maxLevel;
+        // a node that becomes the new top keeps the entry lock until it is linked
+        if (level <= maxLevel) entryGuard.unlock();
+
+        const FlatSpan q = _point(i);
+        float epDist = distance(q, _point(ep));
+        for (int32_t lvl = maxLevel; lvl > level; --lvl)
+            _greedy<true>(q, ep, epDist, lvl);
+
+        for (int32_t lvl = std::min(level, maxLevel); lvl >= 0; --lvl) {
+            std::vector<Candidate> candidates = _searchLayer<true>(q, ep, epDist, (size_t)_efConstruction, lvl);
+            ep     = candidates.front().second;
+            epDist = candidates.front().first;
+
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                            [i](const Candidate& c) { return c.second == i; }),
+                             candidates.end());
+            _selectNeighbours(candidates, (size_t)_M);
+
+            _setList(i, lvl, candidates);
+            for (const Candidate& c : candidates)
+                _connect(c.second, i, c.first, lvl);
+        }
+
+        if (level > maxLevel) {
+            _entry    = i;
+            _maxLevel = level;
+        }
+    }
+};
@@ -6,7 +6,7 @@
  * Assignment step is parallelised with OpenMP; update step is serial
  * (O(N·D) memory-bound, negligible vs. assignment at typical k values).
  *
- * Distance is Euclidean (L2), computed via SIMD dist_l2_f_avx2.
+ * Distance is Euclidean (L2), compared squared via SIMD dist_l2sq_f_avx2.
  */
 
 #include <algorithm>
@@ -50,8 +50,7 @@ inline KMeansResult kmeans_l2(
         for (int64_t i = 0; i < (int64_t)n; ++i) {
             FlatSpan a{data + i * d, d};
             FlatSpan b{prev, d};
-            float v = dist_l2_f_avx2(a, b);
-            v = v * v;  // squared distance for weighted selection
+            float v = dist_l2sq_f_avx2(a, b);  // squared distance for weighted selection
             if (v < min_sq[i]) min_sq[i] = v;
         }
 
@@ -85,7 +84,7 @@ inline KMeansResult kmeans_l2(
             int32_t  best_c    = 0;
             for (size_t c = 0; c < k; ++c) {
                 FlatSpan cj{centroids.data() + c * d, d};
-                float dist = dist_l2_f_avx2(xi, cj);
+                float dist = dist_l2sq_f_avx2(xi, cj);  // argmin is the same without the sqrt
                 if (dist < best_dist) { best_dist = dist; best_c = (int32_t)c; }
             }
             if (labels[i] != best_c) {
@@ -0,0 +1,255 @@
+#pragma once
+/*
+ * KNNGraphBuilder — approximate k-nearest-neighbour graph of a float32
+ * dataset by NN-descent (Dong, Charikar & Li, 2011).
+ *
+ * Seeding
+ * ───────
+ *   A VPTree is built over the data and every point runs a budgeted KNN
+ *   search (seed_visits tree nodes).  Best-first order makes these cheap
+ *   searches land close to the true neighbours; slots they leave empty are
+ *   filled with random points.
+ *
+ * Refinement
+ * ──────────
+ *   Each iteration samples up to max_candidates neighbours per point that
+ *   joined its list since they were last sampled ("new") and as many older
+ *   ones, counting reverse edges, and runs a local join: every pair of new
+ *   candidates, and every new/old pair, is measured and offered to both
+ *   lists.  Points are joined in parallel; lists are guarded by striped
+ *   locks and a racy read of each list's worst distance skips most offers
+ *   without locking.  Iterations stop once fewer than delta × n × k list
+ *   entries changed.
+ *
+ * Distances are computed with the same kernels as the VPTree indices and
+ * reported the same way (plain L2 for squared L2).
+ */
+
+#include <DistanceFunctions.hpp>
+#include <VPTree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+template <float (*distance)(const FlatSpan &, const FlatSpan &)> class KNNGraphBuilder {
+public:
+    /*
+     * k              – neighbours per point
+     * iterations     – maximum number of NN-descent rounds
+     * max_candidates – new (and old) join candidates per point and round, 0 for 2k (quality ↑, time ↑)
+     * delta          – stop once a round changes fewer than delta × n × k entries
+     * seed_visits    – tree nodes each seeding search may visit (0 seeds at random)
+     * seed           – RNG seed for sampling and random fill
+     */
+    explicit KNNGraphBuilder(size_t k, int32_t iterations = 10, size_t max_candidates = 0, float delta = 0.001f,
+                             int64_t seed_visits = 32, uint32_t seed = 42)
+        : _k(k), _iterations(iterations), _maxCandidates(max_candidates > 0 ? max_candidates : 2 * k),
+          _delta(delta), _seedVisits(seed_visits), _seed(seed) {
+        if (k < 1) throw std::invalid_argument("k must be at least 1");
+        if (iterations < 0) throw std::invalid_argument("iterations must be non-negative");
+        if (delta < 0.0f) throw std::invalid_argument("delta must be non-negative");
+    }
+
+    /*
+     * Graph of the n row-major vectors of dimension d, written to (n x k) buffers: row i holds
+     * the neighbours of point i (never i itself), nearest first.  With n <= k rows are padded
+     * with index -1 and distance +inf.  Returns the number of refinement rounds run.
+     */
+    int32_t build(const float *data, size_t n, size_t d, int64_t *indices, float *distances) {
+        _data = data;
+        _dim = d;
+        _n = n;
+        _width = std::min(_k, n > 0 ? n - 1 : 0);
+        _lists.assign(n * _width, Neighbor());
+        _worst = std::make_unique<std::atomic<float>[]>(n);
+
+        _seedGraph();
+
+        int32_t rounds = 0;
+        const size_t stop = (size_t)(_delta * (double)n * (double)_width);
+        while (rounds < _iterations && _width > 0) {
+            ++rounds;
+            if (_refine(rounds) <= stop) break;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < _k; ++j) {
+                const bool found = j < _width;
+                indices[i * _k + j] = found ? _list(i)[j].id : -1;
+                distances[i * _k + j] =
+                    found ? _reported(_list(i)[j].dist) : std::numeric_limits<float>::infinity();
+            }
+        }
+        _lists.clear();
+        _lists.shrink_to_fit();
+        return rounds;
+    }
+
+private:
+    // list entry; lists are kept sorted by distance and free of duplicates
+    struct Neighbor {
+        float dist = std::numeric_limits<float>::max();
+        int32_t id = -1;
+        bool isNew = true;
+    };
+
+    // join candidates of one point: up to capacity ids with the random priority that kept them
+    struct CandidateSet {
+        std::vector<std::pair<uint32_t, int32_t>> entries;
+
+        void offer(int32_t id, uint32_t priority, size_t capacity) {
+            for (const auto &entry : entries)
+                if (entry.second == id) return;
+            if (entries.size() < capacity) {
+                entries.push_back({priority, id});
+                return;
+            }
+            auto worst = std::max_element(entries.begin(), entries.end());
+            if (priority < worst->first) *worst = {priority, id};
+        }
+    };
+
+    static constexpr size_t LOCK_STRIPES = 1 << 12;
+
+    size_t _k;
+    int32_t _iterations;
+    size_t _maxCandidates;
+    float _delta;
+    int64_t _seedVisits;
+    uint32_t _seed;
+
+    const float *_data = nullptr;
+    size_t _dim = 0;
+    size_t _n = 0;
+    size_t _width = 0; // entries per list: k, or n - 1 for tiny datasets
+    std::vector<Neighbor> _lists;
+    std::unique_ptr<std::atomic<float>[]> _worst; // distance of the last entry of each list
+    std::mutex _locks[LOCK_STRIPES];
+
+    FlatSpan _point(size_t i) const { return FlatSpan{_data + i * _dim, _dim}; }
+    Neighbor *_list(size_t i) { return _lists.data() + i * _width; }
+    std::mutex &_lock(size_t i) { return _locks[i % LOCK_STRIPES]; }
+
+    static float _reported(float dist) {
+        if constexpr (distance_traits<distance>::squared) return std::sqrt(dist);
+        return dist;
+    }
+
+    void _seedGraph() {
+        std::vector<int64_t> seedIds(_n * (_width + 1), -1);
+        if (_seedVisits > 0 && _width > 0) {
+            vptree::VPTree<FlatSpan, float, distance> tree;
+            tree.setRows(_data, _n, _dim);
+            // query views only; the tree keeps its own copy of the rows
+            std::vector<FlatSpan> points(_n);
+            for (size_t i = 0; i < _n; ++i) points[i] = _point(i);
+            std::vector<float> seedDistances(seedIds.size());
+            vptree::SearchBudget budget;
+            budget.maxVisits = _seedVisits;
+            tree.searchKNN(points, _width + 1, seedIds.data(), seedDistances.data(), 0, budget);
+        }
+
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(dynamic, 256)
+#endif
+        for (int64_t i = 0; i < (int64_t)_n; ++i) {
+            std::minstd_rand rng(_seed ^ (uint32_t)(i * 2654435761u));
+            std::uniform_int_distribution<int32_t> pick(0, (int32_t)_n - 1);
+            Neighbor *list = _list(i);
+            size_t count = 0;
+            auto push = [&](int32_t id) {
+                if (id < 0 || id == (int32_t)i) return;
+                for (size_t j = 0; j < count; ++j)
+                    if (list[j].id == id) return;
+                list[count++] = Neighbor{distance(_point(i), _point(id)), id, true};
+            };
+            for (size_t j = 0; j <= _width && count < _width; ++j) push((int32_t)seedIds[i * (_width + 1) + j]);
+            while (count < _width) push(pick(rng));
+            std::sort(list, list + _width, [](const Neighbor &a, const Neighbor &b) { return a.dist < b.dist; });
+            _worst[i].store(_width > 0 ? list[_width - 1].dist : 0.0f, std::memory_order_relaxed);
+        }
+    }
+
+    // One NN-descent round; returns the number of list entries replaced
+    size_t _refine(int32_t round) {
+        std::vector<CandidateSet> newCandidates(_n), oldCandidates(_n);
+
+        // forward and reverse candidates, each kept by random priority
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(dynamic, 256)
+#endif
+        for (int64_t i = 0; i < (int64_t)_n; ++i) {
+            std::minstd_rand rng(_seed ^ (uint32_t)(i * 2654435761u) ^ ((uint32_t)round << 24));
+            const Neighbor *list = _list(i);
+            for (size_t j = 0; j < _width; ++j) {
+                const int32_t other = list[j].id;
+                const uint32_t priority = rng();
+                std::vector<CandidateSet> &target = list[j].isNew ? newCandidates : oldCandidates;
+                {
+                    std::lock_guard<std::mutex> lock(_lock(i));
+                    target[i].offer(other, priority, _maxCandidates);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(_lock(other));
+                    target[other].offer((int32_t)i, priority, _maxCandidates);
+                }
+            }
+        }
+
+        // neighbours sampled as new are old from now on
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(static)
+#endif
+        for (int64_t i = 0; i < (int64_t)_n; ++i) {
+            Neighbor *list = _list(i);
+            for (const auto &entry : newCandidates[i].entries)
+                for (size_t j = 0; j < _width; ++j)
+                    if (list[j].id == entry.second) list[j].isNew = false;
+        }
+
+        size_t updates = 0;
+#ifdef ENABLE_OMP_PARALLEL
+        #pragma omp parallel for schedule(dynamic, 64) reduction(+ : updates)
+#endif
+        for (int64_t i = 0; i < (int64_t)_n; ++i) {
+            const auto &fresh = newCandidates[i].entries;
+            const auto &old = oldCandidates[i].entries;
+            for (size_t a = 0; a < fresh.size(); ++a) {
+                const int32_t u = fresh[a].second;
+                for (size_t b = a + 1; b < fresh.size(); ++b) updates += _join(u, fresh[b].second);
+                for (const auto &entry : old) updates += _join(u, entry.second);
+            }
+        }
+        return updates;
+    }
+
+    // Measures u against v and offers each to the other's list
+    size_t _join(int32_t u, int32_t v) {
+        if (u == v) return 0;
+        const float dist = distance(_point(u), _point(v));
+        return _offer(u, v, dist) + _offer(v, u, dist);
+    }
+
+    size_t _offer(int32_t owner, int32_t id, float dist) {
+        if (dist >= _worst[owner].load(std::memory_order_relaxed)) return 0;
+        std::lock_guard<std::mutex> lock(_lock(owner));
+        Neighbor *list = _list(owner);
+        if (dist >= list[_width - 1].dist) return 0;
+        for (size_t j = 0; j < _width; ++j)
+            if (list[j].id == id) return 0;
+
+        size_t pos = _width - 1;
+        for (; pos > 0 && list[pos - 1].dist > dist; --pos) list[pos] = list[pos - 1];
+        list[pos] = Neighbor{dist, id, true};
+        _worst[owner].store(list[_width - 1].dist, std::memory_order_relaxed);
+        return 1;
+    }
+};
@@ -38,6 +38,7 @@
  */
 
 #include <DistanceFunctions.hpp>
+#include <SearchFilter.hpp>
 #include <algorithm>
 #include <cstring>
 #include <limits>
@@ -56,13 +57,17 @@ public:
      */
     explicit MIHBinaryIndex(int32_t m = 8) : _m(m) {}
 
-    /* Add vectors to the index (replaces any existing content). */
-    void set(const ndarrayli& data) {
+    /*
+     * Add n row-major codes of nbytes bytes each (replaces any existing
+     * content).  The codes are copied into one contiguous buffer.
+     */
+    void set(const uint8_t* data, size_t n, size_t nbytes) {
         _db.clear();
         _tables.clear();
-        if (data.empty()) return;
+        _n = _nbytes = 0;
+        if (n == 0) return;
 
-        _nbytes = data[0].size();
+        _nbytes = nbytes;
         if ((int32_t)_nbytes < _m || _nbytes % (size_t)_m != 0)
             throw std::invalid_argument(
                 "MIH: descriptor byte width must be divisible by m");
@@ -72,14 +77,14 @@ public:
                 "MIH: sub-string width exceeds 8 bytes (uint64_t key capacity). "
                 "Increase m so that nbytes/m ≤ 8.");
         _sub_nbits = _sub_nbytes * 8;
-        _n = data.size();
+        _n = n;
 
-        _db = data;
+        _db.assign(data, data + _n * _nbytes);
         _tables.assign((size_t)_m, {});
 
         for (size_t i = 0; i < _n; ++i)
             for (int32_t t = 0; t < _m; ++t)
-                _tables[(size_t)t][_extract_key(data[i], t)].push_back((int32_t)i);
+                _tables[(size_t)t][_extract_key(_code(i), t)].push_back((int32_t)i);
     }
 
     /*
@@ -90,24 +95,28 @@ public:
      *          probability 1 (exact guarantee via pigeonhole).
      *          Larger radius → higher recall, more candidates, slower.
      *
-     * Returns (indices, distances).  Distances are Hamming (integer).
-     * May return fewer than k results when fewer candidates pass the radius.
+     * Searches nq row-major queries of nbytes() bytes and writes row-major
+     * (nq x k) indices and Hamming distances, nearest first.  When fewer than k candidates pass the radius the row is
+     * padded with index -1 and distance INT64_MAX.
+     *
+     * filter – allow-list; rejected candidates are dropped before verification.
      */
-    std::tuple<std::vector<std::vector<int64_t>>,
-               std::vector<std::vector<int64_t>>>
-    searchKNN(const ndarrayli& queries, size_t k, int32_t radius = 8) const {
-        size_t nq = queries.size();
-        std::vector<std::vector<int64_t>> all_idx(nq), all_dist(nq);
-
+    void searchKNN(const uint8_t* queries, size_t nq, size_t k, int64_t* indices,
+                   int64_t* distances, int32_t radius = 8,
+                   const SearchFilter& filter = SearchFilter()) const {
+        const DistanceKernels& kernels = distance_kernels();
         int32_t r_sub = radius / _m; // pigeonhole radius per sub-table
 
         for (size_t qi = 0; qi < nq; ++qi) {
+            const uint8_t* query = queries + qi * _nbytes;
+
             // ── Collect candidates from all sub-tables ───────────────────────
             std::unordered_set<int32_t> candidates;
+            const SearchFilter allowed = filter.row(qi);
 
             std::vector<uint64_t> neighbor_keys;
-            for (int32_t t = 0; t < _m; ++t) {
-                uint64_t qkey = _extract_key(queries[qi], t);
+            for (int32_t t = 0; t < (int32_t)_tables.size(); ++t) {
+                uint64_t qkey = _extract_key(query, t);
                 neighbor_keys.clear();
                 _enumerate_neighbors(qkey, (int)_sub_nbits, r_sub,
                                      neighbor_keys, 0);
@@ -117,7 +126,7 @@ public:
                     auto it = table.find(nk);
                     if (it != table.end())
                         for (int32_t idx : it->second)
-                            candidates.insert(idx);
+                            if (allowed.allows(idx)) candidates.insert(idx);
                 }
             }
 
@@ -126,7 +135,7 @@ public:
             std::priority_queue<Elem> heap;
 
             for (int32_t idx : candidates) {
-                int64_t d = dist_hamming(queries[qi], _db[(size_t)idx]);
+                int64_t d = kernels.hamming(query, _code((size_t)idx), _nbytes);
                 if ((int64_t)heap.size() < (int64_t)k ||
                     d < heap.top().first) {
                     heap.push({d, (int64_t)idx});
@@ -134,21 +143,19 @@ public:
                 }
             }
 
-            // ── Extract results in ascending distance order ──────────────────
-            std::vector<int64_t> idxs, dists;
-            idxs.reserve(heap.size());
-            dists.reserve(heap.size());
-            while (!heap.empty()) {
-                idxs.push_back(heap.top().second);
-                dists.push_back(heap.top().first);
+            // ── Write the row nearest first, padding missing slots ───────────
+            int64_t* row_idx  = indices   + qi * k;
+            int64_t* row_dist = distances + qi * k;
+            for (size_t j = heap.size(); j < k; ++j) {
+                row_idx[j]  = -1;
+                row_dist[j] = std::numeric_limits<int64_t>::max();
+            }
+            for (size_t j = heap.size(); j-- > 0;) {
+                row_idx[j]  = heap.top().second;
+                row_dist[j] = heap.top().first;
                 heap.pop();
             }
-            std::reverse(idxs.begin(), idxs.end());
-            std::reverse(dists.begin(), dists.end());
-            all_idx[qi]  = std::move(idxs);
-            all_dist[qi] = std::move(dists);
         }
-        return {std::move(all_idx), std::move(all_dist)};
     }
 
     int32_t m()     const { return _m; }
@@ -158,13 +165,15 @@ public:
 private:
     int32_t _m;
     size_t  _nbytes = 0, _sub_nbytes = 0, _sub_nbits = 0, _n = 0;
-    ndarrayli _db;
+    std::vector<uint8_t> _db; // row-major, _nbytes bytes per code
     std::vector<std::unordered_map<uint64_t, std::vector<int32_t>>> _tables;
 
+    const uint8_t* _code(size_t i) const { return _db.data() + i * _nbytes; }
+
     // Extract the t-th sub-string of the descriptor as a uint64_t key.
-    inline uint64_t _extract_key(const arrayli& vec, int32_t t) const {
+    inline uint64_t _extract_key(const uint8_t* code, int32_t t) const {
         uint64_t key = 0;
-        std::memcpy(&key, vec.data() + (size_t)t * _sub_nbytes, _sub_nbytes);
+        std::memcpy(&key, code + (size_t)t * _sub_nbytes, _sub_nbytes);
         return key;
     }
 
@@ -0,0 +1,104 @@
+/*
+ *  MIT Licence
+ *  Copyright 2021 Pablo Carneiro Elias
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vptree {
+
+class MappedFile {
+    /*
+     * Read-only memory mapping of a whole file.  Pages are faulted in on first access, so
+     * opening is O(1) in the file size.  The mapping is released on destruction.
+     */
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open " + path);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_file, &size)) {
+            CloseHandle(_file);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        _size = (size_t)size.QuadPart;
+        if (_size > 0) {
+            _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (_mapping == nullptr) {
+                CloseHandle(_file);
+                throw std::runtime_error("cannot map " + path);
+            }
+            _data = static_cast<const uint8_t *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (_data == nullptr) {
+                CloseHandle(_mapping);
+                CloseHandle(_file);
+                throw std::runtime_error("cannot map " + path);
+            }
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        _size = (size_t)st.st_size;
+        if (_size > 0) {
+            void *addr = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            _data = static_cast<const uint8_t *>(addr);
+        }
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+        if (_data) ::munmap(const_cast<uint8_t *>(_data), _size);
+#endif
+    }
+
+    const uint8_t *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const uint8_t *_data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#endif
+};
+
+} // namespace vptree
@@ -0,0 +1,34 @@
+/*
+ *  MIT Licence
+ *  Copyright 2021 Pablo Carneiro Elias
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Allow-list for filtered KNN search: a non-owning byte mask over point ids, where
+ * allowed[id] != 0 keeps the point and ids past numIds are rejected.  With queryStride == 0
+ * every query uses the same mask; otherwise query q uses allowed + q * queryStride.
+ *
+ * Rejected points never enter the result heap but still take part in routing, so tree
+ * pruning stays exact: the pruning radius only ever comes from allowed points.
+ */
+struct SearchFilter {
+    const uint8_t *allowed = nullptr; // nullptr keeps every point
+    size_t numIds = 0;
+    size_t queryStride = 0;
+
+    bool empty() const { return allowed == nullptr; }
+
+    // Mask of query q alone
+    SearchFilter row(size_t q) const {
+        if (empty()) return *this;
+        return SearchFilter{allowed + q * queryStride, numIds, 0};
+    }
+
+    // Only meaningful on a row() or on a filter shared by all queries
+    bool allows(int64_t id) const { return allowed == nullptr || ((uint64_t)id < numIds && allowed[id] != 0); }
+};
@@ -0,0 +1,405 @@
+#pragma once
+/*
+ * SegmentedVPTreeIndex — log-structured exact KNN index for write-heavy
+ * streams of float32 vectors.
+ *
+ * Storage
+ * ───────
+ *   memtable   new vectors are appended to a fixed-capacity row-major buffer
+ *              and scanned by brute force.  Rows are written before the row
+ *              count is published, so readers see whole rows only.
+ *   frozen     a full memtable becomes immutable and waits for the
+ *              compaction thread, still scanned by brute force.
+ *   segments   immutable VPTrees.  A segment is at level L while it holds
+ *              fewer than memtable_size × merge_factor^(L+1) points; once
+ *              merge_factor segments share a level they are merged into one.
+ *
+ * Concurrency
+ * ───────────
+ *   The memtable, frozen tables and segments form a snapshot that is swapped
+ *   atomically.  Searches load the snapshot and never take a lock; writers and
+ *   the compaction thread serialize on a mutex held only to append rows or
+ *   publish a snapshot, while trees are built outside it.  Each point is
+ *   rebuilt once per level, so writes cost O(log N) amortized rebuild work.
+ *
+ * Search fans out across every segment and table and merges the top-k.
+ * Distances are reported like the VPTree indices (plain L2 for squared L2).
+ */
+
+#include <DistanceFunctions.hpp>
+#include <VPTree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <float (*distance)(const FlatSpan &, const FlatSpan &)> class SegmentedVPTreeIndex {
+public:
+    /*
+     * memtable_size – rows buffered before they are frozen into a segment
+     * merge_factor  – segments of one level merged together (write cost ↓, segments searched ↑ as it grows)
+     * leaf_size     – leaf bucket size of the segment trees
+     */
+    explicit SegmentedVPTreeIndex(size_t memtable_size = 4096, size_t merge_factor = 4,
+                                  int32_t leaf_size = vptree::DEFAULT_LEAF_SIZE)
+        : _memtableSize(memtable_size), _mergeFactor(merge_factor), _leafSize(leaf_size) {
+        if (memtable_size < 1) throw std::invalid_argument("memtable_size must be at least 1");
+        if (merge_factor < 2) throw std::invalid_argument("merge_factor must be at least 2");
+        if (leaf_size < 1) throw std::invalid_argument("leaf size must be at least 1");
+        _snapshot = std::make_shared<const Snapshot>();
+    }
+
+    SegmentedVPTreeIndex(const SegmentedVPTreeIndex &) = delete;
+    SegmentedVPTreeIndex &operator=(const SegmentedVPTreeIndex &) = delete;
+
+    ~SegmentedVPTreeIndex() {
+        {
+            std::lock_guard<std::mutex> lock(_workMutex);
+            _stop = true;
+        }
+        _workCv.notify_all();
+        if (_worker.joinable()) _worker.join();
+    }
+
+    /*
+     * Append n row-major vectors of dimension d and return the id of the first one; the rest
+     * get the following ids.  Safe to call while other threads search or add.
+     */
+    int64_t add(const float *data, size_t n, size_t d) {
+        bool frozeAny = false;
+        int64_t first;
+        {
+            std::lock_guard<std::mutex> lock(_writeMutex);
+            first = _nextId;
+            if (n == 0) return first;
+            if (_dim == 0) _dim = d;
+            if (d != _dim)
+                throw std::invalid_argument("vectors have dimension " + std::to_string(d) + ", index has " +
+                                            std::to_string(_dim));
+
+            std::shared_ptr<const Snapshot> current = load();
+            Snapshot next = *current;
+            next.dim = _dim;
+            size_t i = 0;
+            while (i < n) {
+                size_t active = next.memtable ? next.memtable->count.load(std::memory_order_relaxed) : 0;
+                if (next.memtable && active == next.memtable->capacity) {
+                    next.frozen.push_back(std::move(next.memtable));
+                    next.memtable.reset();
+                    active = 0;
+                    frozeAny = true;
+                }
+                if (active == 0 && n - i >= _memtableSize) {
+                    // a batch of at least one memtable goes straight to the compaction thread
+                    auto table = std::make_shared<Memtable>(n - i, _dim, _nextId);
+                    table->append(data + i * _dim, n - i);
+                    next.frozen.push_back(std::move(table));
+                    _nextId += (int64_t)(n - i);
+                    i = n;
+                    frozeAny = true;
+                    break;
+                }
+                // created only when rows go in, so firstId is the id of its first row
+                if (!next.memtable) next.memtable = std::make_shared<Memtable>(_memtableSize, _dim, _nextId);
+                const size_t take = std::min(n - i, next.memtable->capacity - active);
+                next.memtable->append(data + i * _dim, take);
+                _nextId += (int64_t)take;
+                i += take;
+            }
+            if (next.memtable != current->memtable || frozeAny) publish(std::move(next));
+        }
+        if (frozeAny) wakeWorker();
+        return first;
+    }
+
+    /*
+     * Batch top-k search of nq row-major queries of dimension d into row-major (nq x k) buffers,
+     * nearest first.  Missing slots get index -1 and distance +inf.
+     */
+    void searchKNN(const float *queries, size_t nq, size_t d, size_t k, int64_t *indices, float *distances) const {
+        std::shared_ptr<const Snapshot> snapshot = load();
+        // checked against the snapshot searched: a first add() may fix the dimension at any time
+        if (nq > 0 && snapshot->dim != 0 && d != snapshot->dim)
+            throw std::invalid_argument("queries have dimension " + std::to_string(d) + ", index has " +
+                                        std::to_string(snapshot->dim));
+        if (k == 0) return;
+        if (nq > 0 && snapshot->points() > 0) {
+            const size_t dim = snapshot->dim;
+            std::vector<FlatSpan> spans(nq);
+            for (size_t q = 0; q < nq; ++q) spans[q] = FlatSpan{queries + q * dim, dim};
+
+            // every segment answers the whole batch; rows are merged per query below
+            const size_t nseg = snapshot->segments.size();
+            std::vector<std::vector<int64_t>> segIndices(nseg, std::vector<int64_t>(nq * k));
+            std::vector<std::vector<float>> segDistances(nseg, std::vector<float>(nq * k));
+            for (size_t s = 0; s < nseg; ++s)
+                snapshot->segments[s]->tree.searchKNN(spans, k, segIndices[s].data(), segDistances[s].data());
+
+            std::vector<const Memtable *> tables;
+            for (const auto &table : snapshot->frozen) tables.push_back(table.get());
+            if (snapshot->memtable) tables.push_back(snapshot->memtable.get());
+            std::vector<size_t> rows(tables.size());
+            for (size_t t = 0; t < tables.size(); ++t) rows[t] = tables[t]->count.load(std::memory_order_acquire);
+
+#ifdef ENABLE_OMP_PARALLEL
+            #pragma omp parallel for schedule(dynamic) if (nq > 1)
+#endif
+            for (int64_t q = 0; q < (int64_t)nq; ++q) {
+                thread_local std::vector<Candidate> candidates;
+                thread_local std::vector<float> scratch;
+                candidates.clear();
+                for (size_t s = 0; s < nseg; ++s) {
+                    const Segment &segment = *snapshot->segments[s];
+                    for (size_t j = 0; j < k; ++j) {
+                        const int64_t local = segIndices[s][q * k + j];
+                        if (local < 0) break;
+                        candidates.push_back({segDistances[s][q * k + j], segment.ids[local]});
+                    }
+                }
+                for (size_t t = 0; t < tables.size(); ++t) {
+                    scratch.resize(rows[t]);
+                    distance_traits<distance>::one_to_many(spans[q], tables[t]->data.get(), rows[t], scratch.data());
+                    for (size_t r = 0; r < rows[t]; ++r)
+                        candidates.push_back({reported(scratch[r]), tables[t]->firstId + (int64_t)r});
+                }
+
+                const size_t found = std::min(k, candidates.size());
+                std::partial_sort(candidates.begin(), candidates.begin() + found, candidates.end());
+                for (size_t j = 0; j < k; ++j) {
+                    indices[q * k + j] = j < found ? candidates[j].second : -1;
+                    distances[q * k + j] = j < found ? candidates[j].first : std::numeric_limits<float>::infinity();
+                }
+            }
+            return;
+        }
+        std::fill(indices, indices + nq * k, (int64_t)-1);
+        std::fill(distances, distances + nq * k, std::numeric_limits<float>::infinity());
+    }
+
+    /*
+     * Freezes the memtable and blocks until the compaction thread has turned every frozen
+     * table into a segment and no level is left to merge.
+     */
+    void flush() {
+        {
+            std::lock_guard<std::mutex> lock(_writeMutex);
+            std::shared_ptr<const Snapshot> current = load();
+            if (current->memtable && current->memtable->count.load(std::memory_order_relaxed) > 0) {
+                Snapshot next = *current;
+                next.frozen.push_back(next.memtable);
+                next.memtable.reset();
+                publish(std::move(next));
+            }
+        }
+        wakeWorker();
+        std::unique_lock<std::mutex> lock(_workMutex);
+        _idleCv.wait(lock, [this] { return !_busy && !hasWork(*load()); });
+    }
+
+    size_t dim() const { return _dim; }
+    size_t size() const { return load()->points(); }
+    size_t numSegments() const { return load()->segments.size(); }
+    size_t memtableSize() const { return _memtableSize; }
+    size_t mergeFactor() const { return _mergeFactor; }
+    int32_t leafSize() const { return _leafSize; }
+
+    // All vectors, row-major in id order
+    std::vector<float> vectors() const {
+        std::shared_ptr<const Snapshot> snapshot = load();
+        const size_t dim = snapshot->dim;
+        std::vector<float> out(snapshot->points() * dim);
+        for (const auto &segment : snapshot->segments) {
+            const auto &flat = segment->tree.flatBacking();
+            const auto &permutation = segment->tree.indexPermutation();
+            for (size_t pos = 0; pos < permutation.size(); ++pos) {
+                if (permutation[pos] < 0) continue;
+                std::memcpy(out.data() + segment->ids[permutation[pos]] * dim, flat.data() + pos * dim,
+                            dim * sizeof(float));
+            }
+        }
+        std::vector<const Memtable *> tables;
+        for (const auto &table : snapshot->frozen) tables.push_back(table.get());
+        if (snapshot->memtable) tables.push_back(snapshot->memtable.get());
+        for (const Memtable *table : tables) {
+            const size_t count = table->count.load(std::memory_order_acquire);
+            if (count > 0)
+                std::memcpy(out.data() + table->firstId * dim, table->data.get(), count * dim * sizeof(float));
+        }
+        return out;
+    }
+
+private:
+    using Tree = vptree::VPTree<FlatSpan, float, distance>;
+    using Candidate = std::pair<float, int64_t>; // (distance, id)
+
+    // Append-only row buffer; capacity is fixed so readers can scan it while it fills
+    struct Memtable {
+        Memtable(size_t capacity, size_t dim, int64_t firstId)
+            : data(new float[capacity * dim]), capacity(capacity), dim(dim), firstId(firstId) {}
+
+        // single writer (under _writeMutex); rows become visible once count is published
+        void append(const float *rows, size_t n) {
+            const size_t at = count.load(std::memory_order_relaxed);
+            std::memcpy(data.get() + at * dim, rows, n * dim * sizeof(float));
+            count.store(at + n, std::memory_order_release);
+        }
+
+        std::unique_ptr<float[]> data;
+        size_t capacity;
+        size_t dim;
+        int64_t firstId;
+        std::atomic<size_t> count{0};
+    };
+
+    struct Segment {
+        Tree tree;
+        std::vector<int64_t> ids; // tree row → id
+    };
+
+    struct Snapshot {
+        std::vector<std::shared_ptr<Segment>> segments;
+        std::vector<std::shared_ptr<Memtable>> frozen; // oldest first
+        std::shared_ptr<Memtable> memtable;
+        size_t dim = 0; // set by the add() that published it, 0 while nothing was added
+
+        size_t points() const {
+            size_t total = 0;
+            for (const auto &segment : segments) total += segment->ids.size();
+            for (const auto &table : frozen) total += table->count.load(std::memory_order_acquire);
+            if (memtable) total += memtable->count.load(std::memory_order_acquire);
+            return total;
+        }
+    };
+
+    size_t _memtableSize, _mergeFactor;
+    int32_t _leafSize;
+    std::atomic<size_t> _dim{0}; // fixed by the first add()
+    int64_t _nextId = 0;
+
+    std::shared_ptr<const Snapshot> _snapshot; // accessed through load() / publish() only
+    std::mutex _writeMutex;                    // serializes add() and snapshot publication
+
+    std::thread _worker;
+    std::mutex _workMutex;
+    std::condition_variable _workCv, _idleCv;
+    bool _stop = false, _busy = false;
+
+    static float reported(float dist) {
+        if constexpr (distance_traits<distance>::squared) {
+            return std::sqrt(dist);
+        } else {
+            return dist;
+        }
+    }
+
+    std::shared_ptr<const Snapshot> load() const {
+        return std::atomic_load_explicit(&_snapshot, std::memory_order_acquire);
+    }
+
+    // Caller holds _writeMutex
+    void publish(Snapshot next) {
+        std::shared_ptr<const Snapshot> published = std::make_shared<Snapshot>(std::move(next));
+        std::atomic_store_explicit(&_snapshot, std::move(published), std::memory_order_release);
+    }
+
+    size_t levelOf(size_t points) const {
+        size_t level = 0;
+        for (size_t bound = _memtableSize * _mergeFactor; points >= bound; bound *= _mergeFactor) ++level;
+        return level;
+    }
+
+    // Segments to merge next: the oldest merge_factor segments of the lowest full level
+    std::vector<std::shared_ptr<Segment>> mergeCandidates(const Snapshot &snapshot) const {
+        std::vector<std::vector<std::shared_ptr<Segment>>> byLevel;
+        for (const auto &segment : snapshot.segments) {
+            const size_t level = levelOf(segment->ids.size());
+            if (byLevel.size() <= level) byLevel.resize(level + 1);
+            byLevel[level].push_back(segment);
+        }
+        for (auto &level : byLevel) {
+            if (level.size() >= _mergeFactor) {
+                level.resize(_mergeFactor);
+                return level;
+            }
+        }
+        return {};
+    }
+
+    bool hasWork(const Snapshot &snapshot) const {
+        return !snapshot.frozen.empty() || !mergeCandidates(snapshot).empty();
+    }
+
+    void wakeWorker() {
+        {
+            std::lock_guard<std::mutex> lock(_workMutex);
+            if (!_worker.joinable()) _worker = std::thread([this] { compactionLoop(); });
+        }
+        _workCv.notify_one();
+    }
+
+    void compactionLoop() {
+        std::unique_lock<std::mutex> lock(_workMutex);
+        for (;;) {
+            _workCv.wait(lock, [this] { return _stop || hasWork(*load()); });
+            if (_stop) return;
+            _busy = true;
+            lock.unlock();
+            compactOnce();
+            lock.lock();
+            _busy = false;
+            _idleCv.notify_all();
+        }
+    }
+
+    // Builds one segment, from the oldest frozen table or from a full level, and publishes it
+    void compactOnce() {
+        std::shared_ptr<const Snapshot> snapshot = load();
+        auto segment = std::make_shared<Segment>();
+        segment->tree.setLeafSize(_leafSize);
+
+        std::shared_ptr<Memtable> table;
+        std::vector<std::shared_ptr<Segment>> merged;
+        if (!snapshot->frozen.empty()) {
+            // a frozen table no longer grows, so the tree is built straight from its rows
+            table = snapshot->frozen.front();
+            const size_t count = table->count.load(std::memory_order_acquire);
+            segment->ids.resize(count);
+            for (size_t r = 0; r < count; ++r) segment->ids[r] = table->firstId + (int64_t)r;
+            segment->tree.setRows(table->data.get(), count, _dim);
+        } else {
+            merged = mergeCandidates(*snapshot);
+            if (merged.empty()) return;
+            std::vector<float> rows;
+            for (const auto &source : merged) {
+                const auto &flat = source->tree.flatBacking();
+                const auto &permutation = source->tree.indexPermutation();
+                for (size_t pos = 0; pos < permutation.size(); ++pos) {
+                    if (permutation[pos] < 0) continue;
+                    rows.insert(rows.end(), flat.data() + pos * _dim, flat.data() + (pos + 1) * _dim);
+                    segment->ids.push_back(source->ids[permutation[pos]]);
+                }
+            }
+            segment->tree.setRows(rows.data(), segment->ids.size(), _dim);
+        }
+
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        Snapshot next = *load();
+        if (table) {
+            next.frozen.erase(std::find(next.frozen.begin(), next.frozen.end(), table));
+        } else {
+            for (const auto &source : merged)
+                next.segments.erase(std::find(next.segments.begin(), next.segments.end(), source));
+        }
+        next.segments.push_back(std::move(segment));
+        publish(std::move(next));
+    }
+};
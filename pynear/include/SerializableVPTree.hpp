@@ -56,8 +56,8 @@ public:
 
         // Create a writer that will write to the state object
         SerializedStateObjectWriter writer(state);
-        writer.writeUserVector<T, serializer>(this->_examples);
-        writer.writeVector<int32_t>(this->_indices);
+        writer.writeUserVector<T, serializer>(this->examplesById());
+        writer.writeVector<int32_t>(this->_indices.toVector());
 
         // Serialize partitions
         serializeLevelPartitions(writer);
@@ -77,11 +77,16 @@ public:
         }
 
         SerializedStateObjectReader reader(state);
-        this->_examples = reader.readUserVector<T, deserializer>();
+        std::vector<T> examples = reader.readUserVector<T, deserializer>();
+        const size_t numIds = examples.size();
         this->_indices = reader.readVector<int32_t>();
+        this->restoreExamples(std::move(examples));
 
         // Deserialize partitions
         deserializeLevelPartitions(reader);
+        this->recountPoints();
+        // packed codes leave _examples empty, so the id count comes from the state
+        this->_nextId = std::max<int32_t>(this->_nextId, (int32_t)numIds);
     };
 
     void serializeLevelPartitions(SerializedStateObjectWriter &writer) const {
@@ -113,11 +118,12 @@ public:
     }
 
     void deserializeLevelPartitions(SerializedStateObjectReader &reader) {
-        this->_nodePool.clear();
-        this->_rootIdx = rebuildFromState(reader);
+        std::vector<VPLevelPartition<distance_type>> pool;
+        this->_rootIdx = rebuildFromState(reader, pool);
+        this->_nodePool = std::move(pool);
     }
 
-    int32_t rebuildFromState(SerializedStateObjectReader &reader) {
+    int32_t rebuildFromState(SerializedStateObjectReader &reader, std::vector<VPLevelPartition<distance_type>> &pool) {
         if (reader.isEmpty()) {
             return -1;
         }
@@ -130,16 +136,16 @@ public:
         }
 
         // Push node to pool, get its index
-        this->_nodePool.push_back(VPLevelPartition<distance_type>(radius, indexStart, indexEnd));
-        int32_t nodeIdx = static_cast<int32_t>(this->_nodePool.size() - 1);
+        pool.push_back(VPLevelPartition<distance_type>(radius, indexStart, indexEnd));
+        int32_t nodeIdx = static_cast<int32_t>(pool.size() - 1);
 
         // IMPORTANT: rebuild children BEFORE using nodeIdx to index into pool,
         // because push_back may reallocate. We save idx and re-index after.
-        int32_t left_idx = rebuildFromState(reader);
-        int32_t right_idx = rebuildFromState(reader);
+        int32_t left_idx = rebuildFromState(reader, pool);
+        int32_t right_idx = rebuildFromState(reader, pool);
 
         // After recursion, re-access by saved index (pool may have reallocated)
-        this->_nodePool[nodeIdx].setChildIdx(left_idx, right_idx);
+        pool[nodeIdx].setChildIdx(left_idx, right_idx);
 
         return nodeIdx;
     }
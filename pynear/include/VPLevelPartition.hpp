@@ -29,24 +29,23 @@ public:
 
     int32_t left_idx() const { return _left_idx; }
     int32_t right_idx() const { return _right_idx; }
+    // Leaves are buckets: every point in [start, end] is scanned, not just the vantage point
+    bool isLeaf() const { return _left_idx < 0 && _right_idx < 0; }
     void setChildIdx(int32_t left, int32_t right) { _left_idx = left; _right_idx = right; }
 
-    int height(const std::vector<VPLevelPartition<distance_type>> &pool) const {
-        return rec_height(pool, *this, 0);
-    }
-    int numSubnodes(const std::vector<VPLevelPartition<distance_type>> &pool) const {
-        return rec_num_subnodes(pool, *this);
-    }
+    // pool is any indexable container of partitions (std::vector, ArrayStore)
+    template <typename Pool> int height(const Pool &pool) const { return rec_height(pool, *this, 0); }
+    template <typename Pool> int numSubnodes(const Pool &pool) const { return rec_num_subnodes(pool, *this); }
 
 private:
-    static int rec_height(const std::vector<VPLevelPartition<distance_type>> &pool,
-                          const VPLevelPartition<distance_type> &node, int level) {
+    template <typename Pool>
+    static int rec_height(const Pool &pool, const VPLevelPartition<distance_type> &node, int level) {
         int l = (node._left_idx >= 0) ? rec_height(pool, pool[node._left_idx], level + 1) : level;
         int r = (node._right_idx >= 0) ? rec_height(pool, pool[node._right_idx], level + 1) : level;
         return std::max(l, r) + 1;
     }
-    static int rec_num_subnodes(const std::vector<VPLevelPartition<distance_type>> &pool,
-                                const VPLevelPartition<distance_type> &node) {
+    template <typename Pool>
+    static int rec_num_subnodes(const Pool &pool, const VPLevelPartition<distance_type> &node) {
         int l = (node._left_idx >= 0) ? rec_num_subnodes(pool, pool[node._left_idx]) : 0;
         int r = (node._right_idx >= 0) ? rec_num_subnodes(pool, pool[node._right_idx]) : 0;
         return l + r + 1;
@@ -59,8 +58,8 @@ private:
     int32_t _right_idx = -1;
 };
 
-template <typename distance_type>
-void rec_print_state(std::ostream &os, const std::vector<VPLevelPartition<distance_type>> &pool, int32_t idx, int level) {
+template <typename distance_type, typename Pool>
+void rec_print_state(std::ostream &os, const Pool &pool, int32_t idx, int level) {
     if (idx < 0) {
         return;
     }
@@ -86,11 +85,11 @@ void rec_print_state(std::ostream &os, const std::vector<VPLevelPartition<distan
     if (partition.left_idx() >= 0) {
         os << pad << " [+] Left children:" << std::endl;
     }
-    rec_print_state(os, pool, partition.left_idx(), level + 1);
+    rec_print_state<distance_type>(os, pool, partition.left_idx(), level + 1);
     if (partition.right_idx() >= 0) {
         os << pad << " [+] Right children:" << std::endl;
     }
-    rec_print_state(os, pool, partition.right_idx(), level + 1);
+    rec_print_state<distance_type>(os, pool, partition.right_idx(), level + 1);
 }
 
 }; // namespace vptree
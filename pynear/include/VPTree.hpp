@@ -6,6 +6,8 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
@@ -18,16 +20,52 @@
 #include <queue>
 #include <random>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "ArrayStore.hpp"
 #include "DistanceFunctions.hpp"
+#include "SearchFilter.hpp"
 #include "VPLevelPartition.hpp"
 
+// Task-parallel builds need OpenMP 4.5 (taskloop); MSVC's /openmp (2.0) splits level by level
+#if ENABLE_OMP_PARALLEL && defined(_OPENMP) && _OPENMP >= 201511
+#define PYNEAR_OMP_TASKS 1
+#else
+#define PYNEAR_OMP_TASKS 0
+#endif
+
 namespace vptree {
 
+// Partitions with at most this many points are kept as a single leaf bucket
+constexpr int32_t DEFAULT_LEAF_SIZE = 16;
+
+/*
+ * Per-query work limit for anytime search.  A value of 0 means unlimited.
+ * - maxVisits: number of tree nodes (vantage points or leaf buckets) evaluated
+ * - maxTimeUs: wall time in microseconds, checked every few visits
+ * When the budget runs out the best results found so far are returned and marked inexact.
+ */
+struct SearchBudget {
+    int64_t maxVisits = 0;
+    int64_t maxTimeUs = 0;
+
+    bool unlimited() const { return maxVisits <= 0 && maxTimeUs <= 0; }
+};
+
+// true for binary code trees whose metric measures codes by pointer (distance_traits::packed)
+template <typename T, auto distance> constexpr bool packed_codes() {
+    if constexpr (std::is_same_v<T, arrayli>) {
+        return distance_traits<distance>::packed;
+    } else {
+        return false;
+    }
+}
+
 template <typename T, typename distance_type, distance_type (*distance)(const T &, const T &)> class VPTree {
     /*
      * Template arguments:
@@ -38,42 +76,70 @@ template <typename T, typename distance_type, distance_type (*distance)(const T
      *   measuring ddistances between two objects of type T.
      */
 public:
+    // Queries searched together by searchKNNBatched()
+    static constexpr size_t QUERY_BLOCK = 64;
+
+    /*
+     * FlatSpan points, and binary codes with a pointer kernel, are kept as rows of one contiguous
+     * store (_flat_backing) in tree order.  Code rows live in a cache line aligned buffer.
+     */
+    static constexpr bool PACKED_CODES = packed_codes<T, distance>();
+    static constexpr bool FLAT_ROWS = std::is_same_v<T, FlatSpan> || PACKED_CODES;
+    using RowView = std::conditional_t<PACKED_CODES, CodeSpan, FlatSpan>;
+    using Scalar = std::conditional_t<PACKED_CODES, uint8_t, float>;
+    using FlatStore =
+        std::conditional_t<PACKED_CODES, ArrayStore<uint8_t, AlignedAllocator<uint8_t, 64>>, ArrayStore<float>>;
+    // Point type searches work on; packed trees also take points and queries as CodeSpan views
+    using Query = std::conditional_t<PACKED_CODES, CodeSpan, T>;
+
     struct VPTreeSearchResultElement {
         std::vector<int64_t> indexes;
         std::vector<distance_type> distances;
+        // false when a search budget stopped the query before the result was proven exact
+        bool exact = true;
+    };
+
+    /*
+     * CSR layout for radius search: the neighbours of query i are
+     * indexes[offsets[i] .. offsets[i + 1]) with matching distances, sorted nearest first.
+     */
+    struct VPTreeRadiusSearchResult {
+        std::vector<int64_t> offsets;
+        std::vector<int64_t> indexes;
+        std::vector<distance_type> distances;
     };
 
     VPTree() {}
 
     VPTree(const VPTree<T, distance_type, distance> &other) {
+        _leafSize = other._leafSize;
+        _sampledSplit = other._sampledSplit;
+        _splitImbalance = other._splitImbalance;
         _indices = other._indices;
         _nodePool = other._nodePool;
         _rootIdx = other._rootIdx;
         _dim = other._dim;
-        if constexpr (std::is_same_v<T, FlatSpan>) {
-            _flat_backing = other._flat_backing;
-            _examples.resize(other._examples.size());
-            for (size_t i = 0; i < _examples.size(); i++)
-                _examples[i] = FlatSpan{_flat_backing.data() + i * _dim, _dim};
-        } else {
-            _examples = other._examples;
-        }
+        // owned storage is deep copied; a memory-mapped one is shared
+        _flat_backing = other._flat_backing;
+        _examples = other._examples;
+        _numLive = other._numLive;
+        _nextId = other._nextId;
     }
 
     const VPTree<T, distance_type, distance> &operator=(const VPTree<T, distance_type, distance> &other) {
         if (this == &other) return *this;
+        _leafSize = other._leafSize;
+        _sampledSplit = other._sampledSplit;
+        _splitImbalance = other._splitImbalance;
         _indices = other._indices;
         _nodePool = other._nodePool;
         _rootIdx = other._rootIdx;
         _dim = other._dim;
-        if constexpr (std::is_same_v<T, FlatSpan>) {
-            _flat_backing = other._flat_backing;
-            _examples.resize(other._examples.size());
-            for (size_t i = 0; i < _examples.size(); i++)
-                _examples[i] = FlatSpan{_flat_backing.data() + i * _dim, _dim};
-        } else {
-            _examples = other._examples;
-        }
+        _flat_backing = other._flat_backing;
+        _examples = other._examples;
+        _numLive = other._numLive;
+        _nextId = other._nextId;
+        _update = UpdateIndex();
         return *this;
     }
 
@@ -82,56 +148,123 @@ public:
     void clear() {
         _rootIdx = -1;
         _nodePool.clear();
+        _indices.clear();
         _examples.clear();
         _flat_backing.clear();
         _dim = 0;
+        _numLive = 0;
+        _nextId = 0;
+        _splitImbalance = 0;
+        _update = UpdateIndex();
     }
 
     VPTree(const std::vector<T> &array) { set(array); }
 
-    void set(const std::vector<T> &array) {
+    template <typename P> void set(const std::vector<P> &array) {
         clear();
         if (array.empty()) return;
 
-        if constexpr (std::is_same_v<T, FlatSpan>) {
-            _dim = array[0].sz;
-            size_t n = array.size();
-            _flat_backing.resize(n * _dim);
-            for (size_t i = 0; i < n; i++)
-                std::memcpy(_flat_backing.data() + i * _dim, array[i].ptr, _dim * sizeof(float));
-            _examples.resize(n);
-            for (size_t i = 0; i < n; i++)
-                _examples[i] = FlatSpan{_flat_backing.data() + i * _dim, _dim};
+        if constexpr (FLAT_ROWS) {
+            copyToFlatBacking(array);
         } else {
+            static_assert(std::is_same_v<P, T>, "points must be of the tree point type");
             _examples = array;
         }
-        build(_examples);
-        reorderForCache();
+        build();
     }
 
     void set(std::vector<T> &&array) {
         clear();
         if (array.empty()) return;
 
-        if constexpr (std::is_same_v<T, FlatSpan>) {
+        if constexpr (FLAT_ROWS) {
             // For FlatSpan, data is owned externally — copy into flat backing
-            _dim = array[0].sz;
-            size_t n = array.size();
-            _flat_backing.resize(n * _dim);
-            for (size_t i = 0; i < n; i++)
-                std::memcpy(_flat_backing.data() + i * _dim, array[i].ptr, _dim * sizeof(float));
-            _examples.resize(n);
-            for (size_t i = 0; i < n; i++)
-                _examples[i] = FlatSpan{_flat_backing.data() + i * _dim, _dim};
+            copyToFlatBacking(array);
         } else {
             _examples = std::move(array);
         }
-        build(_examples);
-        reorderForCache();
+        build();
+    }
+
+    /*
+     * Builds from n rows of dim scalars in a caller owned buffer, which must stay alive for the
+     * call only.  Rows are copied once into the store: either up front, to be partitioned there
+     * in place, or after building over the buffer, straight into tree order (see buildFlatRows()).
+     * Peak memory is the store plus the tree rather than two copies of it.
+     */
+    void setRows(const Scalar *data, size_t n, size_t dim) {
+        static_assert(FLAT_ROWS, "setRows() needs a tree with flat rows");
+        clear();
+        if (n == 0) return;
+        if (dim == 0) throw std::invalid_argument("points must have at least one dimension");
+
+        _dim = dim;
+        if (movesRows(n)) {
+            _flat_backing = typename FlatStore::vector_type(data, data + n * dim);
+            build();
+            return;
+        }
+
+        std::vector<int32_t> indices(n);
+        std::iota(indices.begin(), indices.end(), 0);
+        std::vector<VPLevelPartition<distance_type>> pool;
+        buildSubtree(indices, pool, [data, dim](int32_t i) { return RowView{data + (size_t)i * dim, dim}; });
+
+        typename FlatStore::vector_type ordered(n * dim);
+        for (size_t i = 0; i < n; i++) {
+            std::memcpy(ordered.data() + i * dim, data + (size_t)indices[i] * dim, dim * sizeof(Scalar));
+        }
+        _flat_backing = std::move(ordered);
+        adoptBuild(std::move(indices), std::move(pool));
     }
 
     bool isEmpty() { return _rootIdx == -1; }
 
+    // Number of points that searches can return
+    size_t size() const { return (size_t)_numLive; }
+
+    size_t numPoints() const {
+        if constexpr (FLAT_ROWS) {
+            return (_dim > 0) ? _flat_backing.size() / _dim : 0;
+        } else {
+            return _examples.size();
+        }
+    }
+
+    /*
+     * Partitions holding leafSize points or fewer are not split any further; search scans
+     * them as one contiguous block instead of popping one heap entry per point.
+     * Takes effect on the next set(); partitions rebuilt by add() and remove() use it at once.
+     */
+    void setLeafSize(int32_t leafSize) {
+        if (leafSize < 1) {
+            throw std::invalid_argument("leaf size must be at least 1");
+        }
+        _leafSize = leafSize;
+    }
+    int32_t leafSize() const { return _leafSize; }
+
+    /*
+     * Partitions of at least minPoints points are split at a median estimated from a sample of
+     * SPLIT_SAMPLE distances, in one streaming pass, instead of selecting the exact median over
+     * all of them.  A split whose children differ by more than MAX_SPLIT_IMBALANCE of the
+     * partition falls back to the exact median.  0 (the default) always splits exactly.
+     */
+    void setSampledSplit(int32_t minPoints) {
+        if (minPoints != 0 && minPoints < SPLIT_SAMPLE) {
+            throw std::invalid_argument("sampled split needs partitions of at least " + std::to_string(SPLIT_SAMPLE) +
+                                        " points, or 0 to disable it");
+        }
+        _sampledSplit = minPoints;
+    }
+    int32_t sampledSplit() const { return _sampledSplit; }
+
+    // Largest |left - right| / (left + right) of the sampled splits since set() or compact()
+    float splitImbalance() const { return _splitImbalance; }
+
+    static constexpr int32_t SPLIT_SAMPLE = 4096;
+    static constexpr float MAX_SPLIT_IMBALANCE = 0.1f;
+
     void print_state() {
         if (_rootIdx == -1) {
             return;
@@ -140,11 +273,27 @@ public:
         rec_print_state<distance_type>(std::cout, _nodePool, _rootIdx, 0);
     }
 
-    void searchKNN(const std::vector<T> &queries, size_t k, std::vector<VPTreeSearchResultElement> &results) {
+    /*
+     * epsilon > 0 turns on (1+epsilon)-approximate search: a partition is skipped when its lower
+     * bound times (1+epsilon) exceeds the current k-th distance, so every returned distance is
+     * at most (1+epsilon) times the true one.
+     *
+     * A non-empty budget bounds the work per query; results cut short have exact == false and
+     * may hold fewer than k entries.
+     *
+     * A non-empty filter restricts results to the ids it allows, so a query may also get
+     * fewer than k entries when the filter is selective.
+     */
+    template <typename P>
+    void searchKNN(const std::vector<P> &queries, size_t k, std::vector<VPTreeSearchResultElement> &results,
+                   float epsilon = 0, const SearchBudget &budget = SearchBudget(),
+                   const SearchFilter &filter = SearchFilter()) {
 
         if (isEmpty()) {
             throw std::runtime_error("index must be first initialized with .set() function and non empty dataset");
         }
+        checkQueryDims(queries);
+        const float pruneScale = approximationScale(epsilon);
 
         // we must return one result per queries
         results.resize(queries.size());
@@ -154,82 +303,455 @@ public:
 #endif
         // i should be size_t, however msvc requires signed integral loop variables (except with -openmp:llvm)
         for (int i = 0; i < static_cast<int>(queries.size()); ++i) {
-            const T &query = queries[i];
+            const Query &query = asQuery(queries[i]);
             std::priority_queue<VPTreeSearchElement> knnQueue;
-            searchKNN(_rootIdx, query, k, knnQueue);
+            const bool exact = searchKNN(_rootIdx, query, k, knnQueue, pruneScale, budget, filter.row(i));
 
             // we must always return k elements for each search unless there is no k elements
-            assert(knnQueue.size() == std::min<size_t>(_examples.size(), k));
+            assert(!exact || !filter.empty() || knnQueue.size() == std::min<size_t>(size(), k));
 
+            results[i] = VPTreeSearchResultElement();
+            results[i].exact = exact;
             fillSearchResult(knnQueue, results[i]);
         }
     }
 
-    // An optimized version for 1 NN search
-    void search1NN(const std::vector<T> &queries, std::vector<int64_t> &indices, std::vector<distance_type> &distances) {
+    /*
+     * Same search, written straight into caller-owned row-major (queries.size() x k) buffers.
+     * Rows are sorted nearest first; rows with fewer than k neighbours are padded with index -1
+     * and an infinite (or, for integer metrics, maximum) distance.  exact, when given, receives
+     * one flag per query.
+     */
+    template <typename P>
+    void searchKNN(const std::vector<P> &queries, size_t k, int64_t *indices, distance_type *distances,
+                   float epsilon = 0, const SearchBudget &budget = SearchBudget(), uint8_t *exact = nullptr,
+                   const SearchFilter &filter = SearchFilter()) {
+
+        if (isEmpty()) {
+            throw std::runtime_error("index must be first initialized with .set() function and non empty dataset");
+        }
+        checkQueryDims(queries);
+        const float pruneScale = approximationScale(epsilon);
+
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(dynamic) if (queries.size() > 1)
+#endif
+        // i should be size_t, see above
+        for (int i = 0; i < static_cast<int>(queries.size()); ++i) {
+            std::priority_queue<VPTreeSearchElement> knnQueue;
+            const bool complete =
+                searchKNN(_rootIdx, asQuery(queries[i]), k, knnQueue, pruneScale, budget, filter.row(i));
+            if (exact) exact[i] = complete ? 1 : 0;
+            fillSearchRow(knnQueue, k, indices + (size_t)i * k, distances + (size_t)i * k);
+        }
+    }
+
+    /*
+     * Throughput-oriented exact KNN for large batches, with the same results and row layout as
+     * the buffer searchKNN above.  Queries are ordered by their path through the top
+     * ROUTE_LEVELS levels and cut into blocks of blockSize queries, one block per thread.
+     * A block walks the tree together: each vantage point is loaded once and measured against
+     * every query of the block still interested in it (one one-to-many kernel call while the
+     * whole block is), and each leaf bucket stays in cache while the block scans it.
+     * Trees over other point types fall back to the per-query search.
+     */
+    template <typename P>
+    void searchKNNBatched(const std::vector<P> &queries, size_t k, int64_t *indices, distance_type *distances,
+                          size_t blockSize = QUERY_BLOCK) {
 
         if (isEmpty()) {
             throw std::runtime_error("index must be first initialized with .set() function and non empty dataset");
         }
+        checkQueryDims(queries);
+        if constexpr (!std::is_same_v<T, FlatSpan>) {
+            searchKNN(queries, k, indices, distances);
+        } else {
+            if (blockSize == 0) throw std::invalid_argument("block size must be at least 1");
+            if (k == 0) return;
+
+            // (route code, query): sorting groups queries that descend the same way
+            std::vector<std::pair<uint32_t, int32_t>> order(queries.size());
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(static) if (queries.size() > 1)
+#endif
+            for (int i = 0; i < static_cast<int>(queries.size()); ++i)
+                order[i] = {routeCode(asQuery(queries[i])), (int32_t)i};
+            std::sort(order.begin(), order.end());
+            std::vector<BlockQuery> members(queries.size());
+            for (size_t i = 0; i < order.size(); ++i)
+                members[i] = {asQuery(queries[order[i].second]), (size_t)order[i].second, -1};
+
+            const int numBlocks = static_cast<int>((queries.size() + blockSize - 1) / blockSize);
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(dynamic) if (numBlocks > 1)
+#endif
+            for (int b = 0; b < numBlocks; ++b) {
+                const size_t first = (size_t)b * blockSize;
+                searchKNNBlock(members.data() + first, std::min(blockSize, queries.size() - first), k, indices,
+                               distances);
+            }
+        }
+    }
+
+    /*
+     * All-k-nearest-neighbours self join: the k nearest stored points of every stored point,
+     * written to row-major (nextId() x k) buffers indexed by id, with the row layout of the
+     * buffer searchKNN.  With excludeSelf a point never reports its own id (an exact duplicate
+     * still does), and rows of removed ids are all padding.
+     *
+     * Points are taken in tree order, so consecutive queries share a subtree and their first
+     * leaves tighten tau at once.  FlatSpan trees walk them QUERY_BLOCK at a time like
+     * searchKNNBatched, with tree order standing in for the route code sort.
+     */
+    void allKNN(size_t k, int64_t *indices, distance_type *distances, bool excludeSelf = true) {
+
+        if (isEmpty()) {
+            throw std::runtime_error("index must be first initialized with .set() function and non empty dataset");
+        }
+        if (k == 0) return;
+
+        // live positions in depth-first tree order
+        std::vector<int32_t> positions;
+        positions.reserve(_numLive);
+        std::vector<int32_t> stack{_rootIdx};
+        while (!stack.empty()) {
+            const VPLevelPartition<distance_type> &node = _nodePool[stack.back()];
+            stack.pop_back();
+            const int32_t count = node.isLeaf() ? node.size() : 1;
+            for (int32_t pos = node.start(); pos < node.start() + count; ++pos)
+                if (_indices[pos] >= 0) positions.push_back(pos);
+            if (node.isLeaf()) continue;
+            if (node.right_idx() >= 0) stack.push_back(node.right_idx());
+            if (node.left_idx() >= 0) stack.push_back(node.left_idx());
+        }
+
+        std::priority_queue<VPTreeSearchElement> none;
+        for (size_t id = 0; id < (size_t)_nextId; ++id) fillSearchRow(none, k, indices + id * k, distances + id * k);
+
+        if constexpr (std::is_same_v<T, FlatSpan>) {
+            std::vector<BlockQuery> members(positions.size());
+            for (size_t i = 0; i < positions.size(); ++i) {
+                const int32_t id = _indices[positions[i]];
+                members[i] = {example(positions[i]), (size_t)id, excludeSelf ? id : -1};
+            }
+
+            const int numBlocks = static_cast<int>((members.size() + QUERY_BLOCK - 1) / QUERY_BLOCK);
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(dynamic) if (numBlocks > 1)
+#endif
+            for (int b = 0; b < numBlocks; ++b) {
+                const size_t first = (size_t)b * QUERY_BLOCK;
+                searchKNNBlock(members.data() + first, std::min(QUERY_BLOCK, members.size() - first), k, indices,
+                               distances);
+            }
+        } else {
+            const SearchFilter everything;
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(dynamic, 16) if (positions.size() > 1)
+#endif
+            // i should be size_t, see searchKNN
+            for (int i = 0; i < static_cast<int>(positions.size()); ++i) {
+                const int32_t id = _indices[positions[i]];
+                std::priority_queue<VPTreeSearchElement> knnQueue;
+                searchKNN(_rootIdx, storedPoint(positions[i]), k, knnQueue, 1.0f, SearchBudget(), everything,
+                          excludeSelf ? id : -1);
+                fillSearchRow(knnQueue, k, indices + (size_t)id * k, distances + (size_t)id * k);
+            }
+        }
+    }
+
+    /*
+     * An optimized version for 1 NN search.
+     * With a budget, exact (when given) receives 1 for queries that completed and 0 for those
+     * cut short; an interrupted query that found nothing yet reports index -1.
+     */
+    template <typename P>
+    void search1NN(const std::vector<P> &queries, std::vector<int64_t> &indices, std::vector<distance_type> &distances,
+                   float epsilon = 0, const SearchBudget &budget = SearchBudget(), std::vector<uint8_t> *exact = nullptr) {
+
+        if (isEmpty()) {
+            throw std::runtime_error("index must be first initialized with .set() function and non empty dataset");
+        }
+        checkQueryDims(queries);
+        const float pruneScale = approximationScale(epsilon);
 
         // we must return one result per queries
         indices.resize(queries.size());
         distances.resize(queries.size());
+        if (exact) exact->assign(queries.size(), 1);
 
 #if (ENABLE_OMP_PARALLEL)
 #pragma omp parallel for schedule(dynamic) if (queries.size() > 1)
 #endif
         // i should be size_t, see above
         for (int i = 0; i < static_cast<int>(queries.size()); ++i) {
-            const T &query = queries[i];
+            const Query &query = asQuery(queries[i]);
             distance_type dist = 0;
             int64_t index = -1;
-            search1NN(_rootIdx, query, index, dist);
-            distances[i] = dist;
+            const bool complete = search1NN(_rootIdx, query, index, dist, pruneScale, budget);
+            if (exact) (*exact)[i] = complete ? 1 : 0;
+            distances[i] = reportedDistance(dist);
             indices[i] = index;
         }
     }
 
-    const std::vector<float>& flatBacking() const { return _flat_backing; }
+    /*
+     * All points within radius (inclusive) of each query.  Pruning uses the same median-radius
+     * bounds as searchKNN with the fixed query radius in place of tau.  maxResults > 0 keeps
+     * only the maxResults nearest points of each query.
+     */
+    template <typename P>
+    void searchRadius(const std::vector<P> &queries, distance_type radius, VPTreeRadiusSearchResult &result,
+                      size_t maxResults = 0) {
+
+        if (isEmpty()) {
+            throw std::runtime_error("index must be first initialized with .set() function and non empty dataset");
+        }
+        checkQueryDims(queries);
+        if (radius < 0) {
+            throw std::invalid_argument("radius must be non-negative");
+        }
+
+        // radius in the units the tree stores
+        distance_type treeRadius = radius;
+        if constexpr (distance_traits<distance>::squared) treeRadius = radius * radius;
+
+        std::vector<std::vector<VPTreeSearchElement>> perQuery(queries.size());
+
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(dynamic) if (queries.size() > 1)
+#endif
+        // i should be size_t, see above
+        for (int i = 0; i < static_cast<int>(queries.size()); ++i) {
+            std::vector<VPTreeSearchElement> &found = perQuery[i];
+            searchRadius(_rootIdx, asQuery(queries[i]), treeRadius, found);
+
+            std::sort(found.begin(), found.end(), [](const VPTreeSearchElement &a, const VPTreeSearchElement &b) {
+                return a.dist < b.dist || (a.dist == b.dist && a.index < b.index);
+            });
+            if (maxResults > 0 && found.size() > maxResults) found.erase(found.begin() + maxResults, found.end());
+        }
+
+        result.offsets.assign(queries.size() + 1, 0);
+        for (size_t i = 0; i < queries.size(); ++i)
+            result.offsets[i + 1] = result.offsets[i] + (int64_t)perQuery[i].size();
+
+        result.indexes.resize(result.offsets.back());
+        result.distances.resize(result.offsets.back());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            int64_t out = result.offsets[i];
+            for (const VPTreeSearchElement &e : perQuery[i]) {
+                result.indexes[out] = e.index;
+                result.distances[out] = reportedDistance(e.dist);
+                ++out;
+            }
+        }
+    }
+
+    /*
+     * Inserts points without rebuilding the tree and returns their ids, which continue after
+     * the largest id in use.  Each point is routed down the vantage point splits to the leaf
+     * it falls into; every touched leaf is rebuilt with its new points (splitting when it
+     * outgrows the leaf size) and written to the end of the store.  Whenever this leaves an
+     * ancestor partition unbalanced, the highest such partition is rebuilt locally, scapegoat
+     * style, so the cost of an update follows the size of the change rather than of the index.
+     *
+     * Like set(), add() and remove() must not run concurrently with searches; the Python
+     * adapters hold their writer lock around them.
+     */
+    template <typename P> std::vector<int64_t> add(const std::vector<P> &points) {
+        std::vector<int64_t> ids(points.size());
+        if (points.empty()) return ids;
+
+        if constexpr (FLAT_ROWS) {
+            const size_t dim = (_dim > 0) ? _dim : points[0].size();
+            for (const P &point : points) {
+                if (point.size() != dim) throw std::invalid_argument("added points must match the index dimension");
+            }
+        }
+        if (numPositions() == 0 && _nextId == 0) {
+            set(points);
+            std::iota(ids.begin(), ids.end(), 0);
+            return ids;
+        }
+        if constexpr (FLAT_ROWS) {
+            if (_dim == 0) _dim = points[0].size();
+        }
+        ensureUpdateIndex();
+
+        // Items name points for buildSubtree: trees with flat rows use tree positions for stored points
+        // and -(i + 1) for points[i]; other trees use the _examples index, which is also the id.
+        const int32_t firstId = _nextId;
+        _nextId += (int32_t)points.size();
+        _numLive += (int64_t)points.size();
+        _update.positionOf.resize(_nextId, -1);
+        for (size_t i = 0; i < points.size(); i++) {
+            ids[i] = firstId + (int64_t)i;
+            if constexpr (!FLAT_ROWS) {
+                static_assert(std::is_same_v<P, T>, "points must be of the tree point type");
+                _examples.push_back(points[i]);
+            }
+        }
+        auto itemOfNew = [&](size_t i) -> int32_t {
+            if constexpr (FLAT_ROWS) {
+                return -(int32_t)i - 1;
+            } else {
+                return firstId + (int32_t)i;
+            }
+        };
+        auto fetch = [&](int32_t item) -> decltype(auto) {
+            if constexpr (FLAT_ROWS) {
+                return item >= 0 ? example(item) : asQuery(points[-item - 1]);
+            } else {
+                return example(item);
+            }
+        };
+        auto idOf = [&](int32_t item) -> int32_t {
+            if constexpr (FLAT_ROWS) {
+                return item >= 0 ? _indices[item] : firstId - item - 1;
+            } else {
+                return item;
+            }
+        };
+
+        // Route every point to the slot, (parent, side), of the leaf or missing child it falls into
+        std::vector<std::pair<int64_t, int32_t>> routed(points.size());
+#if (ENABLE_OMP_PARALLEL)
+#pragma omp parallel for schedule(static) if (points.size() > 64)
+#endif
+        for (int i = 0; i < static_cast<int>(points.size()); ++i) {
+            routed[i] = {routeToSlot(asQuery(points[i])), i};
+        }
+        std::sort(routed.begin(), routed.end());
+
+        std::vector<int32_t> touched;
+        for (size_t first = 0; first < routed.size();) {
+            size_t last = first;
+            while (last < routed.size() && routed[last].first == routed[first].first) ++last;
+
+            const int32_t parent = slotParent(routed[first].first);
+            const int side = slotSide(routed[first].first);
+            const int32_t leaf = childAt(parent, side);
+
+            std::vector<int32_t> items;
+            if (leaf >= 0) collectLiveItems(leaf, items);
+            for (size_t r = first; r < last; r++) items.push_back(itemOfNew(routed[r].second));
+
+            replaceSubtree(parent, side, leaf, items, fetch, idOf);
+            if (parent >= 0) touched.push_back(parent);
+            first = last;
+        }
+
+        rebalance(touched);
+        return ids;
+    }
+
+    /*
+     * Deletes points by id.  Removed points become tombstones that searches skip; a vantage
+     * point keeps routing queries after its removal.  Once more than half of a partition is
+     * tombstones, the highest such partition is rebuilt from its live points.  Throws
+     * std::invalid_argument, leaving the index unchanged, when an id is not in the index.
+     */
+    void remove(const std::vector<int64_t> &ids) {
+        if (ids.empty()) return;
+        ensureUpdateIndex();
+
+        for (int64_t id : ids) {
+            if (id < 0 || id >= (int64_t)_update.positionOf.size() || _update.positionOf[id] < 0)
+                throw std::invalid_argument("id " + std::to_string(id) + " is not in the index");
+        }
+
+        int32_t *indices = _indices.mutableData();
+        std::vector<int32_t> touched;
+        for (int64_t id : ids) {
+            const int32_t pos = _update.positionOf[id];
+            if (pos < 0) continue; // repeated id
+            indices[pos] = tombstone((int32_t)id);
+            _update.positionOf[id] = -1;
+            --_numLive;
+            for (int32_t node = _update.nodeOf[pos]; node >= 0; node = _update.parentOf[node])
+                _update.subtreeDead[node]++;
+            touched.push_back(_update.nodeOf[pos]);
+        }
+
+        rebalance(touched);
+    }
+
+    /*
+     * Rewrites the tree from its live points, dropping tombstones and the storage left behind
+     * by local rebuilds.  add() and remove() call it once that storage outgrows the live points.
+     */
+    void compact() {
+        _splitImbalance = 0;
+        std::vector<int32_t> items;
+        if (_rootIdx >= 0) collectLiveItems(_rootIdx, items);
+
+        std::vector<VPLevelPartition<distance_type>> pool;
+        if constexpr (FLAT_ROWS) {
+            // gather the live rows, then partition them in place as set() does
+            std::vector<int32_t> ids(items.size());
+            typename FlatStore::vector_type flat(items.size() * _dim);
+            for (size_t j = 0; j < items.size(); j++) {
+                ids[j] = _indices[items[j]];
+                std::memcpy(flat.data() + j * _dim, example(items[j]).ptr, _dim * sizeof(Scalar));
+            }
+            _flat_backing = std::move(flat);
+            if (!ids.empty()) buildFlatRows(ids, pool);
+            _indices = std::move(ids);
+        } else {
+            if (!items.empty()) {
+                buildSubtree(items, pool, [this](int32_t i) -> decltype(auto) { return example(i); });
+            }
+            _indices = std::move(items);
+        }
+        _rootIdx = pool.empty() ? -1 : 0;
+        _nodePool = std::move(pool);
+        _update = UpdateIndex();
+    }
+
+    const FlatStore& flatBacking() const { return _flat_backing; }
     size_t flatDim() const { return _dim; }
-    const std::vector<int32_t>& indexPermutation() const { return _indices; }
-    const std::vector<VPLevelPartition<distance_type>>& partitionPool() const { return _nodePool; }
+    const ArrayStore<int32_t>& indexPermutation() const { return _indices; }
+    const ArrayStore<VPLevelPartition<distance_type>>& partitionPool() const { return _nodePool; }
     int32_t rootPartitionIdx() const { return _rootIdx; }
 
-    void initFromSerialized(std::vector<float> flat, size_t dim,
-                            std::vector<int32_t> indices,
-                            std::vector<VPLevelPartition<distance_type>> pool,
-                            int32_t root_idx) {
+    /*
+     * Restores a FlatSpan tree from its serialized parts.  flat is already in tree-traversal
+     * order.  Each part may own its elements or borrow them from a memory-mapped file.
+     * next_id (0 when unknown) keeps ids of removed points from being handed out again.
+     */
+    void initFromSerialized(ArrayStore<float> flat, size_t dim, ArrayStore<int32_t> indices,
+                            ArrayStore<VPLevelPartition<distance_type>> pool, int32_t root_idx,
+                            int64_t next_id = 0) {
+        static_assert(std::is_same_v<T, FlatSpan>, "initFromSerialized only restores FlatSpan trees");
         clear();
         _flat_backing = std::move(flat);
         _dim = dim;
-        size_t n = (dim > 0) ? _flat_backing.size() / dim : 0;
-        _examples.resize(n);
-        if constexpr (std::is_same_v<T, FlatSpan>) {
-            // After serialization, _flat_backing is already in tree-traversal order.
-            // _examples[i] points directly to position i in the tree.
-            for (size_t i = 0; i < n; i++)
-                _examples[i] = FlatSpan{_flat_backing.data() + i * dim, dim};
-        }
         _indices = std::move(indices);
         _nodePool = std::move(pool);
         _rootIdx = root_idx;
+        recountPoints();
+        _nextId = std::max<int32_t>(_nextId, (int32_t)next_id);
     }
 
+    // id of the next added point; saved alongside the tree so ids are never reused
+    int32_t nextId() const { return _nextId; }
+
     friend std::ostream &operator<<(std::ostream &os, const VPTree<T, distance_type, distance> &vptree) {
         os << "####################" << std::endl;
         os << "# [VPTree state]" << std::endl;
-        os << "Num Data Points: " << vptree._examples.size() << std::endl;
+        os << "Num Data Points: " << vptree.size() << std::endl;
+        os << "Leaf Size: " << vptree._leafSize << std::endl;
 
         int64_t total_memory = 0;
         if (vptree._rootIdx != -1) {
-            total_memory = vptree._nodePool[vptree._rootIdx].numSubnodes(vptree._nodePool) * sizeof(VPLevelPartition<distance_type>) + vptree._examples.size() * sizeof(T);
+            total_memory = vptree._nodePool[vptree._rootIdx].numSubnodes(vptree._nodePool) * sizeof(VPLevelPartition<distance_type>) + vptree.numPoints() * sizeof(T);
         }
         os << "Total Memory: " << total_memory << " bytes" << std::endl;
         os << "####################" << std::endl;
         os << "[+] Root Level:" << std::endl;
         if (vptree._rootIdx != -1) {
-            total_memory = vptree._nodePool[vptree._rootIdx].numSubnodes(vptree._nodePool) * sizeof(VPLevelPartition<distance_type>) + vptree._examples.size() * sizeof(T);
+            total_memory = vptree._nodePool[vptree._rootIdx].numSubnodes(vptree._nodePool) * sizeof(VPLevelPartition<distance_type>) + vptree.numPoints() * sizeof(T);
             rec_print_state<distance_type>(os, vptree._nodePool, vptree._rootIdx, 0);
             os << std::endl;
         } else {
@@ -241,178 +763,1004 @@ public:
 
 protected:
     /*
-     *  Builds a Vantage Point tree using a level-parallel BFS strategy.
+     *  Builds a Vantage Point tree with recursive OpenMP tasks.
      *
-     *  All nodes at the same tree depth are processed concurrently:
-     *  - Each worker thread owns its distPairs scratch buffer (thread_local)
-     *    so nth_element calls across sibling partitions run in parallel.
-     *  - Child nodePool slots are pre-assigned via prefix-sum before the
-     *    parallel region, so _nodePool is never mutated during parallel work.
-     *  - _indices ranges are disjoint per partition → no write races.
+     *  - Partitions of at least _sampledSplit points are split first, top down, at a sampled
+     *    median (see splitSampled()).  Below them partition ranges and child slots depend only
+     *    on the partition size and _leafSize, so each remaining subtree is laid out (breadth
+     *    first) before any of its distances is measured.
+     *  - Each split writes a disjoint range of _indices and its own pool slot, and its two
+     *    halves become independent tasks: idle threads pick up subtrees as soon as they exist,
+     *    with no barrier between tree levels.
+     *  - Partitions of PAR_SPLIT points or more also spread their distance loop over the
+     *    team, which keeps every thread busy on the first few levels.
      *  - selectVantagePoint uses a thread_local RNG → race-free.
+     *
+     *  - Narrow flat rows in a store much larger than the cache are moved with their ids at
+     *    every split, like an in-place quickselect: each partition is one contiguous block, so
+     *    lower levels stream through memory instead of gathering rows from all over it.  See
+     *    buildFlatRows().
+     *
+     *  Without OpenMP tasks (MSVC /openmp) the pool is split one level at a time instead.
+     *  Partitions of at most _leafSize points become leaf buckets and are not split.
      */
-    void build(const std::vector<T> &array) {
+    void build() {
 
-        const int32_t n = (int32_t)_examples.size();
+        const int32_t n = (int32_t)numPoints();
         if (n == 0) return;
 
-        _indices.resize(n);
-        std::iota(_indices.begin(), _indices.end(), 0);
+        std::vector<int32_t> indices(n);
+        std::iota(indices.begin(), indices.end(), 0);
 
-        _nodePool.clear();
-        _nodePool.reserve(n);
-        _nodePool.push_back(VPLevelPartition<distance_type>(0, 0, n - 1));
+        std::vector<VPLevelPartition<distance_type>> pool;
+        if constexpr (FLAT_ROWS) {
+            buildFlatRows(indices, pool);
+        } else {
+            buildSubtree(indices, pool, [this](int32_t i) -> decltype(auto) { return example(i); });
+        }
+        adoptBuild(std::move(indices), std::move(pool));
+    }
+
+    // Installs the result of a full build over ids 0 .. indices.size()
+    void adoptBuild(std::vector<int32_t> &&indices, std::vector<VPLevelPartition<distance_type>> &&pool) {
+        const int32_t n = (int32_t)indices.size();
+        _indices = std::move(indices);
+        _nodePool = std::move(pool);
         _rootIdx = 0;
+        _numLive = n;
+        _nextId = n;
+        _update = UpdateIndex();
+    }
+
+    /*
+     * The build() loop over an arbitrary set of points: items are opaque handles resolved by
+     * fetch(item) to a T (or a view of one).  On return items is permuted into tree order and
+     * pool holds the partitions, root first, with ranges over positions [0, items.size()).
+     */
+    template <typename Fetch>
+    void buildSubtree(std::vector<int32_t> &indices, std::vector<VPLevelPartition<distance_type>> &pool,
+                      const Fetch &fetch) {
+        buildPartitions(pool, ItemPoints<Fetch>{indices, fetch});
+    }
 
-        struct WorkItem { int32_t nodeIdx, start, end; };
-        std::vector<WorkItem> current;
-        current.push_back({0, 0, n - 1});
-
-        while (!current.empty()) {
-            const int32_t nItems = (int32_t)current.size();
-
-            // --- Pre-assign child nodePool slots (serial, O(nItems)) ---
-            // Ranges are determined by (start,end) alone — independent of
-            // nth_element outcome — so we can assign before the parallel work.
-            std::vector<int32_t> leftSlot(nItems, -1), rightSlot(nItems, -1);
-            {
-                int32_t nextSlot = (int32_t)_nodePool.size();
-                for (int32_t i = 0; i < nItems; i++) {
-                    const int32_t s = current[i].start, e = current[i].end;
-                    if (s == e) continue;
-                    const int32_t median = (s + e) / 2;
-                    if (s + 1   <= median) leftSlot[i]  = nextSlot++;
-                    if (median + 1 <= e)   rightSlot[i] = nextSlot++;
+    // Rows moved in place by build() are at most this wide, in a store at least this large
+    static constexpr size_t ROW_MOVE_MAX_BYTES = 128;
+    static constexpr size_t ROW_MOVE_MIN_STORE = size_t(64) << 20;
+
+    bool movesRows(size_t n) const {
+        const size_t rowBytes = _dim * sizeof(Scalar);
+        return rowBytes <= ROW_MOVE_MAX_BYTES && n * rowBytes >= ROW_MOVE_MIN_STORE;
+    }
+
+    /*
+     * Builds the partitions over the rows of _flat_backing, where row i belongs to ids[i], and
+     * leaves both in tree order.  Narrow rows of a large store are partitioned in place: every
+     * split streams through its own block, where gathering them by id would miss the cache and
+     * the TLB on almost every row.  Wider rows, or a store that fits in cache, are cheaper to
+     * gather by id and permute once at the end: the gather then streams whole cache lines,
+     * while moving rows at every level costs more bandwidth than it saves.
+     */
+    void buildFlatRows(std::vector<int32_t> &ids, std::vector<VPLevelPartition<distance_type>> &pool) {
+        if (movesRows(ids.size())) {
+            buildPartitions(pool, RowPoints{ids, _flat_backing.mutableData(), _dim});
+            return;
+        }
+
+        std::vector<int32_t> rows(ids.size());
+        std::iota(rows.begin(), rows.end(), 0);
+        buildSubtree(rows, pool, [this](int32_t i) -> decltype(auto) { return example(i); });
+        reorderRows(rows);
+        for (int32_t &row : rows) row = ids[row];
+        ids = std::move(rows);
+    }
+
+    /*
+     * How a build reaches the point at a position and moves it.  ItemPoints permutes opaque
+     * items and resolves them through fetch; RowPoints permutes flat rows of the store along
+     * with their ids, so a partition's points are always the rows of its range.
+     */
+    template <typename Fetch> struct ItemPoints {
+        static constexpr bool MOVES_ROWS = false;
+        std::vector<int32_t> &items;
+        const Fetch &fetch;
+
+        int32_t size() const { return (int32_t)items.size(); }
+        decltype(auto) at(int32_t pos) const { return fetch(items[pos]); }
+        void swap(int32_t a, int32_t b) const { std::swap(items[a], items[b]); }
+    };
+
+    struct RowPoints {
+        static constexpr bool MOVES_ROWS = true;
+        std::vector<int32_t> &ids;
+        Scalar *rows;
+        size_t dim;
+
+        int32_t size() const { return (int32_t)ids.size(); }
+        RowView at(int32_t pos) const { return RowView{rows + (size_t)pos * dim, dim}; }
+        void swap(int32_t a, int32_t b) const {
+            std::swap(ids[a], ids[b]);
+            std::swap_ranges(rows + (size_t)a * dim, rows + (size_t)(a + 1) * dim, rows + (size_t)b * dim);
+        }
+    };
+
+    // Lays out the partitions of points in pool and splits them; see build()
+    template <typename Points>
+    void buildPartitions(std::vector<VPLevelPartition<distance_type>> &pool, const Points &points) {
+
+        const int32_t n = points.size();
+        pool.clear();
+        pool.reserve(2 * (size_t)n / _leafSize + 1);
+        pool.push_back(VPLevelPartition<distance_type>(0, 0, n - 1));
+
+#if PYNEAR_OMP_TASKS
+#pragma omp parallel if (n > TASK_CUTOFF)
+#pragma omp single
+        {
+            const std::vector<int32_t> roots = splitSampled(pool, points);
+            for (int32_t root : roots) layoutBelow(pool, root);
+            for (int32_t root : roots) {
+#pragma omp task default(shared) firstprivate(root) if (pool[root].size() > TASK_CUTOFF)
+                splitTask(pool, root, points);
+            }
+        }
+#else
+        for (int32_t root : splitSampled(pool, points)) {
+            for (const auto &level : layoutBelow(pool, root)) {
+                const int32_t from = level.first, to = level.second;
+#if ENABLE_OMP_PARALLEL
+#pragma omp parallel for schedule(dynamic) if (to - from > 1)
+#endif
+                for (int32_t nodeIdx = from; nodeIdx < to; nodeIdx++) {
+                    splitPartition(pool[nodeIdx], points);
                 }
-                _nodePool.resize(nextSlot); // default-init; written in parallel below
             }
+        }
+#endif
+    }
 
-            // Pre-build the next-level work list (ranges known before nth_element).
-            std::vector<WorkItem> next;
-            next.reserve(2 * nItems);
-            for (int32_t i = 0; i < nItems; i++) {
-                const int32_t s = current[i].start, e = current[i].end;
-                if (s == e) continue;
+    // Partitions larger than this are split by a task of their own; smaller ones run inline
+    static constexpr int32_t TASK_CUTOFF = 2048;
+    // Partitions of at least this many points measure their distances on the whole team
+    static constexpr int32_t PAR_SPLIT = 32768;
+    // Points per block of a sampled split's streaming pass
+    static constexpr int32_t SPLIT_BLOCK = 65536;
+
+    /*
+     * Lays out the exact partitions under pool[root], breadth first with radius 0: each node's
+     * range and child slots, appended to pool.  Returns the slot range of every level.
+     */
+    std::vector<std::pair<int32_t, int32_t>> layoutBelow(std::vector<VPLevelPartition<distance_type>> &pool,
+                                                         int32_t root) const {
+        std::vector<std::pair<int32_t, int32_t>> levels = {{root, root + 1}};
+        for (int32_t from = root, to = root + 1; from < to;) {
+            const int32_t next = (int32_t)pool.size();
+            for (int32_t i = from; i < to; i++) {
+                const int32_t s = pool[i].start(), e = pool[i].end();
+                if (e - s + 1 <= _leafSize) continue;
                 const int32_t median = (s + e) / 2;
-                if (leftSlot[i]  >= 0) next.push_back({leftSlot[i],  s + 1,      median});
-                if (rightSlot[i] >= 0) next.push_back({rightSlot[i], median + 1, e});
+                int32_t left = -1, right = -1;
+                if (s + 1 <= median) {
+                    left = (int32_t)pool.size();
+                    pool.push_back(VPLevelPartition<distance_type>(0, s + 1, median));
+                }
+                if (median + 1 <= e) {
+                    right = (int32_t)pool.size();
+                    pool.push_back(VPLevelPartition<distance_type>(0, median + 1, e));
+                }
+                pool[i].setChildIdx(left, right);
             }
+            from = next;
+            to = (int32_t)pool.size();
+            if (from < to) levels.push_back({from, to});
+        }
+        return levels;
+    }
 
-            // --- Process all items at this level in parallel ---
-            // Each item writes to a disjoint slice of _indices and to
-            // pre-assigned, non-overlapping slots in _nodePool → no races.
-#if ENABLE_OMP_PARALLEL
-            #pragma omp parallel for schedule(dynamic) if(nItems > 1)
+    /*
+     * Splits pool[0] and its descendants top down while they hold at least _sampledSplit points,
+     * appending their children to pool.  Returns the slots of the partitions left to split
+     * exactly, in pool order.
+     */
+    template <typename Points>
+    std::vector<int32_t> splitSampled(std::vector<VPLevelPartition<distance_type>> &pool, const Points &points) {
+        std::vector<int32_t> exactRoots;
+        for (int32_t slot = 0; slot < (int32_t)pool.size(); slot++) {
+            const int32_t start = pool[slot].start(), end_ = pool[slot].end();
+            const int32_t size = end_ - start + 1;
+            if (_sampledSplit == 0 || size < _sampledSplit || size <= _leafSize) {
+                exactRoots.push_back(slot);
+                continue;
+            }
+
+            distance_type radius = 0;
+            int32_t last = splitAtSampledMedian(points, start, end_, radius);
+            const bool sampled = last >= 0;
+            if (!sampled) last = (start + end_) / 2;
+
+            int32_t left = -1, right = -1;
+            if (start + 1 <= last) {
+                left = (int32_t)pool.size();
+                pool.push_back(VPLevelPartition<distance_type>(0, start + 1, last));
+            }
+            if (last + 1 <= end_) {
+                right = (int32_t)pool.size();
+                pool.push_back(VPLevelPartition<distance_type>(0, last + 1, end_));
+            }
+            pool[slot].setChildIdx(left, right);
+
+            if (sampled) {
+                pool[slot].setRadius(radius);
+                const float imbalance = std::abs((float)(last - start) - (float)(end_ - last)) / (float)(end_ - start);
+                _splitImbalance = std::max(_splitImbalance, imbalance);
+            } else {
+                splitPartition(pool[slot], points);
+            }
+        }
+        return exactRoots;
+    }
+
+    /*
+     * Picks a vantage point for [start, end] and moves the points nearer than a median radius
+     * estimated from SPLIT_SAMPLE random distances in front of the others.  Blocks of the range
+     * are partitioned in parallel, measuring each point once, and the far points left of the
+     * boundary then trade places with the near points right of it, so no per-point scratch is
+     * allocated.  Returns the last near position, or -1 when the split is more unbalanced than
+     * MAX_SPLIT_IMBALANCE (the points are then left permuted but unsplit).
+     */
+    template <typename Points>
+    int32_t splitAtSampledMedian(const Points &points, int32_t start, int32_t end_, distance_type &radius) {
+        points.swap(selectVantagePoint(points, start, end_), start);
+        const auto &vp = points.at(start);
+        const int32_t first = start + 1;
+        const int32_t count = end_ - start;
+
+        thread_local std::mt19937 tl_rng{std::random_device{}()};
+        std::uniform_int_distribution<int32_t> uni(first, end_);
+        std::vector<distance_type> sample(SPLIT_SAMPLE);
+        for (distance_type &d : sample) d = measure(vp, points.at(uni(tl_rng)));
+        std::nth_element(sample.begin(), sample.begin() + SPLIT_SAMPLE / 2, sample.end());
+        radius = sample[SPLIT_SAMPLE / 2];
+
+        // Ties at the radius go to the side that balances the sample better; with coarse
+        // distances (e.g. Hamming) they can be a large share of the points.
+        const auto below = std::count_if(sample.begin(), sample.end(), [&](distance_type d) { return d < radius; });
+        const auto upTo = std::count_if(sample.begin(), sample.end(), [&](distance_type d) { return d <= radius; });
+        const bool tiesNear = std::abs(2 * upTo - SPLIT_SAMPLE) < std::abs(2 * below - SPLIT_SAMPLE);
+        const distance_type r = radius;
+        auto isNear = [&](int32_t pos) {
+            const distance_type d = measure(vp, points.at(pos));
+            return tiesNear ? d <= r : d < r;
+        };
+        auto swapAt = [&](int32_t a, int32_t b) { points.swap(a, b); };
+
+        const int32_t numBlocks = (count + SPLIT_BLOCK - 1) / SPLIT_BLOCK;
+        std::vector<int32_t> nearCount(numBlocks);
+        forEachIndex(true, numBlocks, [&](int32_t b) {
+            const int32_t from = first + b * SPLIT_BLOCK;
+            const int32_t to = std::min(from + SPLIT_BLOCK, end_ + 1);
+            nearCount[b] = partitionBy(from, to, isNear, swapAt) - from;
+        }, 1);
+
+        int32_t boundary = first;
+        for (int32_t c : nearCount) boundary += c;
+
+        // Runs of far points left of the boundary and of near points right of it; both hold
+        // the same number of positions
+        using Runs = std::vector<std::pair<int32_t, int32_t>>;
+        Runs farLeft, nearRight;
+        for (int32_t b = 0; b < numBlocks; b++) {
+            const int32_t from = first + b * SPLIT_BLOCK;
+            const int32_t to = std::min(from + SPLIT_BLOCK, end_ + 1);
+            const int32_t cut = from + nearCount[b];
+            if (cut < boundary && cut < to) farLeft.push_back({cut, std::min(to, boundary)});
+            if (cut > boundary && from < cut) nearRight.push_back({std::max(from, boundary), cut});
+        }
+        auto offsets = [](const Runs &runs) {
+            std::vector<int64_t> offset(runs.size() + 1, 0);
+            for (size_t i = 0; i < runs.size(); i++) offset[i + 1] = offset[i] + (runs[i].second - runs[i].first);
+            return offset;
+        };
+        const std::vector<int64_t> farOffset = offsets(farLeft), nearOffset = offsets(nearRight);
+        // the k-th position of runs, and the ones after it in order
+        struct RunCursor {
+            const Runs &runs;
+            size_t run;
+            int32_t pos;
+            RunCursor(const Runs &runs, const std::vector<int64_t> &offset, int64_t k) : runs(runs) {
+                run = std::upper_bound(offset.begin(), offset.end(), k) - offset.begin() - 1;
+                pos = runs[run].first + (int32_t)(k - offset[run]);
+            }
+            int32_t next() {
+                const int32_t current = pos++;
+                if (pos == runs[run].second && run + 1 < runs.size()) pos = runs[++run].first;
+                return current;
+            }
+        };
+        const int64_t misplaced = farOffset.back();
+        const int32_t numChunks = (int32_t)((misplaced + SPLIT_BLOCK - 1) / SPLIT_BLOCK);
+        forEachIndex(true, numChunks, [&](int32_t c) {
+            const int64_t k = (int64_t)c * SPLIT_BLOCK;
+            RunCursor far(farLeft, farOffset, k), near(nearRight, nearOffset, k);
+            for (int64_t i = k; i < std::min<int64_t>(misplaced, k + SPLIT_BLOCK); i++) points.swap(far.next(), near.next());
+        }, 1);
+
+        const int32_t nearTotal = boundary - first;
+        if (std::abs(2 * (int64_t)nearTotal - count) > MAX_SPLIT_IMBALANCE * count) return -1;
+        return boundary - 1;
+    }
+
+#if PYNEAR_OMP_TASKS
+    // Splits pool[nodeIdx], then its children as tasks; runs inside a single region
+    template <typename Points>
+    void splitTask(std::vector<VPLevelPartition<distance_type>> &pool, int32_t nodeIdx, const Points &points) {
+        VPLevelPartition<distance_type> &node = pool[nodeIdx];
+        if (node.isLeaf()) return;
+
+        splitPartition(node, points);
+        for (int32_t child : {node.left_idx(), node.right_idx()}) {
+            if (child < 0) continue;
+#pragma omp task default(shared) firstprivate(child) if (pool[child].size() > TASK_CUTOFF)
+            splitTask(pool, child, points);
+        }
+    }
 #endif
-            for (int32_t i = 0; i < nItems; i++) {
-                const int32_t nodeIdx = current[i].nodeIdx;
-                const int32_t start   = current[i].start;
-                const int32_t end_    = current[i].end;
 
-                if (start == end_) continue;
+    /*
+     * Moves a vantage point to the front of node's range and splits the rest around the median
+     * distance to it: the near half fills the left child's range, the far half the right's.
+     * Leaves are left as they are.
+     */
+    template <typename Points> void splitPartition(VPLevelPartition<distance_type> &node, const Points &points) {
+        if (node.isLeaf()) return;
+
+        const int32_t start = node.start();
+        const int32_t end_  = node.end();
+
+        points.swap(selectVantagePoint(points, start, end_), start);
+
+        const int32_t median        = (start + end_) / 2;
+        const int32_t range_size    = end_ - start;
+        const int32_t medianInPairs = median - start - 1;
+        if (medianInPairs < 0) return;
+
+        // Large partitions share their scratch with the team, small ones use their thread's.
+        // Nothing between filling and reading the thread_local buffers can schedule a task.
+        const bool onTeam = range_size >= PAR_SPLIT;
+        const auto &vp = points.at(start);
+        auto distanceAt = [&](int32_t ci) { return measure(vp, points.at(start + 1 + ci)); };
+
+        if constexpr (Points::MOVES_ROWS) {
+            thread_local std::vector<distance_type> tl_dist, tl_sorted;
+            std::vector<distance_type> teamDist, teamSorted;
+            std::vector<distance_type> &dist = onTeam ? teamDist : tl_dist;
+            std::vector<distance_type> &sorted = onTeam ? teamSorted : tl_sorted;
+            dist.resize(range_size);
+            forEachIndex(onTeam, range_size, [&](int32_t ci) { dist[ci] = distanceAt(ci); });
+
+            sorted.assign(dist.begin(), dist.end());
+            selectNth(onTeam, sorted, medianInPairs, std::less<distance_type>());
+            const distance_type medianDistance = sorted[medianInPairs];
+
+            // Rows nearer than the median go first, then ties, so the left child's range holds
+            // medianInPairs + 1 rows within medianDistance and the right child's the rest.
+            auto swapAt = [&](int32_t a, int32_t b) {
+                std::swap(dist[a], dist[b]);
+                points.swap(start + 1 + a, start + 1 + b);
+            };
+            const int32_t nearer =
+                partitionBy(0, range_size, [&](int32_t ci) { return dist[ci] < medianDistance; }, swapAt);
+            partitionBy(nearer, range_size, [&](int32_t ci) { return dist[ci] == medianDistance; }, swapAt);
+
+            node.setRadius(medianDistance);
+        } else {
+            thread_local std::vector<std::pair<distance_type, int32_t>> tl_distPairs;
+            std::vector<std::pair<distance_type, int32_t>> teamDistPairs;
+            std::vector<std::pair<distance_type, int32_t>> &distPairs = onTeam ? teamDistPairs : tl_distPairs;
+            distPairs.resize(range_size);
+            forEachIndex(onTeam, range_size, [&](int32_t ci) {
+                distPairs[ci] = {distanceAt(ci), points.items[start + 1 + ci]};
+            });
+
+            selectNth(onTeam, distPairs, medianInPairs, [](const auto &a, const auto &b) { return a.first < b.first; });
 
-                const int32_t vpIndex = selectVantagePoint(start, end_);
-                std::swap(_indices[vpIndex], _indices[start]);
+            for (int32_t ci = 0; ci < range_size; ci++)
+                points.items[start + 1 + ci] = distPairs[ci].second;
 
-                const int32_t median        = (start + end_) / 2;
-                const int32_t range_size    = end_ - start;
-                const int32_t medianInPairs = median - start - 1;
+            node.setRadius(distPairs[medianInPairs].first);
+        }
+    }
 
-                distance_type medianDistance = 0;
-                if (medianInPairs >= 0) {
-                    const auto &vp = _examples[_indices[start]];
+    // f(i) for i in [0, n), spread over the team in tasks of grain indices when onTeam
+    template <typename F>
+    static void forEachIndex(bool onTeam, int32_t n, const F &f, [[maybe_unused]] int32_t grain = 4096) {
+        if (onTeam) {
+#if PYNEAR_OMP_TASKS
+#pragma omp taskloop grainsize(grain) default(shared)
+#elif ENABLE_OMP_PARALLEL
+#pragma omp parallel for schedule(static)
+#endif
+            for (int32_t i = 0; i < n; i++) f(i);
+        } else {
+            for (int32_t i = 0; i < n; i++) f(i);
+        }
+    }
 
+    // nth_element of values at nth; with the team in use, TBB's parallel one where available
+    template <typename V, typename Less>
+    static void selectNth([[maybe_unused]] bool onTeam, std::vector<V> &values, int32_t nth, const Less &less) {
 #if ENABLE_OMP_PARALLEL && USE_PSTL_NTH_ELEMENT
-                    // Linux only: TBB provides std::execution::par_unseq.
-                    // At level 0 (not yet inside a parallel region) and for large
-                    // partitions, use a local shared buffer so OMP threads can all
-                    // write into it, then use TBB par_unseq for nth_element.
-                    // For inner nodes (already inside OMP parallel for), use a
-                    // thread_local buffer — each thread processes its own partition
-                    // entirely, so no sharing is needed.
-                    constexpr int32_t PAR_THRESHOLD = 4096;
-                    if (!omp_in_parallel() && range_size >= PAR_THRESHOLD) {
-                        std::vector<std::pair<distance_type, int32_t>> distPairs(range_size);
-
-                        #pragma omp parallel for schedule(static)
-                        for (int32_t ci = 0; ci < range_size; ci++) {
-                            const int32_t exIdx = _indices[start + 1 + ci];
-                            distPairs[ci] = {distance(vp, _examples[exIdx]), exIdx};
-                        }
-
-                        std::nth_element(std::execution::par_unseq,
-                                         distPairs.begin(),
-                                         distPairs.begin() + medianInPairs,
-                                         distPairs.begin() + range_size,
-                                         [](const auto &a, const auto &b) { return a.first < b.first; });
-
-                        for (int32_t ci = 0; ci < range_size; ci++)
-                            _indices[start + 1 + ci] = distPairs[ci].second;
-
-                        medianDistance = distPairs[medianInPairs].first;
-                    } else
+        // Linux only: TBB provides std::execution::par_unseq.
+        if (onTeam) {
+            std::nth_element(std::execution::par_unseq, values.begin(), values.begin() + nth, values.end(), less);
+            return;
+        }
 #endif
-                    {
-                        // Thread-local scratch: each thread owns its own full partition,
-                        // so there are no write conflicts between concurrent threads.
-                        thread_local std::vector<std::pair<distance_type, int32_t>> tl_distPairs;
-                        tl_distPairs.resize(range_size);
-
-                        for (int32_t ci = 0; ci < range_size; ci++) {
-                            const int32_t exIdx = _indices[start + 1 + ci];
-                            tl_distPairs[ci] = {distance(vp, _examples[exIdx]), exIdx};
-                        }
-
-                        std::nth_element(tl_distPairs.begin(),
-                                         tl_distPairs.begin() + medianInPairs,
-                                         tl_distPairs.begin() + range_size,
-                                         [](const auto &a, const auto &b) { return a.first < b.first; });
-
-                        for (int32_t ci = 0; ci < range_size; ci++)
-                            _indices[start + 1 + ci] = tl_distPairs[ci].second;
-
-                        medianDistance = tl_distPairs[medianInPairs].first;
-                    }
+        std::nth_element(values.begin(), values.begin() + nth, values.end(), less);
+    }
+
+    // Hoare partition of [from, to): positions where pred holds first.  Returns where the rest start.
+    template <typename Pred, typename Swap>
+    static int32_t partitionBy(int32_t from, int32_t to, const Pred &pred, const Swap &swapAt) {
+        int32_t i = from, j = to - 1;
+        while (true) {
+            while (i <= j && pred(i)) i++;
+            while (i <= j && !pred(j)) j--;
+            if (i >= j) return i;
+            swapAt(i++, j--);
+        }
+    }
+
+    /*
+     * Permutes _flat_backing so that row i becomes the row that was at from[i], following the
+     * cycles of from: the only extra memory is one row and a bit per row.
+     */
+    void reorderRows(const std::vector<int32_t> &from) {
+        const size_t n = from.size();
+        Scalar *rows = _flat_backing.mutableData();
+        const size_t rowBytes = _dim * sizeof(Scalar);
+        std::vector<Scalar> saved(_dim);
+        std::vector<bool> placed(n, false);
+        for (size_t start = 0; start < n; start++) {
+            if (placed[start] || (size_t)from[start] == start) continue;
+            std::memcpy(saved.data(), rows + start * _dim, rowBytes);
+            size_t pos = start;
+            while (true) {
+                const size_t src = (size_t)from[pos];
+                placed[pos] = true;
+                if (src == start) {
+                    std::memcpy(rows + pos * _dim, saved.data(), rowBytes);
+                    break;
                 }
+                std::memcpy(rows + pos * _dim, rows + src * _dim, rowBytes);
+                pos = src;
+            }
+        }
+    }
 
-                _nodePool[nodeIdx].setRadius(medianDistance);
-                if (leftSlot[i]  >= 0)
-                    _nodePool[leftSlot[i]]  = VPLevelPartition<distance_type>(0, start + 1, median);
-                if (rightSlot[i] >= 0)
-                    _nodePool[rightSlot[i]] = VPLevelPartition<distance_type>(0, median + 1, end_);
-                _nodePool[nodeIdx].setChildIdx(leftSlot[i], rightSlot[i]);
+    template <typename P> void copyToFlatBacking(const std::vector<P> &array) {
+        _dim = array[0].size();
+        typename FlatStore::vector_type flat(array.size() * _dim);
+        for (size_t i = 0; i < array.size(); i++) {
+            if (array[i].size() != _dim) throw std::invalid_argument("all points must have the same dimension");
+            std::memcpy(flat.data() + i * _dim, array[i].data(), _dim * sizeof(Scalar));
+        }
+        _flat_backing = std::move(flat);
+    }
+
+    // Positions in the store, including removed points and those left behind by local rebuilds
+    size_t numPositions() const { return _indices.size(); }
+
+    // _indices entry of a removed point; storedId() recovers the id of any entry but -1
+    static int32_t tombstone(int32_t id) { return -id - 2; }
+    static int32_t storedId(int32_t entry) { return entry >= 0 ? entry : -entry - 2; }
+
+    /*
+     * Points indexed by id, the layout SerializableVPTree writes.  Packed codes are gathered
+     * from the store; ids left without a position get a zero code.
+     */
+    decltype(auto) examplesById() const {
+        if constexpr (PACKED_CODES) {
+            std::vector<T> byId(_nextId, T(_dim, 0));
+            for (size_t pos = 0; pos < numPositions(); pos++) {
+                if (_indices[pos] == -1) continue;
+                const uint8_t *code = _flat_backing.data() + pos * _dim;
+                std::copy(code, code + _dim, byId[storedId(_indices[pos])].begin());
             }
+            return byId;
+        } else {
+            return (_examples);
+        }
+    }
+
+    // Inverse of examplesById(); _indices must already be restored
+    void restoreExamples(std::vector<T> &&byId) {
+        if constexpr (PACKED_CODES) {
+            _dim = byId.empty() ? 0 : byId[0].size();
+            typename FlatStore::vector_type flat(numPositions() * _dim, 0);
+            for (size_t pos = 0; pos < numPositions(); pos++) {
+                if (_indices[pos] == -1) continue;
+                const T &code = byId.at(storedId(_indices[pos]));
+                if (code.size() != _dim) throw std::invalid_argument("all points must have the same dimension");
+                std::memcpy(flat.data() + pos * _dim, code.data(), _dim);
+            }
+            _flat_backing = std::move(flat);
+        } else {
+            _examples = std::move(byId);
+        }
+    }
 
-            current = std::move(next);
+    // Re-derives the point counts of a tree restored from serialized parts
+    void recountPoints() {
+        _numLive = 0;
+        int32_t maxId = -1;
+        for (int32_t entry : _indices) {
+            if (entry >= 0) ++_numLive;
+            maxId = std::max(maxId, storedId(entry));
         }
+        _nextId = std::max<int32_t>(maxId + 1, (int32_t)_examples.size());
+        _update = UpdateIndex();
     }
 
     /*
-     * Reorder _flat_backing so that tree position i holds the data for _indices[i].
-     * After this, _examples[i] can be accessed directly in search (no _indices indirection
-     * for data lookups), improving cache locality during tree traversal.
-     * _indices[i] retains the original row index for result reporting.
-     *
-     * Only applicable for FlatSpan (float32 data). No-op for other types.
+     * Lookup tables for add() and remove().  They are derived from the tree alone, so they are
+     * not serialized and are rebuilt with one traversal on the first update after set or load.
      */
-    void reorderForCache() {
-        if constexpr (std::is_same_v<T, FlatSpan>) {
-            size_t n = _examples.size();
-            if (n == 0) return;
+    struct UpdateIndex {
+        bool ready = false;
+        std::vector<int32_t> positionOf;  // id → tree position, -1 once removed
+        std::vector<int32_t> nodeOf;      // tree position → partition holding it
+        std::vector<int32_t> parentOf;    // partition → parent, -1 for the root and -2 once discarded
+        std::vector<int32_t> subtreeSize; // partition → positions in its subtree, tombstones included
+        std::vector<int32_t> subtreeDead; // partition → tombstones in its subtree
+    };
+
+    // Tree levels whose branches order the queries of searchKNNBatched()
+    static constexpr int ROUTE_LEVELS = 12;
+
+    // A partition is rebuilt when one child holds more than this share of its points...
+    static constexpr float REBUILD_BALANCE = 0.7f;
+    // ...or when more than this share of its points are tombstones
+    static constexpr float REBUILD_DEAD_RATIO = 0.5f;
+
+    void ensureUpdateIndex() {
+        if (_update.ready) return;
+
+        UpdateIndex u;
+        u.positionOf.assign(_nextId, -1);
+        u.nodeOf.assign(numPositions(), -1);
+        u.parentOf.assign(_nodePool.size(), -2);
+        u.subtreeSize.assign(_nodePool.size(), 0);
+        u.subtreeDead.assign(_nodePool.size(), 0);
+
+        std::vector<int32_t> order;
+        if (_rootIdx >= 0) {
+            order.push_back(_rootIdx);
+            u.parentOf[_rootIdx] = -1;
+        }
+        for (size_t o = 0; o < order.size(); o++) {
+            const int32_t node = order[o];
+            const VPLevelPartition<distance_type> &current = _nodePool[node];
+            const int32_t last = current.isLeaf() ? current.end() : current.start();
+            for (int32_t pos = current.start(); pos <= last; pos++) {
+                u.nodeOf[pos] = node;
+                if (_indices[pos] >= 0)
+                    u.positionOf[_indices[pos]] = pos;
+                else
+                    u.subtreeDead[node]++;
+            }
+            u.subtreeSize[node] = last - current.start() + 1;
+            for (int32_t child : {current.left_idx(), current.right_idx()}) {
+                if (child < 0) continue;
+                u.parentOf[child] = node;
+                order.push_back(child);
+            }
+        }
+        // children come after their parent in order
+        for (size_t o = order.size(); o-- > 1;) {
+            const int32_t parent = u.parentOf[order[o]];
+            u.subtreeSize[parent] += u.subtreeSize[order[o]];
+            u.subtreeDead[parent] += u.subtreeDead[order[o]];
+        }
+
+        u.ready = true;
+        _update = std::move(u);
+    }
+
+    /*
+     * A slot is where a subtree hangs: side 0 (left) or 1 (right) of a partition, or the root
+     * when the partition is -1.
+     */
+    static int64_t makeSlot(int32_t parent, int side) { return ((int64_t)parent + 1) * 2 + side; }
+    static int32_t slotParent(int64_t slot) { return (int32_t)(slot / 2) - 1; }
+    static int slotSide(int64_t slot) { return (int)(slot % 2); }
+
+    int32_t childAt(int32_t parent, int side) const {
+        if (parent < 0) return _rootIdx;
+        return side == 0 ? _nodePool[parent].left_idx() : _nodePool[parent].right_idx();
+    }
+
+    int sideOf(int32_t node) const {
+        const int32_t parent = _update.parentOf[node];
+        return (parent >= 0 && _nodePool[parent].right_idx() == node) ? 1 : 0;
+    }
+
+    // Follows the vantage point splits from the root to the leaf (or missing child) val belongs in
+    int64_t routeToSlot(const Query &val) const {
+        int32_t parent = -1;
+        int side = 0;
+        int32_t node = _rootIdx;
+        while (node >= 0 && !_nodePool[node].isLeaf()) {
+            const VPLevelPartition<distance_type> &current = _nodePool[node];
+            const distance_type dist = pointDistance(val, current.start(), std::numeric_limits<distance_type>::max());
+            parent = node;
+            side = (dist > current.radius()) ? 1 : 0;
+            node = childAt(parent, side);
+        }
+        return makeSlot(parent, side);
+    }
+
+    // Appends the buildSubtree items of every live point under node
+    void collectLiveItems(int32_t node, std::vector<int32_t> &items) const {
+        std::vector<int32_t> stack{node};
+        while (!stack.empty()) {
+            const VPLevelPartition<distance_type> &current = _nodePool[stack.back()];
+            stack.pop_back();
+            const int32_t last = current.isLeaf() ? current.end() : current.start();
+            for (int32_t pos = current.start(); pos <= last; pos++) {
+                if (_indices[pos] < 0) continue;
+                if constexpr (FLAT_ROWS) {
+                    items.push_back(pos);
+                } else {
+                    items.push_back(_indices[pos]);
+                }
+            }
+            if (current.left_idx() >= 0) stack.push_back(current.left_idx());
+            if (current.right_idx() >= 0) stack.push_back(current.right_idx());
+        }
+    }
+
+    // Marks the positions and partitions of the subtree under node as garbage
+    void discardSubtree(int32_t node) {
+        int32_t *indices = _indices.mutableData();
+        std::vector<int32_t> stack{node};
+        while (!stack.empty()) {
+            const int32_t idx = stack.back();
+            stack.pop_back();
+            const VPLevelPartition<distance_type> &current = _nodePool[idx];
+            const int32_t last = current.isLeaf() ? current.end() : current.start();
+            for (int32_t pos = current.start(); pos <= last; pos++) {
+                indices[pos] = -1;
+                _update.nodeOf[pos] = -1;
+            }
+            _update.parentOf[idx] = -2;
+            if (current.left_idx() >= 0) stack.push_back(current.left_idx());
+            if (current.right_idx() >= 0) stack.push_back(current.right_idx());
+        }
+    }
+
+    /*
+     * Builds a subtree over items, appends its points and partitions to the end of the store and
+     * hangs it in place of oldRoot (which may be -1) at (parent, side).  The storage of the old
+     * subtree stays behind as garbage until compact().
+     */
+    template <typename Fetch, typename IdOf>
+    void replaceSubtree(int32_t parent, int side, int32_t oldRoot, std::vector<int32_t> &items, const Fetch &fetch,
+                        const IdOf &idOf) {
+        const int32_t oldSize = (oldRoot >= 0) ? _update.subtreeSize[oldRoot] : 0;
+        const int32_t oldDead = (oldRoot >= 0) ? _update.subtreeDead[oldRoot] : 0;
+        const int32_t count = (int32_t)items.size();
+
+        std::vector<VPLevelPartition<distance_type>> nodes;
+        if (count > 0) buildSubtree(items, nodes, fetch);
+
+        // read everything the items refer to before the old subtree is discarded
+        std::vector<int32_t> ids(count);
+        for (int32_t j = 0; j < count; j++) ids[j] = idOf(items[j]);
+        std::vector<Scalar> rows;
+        if constexpr (FLAT_ROWS) {
+            rows.resize((size_t)count * _dim);
+            for (int32_t j = 0; j < count; j++)
+                std::memcpy(rows.data() + (size_t)j * _dim, fetch(items[j]).ptr, _dim * sizeof(Scalar));
+        }
+        if (oldRoot >= 0) discardSubtree(oldRoot);
+
+        const int32_t posBase = (int32_t)numPositions();
+        const int32_t poolBase = (int32_t)_nodePool.size();
+        for (VPLevelPartition<distance_type> &node : nodes) {
+            VPLevelPartition<distance_type> shifted(node.radius(), node.start() + posBase, node.end() + posBase);
+            shifted.setChildIdx(node.left_idx() >= 0 ? node.left_idx() + poolBase : -1,
+                                node.right_idx() >= 0 ? node.right_idx() + poolBase : -1);
+            node = shifted;
+        }
+        _indices.append(ids.data(), ids.size());
+        if constexpr (FLAT_ROWS) _flat_backing.append(rows.data(), rows.size());
+        _nodePool.append(nodes.data(), nodes.size());
+
+        const int32_t newRoot = (count > 0) ? poolBase : -1;
+        if (parent < 0) {
+            _rootIdx = newRoot;
+        } else {
+            VPLevelPartition<distance_type> &p = _nodePool.mutableData()[parent];
+            if (side == 0)
+                p.setChildIdx(newRoot, p.right_idx());
+            else
+                p.setChildIdx(p.left_idx(), newRoot);
+        }
+
+        // bookkeeping for the new partitions; buildSubtree places children after their parent
+        UpdateIndex &u = _update;
+        u.nodeOf.resize(numPositions(), -1);
+        u.parentOf.resize(_nodePool.size(), -2);
+        u.subtreeSize.resize(_nodePool.size(), 0);
+        u.subtreeDead.resize(_nodePool.size(), 0);
+        if (newRoot >= 0) u.parentOf[newRoot] = parent;
+        for (int32_t idx = (int32_t)_nodePool.size(); idx-- > poolBase;) {
+            const VPLevelPartition<distance_type> &current = _nodePool[idx];
+            const int32_t last = current.isLeaf() ? current.end() : current.start();
+            int32_t total = last - current.start() + 1;
+            for (int32_t pos = current.start(); pos <= last; pos++) u.nodeOf[pos] = idx;
+            for (int32_t child : {current.left_idx(), current.right_idx()}) {
+                if (child < 0) continue;
+                u.parentOf[child] = idx;
+                total += u.subtreeSize[child];
+            }
+            u.subtreeSize[idx] = total;
+        }
+        for (int32_t j = 0; j < count; j++) u.positionOf[ids[j]] = posBase + j;
+        for (int32_t a = parent; a >= 0; a = u.parentOf[a]) {
+            u.subtreeSize[a] += count - oldSize;
+            u.subtreeDead[a] -= oldDead;
+        }
+    }
+
+    bool needsRebuild(int32_t node) const {
+        const int32_t total = _update.subtreeSize[node];
+        if (_update.subtreeDead[node] > REBUILD_DEAD_RATIO * total) return true;
+
+        const VPLevelPartition<distance_type> &current = _nodePool[node];
+        if (current.isLeaf() || total <= 2 * _leafSize) return false;
+        const int32_t left = (current.left_idx() >= 0) ? _update.subtreeSize[current.left_idx()] : 0;
+        const int32_t right = (current.right_idx() >= 0) ? _update.subtreeSize[current.right_idx()] : 0;
+        return std::max(left, right) > REBUILD_BALANCE * total;
+    }
+
+    /*
+     * Rebuilds, for each changed partition, its highest ancestor that is unbalanced or mostly
+     * tombstones, then compacts the store once garbage outweighs the live points.
+     */
+    void rebalance(std::vector<int32_t> &changed) {
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+        std::vector<std::pair<int32_t, int32_t>> scapegoats; // (depth, partition)
+        for (int32_t node : changed) {
+            if (_update.parentOf[node] == -2) continue;
+            int32_t scapegoat = -1;
+            int32_t depth = 0, scapegoatDepth = 0;
+            for (int32_t a = node; a >= 0; a = _update.parentOf[a], depth++) {
+                if (needsRebuild(a)) {
+                    scapegoat = a;
+                    scapegoatDepth = depth;
+                }
+            }
+            if (scapegoat < 0) continue;
+            // an empty subtree would leave its parent without children, which reads as a leaf
+            while (_update.parentOf[scapegoat] >= 0 &&
+                   _update.subtreeSize[scapegoat] == _update.subtreeDead[scapegoat]) {
+                scapegoat = _update.parentOf[scapegoat];
+                scapegoatDepth++;
+            }
+            scapegoats.push_back({depth - scapegoatDepth, scapegoat});
+        }
+
+        // outermost first; partitions inside an already rebuilt subtree are discarded by then
+        std::sort(scapegoats.begin(), scapegoats.end());
+        auto fetch = [this](int32_t i) -> decltype(auto) { return example(i); };
+        auto idOf = [this](int32_t item) -> int32_t {
+            if constexpr (FLAT_ROWS) {
+                return _indices[item];
+            } else {
+                return item;
+            }
+        };
+        for (const auto &entry : scapegoats) {
+            const int32_t node = entry.second;
+            if (!attached(node)) continue;
+            std::vector<int32_t> items;
+            collectLiveItems(node, items);
+            const int32_t parent = _update.parentOf[node];
+            replaceSubtree(parent, sideOf(node), node, items, fetch, idOf);
+        }
+
+        if (numPositions() > 2 * (size_t)_numLive + (size_t)_leafSize) compact();
+    }
+
+    // false once node or one of its ancestors was discarded by a rebuild
+    bool attached(int32_t node) const {
+        for (; node >= 0; node = _update.parentOf[node]) {
+            if (_update.parentOf[node] == -2) return false;
+        }
+        return true;
+    }
+
+    /*
+     * Point i of the backing store.  Flat rows are views into _flat_backing, which build()
+     * leaves in tree order.
+     */
+    decltype(auto) example(size_t i) const {
+        if constexpr (FLAT_ROWS) {
+            return RowView{_flat_backing.data() + i * _dim, _dim};
+        } else {
+            return (_examples[i]);
+        }
+    }
+
+    // The point at tree position pos as a query, for searches whose query is a stored point
+    decltype(auto) storedPoint(int32_t pos) const {
+        if constexpr (PACKED_CODES) {
+            return example(pos);
+        } else {
+            return (_examples[storedId(_indices[pos])]);
+        }
+    }
+
+    // A point given by the caller as a Query: a view of the codes for packed trees, itself otherwise
+    template <typename P> static decltype(auto) asQuery(const P &point) {
+        if constexpr (PACKED_CODES) {
+            return CodeSpan{point.data(), point.size()};
+        } else {
+            static_assert(std::is_same_v<P, T>, "points must be of the tree point type");
+            return (point);
+        }
+    }
+
+    // Metric between two points or views; packed codes go through the pointer kernel
+    template <typename A, typename B> distance_type measure(const A &a, const B &b) const {
+        if constexpr (PACKED_CODES) {
+            return distance_traits<distance>::codes(a.data(), b.data(), _dim);
+        } else {
+            return distance(a, b);
+        }
+    }
+
+    /*
+     * Branch taken at each of the first ROUTE_LEVELS internal nodes, root first in the high bit
+     * (0 inside the vantage radius, 1 outside); queries with close codes share most of their
+     * traversal.
+     */
+    uint32_t routeCode(const Query &val) const {
+        uint32_t code = 0;
+        int32_t idx = _rootIdx;
+        for (int level = 0; level < ROUTE_LEVELS && idx >= 0; ++level) {
+            const VPLevelPartition<distance_type> &node = _nodePool[idx];
+            if (node.isLeaf()) break;
+            const bool outside = pointDistance(val, node.start(), node.radius()) > node.radius();
+            if (outside) code |= 1u << (31 - level);
+            idx = outside ? node.right_idx() : node.left_idx();
+        }
+        return code;
+    }
+
+    // Query of a searchKNNBlock() block: its point, its output row and an id it must not report
+    struct BlockQuery {
+        FlatSpan point;
+        size_t row;
+        int32_t excluded;
+    };
+
+    /*
+     * Exact KNN for the m queries of one block.  The block
+     * is walked depth first with one heap and tau per query.  A pending subtree carries the
+     * queries it was queued for with their lower bound on it, and queries whose tau shrank past
+     * that bound in the meantime are dropped when it is popped.  The child that most queries
+     * must enter is walked first.
+     */
+    void searchKNNBlock(const BlockQuery *members, size_t m, size_t k, int64_t *indices, distance_type *distances) {
+        struct Pending {
+            int32_t slot;
+            distance_type bound;
+        };
+        // node with its queries at tl_pending[begin, begin + count)
+        struct Frame {
+            int32_t nodeIdx;
+            size_t begin, count;
+        };
+        // lists are stacked in the order frames are pushed, so popping a frame frees
+        // everything queued above its own list
+        thread_local std::vector<Pending> tl_pending;
+        thread_local std::vector<Frame> tl_frames;
+        thread_local std::vector<float> tl_block;
+        thread_local std::vector<distance_type> tl_dist;
+
+        // queries of the block copied next to each other for the one-to-many kernel
+        tl_block.resize(m * _dim);
+        std::vector<FlatSpan> spans(m);
+        for (size_t s = 0; s < m; ++s) {
+            std::memcpy(tl_block.data() + s * _dim, members[s].point.data(), _dim * sizeof(float));
+            spans[s] = FlatSpan{tl_block.data() + s * _dim, _dim};
+        }
+        std::vector<std::priority_queue<VPTreeSearchElement>> heaps(m);
+        std::vector<distance_type> taus(m, std::numeric_limits<distance_type>::max());
+        const SearchFilter everything;
+
+        tl_pending.clear();
+        tl_frames.clear();
+        for (size_t s = 0; s < m; ++s) tl_pending.push_back({(int32_t)s, (distance_type)0});
+        tl_frames.push_back({_rootIdx, 0, m});
+
+        while (!tl_frames.empty()) {
+            const Frame frame = tl_frames.back();
+            tl_frames.pop_back();
+
+            size_t end = frame.begin;
+            for (size_t p = frame.begin; p < frame.begin + frame.count; ++p) {
+                const Pending entry = tl_pending[p];
+                if (heaps[entry.slot].size() < k || entry.bound <= taus[entry.slot]) tl_pending[end++] = entry;
+            }
+            tl_pending.resize(end);
+            const size_t count = end - frame.begin;
+            if (count == 0) continue;
+
+            const VPLevelPartition<distance_type> &current = _nodePool[frame.nodeIdx];
+            if (current.isLeaf()) {
+                for (size_t p = frame.begin; p < end; ++p) {
+                    const int32_t s = tl_pending[p].slot;
+                    scanLeafKNN(current, spans[s], k, heaps[s], taus[s], everything, members[s].excluded);
+                }
+                continue;
+            }
+
+            // lists keep slots in increasing order, so a full list is the whole block in order
+            tl_dist.resize(count);
+            if (count == m) {
+                distance_traits<distance>::one_to_many(example(current.start()), tl_block.data(), m, tl_dist.data());
+            } else {
+                for (size_t p = frame.begin; p < end; ++p) {
+                    const int32_t s = tl_pending[p].slot;
+                    const distance_type bound = (heaps[s].size() < k) ? std::numeric_limits<distance_type>::max()
+                                                                     : abandonBound(current.radius(), taus[s]);
+                    tl_dist[p - frame.begin] = pointDistance(spans[s], current.start(), bound);
+                }
+            }
 
-            std::vector<float> ordered(n * _dim);
-            for (size_t i = 0; i < n; i++) {
-                std::memcpy(ordered.data() + i * _dim,
-                            _flat_backing.data() + (size_t)_indices[i] * _dim,
-                            _dim * sizeof(float));
+            const int32_t vantage = _indices[current.start()];
+            size_t inside = 0;
+            for (size_t p = frame.begin; p < end; ++p) {
+                const int32_t s = tl_pending[p].slot;
+                const distance_type dist = tl_dist[p - frame.begin];
+                if ((dist < taus[s] || heaps[s].size() < k) && reportable(vantage, everything, members[s].excluded)) {
+                    if (heaps[s].size() == k) heaps[s].pop();
+                    heaps[s].push(VPTreeSearchElement((int64_t)vantage, dist));
+                    taus[s] = heaps[s].top().dist;
+                }
+                if (dist <= current.radius()) ++inside;
             }
-            _flat_backing = std::move(ordered);
 
-            // Fix up FlatSpan pointers into the new contiguous buffer
-            for (size_t i = 0; i < n; i++)
-                _examples[i] = FlatSpan{_flat_backing.data() + i * _dim, _dim};
-            // _indices[i] still holds the original row index — used only for result reporting
+            // queue the child fewer queries must enter first, so the other one is walked first
+            const bool leftFirst = inside * 2 >= count;
+            for (const bool left : {!leftFirst, leftFirst}) {
+                const int32_t child = left ? current.left_idx() : current.right_idx();
+                if (child < 0) continue;
+                const size_t begin = tl_pending.size();
+                for (size_t p = frame.begin; p < end; ++p) {
+                    const int32_t s = tl_pending[p].slot;
+                    const distance_type dist = tl_dist[p - frame.begin];
+                    distance_type bound = 0;
+                    if (left && dist > current.radius()) bound = borderDistance(dist, current.radius());
+                    if (!left && dist <= current.radius()) bound = borderDistance(current.radius(), dist);
+                    if (heaps[s].size() < k || bound <= taus[s]) tl_pending.push_back({s, bound});
+                }
+                if (tl_pending.size() > begin) tl_frames.push_back({child, begin, tl_pending.size() - begin});
+            }
         }
+
+        for (size_t s = 0; s < m; ++s)
+            fillSearchRow(heaps[s], k, indices + members[s].row * k, distances + members[s].row * k);
+    }
+
+    // A live point the filter allows, other than the excluded id
+    static bool reportable(int32_t entry, const SearchFilter &filter, int32_t excluded = -1) {
+        return entry >= 0 && entry != excluded && filter.allows(entry);
     }
 
     // Internal temporary struct to organize K closest elements in a priority queue
@@ -423,6 +1771,32 @@ protected:
         bool operator<(const VPTreeSearchElement &v) const { return dist < v.dist; }
     };
 
+    /*
+     * Lower bound on the distance from the query to any point on the far side of a split,
+     * given the larger (outer) and smaller (inner) of dist and radius.
+     *
+     * Squared metrics store radii squared, so the triangle-inequality bound |d - r| is
+     * evaluated in real units and squared back.  Only internal nodes pay for these two
+     * sqrts; leaf scans and all comparisons stay in squared units.
+     */
+    static distance_type borderDistance(distance_type outer, distance_type inner) {
+        if constexpr (distance_traits<distance>::squared) {
+            const distance_type gap = std::sqrt(outer) - std::sqrt(inner);
+            return gap * gap;
+        } else {
+            return outer - inner;
+        }
+    }
+
+    // Converts a distance returned by the metric into the reported distance
+    static distance_type reportedDistance(distance_type dist) {
+        if constexpr (distance_traits<distance>::squared) {
+            return std::sqrt(dist);
+        } else {
+            return dist;
+        }
+    }
+
     /*
      * Best-first KNN search.
      *
@@ -431,13 +1805,19 @@ protected:
      * tau prunes more pending heap entries → dramatically fewer distance evaluations
      * than the original DFS traversal at moderate-to-large N.
      *
-     * For FlatSpan data (after reorderForCache), data is accessed directly as
-     * _examples[pos] (sequential memory) — no _indices lookup for data.
+     * For FlatSpan data (stored in tree order), data is accessed directly as
+     * example(pos) (sequential memory) — no _indices lookup for data.
+     *
+     * Points the filter rejects are measured and route the query like any other, but never
+     * enter knnQueue, so tau (and every prune) only depends on allowed points.  The same holds
+     * for the excluded id, used by allKNN() to keep a point out of its own neighbours.
      */
-    void searchKNN(int32_t partitionIdx, const T &val, size_t k,
-                   std::priority_queue<VPTreeSearchElement> &knnQueue) {
+    bool searchKNN(int32_t partitionIdx, const Query &val, size_t k, std::priority_queue<VPTreeSearchElement> &knnQueue,
+                   float pruneScale, const SearchBudget &budget, const SearchFilter &filter, int32_t excluded = -1) {
 
         auto tau = std::numeric_limits<distance_type>::max();
+        // pruning radius: tau itself for exact search, tau / (1+eps) in approximate mode
+        auto pruneTau = tau;
 
         // Thread-local backing vector — reused across calls (avoids per-query allocation)
         thread_local std::vector<std::pair<distance_type, int32_t>> tl_heap;
@@ -448,28 +1828,41 @@ protected:
         tl_heap.push_back({(distance_type)0, partitionIdx});
         // single-element "heap" is trivially valid
 
+        BudgetTracker tracker(budget);
+
         while (!tl_heap.empty()) {
             std::pop_heap(tl_heap.begin(), tl_heap.end(), heap_cmp);
             auto [distToBorder, currentIdx] = tl_heap.back();
             tl_heap.pop_back();
 
             // Prune: lower bound on this partition > current search radius
-            if (distToBorder > tau && knnQueue.size() >= k) continue;
+            if (distToBorder > pruneTau && knnQueue.size() >= k) continue;
+
+            if (tracker.exhausted()) {
+                // out of budget: the entry just popped is the closest one still pending
+                return false;
+            }
 
             const VPLevelPartition<distance_type> &current = _nodePool[currentIdx];
 
-            // Access point data — for FlatSpan, _examples[pos] is direct after reorderForCache()
-            distance_type dist;
-            if constexpr (std::is_same_v<T, FlatSpan>) {
-                dist = distance(val, _examples[current.start()]);
-            } else {
-                dist = distance(val, _examples[_indices[current.start()]]);
+            if (current.isLeaf()) {
+                scanLeafKNN(current, val, k, knnQueue, tau, filter, excluded);
+                pruneTau = shrinkRadius(tau, pruneScale);
+                continue;
             }
 
-            if (dist < tau || knnQueue.size() < k) {
+            // Once the heap is full, a vantage point farther than abandonBound() can neither enter
+            // the heap nor open its inner child, so the kernel may stop early
+            const distance_type bound = (knnQueue.size() < k) ? std::numeric_limits<distance_type>::max()
+                                                              : abandonBound(current.radius(), tau);
+            const distance_type dist = pointDistance(val, current.start(), bound);
+
+            // removed and filtered out vantage points keep routing queries but are never reported
+            if ((dist < tau || knnQueue.size() < k) && reportable(_indices[current.start()], filter, excluded)) {
                 if (knnQueue.size() == k) knnQueue.pop();
                 knnQueue.push(VPTreeSearchElement((int64_t)_indices[current.start()], dist));
                 tau = knnQueue.top().dist;
+                pruneTau = shrinkRadius(tau, pruneScale);
             }
 
             int32_t left_idx  = current.left_idx();
@@ -483,8 +1876,8 @@ protected:
                 }
                 // Optional: left (inside sphere) — lower bound = dist - radius
                 if (left_idx >= 0) {
-                    auto toBorder = dist - current.radius();
-                    if (knnQueue.size() < k || toBorder <= tau) {
+                    auto toBorder = borderDistance(dist, current.radius());
+                    if (knnQueue.size() < k || toBorder <= pruneTau) {
                         tl_heap.push_back({toBorder, left_idx});
                         std::push_heap(tl_heap.begin(), tl_heap.end(), heap_cmp);
                     }
@@ -497,20 +1890,23 @@ protected:
                 }
                 // Optional: right (outside sphere) — lower bound = radius - dist
                 if (right_idx >= 0) {
-                    auto toBorder = current.radius() - dist;
-                    if (knnQueue.size() < k || toBorder <= tau) {
+                    auto toBorder = borderDistance(current.radius(), dist);
+                    if (knnQueue.size() < k || toBorder <= pruneTau) {
                         tl_heap.push_back({toBorder, right_idx});
                         std::push_heap(tl_heap.begin(), tl_heap.end(), heap_cmp);
                     }
                 }
             }
         }
+        return true;
     }
 
-    void search1NN(int32_t partitionIdx, const T &val, int64_t &resultIndex, distance_type &resultDist) {
+    bool search1NN(int32_t partitionIdx, const Query &val, int64_t &resultIndex, distance_type &resultDist,
+                   float pruneScale, const SearchBudget &budget) {
 
         resultDist  = std::numeric_limits<distance_type>::max();
         resultIndex = -1;
+        auto pruneDist = resultDist;
 
         thread_local std::vector<std::pair<distance_type, int32_t>> tl_heap;
         tl_heap.clear();
@@ -519,25 +1915,33 @@ protected:
 
         tl_heap.push_back({(distance_type)0, partitionIdx});
 
+        BudgetTracker tracker(budget);
+
         while (!tl_heap.empty()) {
             std::pop_heap(tl_heap.begin(), tl_heap.end(), heap_cmp);
             auto [distToBorder, currentIdx] = tl_heap.back();
             tl_heap.pop_back();
 
-            if (distToBorder > resultDist) continue;
+            if (distToBorder > pruneDist) continue;
+
+            if (tracker.exhausted()) return false;
 
             const VPLevelPartition<distance_type> &current = _nodePool[currentIdx];
 
-            distance_type dist;
-            if constexpr (std::is_same_v<T, FlatSpan>) {
-                dist = distance(val, _examples[current.start()]);
-            } else {
-                dist = distance(val, _examples[_indices[current.start()]]);
+            if (current.isLeaf()) {
+                scanLeaf1NN(current, val, resultIndex, resultDist);
+                pruneDist = shrinkRadius(resultDist, pruneScale);
+                continue;
             }
 
-            if (dist < resultDist) {
+            const distance_type bound = (resultIndex < 0) ? std::numeric_limits<distance_type>::max()
+                                                          : abandonBound(current.radius(), resultDist);
+            const distance_type dist = pointDistance(val, current.start(), bound);
+
+            if (dist < resultDist && _indices[current.start()] >= 0) {
                 resultDist  = dist;
                 resultIndex = (int64_t)_indices[current.start()];
+                pruneDist   = shrinkRadius(resultDist, pruneScale);
             }
 
             int32_t left_idx  = current.left_idx();
@@ -551,8 +1955,8 @@ protected:
                 }
                 // May search inside (left)
                 if (left_idx >= 0) {
-                    auto toBorder = dist - current.radius();
-                    if (toBorder < resultDist) {
+                    auto toBorder = borderDistance(dist, current.radius());
+                    if (toBorder < pruneDist) {
                         tl_heap.push_back({toBorder, left_idx});
                         std::push_heap(tl_heap.begin(), tl_heap.end(), heap_cmp);
                     }
@@ -565,14 +1969,217 @@ protected:
                 }
                 // May search outside (right)
                 if (right_idx >= 0) {
-                    auto toBorder = current.radius() - dist;
-                    if (toBorder < resultDist) {
+                    auto toBorder = borderDistance(current.radius(), dist);
+                    if (toBorder < pruneDist) {
                         tl_heap.push_back({toBorder, right_idx});
                         std::push_heap(tl_heap.begin(), tl_heap.end(), heap_cmp);
                     }
                 }
             }
         }
+        return true;
+    }
+
+    /*
+     * Depth-first radius search.  Visit order does not matter since the radius never shrinks,
+     * so a plain stack replaces the best-first heap.
+     */
+    void searchRadius(int32_t partitionIdx, const Query &val, distance_type radius,
+                      std::vector<VPTreeSearchElement> &found) const {
+
+        thread_local std::vector<int32_t> tl_stack;
+        thread_local std::vector<distance_type> tl_leafDist;
+        tl_stack.clear();
+        tl_stack.push_back(partitionIdx);
+
+        while (!tl_stack.empty()) {
+            const VPLevelPartition<distance_type> &current = _nodePool[tl_stack.back()];
+            tl_stack.pop_back();
+
+            if (current.isLeaf()) {
+                tl_leafDist.resize(current.size());
+                leafDistances(current, val, radius, tl_leafDist.data());
+                for (int32_t i = 0; i < current.size(); i++) {
+                    if (tl_leafDist[i] <= radius && _indices[current.start() + i] >= 0)
+                        found.push_back(VPTreeSearchElement((int64_t)_indices[current.start() + i], tl_leafDist[i]));
+                }
+                continue;
+            }
+
+            const distance_type dist = pointDistance(val, current.start(), abandonBound(current.radius(), radius));
+            if (dist <= radius && _indices[current.start()] >= 0)
+                found.push_back(VPTreeSearchElement((int64_t)_indices[current.start()], dist));
+
+            int32_t left_idx  = current.left_idx();
+            int32_t right_idx = current.right_idx();
+
+            if (dist > current.radius()) {
+                if (right_idx >= 0) tl_stack.push_back(right_idx);
+                if (left_idx >= 0 && borderDistance(dist, current.radius()) <= radius) tl_stack.push_back(left_idx);
+            } else {
+                if (left_idx >= 0) tl_stack.push_back(left_idx);
+                if (right_idx >= 0 && borderDistance(current.radius(), dist) <= radius) tl_stack.push_back(right_idx);
+            }
+        }
+    }
+
+    /*
+     * Counts node visits against a SearchBudget.  The clock is only read every
+     * TIME_CHECK_INTERVAL visits so unlimited and visit-only budgets cost one branch per node.
+     */
+    class BudgetTracker {
+    public:
+        explicit BudgetTracker(const SearchBudget &budget) : _budget(budget), _unlimited(budget.unlimited()) {
+            if (_budget.maxTimeUs > 0) _start = std::chrono::steady_clock::now();
+        }
+
+        // Registers one more visit; true when the budget does not allow it
+        bool exhausted() {
+            if (_unlimited) return false;
+            if (_budget.maxVisits > 0 && _visits >= _budget.maxVisits) return true;
+            ++_visits;
+            if (_budget.maxTimeUs > 0 && (_visits % TIME_CHECK_INTERVAL) == 0) {
+                const auto elapsed = std::chrono::steady_clock::now() - _start;
+                if (std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() >= _budget.maxTimeUs) {
+                    _budget.maxVisits = _visits; // refuse every further visit
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        static constexpr int64_t TIME_CHECK_INTERVAL = 8;
+
+        SearchBudget _budget;
+        bool _unlimited;
+        int64_t _visits = 0;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    // Flat row kernels stride by the query length, so a query of another width would read across rows
+    template <typename P> void checkQueryDims(const std::vector<P> &queries) const {
+        if constexpr (FLAT_ROWS) {
+            for (const P &query : queries) {
+                if (query.size() != _dim)
+                    throw std::invalid_argument("queries have dimension " + std::to_string(query.size()) +
+                                                ", index has " + std::to_string(_dim));
+            }
+        }
+    }
+
+    // Factor applied to lower bounds in approximate search, in the units the tree stores
+    static float approximationScale(float epsilon) {
+        if (epsilon < 0) {
+            throw std::invalid_argument("epsilon must be non-negative");
+        }
+        if constexpr (!std::is_floating_point_v<distance_type>) {
+            if (epsilon != 0) {
+                throw std::invalid_argument("epsilon is only supported for floating point metrics");
+            }
+        }
+        const float scale = 1.0f + epsilon;
+        if constexpr (distance_traits<distance>::squared) {
+            return scale * scale;
+        } else {
+            return scale;
+        }
+    }
+
+    // Largest lower bound worth exploring: bound * pruneScale <= radius
+    static distance_type shrinkRadius(distance_type radius, float pruneScale) {
+        if constexpr (std::is_floating_point_v<distance_type>) {
+            return radius / pruneScale;
+        } else {
+            return radius;
+        }
+    }
+
+    /*
+     * Smallest distance from the query to a vantage point at which both the point itself and
+     * the inner child are provably useless: it is >= tau and >= radius + tau (in real units).
+     * Values past it are only ever compared against the radius and tau, so an early-abandoned
+     * lower bound gives the same decisions as the exact distance.
+     */
+    static distance_type abandonBound(distance_type radius, distance_type tau) {
+        if constexpr (distance_traits<distance>::squared) {
+            const distance_type reach = std::sqrt(radius) + std::sqrt(tau);
+            return std::max({radius, tau, reach * reach});
+        } else {
+            return radius + tau;
+        }
+    }
+
+    // Distance to the point at tree position pos; may stop early and return any value > bound
+    distance_type pointDistance(const Query &val, int32_t pos, distance_type bound) const {
+        // Access point data — for FlatSpan, example(pos) is direct since rows are in tree order
+        if constexpr (std::is_same_v<T, FlatSpan>) {
+            return distance_traits<distance>::bounded(val, example(pos), bound);
+        } else if constexpr (PACKED_CODES) {
+            return measure(val, example(pos));
+        } else {
+            return distance(val, _examples[storedId(_indices[pos])]);
+        }
+    }
+
+    /*
+     * Distances from val to every point of a leaf bucket, written to out[0 .. size).
+     * FlatSpan leaves are contiguous in _flat_backing, so they go
+     * through the one-to-many kernel of the metric; packed code leaves are scanned in place.  Points farther than bound may be
+     * abandoned early and reported as any value > bound.
+     */
+    void leafDistances(const VPLevelPartition<distance_type> &leaf, const Query &val, distance_type bound,
+                       distance_type *out) const {
+        const int32_t start = leaf.start();
+        const int32_t count = leaf.size();
+        if constexpr (std::is_same_v<T, FlatSpan>) {
+            const float *block = _flat_backing.data() + (size_t)start * _dim;
+            if (bound == std::numeric_limits<distance_type>::max())
+                distance_traits<distance>::one_to_many(val, block, (size_t)count, out);
+            else
+                distance_traits<distance>::one_to_many_bounded(val, block, (size_t)count, out, bound);
+        } else if constexpr (PACKED_CODES) {
+            const uint8_t *block = _flat_backing.data() + (size_t)start * _dim;
+            for (int32_t i = 0; i < count; i++)
+                out[i] = distance_traits<distance>::codes(val.data(), block + (size_t)i * _dim, _dim);
+        } else {
+            for (int32_t i = 0; i < count; i++)
+                out[i] = distance(val, _examples[storedId(_indices[start + i])]);
+        }
+    }
+
+    void scanLeafKNN(const VPLevelPartition<distance_type> &leaf, const Query &val, size_t k,
+                     std::priority_queue<VPTreeSearchElement> &knnQueue, distance_type &tau,
+                     const SearchFilter &filter, int32_t excluded = -1) const {
+        thread_local std::vector<distance_type> tl_leafDist;
+        tl_leafDist.resize(leaf.size());
+        const distance_type bound = (knnQueue.size() < k) ? std::numeric_limits<distance_type>::max() : tau;
+        leafDistances(leaf, val, bound, tl_leafDist.data());
+
+        const int32_t start = leaf.start();
+        for (int32_t i = 0; i < leaf.size(); i++) {
+            const distance_type dist = tl_leafDist[i];
+            if ((dist < tau || knnQueue.size() < k) && reportable(_indices[start + i], filter, excluded)) {
+                if (knnQueue.size() == k) knnQueue.pop();
+                knnQueue.push(VPTreeSearchElement((int64_t)_indices[start + i], dist));
+                tau = knnQueue.top().dist;
+            }
+        }
+    }
+
+    void scanLeaf1NN(const VPLevelPartition<distance_type> &leaf, const Query &val, int64_t &resultIndex,
+                     distance_type &resultDist) const {
+        thread_local std::vector<distance_type> tl_leafDist;
+        tl_leafDist.resize(leaf.size());
+        leafDistances(leaf, val, resultDist, tl_leafDist.data());
+
+        const int32_t start = leaf.start();
+        for (int32_t i = 0; i < leaf.size(); i++) {
+            if (tl_leafDist[i] < resultDist && _indices[start + i] >= 0) {
+                resultDist  = tl_leafDist[i];
+                resultIndex = (int64_t)_indices[start + i];
+            }
+        }
     }
 
     /*
@@ -583,7 +2190,8 @@ protected:
      * Cost: O(S²) distance evaluations per partition level — negligible compared
      * to the O(N) distance loop in build().
      */
-    int32_t selectVantagePoint(int32_t fromIndex, int32_t toIndex) {
+    template <typename Points>
+    int32_t selectVantagePoint(const Points &points, int32_t fromIndex, int32_t toIndex) {
         int32_t range = (toIndex - fromIndex) + 1;
         if (range <= 2) return fromIndex;
 
@@ -599,12 +2207,12 @@ protected:
 
         for (int s = 0; s < nSample; ++s) {
             int32_t cand_pos = uni(tl_rng);
-            const auto &cand = _examples[_indices[cand_pos]];
+            const auto &cand = points.at(cand_pos);
 
             float sum = 0.f, sum2 = 0.f;
             for (int p = 0; p < nSample; ++p) {
                 int32_t probe_pos = uni(tl_rng);
-                float d = (float)distance(cand, _examples[_indices[probe_pos]]);
+                float d = (float)measure(cand, points.at(probe_pos));
                 sum += d; sum2 += d * d;
             }
             float var = sum2 / nSample - (sum / nSample) * (sum / nSample);
@@ -624,19 +2232,45 @@ protected:
 
         while (!knnQueue.empty()) {
             const VPTreeSearchElement &top = knnQueue.top();
-            element.distances.push_back(top.dist);
+            element.distances.push_back(reportedDistance(top.dist));
             element.indexes.push_back(top.index);
             knnQueue.pop();
         }
     }
 
+    // the queue pops farthest first, so the row is filled back to front
+    void fillSearchRow(std::priority_queue<VPTreeSearchElement> &knnQueue, size_t k, int64_t *indices,
+                       distance_type *distances) {
+        constexpr distance_type padding = std::numeric_limits<distance_type>::has_infinity
+                                              ? std::numeric_limits<distance_type>::infinity()
+                                              : std::numeric_limits<distance_type>::max();
+        for (size_t j = knnQueue.size(); j < k; ++j) {
+            indices[j] = -1;
+            distances[j] = padding;
+        }
+        for (size_t j = knnQueue.size(); j-- > 0;) {
+            const VPTreeSearchElement &top = knnQueue.top();
+            indices[j] = top.index;
+            distances[j] = reportedDistance(top.dist);
+            knnQueue.pop();
+        }
+    }
+
 protected:
-    std::vector<T> _examples;
-    std::vector<int32_t> _indices;   // tree-position → original row index (for result reporting)
-    std::vector<VPLevelPartition<distance_type>> _nodePool;
+    std::vector<T> _examples;        // unused with flat rows, which live in _flat_backing
+    // tree-position → original row index (for result reporting); a removed point holds
+    // tombstone(id) and a position left behind by a local rebuild holds -1
+    ArrayStore<int32_t> _indices;
+    ArrayStore<VPLevelPartition<distance_type>> _nodePool;
     int32_t _rootIdx = -1;
-    std::vector<float> _flat_backing;
+    FlatStore _flat_backing;
     size_t _dim = 0;
+    int32_t _leafSize = DEFAULT_LEAF_SIZE;
+    int32_t _sampledSplit = 0;     // see setSampledSplit()
+    float _splitImbalance = 0;
+    int64_t _numLive = 0;   // positions holding a point that is not removed
+    int32_t _nextId = 0;    // id of the next added point
+    UpdateIndex _update;    // lookup tables for add() and remove(), built on first use
 };
 
 } // namespace vptree
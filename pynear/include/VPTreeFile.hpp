@@ -0,0 +1,182 @@
+/*
+ *  MIT Licence
+ *  Copyright 2021 Pablo Carneiro Elias
+ */
+
+#pragma once
+
+#include "ArrayStore.hpp"
+#include "MappedFile.hpp"
+#include "VPTree.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace vptree {
+
+/*
+ * On-disk layout of a FlatSpan VPTree (version 1), little-endian:
+ *
+ *   [0, 128)          VPTreeFileHeader
+ *   flat_offset       num_points * dim float32, in tree order
+ *   indices_offset    num_points int32, tree position -> original row (negative for removed
+ *                     points and for positions left unused by add()/remove())
+ *   pool_offset       num_nodes VPLevelPartition records
+ *
+ * Every section starts on a 64 byte boundary so a memory-mapped file can be searched in
+ * place: the sections are handed to the tree as borrowed ArrayStores and pages are only
+ * read from disk when a query touches them.
+ */
+struct VPTreeFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    char metric[16];
+    uint32_t squared;
+    int32_t root_idx;
+    int32_t leaf_size;
+    uint32_t node_size;
+    uint64_t dim;
+    uint64_t num_points;
+    uint64_t num_nodes;
+    uint64_t flat_offset;
+    uint64_t indices_offset;
+    uint64_t pool_offset;
+    uint64_t next_id; // 0 in files written before add()/remove() existed
+    uint8_t reserved[24];
+};
+static_assert(sizeof(VPTreeFileHeader) == 128, "VPTreeFileHeader must stay 128 bytes");
+
+namespace detail {
+
+constexpr char kVPTreeFileMagic[8] = {'P', 'Y', 'N', 'E', 'A', 'R', 'V', 'P'};
+constexpr uint32_t kVPTreeFileVersion = 1;
+constexpr uint64_t kVPTreeFileAlignment = 64;
+
+inline uint64_t alignFileOffset(uint64_t offset) {
+    return (offset + kVPTreeFileAlignment - 1) / kVPTreeFileAlignment * kVPTreeFileAlignment;
+}
+
+inline void requireLittleEndian() {
+    const uint16_t probe = 1;
+    if (*reinterpret_cast<const uint8_t *>(&probe) != 1)
+        throw std::runtime_error("the pynear index file format is only supported on little-endian hosts");
+}
+
+inline void writeSection(std::ofstream &out, const void *data, uint64_t bytes, uint64_t offset) {
+    static const char zeros[kVPTreeFileAlignment] = {};
+    uint64_t pos = (uint64_t)out.tellp();
+    if (offset > pos) out.write(zeros, (std::streamsize)(offset - pos));
+    if (bytes > 0) out.write(static_cast<const char *>(data), (std::streamsize)bytes);
+}
+
+} // namespace detail
+
+/*
+ * Writes tree to path.  metric is a short tag (e.g. "l2") that loadVPTree checks, so an index
+ * saved for one metric cannot be opened as another.
+ */
+template <typename distance_type, distance_type (*distance)(const FlatSpan &, const FlatSpan &)>
+void saveVPTree(const VPTree<FlatSpan, distance_type, distance> &tree, const std::string &path,
+                const std::string &metric) {
+    using Node = VPLevelPartition<distance_type>;
+    static_assert(std::is_trivially_copyable_v<Node>, "partitions are written as raw records");
+    detail::requireLittleEndian();
+
+    const auto &flat = tree.flatBacking();
+    const auto &indices = tree.indexPermutation();
+    const auto &pool = tree.partitionPool();
+
+    VPTreeFileHeader header{};
+    std::memcpy(header.magic, detail::kVPTreeFileMagic, sizeof(header.magic));
+    header.version = detail::kVPTreeFileVersion;
+    header.header_size = sizeof(VPTreeFileHeader);
+    std::strncpy(header.metric, metric.c_str(), sizeof(header.metric) - 1);
+    header.squared = distance_traits<distance>::squared ? 1 : 0;
+    header.root_idx = tree.rootPartitionIdx();
+    header.leaf_size = tree.leafSize();
+    header.node_size = sizeof(Node);
+    header.dim = tree.flatDim();
+    header.num_points = indices.size();
+    header.num_nodes = pool.size();
+    header.flat_offset = detail::alignFileOffset(sizeof(VPTreeFileHeader));
+    header.indices_offset = detail::alignFileOffset(header.flat_offset + flat.size() * sizeof(float));
+    header.pool_offset = detail::alignFileOffset(header.indices_offset + indices.size() * sizeof(int32_t));
+    header.next_id = (uint64_t)tree.nextId();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("cannot open " + path + " for writing");
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    detail::writeSection(out, flat.data(), flat.size() * sizeof(float), header.flat_offset);
+    detail::writeSection(out, indices.data(), indices.size() * sizeof(int32_t), header.indices_offset);
+    detail::writeSection(out, pool.data(), pool.size() * sizeof(Node), header.pool_offset);
+    if (!out) throw std::runtime_error("failed writing " + path);
+}
+
+/*
+ * Replaces tree with the index stored at path.  With mmap the file is mapped and searched in
+ * place (the mapping lives as long as any tree sharing it); otherwise the sections are read
+ * into memory.
+ */
+template <typename distance_type, distance_type (*distance)(const FlatSpan &, const FlatSpan &)>
+void loadVPTree(VPTree<FlatSpan, distance_type, distance> &tree, const std::string &path, const std::string &metric,
+                bool mmap = true) {
+    using Node = VPLevelPartition<distance_type>;
+    detail::requireLittleEndian();
+
+    auto file = std::make_shared<MappedFile>(path);
+    if (file->size() < sizeof(VPTreeFileHeader))
+        throw std::runtime_error(path + " is not a pynear index file");
+
+    VPTreeFileHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, detail::kVPTreeFileMagic, sizeof(header.magic)) != 0)
+        throw std::runtime_error(path + " is not a pynear index file");
+    if (header.version != detail::kVPTreeFileVersion)
+        throw std::runtime_error(path + ": unsupported index file version " + std::to_string(header.version));
+    if (header.node_size != sizeof(Node))
+        throw std::runtime_error(path + ": partition record size does not match this build");
+
+    header.metric[sizeof(header.metric) - 1] = '\0';
+    if (metric != header.metric)
+        throw std::invalid_argument(path + " holds a '" + header.metric + "' index, expected '" + metric + "'");
+    if ((header.squared != 0) != distance_traits<distance>::squared)
+        throw std::runtime_error(path + ": radius convention does not match this index type");
+
+    const uint64_t flat_bytes = header.num_points * header.dim * sizeof(float);
+    const uint64_t indices_bytes = header.num_points * sizeof(int32_t);
+    const uint64_t pool_bytes = header.num_nodes * sizeof(Node);
+    if (header.flat_offset + flat_bytes > file->size() || header.indices_offset + indices_bytes > file->size() ||
+        header.pool_offset + pool_bytes > file->size())
+        throw std::runtime_error(path + " is truncated");
+
+    const float *flat = reinterpret_cast<const float *>(file->data() + header.flat_offset);
+    const int32_t *indices = reinterpret_cast<const int32_t *>(file->data() + header.indices_offset);
+    const Node *pool = reinterpret_cast<const Node *>(file->data() + header.pool_offset);
+    const size_t num_values = header.num_points * header.dim;
+
+    ArrayStore<float> flat_store;
+    ArrayStore<int32_t> indices_store;
+    ArrayStore<Node> pool_store;
+    if (mmap) {
+        flat_store = ArrayStore<float>(flat, num_values, file);
+        indices_store = ArrayStore<int32_t>(indices, header.num_points, file);
+        pool_store = ArrayStore<Node>(pool, header.num_nodes, file);
+    } else {
+        flat_store = std::vector<float>(flat, flat + num_values);
+        indices_store = std::vector<int32_t>(indices, indices + header.num_points);
+        pool_store = std::vector<Node>(pool, pool + header.num_nodes);
+    }
+
+    tree.setLeafSize(header.leaf_size);
+    tree.initFromSerialized(std::move(flat_store), header.dim, std::move(indices_store), std::move(pool_store),
+                            header.root_idx, (int64_t)header.next_id);
+}
+
+} // namespace vptree
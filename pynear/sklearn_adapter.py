@@ -61,19 +61,14 @@ def _input_dtype(metric: str) -> str:
     return "uint8" if metric.lower() in _BINARY_METRIC_NAMES else "float32"
 
 
-def _to_arrays(indices_ll, distances_ll):
+def _to_arrays(indices, distances):
     """
-    Convert PyNear list-of-lists to (n_queries, k) numpy arrays sorted
-    nearest-first, matching sklearn's convention.
+    Convert PyNear's (n_queries, k) search arrays to sklearn's dtypes.
 
-    PyNear returns results farthest-first; we sort by ascending distance here.
-    Note: sklearn also returns ``(distances, indices)``, opposite of PyNear's
-    ``(indices, distances)``.
+    PyNear already returns rows sorted nearest-first.  Note: sklearn returns
+    ``(distances, indices)``, opposite of PyNear's ``(indices, distances)``.
     """
-    ind = np.array(indices_ll, dtype=np.intp)
-    dst = np.array(distances_ll, dtype=np.float64)
-    order = np.argsort(dst, axis=1)
-    return np.take_along_axis(dst, order, axis=1), np.take_along_axis(ind, order, axis=1)
+    return distances.astype(np.float64, copy=False), indices.astype(np.intp, copy=False)
 
 
 def _compute_weights(distances: np.ndarray, weights: str) -> np.ndarray:
@@ -168,23 +163,15 @@ class PyNearNearestNeighbors(BaseEstimator):
         if n_neighbors is None:
             n_neighbors = self.n_neighbors
 
-        exclude_self = X is None
-        if exclude_self:
-            X = self._fit_X
+        if X is None:
+            # Self join: the index drops each point's own id while searching, so exact
+            # duplicates of a point are still reported as its neighbours
+            indices, distances = self._index.allKNN(n_neighbors)
         else:
             X = check_array(X, dtype=_input_dtype(self.metric))
+            indices, distances = self._index.searchKNN(X, n_neighbors)
 
-        # Fetch one extra neighbour when excluding self so we can strip it
-        k_fetch = n_neighbors + 1 if exclude_self else n_neighbors
-        indices_ll, distances_ll = self._index.searchKNN(X, k_fetch)
-
-        # Sort nearest-first before stripping so we always remove the true self (distance=0)
-        dst, ind = _to_arrays(indices_ll, distances_ll)
-
-        if exclude_self:
-            dst = dst[:, 1:]
-            ind = ind[:, 1:]
-
+        dst, ind = _to_arrays(indices, distances)
         return (dst, ind) if return_distance else ind
 
     def kneighbors_graph(self, X=None, n_neighbors=None, mode="connectivity"):
@@ -204,17 +191,13 @@ class PyNearNearestNeighbors(BaseEstimator):
         -------
         A : scipy.sparse.csr_matrix of shape (n_queries, n_samples_fit_)
         """
-        from scipy.sparse import csr_matrix
+        from .knn_graph import knn_to_csr
 
         if n_neighbors is None:
             n_neighbors = self.n_neighbors
 
         dst, ind = self.kneighbors(X, n_neighbors=n_neighbors, return_distance=True)
-        n_queries = ind.shape[0]
-        row = np.repeat(np.arange(n_queries), n_neighbors)
-        col = ind.ravel()
-        data = np.ones(len(col)) if mode == "connectivity" else dst.ravel()
-        return csr_matrix((data, (row, col)), shape=(n_queries, self.n_samples_fit_))
+        return knn_to_csr(ind, dst, self.n_samples_fit_, mode)
 
 
 # ---------------------------------------------------------------------------
@@ -301,8 +284,8 @@ class PyNearKNeighborsClassifier(ClassifierMixin, BaseEstimator):
         check_is_fitted(self)
         X = check_array(X, dtype=_input_dtype(self.metric))
 
-        indices_ll, distances_ll = self._index.searchKNN(X, self.n_neighbors)
-        dst, ind = _to_arrays(indices_ll, distances_ll)
+        indices, distances = self._index.searchKNN(X, self.n_neighbors)
+        dst, ind = _to_arrays(indices, distances)
         w = _compute_weights(dst, self.weights)
 
         n_queries = X.shape[0]
@@ -383,8 +366,8 @@ class PyNearKNeighborsRegressor(RegressorMixin, BaseEstimator):
         check_is_fitted(self)
         X = check_array(X, dtype=_input_dtype(self.metric))
 
-        indices_ll, distances_ll = self._index.searchKNN(X, self.n_neighbors)
-        dst, ind = _to_arrays(indices_ll, distances_ll)
+        indices, distances = self._index.searchKNN(X, self.n_neighbors)
+        dst, ind = _to_arrays(indices, distances)
         w = _compute_weights(dst, self.weights)           # (n_queries, k)
 
         neighbour_y = self._y[ind]                        # (n_queries, k, ...)
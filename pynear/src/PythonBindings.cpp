@@ -11,90 +11,354 @@
 #include <cstring>
 #include <iostream>
 #include <omp.h>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <tuple>
 #include <vector>
 
 #include <BKTree.hpp>
 #include <BinaryIVF.hpp>
 #include <BuiltinSerializers.hpp>
 #include <DistanceFunctions.hpp>
+#include <FloatIVF.hpp>
+#include <HNSW.hpp>
 #include <ISerializable.hpp>
 #include <KMeans.hpp>
+#include <KNNGraph.hpp>
 #include <MIH.hpp>
+#include <SearchFilter.hpp>
+#include <SegmentedIndex.hpp>
 #include <SerializableVPTree.hpp>
+#include <VPTreeFile.hpp>
 
 namespace py = pybind11;
 
+template <typename V> static py::array_t<V> vectorToNumpy(const std::vector<V> &values) {
+    py::array_t<V> out({(py::ssize_t)values.size()});
+    if (!values.empty()) std::memcpy(out.mutable_data(), values.data(), values.size() * sizeof(V));
+    return out;
+}
+
+// (offsets, indices, distances) numpy arrays for a VPTree radius search result
+template <typename Result> static py::tuple radiusResultToNumpy(const Result &result) {
+    return py::make_tuple(vectorToNumpy(result.offsets), vectorToNumpy(result.indexes), vectorToNumpy(result.distances));
+}
+
+static py::array_t<bool> flagsToNumpy(const std::vector<uint8_t> &flags) {
+    py::array_t<bool> out({(py::ssize_t)flags.size()});
+    bool *ptr = out.mutable_data();
+    for (size_t i = 0; i < flags.size(); i++)
+        ptr[i] = flags[i] != 0;
+    return out;
+}
+
+template <typename V> static py::array_t<V> knnBuffer(py::handle h, size_t n, size_t k, const char *name) {
+    if (!py::isinstance<py::array_t<V, py::array::c_style>>(h))
+        throw std::invalid_argument(std::string("out: ") + name + " must be a C-contiguous " +
+                                    std::string(py::str(py::dtype::of<V>())) + " array");
+    auto arr = py::reinterpret_borrow<py::array_t<V>>(h);
+    if (arr.ndim() != 2 || (size_t)arr.shape(0) != n || (size_t)arr.shape(1) != k || !arr.writeable())
+        throw std::invalid_argument(std::string("out: ") + name + " must be a writeable array of shape (" +
+                                    std::to_string(n) + ", " + std::to_string(k) + ")");
+    return arr;
+}
+
+/*
+ * (n, k) result buffers for a top-k search: freshly allocated, or the caller's
+ * out=(indices, distances) pair with matching dtypes and shape.
+ */
+template <typename D>
+static std::pair<py::array_t<int64_t>, py::array_t<D>> knnOutput(const py::object &out, size_t n, size_t k) {
+    if (out.is_none())
+        return {py::array_t<int64_t>({(py::ssize_t)n, (py::ssize_t)k}), py::array_t<D>({(py::ssize_t)n, (py::ssize_t)k})};
+    auto pair = out.cast<py::tuple>();
+    if (pair.size() != 2) throw std::invalid_argument("out must be an (indices, distances) tuple");
+    return {knnBuffer<int64_t>(pair[0], n, k, "indices"), knnBuffer<D>(pair[1], n, k, "distances")};
+}
+
+using CodeArray = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>;
+
+/*
+ * Throws unless n codes of width bytes match an index of indexBytes (0 before its first set()).
+ * Adapters check their queries again under their IndexLock, where the width cannot change.
+ */
+static void checkCodeWidth(size_t n, size_t width, size_t indexBytes) {
+    if (n > 0 && indexBytes != 0 && width != indexBytes)
+        throw std::invalid_argument("codes have " + std::to_string(width) + " bytes, index has " +
+                                    std::to_string(indexBytes));
+}
+
+/*
+ * (data, rows, bytes) of a C-contiguous (n, bytes) uint8 array of binary codes, read in place.
+ * An empty 1-D array has no rows.  bytes, when not 0, is the code width the rows must have.
+ */
+static std::tuple<const uint8_t *, size_t, size_t> codeRows(const CodeArray &arr, size_t bytes = 0) {
+    if (arr.ndim() == 1 && arr.shape(0) == 0) return {arr.data(), 0, bytes};
+    if (arr.ndim() != 2) throw std::invalid_argument("binary codes must be a 2-D uint8 array of shape (n, bytes)");
+    const size_t width = (size_t)arr.shape(1);
+    checkCodeWidth(1, width, bytes);
+    return {arr.data(), (size_t)arr.shape(0), width};
+}
+
+// CodeSpan views of the rows of codeRows(arr, bytes); valid while arr is alive
+static std::vector<CodeSpan> codeSpans(const CodeArray &arr, size_t bytes = 0) {
+    auto [data, n, width] = codeRows(arr, bytes);
+    std::vector<CodeSpan> spans(n);
+    for (size_t i = 0; i < n; i++) spans[i] = CodeSpan{data + i * width, width};
+    return spans;
+}
+
+static void checkCodeWidth(const std::vector<CodeSpan> &spans, size_t bytes) {
+    if (!spans.empty()) checkCodeWidth(spans.size(), spans[0].size(), bytes);
+}
+
+/*
+ * The filter= argument of a top-k search:
+ * - None: every point may be returned
+ * - 1-D bool array: mask over ids shared by every query
+ * - 2-D bool array of shape (n_queries, m): one mask per query
+ * - 1-D integer array: ids every query may return
+ * Holds the mask while the search runs; ids past the end of a mask are rejected.
+ */
+struct FilterArgument {
+    FilterArgument(const py::object &filter, size_t nq) {
+        if (filter.is_none()) return;
+        auto arr = py::array::ensure(filter);
+        if (!arr) throw std::invalid_argument("filter must be a bool mask or an array of ids");
+        if (arr.dtype().kind() == 'b') {
+            auto mask = py::array_t<bool, py::array::c_style | py::array::forcecast>::ensure(arr);
+            if (mask.ndim() == 1) {
+                value = SearchFilter{reinterpret_cast<const uint8_t *>(mask.data()), (size_t)mask.shape(0), 0};
+            } else if (mask.ndim() == 2 && (size_t)mask.shape(0) == nq) {
+                value = SearchFilter{reinterpret_cast<const uint8_t *>(mask.data()), (size_t)mask.shape(1),
+                                     (size_t)mask.shape(1)};
+            } else {
+                throw std::invalid_argument("filter: a bool mask must be 1-D or of shape (" + std::to_string(nq) +
+                                            ", n)");
+            }
+            array = mask;
+        } else if (arr.dtype().kind() == 'i' || arr.dtype().kind() == 'u') {
+            auto ids = py::array_t<int64_t, py::array::c_style | py::array::forcecast>::ensure(arr);
+            if (ids.ndim() != 1) throw std::invalid_argument("filter: an id list must be 1-D");
+            const int64_t *values = ids.data();
+            int64_t maxId = -1;
+            for (py::ssize_t i = 0; i < ids.shape(0); ++i) {
+                if (values[i] < 0) throw std::invalid_argument("filter: ids must be non-negative");
+                maxId = std::max(maxId, values[i]);
+            }
+            idMask.assign((size_t)(maxId + 1), 0);
+            for (py::ssize_t i = 0; i < ids.shape(0); ++i) idMask[(size_t)values[i]] = 1;
+            // an empty list allows nothing: a one byte mask of zeros
+            if (idMask.empty()) idMask.push_back(0);
+            value = SearchFilter{idMask.data(), (size_t)(maxId + 1), 0};
+        } else {
+            throw std::invalid_argument("filter must be a bool mask or an array of ids");
+        }
+    }
+
+    SearchFilter value;
+    py::object array;            // bool mask passed in
+    std::vector<uint8_t> idMask; // mask built from an id list
+};
+
+/*
+ * Readers/writer lock of an adapter's index.  Searches and accessors hold it shared; calls that
+ * free or rebuild the index's storage hold it exclusively, so a search on one Python thread never
+ * reads memory a set() on another is replacing.  Always taken after the GIL is released: a thread
+ * waiting for it must not stop the interpreter, nor the thread holding it from finishing.
+ * A copied adapter gets a lock of its own.
+ */
+class IndexLock {
+public:
+    IndexLock() = default;
+    IndexLock(const IndexLock &) {}
+    IndexLock &operator=(const IndexLock &) { return *this; }
+
+    std::shared_lock<std::shared_mutex> read() const { return std::shared_lock<std::shared_mutex>(_mutex); }
+    std::unique_lock<std::shared_mutex> write() const { return std::unique_lock<std::shared_mutex>(_mutex); }
+
+private:
+    mutable std::shared_mutex _mutex;
+};
+
 typedef float (*distance_func_f)(const arrayf &, const arrayf &);
 typedef int64_t (*distance_func_li)(const arrayli &, const arrayli &);
 
 template <distance_func_f distance> class VPTreeNumpyAdapter {
 public:
-    VPTreeNumpyAdapter() = default;
+    explicit VPTreeNumpyAdapter(int32_t leaf_size = vptree::DEFAULT_LEAF_SIZE, int32_t sampled_split = 0) {
+        tree.setLeafSize(leaf_size);
+        tree.setSampledSplit(sampled_split);
+    }
 
+    int32_t leaf_size() const { return tree.leafSize(); }
+
+    float split_imbalance() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.splitImbalance();
+    }
+
+    // Built straight from the array buffer, without a row view per point
     void set(py::array_t<float, py::array::c_style | py::array::forcecast> arr) {
         auto buf = arr.request();
-        if (buf.ndim != 2)
-            throw std::runtime_error("set() expects a 2D float32 array of shape (n, d)");
-        size_t n = (size_t)buf.shape[0];
-        size_t d = (size_t)buf.shape[1];
-        const float* ptr = static_cast<const float*>(buf.ptr);
-        std::vector<arrayf> spans(n);
-        for (size_t i = 0; i < n; i++)
-            spans[i] = FlatSpan{ptr + i * d, d};
-        tree.set(spans);
+        if (buf.ndim != 2) throw std::runtime_error("set() expects a 2D float32 array of shape (n, d)");
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        tree.setRows(static_cast<const float *>(buf.ptr), (size_t)buf.shape[0], (size_t)buf.shape[1]);
     }
 
-    std::tuple<std::vector<std::vector<int64_t>>, std::vector<std::vector<float>>>
-    searchKNN(py::array_t<float, py::array::c_style | py::array::forcecast> queries, size_t k) {
-        auto buf = queries.request();
-        if (buf.ndim != 2)
-            throw std::runtime_error("searchKNN() expects a 2D float32 array of shape (n, d)");
-        size_t n = (size_t)buf.shape[0];
-        size_t d = (size_t)buf.shape[1];
-        const float* ptr = static_cast<const float*>(buf.ptr);
-        std::vector<arrayf> spans(n);
-        for (size_t i = 0; i < n; i++)
-            spans[i] = FlatSpan{ptr + i * d, d};
+    py::array_t<int64_t> add(py::array_t<float, py::array::c_style | py::array::forcecast> arr) {
+        auto spans = rowSpans(arr, "add()");
+        std::vector<int64_t> ids;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.write();
+            ids = tree.add(spans);
+        }
+        return vectorToNumpy(ids);
+    }
+
+    void remove(py::array_t<int64_t, py::array::c_style | py::array::forcecast> ids) {
+        std::vector<int64_t> values(ids.data(), ids.data() + ids.size());
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        tree.remove(values);
+    }
+
+    void compact() {
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        tree.compact();
+    }
 
-        std::vector<typename vptree::VPTree<arrayf, float, distance>::VPTreeSearchResultElement> results;
-        tree.searchKNN(spans, k, results);
+    size_t size() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.size();
+    }
 
-        std::vector<std::vector<int64_t>> indexes(results.size());
-        std::vector<std::vector<float>> distances(results.size());
-        for (size_t i = 0; i < results.size(); i++) {
-            indexes[i] = std::move(results[i].indexes);
-            distances[i] = std::move(results[i].distances);
+    py::tuple searchKNN(py::array_t<float, py::array::c_style | py::array::forcecast> queries, size_t k, float epsilon,
+                        py::object out, py::object filter) {
+        auto spans = rowSpans(queries, "searchKNN()");
+        FilterArgument allowed(filter, spans.size());
+        auto [indices, distances] = knnOutput<float>(out, spans.size(), k);
+        int64_t *indexOut = indices.mutable_data();
+        float *distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            tree.searchKNN(spans, k, indexOut, distanceOut, epsilon, vptree::SearchBudget(), nullptr, allowed.value);
         }
-        return std::make_tuple(indexes, distances);
+        return py::make_tuple(indices, distances);
     }
 
-    std::tuple<std::vector<int64_t>, std::vector<float>>
-    search1NN(py::array_t<float, py::array::c_style | py::array::forcecast> queries) {
-        auto buf = queries.request();
-        if (buf.ndim != 2)
-            throw std::runtime_error("search1NN() expects a 2D float32 array of shape (n, d)");
-        size_t n = (size_t)buf.shape[0];
-        size_t d = (size_t)buf.shape[1];
-        const float* ptr = static_cast<const float*>(buf.ptr);
-        std::vector<arrayf> spans(n);
-        for (size_t i = 0; i < n; i++)
-            spans[i] = FlatSpan{ptr + i * d, d};
+    py::tuple searchKNNBatched(py::array_t<float, py::array::c_style | py::array::forcecast> queries, size_t k,
+                               size_t block_size, py::object out) {
+        auto spans = rowSpans(queries, "searchKNNBatched()");
+        auto [indices, distances] = knnOutput<float>(out, spans.size(), k);
+        int64_t *indexOut = indices.mutable_data();
+        float *distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            tree.searchKNNBatched(spans, k, indexOut, distanceOut, block_size);
+        }
+        return py::make_tuple(indices, distances);
+    }
 
+    py::tuple allKNN(size_t k, bool exclude_self, py::object out) {
+        // one row per id: sized under the lock, which a set() or add() would change
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        py::gil_scoped_acquire acquire;
+        auto [indices, distances] = knnOutput<float>(out, (size_t)tree.nextId(), k);
+        int64_t *indexOut = indices.mutable_data();
+        float *distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release searching;
+            tree.allKNN(k, indexOut, distanceOut, exclude_self);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    py::tuple searchKNNBudgeted(py::array_t<float, py::array::c_style | py::array::forcecast> queries, size_t k,
+                                int64_t max_visits, int64_t max_time_us, float epsilon, py::object out) {
+        vptree::SearchBudget budget;
+        budget.maxVisits = max_visits;
+        budget.maxTimeUs = max_time_us;
+
+        auto spans = rowSpans(queries, "searchKNNBudgeted()");
+        auto [indices, distances] = knnOutput<float>(out, spans.size(), k);
+        int64_t *indexOut = indices.mutable_data();
+        float *distanceOut = distances.mutable_data();
+        std::vector<uint8_t> exact(spans.size());
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            tree.searchKNN(spans, k, indexOut, distanceOut, epsilon, budget, exact.data());
+        }
+        return py::make_tuple(indices, distances, flagsToNumpy(exact));
+    }
+
+    py::tuple search1NN(py::array_t<float, py::array::c_style | py::array::forcecast> queries, float epsilon) {
+        auto spans = rowSpans(queries, "search1NN()");
         std::vector<int64_t> indices;
         std::vector<float> distances;
-        tree.search1NN(spans, indices, distances);
-        return std::make_tuple(std::move(indices), std::move(distances));
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            tree.search1NN(spans, indices, distances, epsilon);
+        }
+        return py::make_tuple(vectorToNumpy(indices), vectorToNumpy(distances));
+    }
+
+    py::tuple search1NNBudgeted(py::array_t<float, py::array::c_style | py::array::forcecast> queries,
+                                int64_t max_visits, int64_t max_time_us, float epsilon) {
+        vptree::SearchBudget budget;
+        budget.maxVisits = max_visits;
+        budget.maxTimeUs = max_time_us;
+
+        auto spans = rowSpans(queries, "search1NNBudgeted()");
+        std::vector<int64_t> indices;
+        std::vector<float> distances;
+        std::vector<uint8_t> exact;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            tree.search1NN(spans, indices, distances, epsilon, budget, &exact);
+        }
+        return py::make_tuple(vectorToNumpy(indices), vectorToNumpy(distances), flagsToNumpy(exact));
+    }
+
+    py::tuple searchRadius(py::array_t<float, py::array::c_style | py::array::forcecast> queries, float radius,
+                           std::optional<size_t> max_results) {
+        auto spans = rowSpans(queries, "searchRadius()");
+        typename vptree::VPTree<arrayf, float, distance>::VPTreeRadiusSearchResult result;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            tree.searchRadius(spans, radius, result, max_results.value_or(0));
+        }
+        return radiusResultToNumpy(result);
     }
 
     std::string to_string() {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
         std::stringstream stream;
         stream << tree;
         return stream.str();
     }
 
     static py::tuple get_state(const VPTreeNumpyAdapter<distance>& p) {
+        py::gil_scoped_release release;
+        auto lock = p._lock.read();
+        py::gil_scoped_acquire acquire;
         const auto& flat = p.tree.flatBacking();
         size_t dim = p.tree.flatDim();
         const auto& indices = p.tree.indexPermutation();
@@ -108,7 +372,23 @@ public:
         py::bytes pool_bytes(reinterpret_cast<const char*>(pool.data()),
                              pool.size() * sizeof(pool[0]));
 
-        return py::make_tuple(flat_bytes, (uint64_t)dim, idx_bytes, pool_bytes, root_idx);
+        return py::make_tuple(flat_bytes, (uint64_t)dim, idx_bytes, pool_bytes, root_idx, p.tree.leafSize(),
+                              distance_traits<distance>::squared, p.tree.nextId());
+    }
+
+    void save(const std::string &path) const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        vptree::saveVPTree(tree, path, metricName());
+    }
+
+    static VPTreeNumpyAdapter<distance> load(const std::string &path, bool mmap) {
+        VPTreeNumpyAdapter<distance> p;
+        {
+            py::gil_scoped_release release;
+            vptree::loadVPTree(p.tree, path, metricName(), mmap);
+        }
+        return p;
     }
 
     static VPTreeNumpyAdapter<distance> set_state(py::tuple t) {
@@ -119,6 +399,8 @@ public:
         auto idx_bytes   = t[2].cast<py::bytes>();
         auto pool_bytes  = t[3].cast<py::bytes>();
         int32_t root_idx = t[4].cast<int32_t>();
+        // leaf size was added after v2.2; older pickles were built with single point leaves
+        if (t.size() > 5) p.tree.setLeafSize(t[5].cast<int32_t>());
 
         // Flat backing
         std::string flat_str(flat_bytes);
@@ -136,46 +418,199 @@ public:
         std::vector<NodeT> pool(pool_str.size() / sizeof(NodeT));
         std::memcpy(pool.data(), pool_str.data(), pool_str.size());
 
+        // VPTreeL2Index switched to squared radii; pickles without the flag store plain L2 radii
+        bool squared_radii = (t.size() > 6) ? t[6].cast<bool>() : false;
+        if (distance_traits<distance>::squared && !squared_radii) {
+            for (NodeT &node : pool)
+                node.setRadius(node.radius() * node.radius());
+        }
+
+        int64_t next_id = (t.size() > 7) ? t[7].cast<int64_t>() : 0;
         p.tree.initFromSerialized(std::move(flat), (size_t)dim,
-                                  std::move(indices), std::move(pool), root_idx);
+                                  std::move(indices), std::move(pool), root_idx, next_id);
         return p;
     }
 
     vptree::VPTree<arrayf, float, distance> tree;
+
+private:
+    IndexLock _lock;
+
+    // metric tag stored in saved index files
+    static constexpr const char *metricName() {
+        if constexpr (distance == dist_l2sq_f_avx2)
+            return "l2";
+        else if constexpr (distance == dist_l1_f_avx2)
+            return "l1";
+        else
+            return "chebyshev";
+    }
+
+    // Row views over a C-contiguous (n, d) float32 array; valid while the array is alive
+    static std::vector<arrayf> rowSpans(py::array_t<float, py::array::c_style | py::array::forcecast> &arr,
+                                        const char *caller) {
+        auto buf = arr.request();
+        if (buf.ndim != 2)
+            throw std::runtime_error(std::string(caller) + " expects a 2D float32 array of shape (n, d)");
+        size_t n = (size_t)buf.shape[0];
+        size_t d = (size_t)buf.shape[1];
+        const float* ptr = static_cast<const float*>(buf.ptr);
+        std::vector<arrayf> spans(n);
+        for (size_t i = 0; i < n; i++)
+            spans[i] = FlatSpan{ptr + i * d, d};
+        return spans;
+    }
 };
 
 template <distance_func_li distance> class VPTreeNumpyAdapterBinary {
 public:
-    VPTreeNumpyAdapterBinary() = default;
+    explicit VPTreeNumpyAdapterBinary(int32_t leaf_size = vptree::DEFAULT_LEAF_SIZE, int32_t sampled_split = 0) {
+        tree.setLeafSize(leaf_size);
+        tree.setSampledSplit(sampled_split);
+    }
 
-    void set(const ndarrayli &array) { tree.set(array); }
+    int32_t leaf_size() const { return tree.leafSize(); }
 
-    std::tuple<std::vector<std::vector<int64_t>>, std::vector<std::vector<int64_t>>> searchKNN(const ndarrayli &queries, size_t k) {
+    float split_imbalance() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.splitImbalance();
+    }
 
-        std::vector<typename vptree::VPTree<arrayli, int64_t, distance>::VPTreeSearchResultElement> results;
-        tree.searchKNN(queries, k, results);
+    void set(CodeArray array) {
+        auto [data, n, bytes] = codeRows(array);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        tree.setRows(data, n, bytes);
+    }
 
-        std::vector<std::vector<int64_t>> indexes;
-        std::vector<std::vector<int64_t>> distances;
-        indexes.resize(results.size());
-        distances.resize(results.size());
-        for (size_t i = 0; i < results.size(); ++i) {
-            indexes[i] = std::move(results[i].indexes);
-            distances[i] = std::move(results[i].distances);
+    py::array_t<int64_t> add(CodeArray array) {
+        auto spans = codeSpans(array);
+        std::vector<int64_t> ids;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.write();
+            checkCodeWidth(spans, tree.flatDim());
+            ids = tree.add(spans);
         }
-        return std::make_tuple(indexes, distances);
+        return vectorToNumpy(ids);
     }
 
-    std::tuple<std::vector<int64_t>, std::vector<int64_t>> search1NN(const ndarrayli &queries) {
+    void remove(py::array_t<int64_t, py::array::c_style | py::array::forcecast> ids) {
+        std::vector<int64_t> values(ids.data(), ids.data() + ids.size());
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        tree.remove(values);
+    }
 
+    void compact() {
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        tree.compact();
+    }
+
+    size_t size() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.size();
+    }
+
+    py::tuple searchKNN(CodeArray queries, size_t k, py::object out, py::object filter) {
+        auto spans = codeSpans(queries);
+        FilterArgument allowed(filter, spans.size());
+        auto [indices, distances] = knnOutput<int64_t>(out, spans.size(), k);
+        int64_t *indexOut = indices.mutable_data();
+        int64_t *distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(spans, tree.flatDim());
+            tree.searchKNN(spans, k, indexOut, distanceOut, 0, vptree::SearchBudget(), nullptr, allowed.value);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    py::tuple allKNN(size_t k, bool exclude_self, py::object out) {
+        // one row per id: sized under the lock, which a set() or add() would change
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        py::gil_scoped_acquire acquire;
+        auto [indices, distances] = knnOutput<int64_t>(out, (size_t)tree.nextId(), k);
+        int64_t *indexOut = indices.mutable_data();
+        int64_t *distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release searching;
+            tree.allKNN(k, indexOut, distanceOut, exclude_self);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    py::tuple search1NN(CodeArray queries) {
+        auto spans = codeSpans(queries);
         std::vector<int64_t> indices;
         std::vector<int64_t> distances;
-        tree.search1NN(queries, indices, distances);
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(spans, tree.flatDim());
+            tree.search1NN(spans, indices, distances);
+        }
+        return py::make_tuple(vectorToNumpy(indices), vectorToNumpy(distances));
+    }
+
+    py::tuple searchRadius(CodeArray queries, int64_t radius, std::optional<size_t> max_results) {
+        auto spans = codeSpans(queries);
+        typename vptree::VPTree<arrayli, int64_t, distance>::VPTreeRadiusSearchResult result;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(spans, tree.flatDim());
+            tree.searchRadius(spans, radius, result, max_results.value_or(0));
+        }
+        return radiusResultToNumpy(result);
+    }
 
-        return std::make_tuple(std::move(indices), std::move(distances));
+    py::tuple searchKNNBudgeted(CodeArray queries, size_t k, int64_t max_visits, int64_t max_time_us,
+                                py::object out) {
+        vptree::SearchBudget budget;
+        budget.maxVisits = max_visits;
+        budget.maxTimeUs = max_time_us;
+
+        auto spans = codeSpans(queries);
+        auto [indices, distances] = knnOutput<int64_t>(out, spans.size(), k);
+        int64_t *indexOut = indices.mutable_data();
+        int64_t *distanceOut = distances.mutable_data();
+        std::vector<uint8_t> exact(spans.size());
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(spans, tree.flatDim());
+            tree.searchKNN(spans, k, indexOut, distanceOut, 0, budget, exact.data());
+        }
+        return py::make_tuple(indices, distances, flagsToNumpy(exact));
+    }
+
+    py::tuple search1NNBudgeted(CodeArray queries, int64_t max_visits, int64_t max_time_us) {
+        vptree::SearchBudget budget;
+        budget.maxVisits = max_visits;
+        budget.maxTimeUs = max_time_us;
+
+        auto spans = codeSpans(queries);
+        std::vector<int64_t> indices;
+        std::vector<int64_t> distances;
+        std::vector<uint8_t> exact;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(spans, tree.flatDim());
+            tree.search1NN(spans, indices, distances, 0, budget, &exact);
+        }
+        return py::make_tuple(vectorToNumpy(indices), vectorToNumpy(distances), flagsToNumpy(exact));
     }
 
     std::string to_string() {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
         std::stringstream stream;
         stream << tree;
 
@@ -183,8 +618,13 @@ public:
     }
 
     static py::tuple get_state(const VPTreeNumpyAdapterBinary<distance> &p) {
-        vptree::SerializedStateObject state = p.tree.serialize();
-        py::tuple t = py::make_tuple(state.data(), state.checksum());
+        vptree::SerializedStateObject state;
+        {
+            py::gil_scoped_release release;
+            auto lock = p._lock.read();
+            state = p.tree.serialize();
+        }
+        py::tuple t = py::make_tuple(state.data(), state.checksum(), p.tree.leafSize());
         return t;
     }
 
@@ -193,17 +633,27 @@ public:
         std::vector<uint8_t> state = t[0].cast<std::vector<uint8_t>>();
         uint32_t checksum = t[1].cast<uint32_t>();
         p.tree.deserialize(vptree::SerializedStateObject(state, checksum));
+        if (t.size() > 2) p.tree.setLeafSize(t[2].cast<int32_t>());
         return p;
     }
 
     vptree::SerializableVPTree<arrayli, int64_t, distance, vptree::ndarraySerializer<uint8_t>, vptree::ndarrayDeserializer<uint8_t>> tree;
+
+private:
+    IndexLock _lock;
 };
 
+// Keys and queries are stored codes or CodeSpan views of the same width
 template <distance_func_li distance_f> class HammingMetric : Metric<arrayli, int64_t> {
 public:
-    static int64_t distance(const arrayli &a, const arrayli &b) { return distance_f(a, b); }
+    template <typename A, typename B> static int64_t distance(const A &a, const B &b) {
+        return distance_traits<distance_f>::codes(a.data(), b.data(), a.size());
+    }
 
-    static std::optional<int64_t> threshold_distance(const arrayli &a, const arrayli &b, int64_t threshold) { return distance_f(a, b); }
+    template <typename A, typename B>
+    static std::optional<int64_t> threshold_distance(const A &a, const B &b, int64_t threshold) {
+        return distance(a, b);
+    }
 };
 
 template <distance_func_li distance> class BKTreeBinaryNumpyAdapter {
@@ -215,16 +665,66 @@ public:
 
     BKTreeBinaryNumpyAdapter() = default;
 
-    void set(const std::vector<key_t> &array) { tree.update(array); }
+    // Keys are copied straight from the array rows; there is no intermediate list of codes
+    void set(CodeArray array) {
+        auto [data, n, bytes] = codeRows(array);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        checkCodeWidth(n, bytes, _bytes);
+        for (size_t i = 0; i < n; i++) tree.add(key_t(data + i * bytes, data + (i + 1) * bytes));
+        if (n > 0) _bytes = bytes;
+    }
+
+    // CSR-style (offsets, indices, distances) like searchRadius; the keys are data[indices]
+    py::tuple find_threshold(CodeArray queries, distance_t threshold) {
+        auto spans = codeSpans(queries);
+        std::vector<int64_t> offsets(spans.size() + 1, 0);
+        std::vector<index_t> indices;
+        std::vector<distance_t> distances;
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(spans, _bytes);
+            auto [found, foundDistances, keys] = tree.find_batch(spans, threshold);
+            for (size_t q = 0; q < spans.size(); q++) offsets[q + 1] = offsets[q] + found[q].size();
+            indices.resize(offsets.back());
+            distances.resize(offsets.back());
+            std::vector<std::pair<distance_t, index_t>> matches;
+            for (size_t q = 0; q < spans.size(); q++) {
+                // nearest first, ties by id
+                matches.clear();
+                for (size_t i = 0; i < found[q].size(); i++) matches.push_back({foundDistances[q][i], found[q][i]});
+                std::sort(matches.begin(), matches.end());
+                for (size_t i = 0; i < matches.size(); i++) {
+                    distances[offsets[q] + i] = matches[i].first;
+                    indices[offsets[q] + i] = matches[i].second;
+                }
+            }
+        }
+        return py::make_tuple(vectorToNumpy(offsets), vectorToNumpy(indices), vectorToNumpy(distances));
+    }
+
+    bool empty() {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.empty();
+    }
 
-    std::tuple<std::vector<std::vector<index_t>>, std::vector<std::vector<distance_t>>, std::vector<std::vector<key_t>>>
-    find_threshold(const std::vector<key_t> &queries, distance_t threshold) {
-        return tree.find_batch(queries, threshold);
+    size_t size() {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.size();
     }
 
-    bool empty() { return tree.empty(); }
-    size_t size() { return tree.size(); }
-    std::vector<key_t> values() { return tree.values(); }
+    std::vector<key_t> values() {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return tree.values();
+    }
+
+private:
+    IndexLock _lock;
+    size_t _bytes = 0; // code width, 0 until the first non-empty set()
 };
 
 // ── IVFFlatBinaryIndex adapter ────────────────────────────────────────────────
@@ -234,50 +734,501 @@ public:
                                int32_t max_iter = 20, uint32_t seed = 42)
         : _index(nlist, nprobe, max_iter, seed) {}
 
-    void set(const ndarrayli& data) { _index.set(data); }
+    void set(CodeArray data) {
+        auto [ptr, n, bytes] = codeRows(data);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.set(ptr, n, bytes);
+    }
+
+    py::tuple searchKNN(CodeArray queries, size_t k, py::object out, py::object filter) {
+        auto [queryPtr, nq, bytes] = codeRows(queries);
+        FilterArgument allowed(filter, nq);
+        auto [indices, distances] = knnOutput<int64_t>(out, nq, k);
+        int64_t* indexOut    = indices.mutable_data();
+        int64_t* distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(nq, bytes, _index.nbytes());
+            _index.searchKNN(queryPtr, nq, k, indexOut, distanceOut, allowed.value);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    int32_t nlist() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.nlist();
+    }
 
-    std::tuple<std::vector<std::vector<int64_t>>,
-               std::vector<std::vector<int64_t>>>
-    searchKNN(const ndarrayli& queries, size_t k) {
-        return _index.searchKNN(queries, k);
+    int32_t nprobe() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.nprobe();
     }
 
-    int32_t nlist()  const { return _index.nlist(); }
-    int32_t nprobe() const { return _index.nprobe(); }
-    void set_nprobe(int32_t nprobe) { _index.set_nprobe(nprobe); }
+    void set_nprobe(int32_t nprobe) {
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.set_nprobe(nprobe);
+    }
 
 private:
+    IndexLock _lock;
     IVFFlatBinaryIndex _index;
 };
 
+// ── IVFFlatL2Index adapter ────────────────────────────────────────────────────
+class IVFFlatL2NumpyAdapter {
+public:
+    using FloatArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+    IVFFlatL2NumpyAdapter(int32_t n_clusters = 100, int32_t n_probe = 10)
+        : _index(n_clusters, n_probe) {}
+
+    void set(FloatArray data) {
+        if (data.ndim() != 2) throw std::invalid_argument("data must be a 2-D array of shape (N, D)");
+        const float* ptr = data.data();
+        size_t n = (size_t)data.shape(0);
+        size_t d = (size_t)data.shape(1);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.set(ptr, n, d);
+    }
+
+    // A 1-D query is searched as a single row
+    py::tuple searchKNN(FloatArray queries, size_t k, py::object out) {
+        if (queries.ndim() != 1 && queries.ndim() != 2)
+            throw std::invalid_argument("queries must be a 1-D or 2-D float32 array");
+        size_t nq = queries.ndim() == 1 ? 1 : (size_t)queries.shape(0);
+        size_t d  = (size_t)queries.shape(queries.ndim() - 1);
+
+        auto [indices, distances] = knnOutput<float>(out, nq, k);
+        const float* queryPtr = queries.data();
+        int64_t* indexOut     = indices.mutable_data();
+        float* distanceOut    = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            if (_index.empty()) throw std::runtime_error("Index is empty — call set() first");
+            if (d != _index.dim())
+                throw std::invalid_argument("queries have dimension " + std::to_string(d) + ", index has " +
+                                            std::to_string(_index.dim()));
+            _index.searchKNN(queryPtr, nq, k, indexOut, distanceOut);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    py::tuple search1NN(FloatArray queries) { return searchKNN(queries, 1, py::none()); }
+
+    size_t n_clusters() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.n_clusters();
+    }
+
+    int32_t n_probe() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return std::min(_index.nprobe(), _index.nlist());
+    }
+
+    static py::tuple get_state(const IVFFlatL2NumpyAdapter& p) {
+        py::gil_scoped_release release;
+        auto lock = p._lock.read();
+        py::gil_scoped_acquire acquire;
+        const IVFFlatL2Index& index = p._index;
+        return py::make_tuple(index.nlist(), index.nprobe(), (uint64_t)index.dim(),
+                              vectorToNumpy(index.centroids()), vectorToNumpy(index.blocks()),
+                              vectorToNumpy(index.offsets()), vectorToNumpy(index.ids()));
+    }
+
+    static IVFFlatL2NumpyAdapter set_state(py::tuple t) {
+        IVFFlatL2NumpyAdapter p(t[0].cast<int32_t>(), t[1].cast<int32_t>());
+        p._index.initFromSerialized(t[2].cast<uint64_t>(), t[3].cast<std::vector<float>>(),
+                                    t[4].cast<std::vector<float>>(), t[5].cast<std::vector<int64_t>>(),
+                                    t[6].cast<std::vector<int64_t>>());
+        return p;
+    }
+
+private:
+    IndexLock _lock;
+    IVFFlatL2Index _index;
+};
+
+// ── HNSWIndex adapter ─────────────────────────────────────────────────────────
+template <distance_func_f distance> class HNSWNumpyAdapter {
+public:
+    using FloatArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+    HNSWNumpyAdapter(int32_t M = 16, int32_t ef_construction = 200, int32_t ef_search = 50, uint32_t seed = 42)
+        : _index(M, ef_construction, ef_search, seed) {}
+
+    void set(FloatArray data) {
+        auto [ptr, n, d] = rows(data);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.set(ptr, n, d);
+    }
+
+    void add(FloatArray data) {
+        auto [ptr, n, d] = rows(data);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.add(ptr, n, d);
+    }
+
+    py::tuple searchKNN(FloatArray queries, size_t k, int32_t ef, py::object out) {
+        auto [queryPtr, nq, d] = rows(queries);
+        auto [indices, distances] = knnOutput<float>(out, nq, k);
+        int64_t* indexOut  = indices.mutable_data();
+        float* distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkDim(d);
+            _index.searchKNN(queryPtr, nq, k, ef, indexOut, distanceOut);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    py::tuple search1NN(FloatArray queries, int32_t ef) {
+        auto [queryPtr, nq, d] = rows(queries);
+        py::array_t<int64_t> indices({(py::ssize_t)nq});
+        py::array_t<float> distances({(py::ssize_t)nq});
+        int64_t* indexOut  = indices.mutable_data();
+        float* distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkDim(d);
+            _index.searchKNN(queryPtr, nq, 1, ef, indexOut, distanceOut);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    size_t size() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.size();
+    }
+
+    int32_t M() const { return _index.M(); }
+
+    int32_t ef_search() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.ef_search();
+    }
+
+    void set_ef_search(int32_t ef) {
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.set_ef_search(ef);
+    }
+
+    static py::tuple get_state(const HNSWNumpyAdapter<distance>& p) {
+        py::gil_scoped_release release;
+        auto lock = p._lock.read();
+        py::gil_scoped_acquire acquire;
+        const auto& index = p._index;
+        return py::make_tuple(index.M(), index.ef_construction(), index.ef_search(), (uint64_t)index.dim(),
+                              vectorToNumpy(index.vectors()), vectorToNumpy(index.levels()),
+                              vectorToNumpy(index.links()), index.entryPoint());
+    }
+
+    static HNSWNumpyAdapter<distance> set_state(py::tuple t) {
+        HNSWNumpyAdapter<distance> p(t[0].cast<int32_t>(), t[1].cast<int32_t>(), t[2].cast<int32_t>());
+        p._index.initFromSerialized(t[3].cast<uint64_t>(), t[4].cast<std::vector<float>>(),
+                                    t[5].cast<std::vector<int32_t>>(), t[6].cast<std::vector<int32_t>>(),
+                                    t[7].cast<int32_t>());
+        return p;
+    }
+
+private:
+    IndexLock _lock;
+    HNSWIndex<distance> _index;
+
+    // call with the lock held
+    void checkDim(size_t d) const {
+        if (!_index.empty() && d != _index.dim())
+            throw std::invalid_argument("queries have dimension " + std::to_string(d) + ", index has " +
+                                        std::to_string(_index.dim()));
+    }
+
+    // (data, rows, dim) of a 2-D array; a 1-D array is a single row
+    static std::tuple<const float*, size_t, size_t> rows(const FloatArray& arr) {
+        if (arr.ndim() == 1) return {arr.data(), 1, (size_t)arr.shape(0)};
+        if (arr.ndim() != 2) throw std::invalid_argument("expected a 2-D float32 array of shape (n, d)");
+        return {arr.data(), (size_t)arr.shape(0), (size_t)arr.shape(1)};
+    }
+};
+
+// ── SegmentedVPTreeIndex adapter ──────────────────────────────────────────────
+template <distance_func_f distance> class SegmentedVPTreeNumpyAdapter {
+public:
+    using FloatArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+    // held by pointer: the index owns a mutex and a worker thread, the adapter must stay movable for pickle
+    SegmentedVPTreeNumpyAdapter(size_t memtable_size = 4096, size_t merge_factor = 4,
+                                int32_t leaf_size = vptree::DEFAULT_LEAF_SIZE)
+        : _index(std::make_unique<SegmentedVPTreeIndex<distance>>(memtable_size, merge_factor, leaf_size)) {}
+
+    py::array_t<int64_t> add(FloatArray data) {
+        auto [ptr, n, d] = rows(data);
+        py::array_t<int64_t> ids({(py::ssize_t)n});
+        int64_t* idOut = ids.mutable_data();
+        {
+            py::gil_scoped_release release;
+            const int64_t first = (int64_t)_index->add(ptr, n, d);
+            for (size_t i = 0; i < n; ++i) idOut[i] = first + (int64_t)i;
+        }
+        return ids;
+    }
+
+    py::tuple searchKNN(FloatArray queries, size_t k, py::object out) {
+        auto [queryPtr, nq, d] = rows(queries);
+        auto [indices, distances] = knnOutput<float>(out, nq, k);
+        int64_t* indexOut  = indices.mutable_data();
+        float* distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            _index->searchKNN(queryPtr, nq, d, k, indexOut, distanceOut);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    py::tuple search1NN(FloatArray queries) {
+        auto [queryPtr, nq, d] = rows(queries);
+        py::array_t<int64_t> indices({(py::ssize_t)nq});
+        py::array_t<float> distances({(py::ssize_t)nq});
+        int64_t* indexOut  = indices.mutable_data();
+        float* distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            _index->searchKNN(queryPtr, nq, d, 1, indexOut, distanceOut);
+        }
+        return py::make_tuple(indices, distances);
+    }
+
+    void flush() {
+        py::gil_scoped_release release;
+        _index->flush();
+    }
+
+    size_t  size()          const { return _index->size(); }
+    size_t  num_segments()  const { return _index->numSegments(); }
+    size_t  memtable_size() const { return _index->memtableSize(); }
+    size_t  merge_factor()  const { return _index->mergeFactor(); }
+
+    static py::tuple get_state(const SegmentedVPTreeNumpyAdapter<distance>& p) {
+        const auto& index = *p._index;
+        std::vector<float> values;
+        {
+            py::gil_scoped_release release;
+            values = index.vectors();
+        }
+        // read after the vectors: the add() that published any of them had fixed the dimension
+        return py::make_tuple(index.memtableSize(), index.mergeFactor(), index.leafSize(), (uint64_t)index.dim(),
+                              vectorToNumpy(values));
+    }
+
+    // the vectors are added back in id order, so every point keeps its id
+    static SegmentedVPTreeNumpyAdapter<distance> set_state(py::tuple t) {
+        SegmentedVPTreeNumpyAdapter<distance> p(t[0].cast<size_t>(), t[1].cast<size_t>(), t[2].cast<int32_t>());
+        const size_t dim = t[3].cast<uint64_t>();
+        auto values = t[4].cast<FloatArray>();
+        if (dim > 0 && values.size() > 0) {
+            const float* ptr = values.data();
+            const size_t n = (size_t)values.size() / dim;
+            py::gil_scoped_release release;
+            p._index->add(ptr, n, dim);
+        }
+        return p;
+    }
+
+private:
+    std::unique_ptr<SegmentedVPTreeIndex<distance>> _index;
+
+    // (data, rows, dim) of a 2-D array; a 1-D array is a single row
+    static std::tuple<const float*, size_t, size_t> rows(const FloatArray& arr) {
+        if (arr.ndim() == 1) return {arr.data(), 1, (size_t)arr.shape(0)};
+        if (arr.ndim() != 2) throw std::invalid_argument("expected a 2-D float32 array of shape (n, d)");
+        return {arr.data(), (size_t)arr.shape(0), (size_t)arr.shape(1)};
+    }
+};
+
 // ── MIHBinaryIndex adapter ────────────────────────────────────────────────────
 class MIHBinaryNumpyAdapter {
 public:
     explicit MIHBinaryNumpyAdapter(int32_t m = 8) : _index(m) {}
 
-    void set(const ndarrayli& data) { _index.set(data); }
+    void set(CodeArray data) {
+        auto [ptr, n, bytes] = codeRows(data);
+        py::gil_scoped_release release;
+        auto lock = _lock.write();
+        _index.set(ptr, n, bytes);
+    }
 
-    std::tuple<std::vector<std::vector<int64_t>>,
-               std::vector<std::vector<int64_t>>>
-    searchKNN(const ndarrayli& queries, size_t k, int32_t radius = 8) {
-        return _index.searchKNN(queries, k, radius);
+    py::tuple searchKNN(CodeArray queries, size_t k, int32_t radius, py::object out, py::object filter) {
+        auto [queryPtr, nq, bytes] = codeRows(queries);
+        FilterArgument allowed(filter, nq);
+        auto [indices, distances] = knnOutput<int64_t>(out, nq, k);
+        int64_t* indexOut    = indices.mutable_data();
+        int64_t* distanceOut = distances.mutable_data();
+        {
+            py::gil_scoped_release release;
+            auto lock = _lock.read();
+            checkCodeWidth(nq, bytes, _index.nbytes());
+            _index.searchKNN(queryPtr, nq, k, indexOut, distanceOut, radius, allowed.value);
+        }
+        return py::make_tuple(indices, distances);
     }
 
-    int32_t m()      const { return _index.m(); }
-    size_t  n()      const { return _index.n(); }
-    size_t  nbytes() const { return _index.nbytes(); }
+    int32_t m() const { return _index.m(); }
+
+    size_t n() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.n();
+    }
+
+    size_t nbytes() const {
+        py::gil_scoped_release release;
+        auto lock = _lock.read();
+        return _index.nbytes();
+    }
 
 private:
+    IndexLock _lock;
     MIHBinaryIndex _index;
 };
 
 static const char *index_set = "Add vectors to index";
-static const char *index_topk = "Batch find top-k vectors in index and return indices and distances";
-static const char *index_top1 = "Batch find closest vectors in index and return indices and distances";
+static const char *index_topk = "Batch find top-k vectors in index and return (n, k) numpy arrays of indices and distances.\n"
+                                "Rows are sorted nearest first and padded with index -1 when fewer than k neighbours "
+                                "exist; out=(indices, distances) writes into caller-provided arrays instead";
+static const char *index_topk_filter = "Batch find top-k vectors in index and return (n, k) numpy arrays of indices and "
+                                       "distances, sorted nearest first and padded with index -1 when fewer than k "
+                                       "neighbours exist; out=(indices, distances) writes into caller-provided arrays "
+                                       "instead.\n"
+                                       "filter restricts the results: a bool mask over ids, an (n, m) bool array with "
+                                       "one mask per query, or an array of allowed ids";
+static const char *index_top1 = "Batch find closest vectors in index and return numpy arrays of indices and distances";
 static const char *index_string = "Return a debug string representation of the tree";
-static const char *index_find_threshold = "Batch find all vectors below the distance threshold";
+static const char *index_find_threshold = "Batch find all vectors within the distance threshold (inclusive).\n"
+                                          "Returns CSR-style numpy arrays (offsets, indices, distances): the matches of "
+                                          "query i are indices[offsets[i]:offsets[i + 1]], sorted nearest first";
 static const char *index_values = "Return all stored vectors in arbitrary order";
 
+static const char *index_leaf_size = "Maximum number of points stored in a leaf bucket";
+static const char *index_init = "leaf_size is the maximum number of points stored in a leaf bucket.\n"
+                                "sampled_split > 0 splits partitions of at least that many points (4096 or more) "
+                                "at a median radius estimated from a random sample, in one streaming pass, which "
+                                "builds very large indexes faster and with less scratch memory. Searches stay exact; "
+                                "only the tree balance is approximate";
+static const char *index_split_imbalance = "Largest relative size difference between the two halves of a sampled "
+                                           "split in the last build (0 when none was sampled)";
+static const char *index_add = "Insert vectors without rebuilding the index and return their ids, which continue "
+                               "after the largest id in use";
+static const char *index_remove = "Delete vectors by id; they stop appearing in results at once. Raises ValueError "
+                                  "for ids not in the index";
+static const char *index_compact = "Rewrite the index from its live vectors, releasing space held by removed ones";
+static const char *index_size = "Number of vectors searches can return";
+static const char *index_topk_eps = "Batch find top-k vectors in index and return (n, k) numpy arrays of indices and "
+                                    "distances, sorted nearest first; out=(indices, distances) writes into "
+                                    "caller-provided arrays instead.\n"
+                                    "epsilon > 0 enables (1+epsilon)-approximate search: every returned distance is at "
+                                    "most (1+epsilon) times the exact one.\n"
+                                    "filter restricts the results: a bool mask over ids, an (n, m) bool array with one "
+                                    "mask per query, or an array of allowed ids";
+static const char *index_topk_batched = "Exact top-k search tuned for throughput on large batches; same results as "
+                                        "searchKNN.\n"
+                                        "Queries are grouped by the region of the tree they fall in and walked "
+                                        "through it together, block_size at a time, so every node is loaded once "
+                                        "per block instead of once per query";
+static const char *index_all_knn = "Top-k neighbours of every indexed vector among the others, as (n, k) numpy arrays "
+                                   "with one row per id (rows of removed ids are padding). exclude_self=False lets a "
+                                   "vector report itself";
+static const char *knn_graph_doc = "Approximate k-nearest-neighbour graph of data by NN-descent seeded with budgeted "
+                                   "VP-tree searches. Returns (n, k) arrays (indices, distances); row i holds the "
+                                   "neighbours of point i, never i itself, nearest first";
+static const char *index_topk_budget = "Batch top-k search under a per-query work budget (0 = unlimited).\n"
+                                       "Returns (indices, distances, exact); exact[i] is False when the budget "
+                                       "ran out and the result holds the best neighbours found so far";
+static const char *index_top1_budget = "Batch 1-NN search under a per-query work budget (0 = unlimited).\n"
+                                       "Returns (indices, distances, exact); exact[i] is False when the budget "
+                                       "ran out before the nearest neighbour was proven";
+static const char *index_radius = "Batch find all vectors within radius (inclusive) of each query.\n"
+                                  "Returns CSR-style numpy arrays (offsets, indices, distances): the neighbours of "
+                                  "query i are indices[offsets[i]:offsets[i + 1]], sorted nearest first. "
+                                  "max_results keeps only the nearest max_results per query";
+static const char *index_save = "Write the index to path in the pynear index file format (little-endian, "
+                                "64-byte aligned sections)";
+static const char *index_load = "Open an index written by save(). With mmap=True the file is memory-mapped and "
+                                "searched in place, loading pages lazily; mmap=False reads it into memory";
+static const char *index_top1_eps = "Batch find closest vectors in index and return numpy arrays of indices and distances.\n"
+                                    "epsilon > 0 enables (1+epsilon)-approximate search";
+
+template <distance_func_f distance> void bind_vptree_index(py::module &m, const char *name) {
+    using Adapter = VPTreeNumpyAdapter<distance>;
+    py::class_<Adapter>(m, name)
+        .def(py::init<int32_t, int32_t>(), index_init, py::arg("leaf_size") = vptree::DEFAULT_LEAF_SIZE,
+             py::arg("sampled_split") = 0)
+        .def("set", &Adapter::set, index_set, py::arg("vectors"))
+        .def("add", &Adapter::add, index_add, py::arg("vectors"))
+        .def("remove", &Adapter::remove, index_remove, py::arg("ids"))
+        .def("compact", &Adapter::compact, index_compact)
+        .def("size", &Adapter::size, index_size)
+        .def("to_string", &Adapter::to_string, index_string)
+        .def("searchKNN", &Adapter::searchKNN, index_topk_eps, py::arg("vectors"), py::arg("k"), py::arg("epsilon") = 0.0f,
+             py::arg("out") = py::none(), py::arg("filter") = py::none())
+        .def("search1NN", &Adapter::search1NN, index_top1_eps, py::arg("vectors"), py::arg("epsilon") = 0.0f)
+        .def("searchKNNBatched", &Adapter::searchKNNBatched, index_topk_batched, py::arg("vectors"), py::arg("k"),
+             py::arg("block_size") = vptree::VPTree<arrayf, float, distance>::QUERY_BLOCK, py::arg("out") = py::none())
+        .def("allKNN", &Adapter::allKNN, index_all_knn, py::arg("k"), py::arg("exclude_self") = true,
+             py::arg("out") = py::none())
+        .def("searchKNNBudgeted", &Adapter::searchKNNBudgeted, index_topk_budget, py::arg("vectors"), py::arg("k"),
+             py::arg("max_visits") = 0, py::arg("max_time_us") = 0, py::arg("epsilon") = 0.0f, py::arg("out") = py::none())
+        .def("searchRadius", &Adapter::searchRadius, index_radius, py::arg("vectors"), py::arg("radius"),
+             py::arg("max_results") = py::none())
+        .def("search1NNBudgeted", &Adapter::search1NNBudgeted, index_top1_budget, py::arg("vectors"),
+             py::arg("max_visits") = 0, py::arg("max_time_us") = 0, py::arg("epsilon") = 0.0f)
+        .def("leaf_size", &Adapter::leaf_size, index_leaf_size)
+        .def("split_imbalance", &Adapter::split_imbalance, index_split_imbalance)
+        .def("save", &Adapter::save, index_save, py::arg("path"))
+        .def_static("load", &Adapter::load, index_load, py::arg("path"), py::arg("mmap") = true)
+        .def(py::pickle(&Adapter::get_state, &Adapter::set_state));
+}
+
+template <distance_func_li distance> void bind_vptree_binary_index(py::module &m, const char *name) {
+    using Adapter = VPTreeNumpyAdapterBinary<distance>;
+    py::class_<Adapter>(m, name)
+        .def(py::init<int32_t, int32_t>(), index_init, py::arg("leaf_size") = vptree::DEFAULT_LEAF_SIZE,
+             py::arg("sampled_split") = 0)
+        .def("set", &Adapter::set, index_set, py::arg("vectors"))
+        .def("add", &Adapter::add, index_add, py::arg("vectors"))
+        .def("remove", &Adapter::remove, index_remove, py::arg("ids"))
+        .def("compact", &Adapter::compact, index_compact)
+        .def("size", &Adapter::size, index_size)
+        .def("to_string", &Adapter::to_string, index_string)
+        .def("searchKNN", &Adapter::searchKNN, index_topk_filter, py::arg("vectors"), py::arg("k"),
+             py::arg("out") = py::none(), py::arg("filter") = py::none())
+        .def("search1NN", &Adapter::search1NN, index_top1, py::arg("vectors"))
+        .def("allKNN", &Adapter::allKNN, index_all_knn, py::arg("k"), py::arg("exclude_self") = true,
+             py::arg("out") = py::none())
+        .def("searchKNNBudgeted", &Adapter::searchKNNBudgeted, index_topk_budget, py::arg("vectors"), py::arg("k"),
+             py::arg("max_visits") = 0, py::arg("max_time_us") = 0, py::arg("out") = py::none())
+        .def("searchRadius", &Adapter::searchRadius, index_radius, py::arg("vectors"), py::arg("radius"),
+             py::arg("max_results") = py::none())
+        .def("search1NNBudgeted", &Adapter::search1NNBudgeted, index_top1_budget, py::arg("vectors"),
+             py::arg("max_visits") = 0, py::arg("max_time_us") = 0)
+        .def("leaf_size", &Adapter::leaf_size, index_leaf_size)
+        .def("split_imbalance", &Adapter::split_imbalance, index_split_imbalance)
+        .def(py::pickle(&Adapter::get_state, &Adapter::set_state));
+}
+
 static float py_dist_l2(py::array_t<float, py::array::c_style | py::array::forcecast> a,
                         py::array_t<float, py::array::c_style | py::array::forcecast> b) {
     auto ba = a.request(); auto bb = b.request();
@@ -317,7 +1268,11 @@ static py::tuple py_kmeans_l2(
         throw std::runtime_error("kmeans_l2: k must be between 1 and N");
 
     const float* ptr = static_cast<const float*>(buf.ptr);
-    KMeansResult res  = kmeans_l2(ptr, n, d, k, max_iter, seed);
+    KMeansResult res;
+    {
+        py::gil_scoped_release release;
+        res = kmeans_l2(ptr, n, d, k, max_iter, seed);
+    }
 
     py::array_t<int32_t> labels_out({(py::ssize_t)n});
     std::memcpy(labels_out.mutable_data(), res.labels.data(), n * sizeof(int32_t));
@@ -328,6 +1283,27 @@ static py::tuple py_kmeans_l2(
     return py::make_tuple(labels_out, centroids_out);
 }
 
+template <distance_func_f distance>
+static py::tuple py_knn_graph(py::array_t<float, py::array::c_style | py::array::forcecast> data, size_t k,
+                              int32_t iterations, size_t max_candidates, float delta, int64_t seed_visits,
+                              uint32_t seed) {
+    if (data.ndim() != 2) throw std::invalid_argument("data must be a 2-D float32 array of shape (n, d)");
+    const size_t n = (size_t)data.shape(0);
+    const size_t d = (size_t)data.shape(1);
+    // the builder holds its lock stripes inline, keep it off the stack
+    auto builder = std::make_unique<KNNGraphBuilder<distance>>(k, iterations, max_candidates, delta, seed_visits, seed);
+
+    auto [indices, distances] = knnOutput<float>(py::none(), n, k);
+    int64_t *indexOut = indices.mutable_data();
+    float *distanceOut = distances.mutable_data();
+    const float *ptr = data.data();
+    {
+        py::gil_scoped_release release;
+        builder->build(ptr, n, d, indexOut, distanceOut);
+    }
+    return py::make_tuple(indices, distances);
+}
+
 PYBIND11_MODULE(_pynear, m) {
     m.def("dist_l2", py_dist_l2);
     m.def("dist_l1", py_dist_l1);
@@ -336,74 +1312,33 @@ PYBIND11_MODULE(_pynear, m) {
     m.def("dist_hamming_128", dist_hamming_128);
     m.def("dist_hamming_256", dist_hamming_256);
     m.def("dist_hamming_512", dist_hamming_512);
+    m.def(
+        "simd_level", [] { return std::string(simd_level_name(distance_kernels().level)); },
+        "Instruction set the distance kernels dispatch to: 'scalar', 'sse4.2', 'avx2' or 'avx512'. Picked at import "
+        "from the CPU; the PYNEAR_SIMD environment variable caps it");
     m.def("kmeans_l2", py_kmeans_l2,
           "Lloyd K-Means (K-Means++ init, SIMD L2, OpenMP parallel assignment)\n"
           "Args: data (N,D) float32, k, max_iter, seed  →  (labels int32, centroids float32)",
           py::arg("data"), py::arg("k"), py::arg("max_iter") = 100, py::arg("seed") = 42);
-
-    py::class_<VPTreeNumpyAdapter<dist_l2_f_avx2>>(m, "VPTreeL2Index")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapter<dist_l2_f_avx2>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapter<dist_l2_f_avx2>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapter<dist_l2_f_avx2>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapter<dist_l2_f_avx2>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapter<dist_l2_f_avx2>::get_state, &VPTreeNumpyAdapter<dist_l2_f_avx2>::set_state));
-
-    py::class_<VPTreeNumpyAdapter<dist_l1_f_avx2>>(m, "VPTreeL1Index")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapter<dist_l1_f_avx2>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapter<dist_l1_f_avx2>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapter<dist_l1_f_avx2>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapter<dist_l1_f_avx2>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapter<dist_l1_f_avx2>::get_state, &VPTreeNumpyAdapter<dist_l1_f_avx2>::set_state));
-
-    py::class_<VPTreeNumpyAdapter<dist_chebyshev_f_avx2>>(m, "VPTreeChebyshevIndex")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapter<dist_chebyshev_f_avx2>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapter<dist_chebyshev_f_avx2>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapter<dist_chebyshev_f_avx2>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapter<dist_chebyshev_f_avx2>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapter<dist_chebyshev_f_avx2>::get_state, &VPTreeNumpyAdapter<dist_chebyshev_f_avx2>::set_state));
-
-    py::class_<VPTreeNumpyAdapterBinary<dist_hamming_512>>(m, "VPTreeBinaryIndex512")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapterBinary<dist_hamming_512>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapterBinary<dist_hamming_512>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapterBinary<dist_hamming_512>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapterBinary<dist_hamming_512>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapterBinary<dist_hamming_512>::get_state, &VPTreeNumpyAdapterBinary<dist_hamming_512>::set_state));
-
-    py::class_<VPTreeNumpyAdapterBinary<dist_hamming_256>>(m, "VPTreeBinaryIndex256")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapterBinary<dist_hamming_256>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapterBinary<dist_hamming_256>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapterBinary<dist_hamming_256>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapterBinary<dist_hamming_256>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapterBinary<dist_hamming_256>::get_state, &VPTreeNumpyAdapterBinary<dist_hamming_256>::set_state));
-
-    py::class_<VPTreeNumpyAdapterBinary<dist_hamming_128>>(m, "VPTreeBinaryIndex128")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapterBinary<dist_hamming_128>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapterBinary<dist_hamming_128>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapterBinary<dist_hamming_128>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapterBinary<dist_hamming_128>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapterBinary<dist_hamming_128>::get_state, &VPTreeNumpyAdapterBinary<dist_hamming_128>::set_state));
-
-    py::class_<VPTreeNumpyAdapterBinary<dist_hamming_64>>(m, "VPTreeBinaryIndex64")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapterBinary<dist_hamming_64>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapterBinary<dist_hamming_64>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapterBinary<dist_hamming_64>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapterBinary<dist_hamming_64>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapterBinary<dist_hamming_64>::get_state, &VPTreeNumpyAdapterBinary<dist_hamming_64>::set_state));
-
-    py::class_<VPTreeNumpyAdapterBinary<dist_hamming>>(m, "VPTreeBinaryIndex")
-        .def(py::init<>())
-        .def("set", &VPTreeNumpyAdapterBinary<dist_hamming>::set, index_set, py::arg("vectors"))
-        .def("to_string", &VPTreeNumpyAdapterBinary<dist_hamming>::to_string, index_string)
-        .def("searchKNN", &VPTreeNumpyAdapterBinary<dist_hamming>::searchKNN, index_topk, py::arg("vectors"), py::arg("k"))
-        .def("search1NN", &VPTreeNumpyAdapterBinary<dist_hamming>::search1NN, index_top1, py::arg("vectors"))
-        .def(py::pickle(&VPTreeNumpyAdapterBinary<dist_hamming>::get_state, &VPTreeNumpyAdapterBinary<dist_hamming>::set_state));
+    m.def("knn_graph_l2", py_knn_graph<dist_l2sq_f_avx2>, knn_graph_doc, py::arg("data"), py::arg("k"),
+          py::arg("iterations") = 10, py::arg("max_candidates") = 0, py::arg("delta") = 0.001f,
+          py::arg("seed_visits") = 32, py::arg("seed") = 42);
+    m.def("knn_graph_l1", py_knn_graph<dist_l1_f_avx2>, knn_graph_doc, py::arg("data"), py::arg("k"),
+          py::arg("iterations") = 10, py::arg("max_candidates") = 0, py::arg("delta") = 0.001f,
+          py::arg("seed_visits") = 32, py::arg("seed") = 42);
+    m.def("knn_graph_chebyshev", py_knn_graph<dist_chebyshev_f_avx2>, knn_graph_doc, py::arg("data"), py::arg("k"),
+          py::arg("iterations") = 10, py::arg("max_candidates") = 0, py::arg("delta") = 0.001f,
+          py::arg("seed_visits") = 32, py::arg("seed") = 42);
+
+    bind_vptree_index<dist_l2sq_f_avx2>(m, "VPTreeL2Index");
+    bind_vptree_index<dist_l1_f_avx2>(m, "VPTreeL1Index");
+    bind_vptree_index<dist_chebyshev_f_avx2>(m, "VPTreeChebyshevIndex");
+
+    bind_vptree_binary_index<dist_hamming_512>(m, "VPTreeBinaryIndex512");
+    bind_vptree_binary_index<dist_hamming_256>(m, "VPTreeBinaryIndex256");
+    bind_vptree_binary_index<dist_hamming_128>(m, "VPTreeBinaryIndex128");
+    bind_vptree_binary_index<dist_hamming_64>(m, "VPTreeBinaryIndex64");
+    bind_vptree_binary_index<dist_hamming>(m, "VPTreeBinaryIndex");
 
     py::class_<BKTreeBinaryNumpyAdapter<dist_hamming_512>>(m, "BKTreeBinaryIndex512")
         .def(py::init<>())
@@ -459,12 +1394,79 @@ PYBIND11_MODULE(_pynear, m) {
              py::arg("nlist") = 256, py::arg("nprobe") = 8,
              py::arg("max_iter") = 20, py::arg("seed") = 42)
         .def("set", &IVFFlatBinaryNumpyAdapter::set, index_set, py::arg("vectors"))
-        .def("searchKNN", &IVFFlatBinaryNumpyAdapter::searchKNN, index_topk,
-             py::arg("vectors"), py::arg("k"))
+        .def("searchKNN", &IVFFlatBinaryNumpyAdapter::searchKNN, index_topk_filter,
+             py::arg("vectors"), py::arg("k"), py::arg("out") = py::none(), py::arg("filter") = py::none())
         .def("nlist",      &IVFFlatBinaryNumpyAdapter::nlist)
         .def("nprobe",     &IVFFlatBinaryNumpyAdapter::nprobe)
         .def("set_nprobe", &IVFFlatBinaryNumpyAdapter::set_nprobe, py::arg("nprobe"));
 
+    // ── IVFFlatL2Index ───────────────────────────────────────────────────────
+    py::class_<IVFFlatL2NumpyAdapter>(m, "IVFFlatL2Index")
+        .def(py::init<int32_t, int32_t>(),
+             "Inverted File Index for float32 vectors (approximate squared-L2 KNN).\n"
+             "Args: n_clusters (Voronoi cells, ~sqrt(N)), n_probe (cells scanned per query; "
+             "n_probe=n_clusters is exact)",
+             py::arg("n_clusters") = 100, py::arg("n_probe") = 10)
+        .def("set", &IVFFlatL2NumpyAdapter::set, index_set, py::arg("vectors"))
+        .def("searchKNN", &IVFFlatL2NumpyAdapter::searchKNN, index_topk,
+             py::arg("vectors"), py::arg("k"), py::arg("out") = py::none())
+        .def("search1NN", &IVFFlatL2NumpyAdapter::search1NN,
+             "Shortcut for searchKNN(vectors, 1); returns (n, 1) arrays", py::arg("vectors"))
+        .def_property_readonly("n_clusters", &IVFFlatL2NumpyAdapter::n_clusters,
+                               "Number of clusters actually built (may be less than requested)")
+        .def_property_readonly("n_probe", &IVFFlatL2NumpyAdapter::n_probe)
+        .def(py::pickle(&IVFFlatL2NumpyAdapter::get_state, &IVFFlatL2NumpyAdapter::set_state));
+
+    // ── HNSWL2Index ──────────────────────────────────────────────────────────
+    using HNSWL2Adapter = HNSWNumpyAdapter<dist_l2sq_f_avx2>;
+    py::class_<HNSWL2Adapter>(m, "HNSWL2Index")
+        .def(py::init<int32_t, int32_t, int32_t, uint32_t>(),
+             "Hierarchical Navigable Small World graph for float32 vectors (approximate L2 KNN).\n"
+             "Args: M (neighbours per node, 2M on the base layer), ef_construction (build beam width), "
+             "ef_search (default search beam width), seed",
+             py::arg("M") = 16, py::arg("ef_construction") = 200, py::arg("ef_search") = 50, py::arg("seed") = 42)
+        .def("set", &HNSWL2Adapter::set, index_set, py::arg("vectors"))
+        .def("add", &HNSWL2Adapter::add,
+             "Insert more vectors without rebuilding; they get the next consecutive indices", py::arg("vectors"))
+        .def("searchKNN", &HNSWL2Adapter::searchKNN,
+             "Batch find approximate top-k vectors and return (n, k) numpy arrays of indices and L2 distances, "
+             "sorted nearest first and padded with index -1.\n"
+             "ef is the search beam width (0 = ef_search); out=(indices, distances) writes into "
+             "caller-provided arrays",
+             py::arg("vectors"), py::arg("k"), py::arg("ef") = 0, py::arg("out") = py::none())
+        .def("search1NN", &HNSWL2Adapter::search1NN, index_top1, py::arg("vectors"), py::arg("ef") = 0)
+        .def("size", &HNSWL2Adapter::size)
+        .def("M", &HNSWL2Adapter::M)
+        .def_property("ef_search", &HNSWL2Adapter::ef_search, &HNSWL2Adapter::set_ef_search,
+                      "Default search beam width; higher gives better recall at higher cost")
+        .def(py::pickle(&HNSWL2Adapter::get_state, &HNSWL2Adapter::set_state));
+
+    // ── SegmentedVPTreeL2Index ───────────────────────────────────────────────
+    using SegmentedL2Adapter = SegmentedVPTreeNumpyAdapter<dist_l2sq_f_avx2>;
+    py::class_<SegmentedL2Adapter>(m, "SegmentedVPTreeL2Index")
+        .def(py::init<size_t, size_t, int32_t>(),
+             "Log-structured exact L2 index for write-heavy streams of float32 vectors.\n"
+             "New vectors land in a brute-force memtable; full memtables become VP-tree segments that a "
+             "background thread merges. Searches never wait for writers.\n"
+             "Args: memtable_size (rows buffered per memtable), merge_factor (segments merged per level), "
+             "leaf_size",
+             py::arg("memtable_size") = 4096, py::arg("merge_factor") = 4,
+             py::arg("leaf_size") = vptree::DEFAULT_LEAF_SIZE)
+        .def("add", &SegmentedL2Adapter::add,
+             "Append vectors and return their ids, which continue from the last one added. Safe to call "
+             "while other threads search",
+             py::arg("vectors"))
+        .def("searchKNN", &SegmentedL2Adapter::searchKNN, index_topk, py::arg("vectors"), py::arg("k"),
+             py::arg("out") = py::none())
+        .def("search1NN", &SegmentedL2Adapter::search1NN, index_top1, py::arg("vectors"))
+        .def("flush", &SegmentedL2Adapter::flush,
+             "Block until every buffered vector is in a segment and no pending merge is left")
+        .def("size", &SegmentedL2Adapter::size, index_size)
+        .def("num_segments", &SegmentedL2Adapter::num_segments, "Number of VP-tree segments searched")
+        .def_property_readonly("memtable_size", &SegmentedL2Adapter::memtable_size)
+        .def_property_readonly("merge_factor", &SegmentedL2Adapter::merge_factor)
+        .def(py::pickle(&SegmentedL2Adapter::get_state, &SegmentedL2Adapter::set_state));
+
     // ── MIHBinaryIndex ────────────────────────────────────────────────────────
     py::class_<MIHBinaryNumpyAdapter>(m, "MIHBinaryIndex")
         .def(py::init<int32_t>(),
@@ -473,8 +1475,9 @@ PYBIND11_MODULE(_pynear, m) {
              "divisible by m and nbytes/m ≤ 8.",
              py::arg("m") = 8)
         .def("set", &MIHBinaryNumpyAdapter::set, index_set, py::arg("vectors"))
-        .def("searchKNN", &MIHBinaryNumpyAdapter::searchKNN, index_topk,
-             py::arg("vectors"), py::arg("k"), py::arg("radius") = 8)
+        .def("searchKNN", &MIHBinaryNumpyAdapter::searchKNN, index_topk_filter,
+             py::arg("vectors"), py::arg("k"), py::arg("radius") = 8, py::arg("out") = py::none(),
+             py::arg("filter") = py::none())
         .def("m",      &MIHBinaryNumpyAdapter::m)
         .def("n",      &MIHBinaryNumpyAdapter::n)
         .def("nbytes", &MIHBinaryNumpyAdapter::nbytes);
@@ -3,19 +3,27 @@
 
 #include <BuiltinSerializers.hpp>
 #include <DistanceFunctions.hpp>
+#include <KNNGraph.hpp>
 #include <MathUtils.hpp>
+#include <SegmentedIndex.hpp>
 #include <SerializableVPTree.hpp>
 #include <SerializedStateObject.hpp>
 #include <VPTree.hpp>
+#include <VPTreeFile.hpp>
 
 #include <Eigen/Core>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <exception>
 #include <iostream>
 #include <random>
 #include <sstream>
 #include <stdint.h>
+#include <thread>
 #include <vector>
 
 #if defined(_MSC_VER)
@@ -360,4 +368,1203 @@ TEST(VPTests, TestSearch) {
     diff = end - start;
 }
 
+TEST(VPTests, TestLeafBucketSearch) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    const unsigned int numPoints = 3000;
+    const size_t dim = 13;
+    const size_t k = 5;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(50 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(50);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    // brute force reference, farthest first like fillSearchResult
+    std::vector<std::vector<float>> expected(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (const FlatSpan &p : points) expected[q].push_back(dist_l2_f_avx2(queries[q], p));
+        std::sort(expected[q].begin(), expected[q].end());
+        expected[q].resize(k);
+        std::reverse(expected[q].begin(), expected[q].end());
+    }
+
+    for (int32_t leafSize : {1, 4, 16, 100}) {
+        VPTree<FlatSpan, float, dist_l2_f_avx2> tree;
+        tree.setLeafSize(leafSize);
+        tree.set(points);
+        EXPECT_EQ(tree.leafSize(), leafSize);
+
+        std::vector<VPTree<FlatSpan, float, dist_l2_f_avx2>::VPTreeSearchResultElement> results;
+        tree.searchKNN(queries, k, results);
+
+        std::vector<int64_t> indices;
+        std::vector<float> distances;
+        tree.search1NN(queries, indices, distances);
+
+        for (size_t q = 0; q < queries.size(); ++q) {
+            ASSERT_EQ(results[q].distances.size(), k);
+            for (size_t j = 0; j < k; ++j) {
+                EXPECT_NEAR(results[q].distances[j], expected[q][j], 1e-4);
+                EXPECT_NEAR(dist_l2_f_avx2(queries[q], points[results[q].indexes[j]]), expected[q][j], 1e-4);
+            }
+            EXPECT_NEAR(distances[q], expected[q][k - 1], 1e-4);
+        }
+    }
+
+    VPTree<FlatSpan, float, dist_l2_f_avx2> tree;
+    EXPECT_THROW(tree.setLeafSize(0), std::invalid_argument);
+}
+
+TEST(VPTests, TestSetRowsFromBuffer) {
+    std::default_random_engine generator(5);
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    const size_t numPoints = 2500;
+    const size_t dim = 9;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    // set() copies from the row views, setRows() from the buffer; both partition the copy in place
+    VPTree<FlatSpan, float, dist_l2_f_avx2> fromSpans, fromRows;
+    fromSpans.set(points);
+    fromRows.setRows(data.data(), numPoints, dim);
+    EXPECT_EQ(fromRows.numPoints(), numPoints);
+    EXPECT_EQ(fromRows.flatBacking().size(), numPoints * dim);
+
+    for (auto *tree : {&fromSpans, &fromRows}) {
+        std::vector<int64_t> indices;
+        std::vector<float> distances;
+        tree->search1NN(points, indices, distances);
+        for (size_t i = 0; i < numPoints; ++i) {
+            EXPECT_EQ(indices[i], (int64_t)i);
+            EXPECT_EQ(distances[i], 0.0f);
+        }
+    }
+
+    // queries of another width are rejected rather than scanned across row boundaries
+    std::vector<int64_t> indices;
+    std::vector<float> distances;
+    std::vector<FlatSpan> narrow = {FlatSpan{data.data(), dim - 1}};
+    EXPECT_THROW(fromRows.search1NN(narrow, indices, distances), std::invalid_argument);
+    std::vector<int64_t> knnIndices(3);
+    std::vector<float> knnDistances(3);
+    std::vector<FlatSpan> wide = {FlatSpan{data.data(), dim + 1}};
+    EXPECT_THROW(fromRows.searchKNN(wide, 3, knnIndices.data(), knnDistances.data()), std::invalid_argument);
+
+    fromRows.setRows(data.data(), 0, dim);
+    EXPECT_TRUE(fromRows.isEmpty());
+    EXPECT_THROW(fromRows.setRows(data.data(), numPoints, 0), std::invalid_argument);
+}
+
+// Exposes the in-place row partitioning build() uses for large stores of narrow rows
+struct RowMovingTree : VPTree<FlatSpan, float, dist_l2_f_avx2> {
+    using VPTree::buildPartitions;
+    using VPTree::RowPoints;
+};
+
+// Rows moved with their ids, and every split put the points within its radius on the left and the rest on the right
+static void expectRowSplits(const std::vector<VPLevelPartition<float>> &pool, const std::vector<float> &rows,
+                            const std::vector<float> &original, const std::vector<int32_t> &ids, size_t dim) {
+    const size_t numPoints = ids.size();
+    std::vector<int32_t> sortedIds = ids;
+    std::sort(sortedIds.begin(), sortedIds.end());
+    for (size_t i = 0; i < numPoints; ++i) {
+        EXPECT_EQ(sortedIds[i], (int32_t)i);
+        EXPECT_TRUE(std::equal(rows.begin() + i * dim, rows.begin() + (i + 1) * dim, original.begin() + ids[i] * dim));
+    }
+
+    auto row = [&](int32_t pos) { return FlatSpan{rows.data() + pos * dim, dim}; };
+    for (const auto &node : pool) {
+        if (node.isLeaf()) continue;
+        const FlatSpan vp = row(node.start());
+        if (node.left_idx() >= 0) {
+            for (int32_t pos = pool[node.left_idx()].start(); pos <= pool[node.left_idx()].end(); ++pos)
+                EXPECT_LE(dist_l2_f_avx2(vp, row(pos)), node.radius());
+        }
+        for (int32_t pos = pool[node.right_idx()].start(); pos <= pool[node.right_idx()].end(); ++pos)
+            EXPECT_GE(dist_l2_f_avx2(vp, row(pos)), node.radius());
+    }
+}
+
+TEST(VPTests, TestInPlaceRowPartitioning) {
+    std::default_random_engine generator(11);
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    const size_t numPoints = 5000;
+    const size_t dim = 6;
+    std::vector<float> original(numPoints * dim);
+    for (float &v : original) v = distribution(generator);
+
+    std::vector<float> rows = original;
+    std::vector<int32_t> ids(numPoints);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::vector<VPLevelPartition<float>> pool;
+    RowMovingTree tree;
+    tree.buildPartitions(pool, RowMovingTree::RowPoints{ids, rows.data(), dim});
+    expectRowSplits(pool, rows, original, ids, dim);
+}
+
+TEST(VPTests, TestSampledSplit) {
+    std::default_random_engine generator(5);
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    // several streaming blocks per sampled split
+    const size_t numPoints = 200000;
+    const size_t dim = 4;
+    std::vector<float> original(numPoints * dim);
+    for (float &v : original) v = distribution(generator);
+
+    std::vector<float> rows = original;
+    std::vector<int32_t> ids(numPoints);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::vector<VPLevelPartition<float>> pool;
+    RowMovingTree rowTree;
+    rowTree.setSampledSplit(RowMovingTree::SPLIT_SAMPLE);
+    rowTree.buildPartitions(pool, RowMovingTree::RowPoints{ids, rows.data(), dim});
+    expectRowSplits(pool, rows, original, ids, dim);
+    EXPECT_GT(rowTree.splitImbalance(), 0.0f);
+    EXPECT_LE(rowTree.splitImbalance(), RowMovingTree::MAX_SPLIT_IMBALANCE);
+
+    // searches stay exact
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{original.data() + i * dim, dim};
+    VPTree<FlatSpan, float, dist_l2_f_avx2> exact, sampled;
+    exact.set(points);
+    sampled.setSampledSplit(50000);
+    sampled.set(points);
+    EXPECT_EQ(exact.splitImbalance(), 0.0f);
+    EXPECT_LE(sampled.splitImbalance(), RowMovingTree::MAX_SPLIT_IMBALANCE);
+
+    std::vector<float> queryData(64 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(64);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+    std::vector<VPTree<FlatSpan, float, dist_l2_f_avx2>::VPTreeSearchResultElement> results, sampledResults;
+    exact.searchKNN(queries, 5, results);
+    sampled.searchKNN(queries, 5, sampledResults);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        EXPECT_EQ(results[q].indexes, sampledResults[q].indexes);
+        EXPECT_EQ(results[q].distances, sampledResults[q].distances);
+    }
+
+    EXPECT_THROW(sampled.setSampledSplit(100), std::invalid_argument);
+    EXPECT_EQ(sampled.sampledSplit(), 50000);
+    sampled.setSampledSplit(0);
+    sampled.set(points);
+    EXPECT_EQ(sampled.splitImbalance(), 0.0f);
+}
+
+TEST(VPTests, TestSquaredL2Search) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    const unsigned int numPoints = 4000;
+    const size_t dim = 9;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(64 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(64);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2_f_avx2> tree;
+    tree.set(points);
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> treeSq;
+    treeSq.set(points);
+
+    std::vector<VPTree<FlatSpan, float, dist_l2_f_avx2>::VPTreeSearchResultElement> results;
+    tree.searchKNN(queries, 7, results);
+    std::vector<VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeSearchResultElement> resultsSq;
+    treeSq.searchKNN(queries, 7, resultsSq);
+
+    for (size_t q = 0; q < queries.size(); ++q) {
+        EXPECT_EQ(results[q].indexes, resultsSq[q].indexes);
+        // squared mode reports real L2 distances
+        for (size_t j = 0; j < 7; ++j)
+            EXPECT_FLOAT_EQ(results[q].distances[j], resultsSq[q].distances[j]);
+    }
+
+    std::vector<int64_t> indices, indicesSq;
+    std::vector<float> distances, distancesSq;
+    tree.search1NN(queries, indices, distances);
+    treeSq.search1NN(queries, indicesSq, distancesSq);
+    EXPECT_EQ(indices, indicesSq);
+    for (size_t q = 0; q < queries.size(); ++q)
+        EXPECT_FLOAT_EQ(distances[q], distancesSq[q]);
+}
+
+TEST(VPTests, TestEarlyAbandonKernels) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(-1, 1);
+
+    for (size_t dim : {5, 8, 31, 32, 64, 100, 128}) {
+        const size_t rows = 11;
+        std::vector<float> block(rows * dim), query(dim);
+        for (float &v : block) v = distribution(generator);
+        for (float &v : query) v = distribution(generator);
+        const FlatSpan q{query.data(), dim};
+
+        std::vector<float> full(rows), blockOut(rows);
+        for (size_t r = 0; r < rows; ++r) full[r] = dist_l2sq_f_avx2(q, FlatSpan{block.data() + r * dim, dim});
+
+        std::vector<float> sorted = full;
+        std::sort(sorted.begin(), sorted.end());
+        for (float bound : {0.f, sorted[0], sorted[rows / 2], sorted[rows - 1], 1e30f}) {
+            distance_traits<dist_l2sq_f_avx2>::one_to_many_bounded(q, block.data(), rows, blockOut.data(), bound);
+            for (size_t r = 0; r < rows; ++r) {
+                const float single = distance_traits<dist_l2sq_f_avx2>::bounded(q, FlatSpan{block.data() + r * dim, dim}, bound);
+                // exact when within the bound, otherwise anything past the bound
+                if (full[r] <= bound) {
+                    EXPECT_EQ(single, full[r]);
+                    EXPECT_EQ(blockOut[r], full[r]);
+                } else {
+                    EXPECT_GT(single, bound);
+                    EXPECT_GT(blockOut[r], bound);
+                    EXPECT_LE(single, full[r]);
+                    EXPECT_LE(blockOut[r], full[r]);
+                }
+            }
+        }
+    }
+}
+
+TEST(VPTests, TestSimdDispatch) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(-1, 1);
+    std::uniform_int_distribution<int> byteDistribution(0, 255);
+
+    const SimdLevel initial = distance_kernels().level;
+    EXPECT_TRUE(simd_level_supported(SimdLevel::Scalar));
+
+    struct Metric {
+        float (*reference)(const arrayf &, const arrayf &);
+        float (*single)(const float *, const float *, size_t);
+        float (*bounded)(const float *, const float *, size_t, float);
+        void (*block)(const float *, size_t, const float *, size_t, float *, float);
+        void (*blockBounded)(const float *, size_t, const float *, size_t, float *, float);
+    };
+
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE42, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (!simd_level_supported(level)) {
+            EXPECT_FALSE(set_simd_level(level));
+            continue;
+        }
+        ASSERT_TRUE(set_simd_level(level));
+        const DistanceKernels &kernels = distance_kernels();
+        EXPECT_EQ(kernels.level, level);
+
+        const Metric metrics[] = {
+            {dist_l2sq_f, kernels.l2sq, kernels.l2sq_bounded, kernels.l2sq_block, kernels.l2sq_block_bounded},
+            {dist_l1_f, kernels.l1, kernels.l1_bounded, kernels.l1_block, kernels.l1_block_bounded},
+            {dist_chebyshev_f, kernels.chebyshev, kernels.chebyshev_bounded, kernels.chebyshev_block,
+             kernels.chebyshev_block_bounded},
+        };
+
+        for (size_t dim : {1, 3, 4, 7, 15, 16, 17, 33, 64, 100, 129}) {
+            const size_t rows = 10;
+            std::vector<float> block(rows * dim), query(dim);
+            for (float &v : block) v = distribution(generator);
+            for (float &v : query) v = distribution(generator);
+
+            for (const Metric &metric : metrics) {
+                std::vector<float> full(rows), blockOut(rows);
+                metric.block(query.data(), dim, block.data(), rows, blockOut.data(), 0.f);
+                for (size_t r = 0; r < rows; ++r) {
+                    const float *row = block.data() + r * dim;
+                    full[r] = metric.single(query.data(), row, dim);
+                    EXPECT_EQ(blockOut[r], full[r]);
+                    const float reference = metric.reference(FlatSpan{query.data(), dim}, FlatSpan{row, dim});
+                    EXPECT_NEAR(full[r], reference, 1e-5f * std::max(1.f, reference));
+                }
+
+                // the early-abandon contract holds at every level
+                const float bound = full[rows / 2];
+                metric.blockBounded(query.data(), dim, block.data(), rows, blockOut.data(), bound);
+                for (size_t r = 0; r < rows; ++r) {
+                    const float single = metric.bounded(query.data(), block.data() + r * dim, dim, bound);
+                    if (full[r] <= bound) {
+                        EXPECT_EQ(single, full[r]);
+                        EXPECT_EQ(blockOut[r], full[r]);
+                    } else {
+                        EXPECT_GT(single, bound);
+                        EXPECT_GT(blockOut[r], bound);
+                    }
+                }
+            }
+
+            // an odd query count covers both the paired and the single-query path of the cross kernel
+            const size_t m = 3;
+            std::vector<float> queries(m * dim), cross(m * rows), single(rows);
+            for (float &v : queries) v = distribution(generator);
+            kernels.dot_cross(queries.data(), m, dim, block.data(), rows, cross.data());
+            for (size_t q = 0; q < m; ++q) {
+                kernels.dot_cross(queries.data() + q * dim, 1, dim, block.data(), rows, single.data());
+                for (size_t r = 0; r < rows; ++r) {
+                    float reference = 0.f;
+                    for (size_t i = 0; i < dim; ++i) reference += queries[q * dim + i] * block[r * dim + i];
+                    EXPECT_EQ(cross[q * rows + r], single[r]);
+                    EXPECT_NEAR(cross[q * rows + r], reference, 1e-4f * std::max(1.f, std::fabs(reference)));
+                }
+            }
+        }
+
+        for (size_t bytes : {1, 3, 8, 13, 32, 64, 100, 200, 256, 300, 1000}) {
+            arrayli a(bytes), b(bytes);
+            for (size_t i = 0; i < bytes; ++i) {
+                a[i] = (uint8_t)byteDistribution(generator);
+                b[i] = (uint8_t)byteDistribution(generator);
+            }
+            int64_t expected = 0;
+            for (size_t i = 0; i < bytes; ++i) expected += std::bitset<8>(a[i] ^ b[i]).count();
+            EXPECT_EQ(dist_hamming(a, b), expected);
+            if (bytes == 8) {
+                EXPECT_EQ(dist_hamming_64(a, b), expected);
+            }
+            if (bytes == 64) {
+                EXPECT_EQ(dist_hamming_512(a, b), expected);
+            }
+        }
+    }
+
+    ASSERT_TRUE(set_simd_level(initial));
+}
+
+TEST(VPTests, TestEarlyAbandonSearchHighDim) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0, 1);
+
+    const unsigned int numPoints = 3000;
+    const size_t dim = 96;
+    const size_t k = 6;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(20 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(20);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    auto check = [&](auto &tree, auto metric) {
+        tree.set(points);
+        std::vector<typename std::remove_reference_t<decltype(tree)>::VPTreeSearchResultElement> results;
+        tree.searchKNN(queries, k, results);
+        std::vector<int64_t> indices;
+        std::vector<float> distances;
+        tree.search1NN(queries, indices, distances);
+
+        for (size_t q = 0; q < queries.size(); ++q) {
+            std::vector<std::pair<float, int64_t>> expected;
+            for (size_t i = 0; i < numPoints; ++i) expected.push_back({metric(queries[q], points[i]), (int64_t)i});
+            std::sort(expected.begin(), expected.end());
+            for (size_t j = 0; j < k; ++j) {
+                // results come out farthest first
+                EXPECT_EQ(results[q].indexes[k - 1 - j], expected[j].second);
+                EXPECT_EQ(results[q].distances[k - 1 - j], expected[j].first);
+            }
+            EXPECT_EQ(indices[q], expected[0].second);
+            EXPECT_EQ(distances[q], expected[0].first);
+        }
+    };
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> l2sq;
+    check(l2sq, [](const FlatSpan &a, const FlatSpan &b) { return std::sqrt(dist_l2sq_f_avx2(a, b)); });
+    VPTree<FlatSpan, float, dist_l2_f_avx2> l2;
+    check(l2, dist_l2_f_avx2);
+    VPTree<FlatSpan, float, dist_l1_f_avx2> l1;
+    check(l1, dist_l1_f_avx2);
+    VPTree<FlatSpan, float, dist_chebyshev_f_avx2> chebyshev;
+    check(chebyshev, dist_chebyshev_f_avx2);
+}
+
+TEST(VPTests, TestApproximateSearch) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0, 1);
+
+    const unsigned int numPoints = 5000;
+    const size_t dim = 24;
+    const size_t k = 5;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(40 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(40);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.set(points);
+
+    std::vector<VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeSearchResultElement> exact;
+    tree.searchKNN(queries, k, exact);
+    std::vector<int64_t> exactIndices;
+    std::vector<float> exactDistances;
+    tree.search1NN(queries, exactIndices, exactDistances);
+
+    for (float epsilon : {0.1f, 0.5f, 2.0f}) {
+        std::vector<VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeSearchResultElement> approx;
+        tree.searchKNN(queries, k, approx, epsilon);
+        std::vector<int64_t> indices;
+        std::vector<float> distances;
+        tree.search1NN(queries, indices, distances, epsilon);
+
+        for (size_t q = 0; q < queries.size(); ++q) {
+            ASSERT_EQ(approx[q].distances.size(), k);
+            // the j-th neighbour is within (1 + eps) of the exact j-th neighbour
+            for (size_t j = 0; j < k; ++j)
+                EXPECT_LE(approx[q].distances[j], exact[q].distances[j] * (1 + epsilon) * (1 + 1e-5f));
+            EXPECT_LE(distances[q], exactDistances[q] * (1 + epsilon) * (1 + 1e-5f));
+        }
+    }
+
+    EXPECT_THROW(tree.search1NN(queries, exactIndices, exactDistances, -1.f), std::invalid_argument);
+}
+
+TEST(VPTests, TestBudgetedSearch) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0, 1);
+
+    const unsigned int numPoints = 20000;
+    const size_t dim = 16;
+    const size_t k = 4;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(16 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(16);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.set(points);
+
+    std::vector<VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeSearchResultElement> exact;
+    tree.searchKNN(queries, k, exact);
+
+    // a generous budget completes and matches the unbudgeted search
+    SearchBudget generous;
+    generous.maxVisits = numPoints;
+    std::vector<VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeSearchResultElement> results;
+    tree.searchKNN(queries, k, results, 0, generous);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        EXPECT_TRUE(results[q].exact);
+        EXPECT_EQ(results[q].indexes, exact[q].indexes);
+    }
+
+    // a tiny budget stops early: results are flagged and never better than the exact ones
+    SearchBudget tight;
+    tight.maxVisits = 3;
+    tree.searchKNN(queries, k, results, 0, tight);
+    std::vector<int64_t> indices;
+    std::vector<float> distances;
+    std::vector<uint8_t> complete;
+    tree.search1NN(queries, indices, distances, 0, tight, &complete);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        EXPECT_FALSE(results[q].exact);
+        EXPECT_LE(results[q].indexes.size(), k);
+        if (!results[q].distances.empty()) {
+            EXPECT_GE(results[q].distances.back(), exact[q].distances.back());
+        }
+        EXPECT_EQ(complete[q], 0);
+        if (indices[q] >= 0) {
+            EXPECT_GE(distances[q], exact[q].distances.back());
+        }
+    }
+
+    // a generous time-only budget completes
+    SearchBudget timed;
+    timed.maxTimeUs = 10 * 1000 * 1000;
+    tree.searchKNN(queries, k, results, 0, timed);
+    for (size_t q = 0; q < queries.size(); ++q) EXPECT_TRUE(results[q].exact);
+}
+
+TEST(VPTests, TestRadiusSearch) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0, 1);
+
+    const unsigned int numPoints = 6000;
+    const size_t dim = 6;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(25 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(25);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    const float radius = 0.25f;
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.set(points);
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeRadiusSearchResult result;
+    tree.searchRadius(queries, radius, result);
+
+    ASSERT_EQ(result.offsets.size(), queries.size() + 1);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        std::vector<int64_t> expected;
+        for (size_t i = 0; i < numPoints; ++i) {
+            if (std::sqrt(dist_l2sq_f_avx2(queries[q], points[i])) <= radius) expected.push_back((int64_t)i);
+        }
+        std::vector<int64_t> got(result.indexes.begin() + result.offsets[q], result.indexes.begin() + result.offsets[q + 1]);
+        for (int64_t j = result.offsets[q]; j < result.offsets[q + 1]; ++j) {
+            EXPECT_LE(result.distances[j], radius);
+            if (j > result.offsets[q]) {
+                EXPECT_LE(result.distances[j - 1], result.distances[j]);
+            }
+        }
+        std::sort(got.begin(), got.end());
+        EXPECT_EQ(got, expected);
+    }
+
+    // max_results keeps the nearest ones
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeRadiusSearchResult capped;
+    tree.searchRadius(queries, radius, capped, 3);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        const int64_t n = capped.offsets[q + 1] - capped.offsets[q];
+        EXPECT_EQ(n, std::min<int64_t>(3, result.offsets[q + 1] - result.offsets[q]));
+        for (int64_t j = 0; j < n; ++j)
+            EXPECT_EQ(capped.distances[capped.offsets[q] + j], result.distances[result.offsets[q] + j]);
+    }
+}
+
+
+TEST(VPTests, TestSearchKNNRowBuffers) {
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(0, 1);
+
+    const unsigned int numPoints = 500;
+    const size_t dim = 7;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(9 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(9);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.set(points);
+
+    const size_t k = 6;
+    std::vector<VPTree<FlatSpan, float, dist_l2sq_f_avx2>::VPTreeSearchResultElement> results;
+    tree.searchKNN(queries, k, results);
+
+    std::vector<int64_t> indices(queries.size() * k);
+    std::vector<float> distances(queries.size() * k);
+    tree.searchKNN(queries, k, indices.data(), distances.data());
+
+    // rows are the element results reversed: nearest first
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (size_t j = 0; j < k; ++j) {
+            EXPECT_EQ(indices[q * k + j], results[q].indexes[k - 1 - j]);
+            EXPECT_EQ(distances[q * k + j], results[q].distances[k - 1 - j]);
+        }
+    }
+
+    // k beyond the dataset pads with -1 / infinity
+    const size_t bigK = numPoints + 4;
+    std::vector<int64_t> paddedIndices(queries.size() * bigK);
+    std::vector<float> paddedDistances(queries.size() * bigK);
+    std::vector<uint8_t> exact(queries.size());
+    tree.searchKNN(queries, bigK, paddedIndices.data(), paddedDistances.data(), 0, SearchBudget(), exact.data());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        EXPECT_EQ(exact[q], 1);
+        for (size_t j = 0; j < bigK; ++j) {
+            if (j < numPoints) {
+                EXPECT_GE(paddedIndices[q * bigK + j], 0);
+            } else {
+                EXPECT_EQ(paddedIndices[q * bigK + j], -1);
+                EXPECT_TRUE(std::isinf(paddedDistances[q * bigK + j]));
+            }
+        }
+    }
+}
+
+TEST(VPTests, TestFilteredSearch) {
+    std::mt19937 generator(19);
+    std::uniform_real_distribution<float> distribution(0, 1);
+
+    const size_t numPoints = 3000, dim = 5, k = 8;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    const size_t numQueries = 12;
+    std::vector<float> queryData(numQueries * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(numQueries);
+    for (size_t i = 0; i < numQueries; ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.setLeafSize(8);
+    tree.set(points);
+
+    // one mask per query, from nearly everything down to a handful of points
+    std::vector<uint8_t> masks(numQueries * numPoints);
+    for (size_t q = 0; q < numQueries; ++q) {
+        const uint32_t keepOneIn = 1u << q;
+        for (size_t i = 0; i < numPoints; ++i) masks[q * numPoints + i] = generator() % keepOneIn == 0;
+    }
+    SearchFilter filter{masks.data(), numPoints, numPoints};
+
+    std::vector<int64_t> indices(numQueries * k);
+    std::vector<float> distances(numQueries * k);
+    tree.searchKNN(queries, k, indices.data(), distances.data(), 0, SearchBudget(), nullptr, filter);
+
+    for (size_t q = 0; q < numQueries; ++q) {
+        std::vector<std::pair<float, int64_t>> expected;
+        for (size_t i = 0; i < numPoints; ++i) {
+            if (!masks[q * numPoints + i]) continue;
+            expected.push_back({std::sqrt(dist_l2sq_f_avx2(queries[q], points[i])), (int64_t)i});
+        }
+        std::sort(expected.begin(), expected.end());
+        for (size_t j = 0; j < k; ++j) {
+            if (j < expected.size()) {
+                EXPECT_EQ(indices[q * k + j], expected[j].second);
+                EXPECT_NEAR(distances[q * k + j], expected[j].first, 1e-5);
+            } else {
+                EXPECT_EQ(indices[q * k + j], -1);
+            }
+        }
+    }
+
+    // a shared mask shorter than the dataset rejects the ids past its end
+    std::vector<uint8_t> prefix(10, 1);
+    tree.searchKNN(queries, k, indices.data(), distances.data(), 0, SearchBudget(), nullptr,
+                   SearchFilter{prefix.data(), prefix.size(), 0});
+    for (size_t j = 0; j < numQueries * k; ++j) {
+        EXPECT_GE(indices[j], 0);
+        EXPECT_LT(indices[j], 10);
+    }
+}
+
+TEST(VPTests, TestBatchedSearch) {
+    std::mt19937 generator(29);
+    std::normal_distribution<float> distribution(0, 1);
+
+    const size_t numPoints = 5000, dim = 6, numQueries = 700;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+    std::vector<float> queryData(numQueries * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(numQueries);
+    for (size_t i = 0; i < numQueries; ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.setLeafSize(8);
+    tree.set(points);
+    // removed points must not show up either
+    std::vector<int64_t> removed;
+    for (int64_t i = 0; i < (int64_t)numPoints; i += 5) removed.push_back(i);
+    tree.remove(removed);
+
+    for (size_t k : {1, 7, 40}) {
+        std::vector<int64_t> expectedIndices(numQueries * k), indices(numQueries * k);
+        std::vector<float> expectedDistances(numQueries * k), distances(numQueries * k);
+        tree.searchKNN(queries, k, expectedIndices.data(), expectedDistances.data());
+        for (size_t blockSize : {1, 16, 64, 1000}) {
+            tree.searchKNNBatched(queries, k, indices.data(), distances.data(), blockSize);
+            for (size_t j = 0; j < indices.size(); ++j) {
+                EXPECT_NEAR(distances[j], expectedDistances[j], 1e-5) << "k " << k << " block " << blockSize;
+                EXPECT_NE(indices[j] % 5, 0);
+            }
+        }
+    }
+
+    // a tiny tree pads rows like searchKNN
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> small;
+    small.set(std::vector<FlatSpan>(points.begin(), points.begin() + 3));
+    std::vector<int64_t> indices(2 * 5);
+    std::vector<float> distances(2 * 5);
+    small.searchKNNBatched(std::vector<FlatSpan>(queries.begin(), queries.begin() + 2), 5, indices.data(),
+                           distances.data());
+    for (size_t q = 0; q < 2; ++q) {
+        EXPECT_EQ(indices[q * 5 + 3], -1);
+        EXPECT_TRUE(std::isinf(distances[q * 5 + 4]));
+    }
+}
+
+TEST(VPTests, TestAllKNN) {
+    std::mt19937 generator(31);
+    std::normal_distribution<float> distribution(0, 1);
+
+    const size_t numPoints = 1500, dim = 5, k = 6;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    // every tenth point duplicates its predecessor
+    for (size_t i = 10; i < numPoints; i += 10) std::copy_n(&data[(i - 1) * dim], dim, &data[i * dim]);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.setLeafSize(8);
+    tree.set(points);
+    std::vector<int64_t> removed;
+    for (int64_t i = 3; i < (int64_t)numPoints; i += 7) removed.push_back(i);
+    tree.remove(removed);
+    auto live = [](size_t i) { return i % 7 != 3; };
+
+    for (bool excludeSelf : {true, false}) {
+        std::vector<int64_t> indices(numPoints * k);
+        std::vector<float> distances(numPoints * k);
+        tree.allKNN(k, indices.data(), distances.data(), excludeSelf);
+
+        for (size_t i = 0; i < numPoints; ++i) {
+            if (!live(i)) {
+                EXPECT_EQ(indices[i * k], -1);
+                continue;
+            }
+            std::vector<float> expected;
+            for (size_t j = 0; j < numPoints; ++j) {
+                if (!live(j) || (excludeSelf && j == i)) continue;
+                expected.push_back(dist_l2_f_avx2(points[i], points[j]));
+            }
+            std::sort(expected.begin(), expected.end());
+            for (size_t j = 0; j < k; ++j) {
+                EXPECT_NEAR(distances[i * k + j], expected[j], 1e-4) << "point " << i;
+                EXPECT_TRUE(live(indices[i * k + j]));
+                if (excludeSelf) {
+                    EXPECT_NE(indices[i * k + j], (int64_t)i);
+                }
+            }
+        }
+    }
+
+    // trees over other point types take the per-point path
+    std::vector<Eigen::Vector3d> eigenPoints(400);
+    for (Eigen::Vector3d &p : eigenPoints) p = Eigen::Vector3d(distribution(generator), distribution(generator), 0);
+    VPTree<Eigen::Vector3d, float, distance> eigenTree(eigenPoints);
+    std::vector<int64_t> indices(eigenPoints.size() * k);
+    std::vector<float> distances(eigenPoints.size() * k);
+    eigenTree.allKNN(k, indices.data(), distances.data());
+    for (size_t i = 0; i < eigenPoints.size(); ++i) {
+        std::vector<float> expected;
+        for (size_t j = 0; j < eigenPoints.size(); ++j)
+            if (j != i) expected.push_back(distance(eigenPoints[i], eigenPoints[j]));
+        std::sort(expected.begin(), expected.end());
+        for (size_t j = 0; j < k; ++j) {
+            EXPECT_NEAR(distances[i * k + j], expected[j], 1e-4);
+            EXPECT_NE(indices[i * k + j], (int64_t)i);
+        }
+    }
+}
+
+TEST(VPTests, TestKNNGraph) {
+    std::mt19937 generator(37);
+    std::normal_distribution<float> distribution(0, 1);
+
+    const size_t numPoints = 4000, dim = 8, k = 10;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    VPTree<FlatSpan, float, dist_l2sq_f_avx2> tree;
+    tree.set(points);
+    std::vector<int64_t> exactIndices(numPoints * k);
+    std::vector<float> exactDistances(numPoints * k);
+    tree.allKNN(k, exactIndices.data(), exactDistances.data());
+
+    for (int64_t seedVisits : {0, 32}) {
+        KNNGraphBuilder<dist_l2sq_f_avx2> builder(k, 10, 0, 0.001f, seedVisits);
+        std::vector<int64_t> indices(numPoints * k);
+        std::vector<float> distances(numPoints * k);
+        EXPECT_GT(builder.build(data.data(), numPoints, dim, indices.data(), distances.data()), 0);
+
+        size_t hits = 0;
+        for (size_t i = 0; i < numPoints; ++i) {
+            for (size_t j = 0; j < k; ++j) {
+                const int64_t id = indices[i * k + j];
+                ASSERT_TRUE(id >= 0 && id < (int64_t)numPoints && id != (int64_t)i);
+                EXPECT_NEAR(distances[i * k + j], dist_l2_f_avx2(points[i], points[id]), 1e-4);
+                if (j > 0) {
+                    EXPECT_LE(distances[i * k + j - 1], distances[i * k + j]);
+                }
+                hits += std::count(&exactIndices[i * k], &exactIndices[i * k] + k, id);
+            }
+        }
+        EXPECT_GT((double)hits / (numPoints * k), 0.9) << "seed visits " << seedVisits;
+    }
+
+    // fewer points than k: every other point, then padding
+    KNNGraphBuilder<dist_l1_f_avx2> small(k);
+    std::vector<int64_t> indices(3 * k);
+    std::vector<float> distances(3 * k);
+    small.build(data.data(), 3, dim, indices.data(), distances.data());
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_NE(indices[i * k], (int64_t)i);
+        EXPECT_NE(indices[i * k + 1], (int64_t)i);
+        EXPECT_EQ(indices[i * k + 2], -1);
+        EXPECT_TRUE(std::isinf(distances[i * k + k - 1]));
+    }
+    EXPECT_THROW(KNNGraphBuilder<dist_l2sq_f_avx2>(0), std::invalid_argument);
+}
+
+TEST(VPTests, TestSaveLoadFile) {
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    const size_t numPoints = 300;
+    const size_t dim = 5;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    std::vector<FlatSpan> points(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) points[i] = FlatSpan{data.data() + i * dim, dim};
+
+    std::vector<float> queryData(12 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(12);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    using Tree = VPTree<FlatSpan, float, dist_l2sq_f_avx2>;
+    Tree tree;
+    tree.setLeafSize(4);
+    tree.set(points);
+
+    const std::string path = testing::TempDir() + "pynear_vptree_file_test.idx";
+    saveVPTree(tree, path, "l2");
+
+    const size_t k = 5;
+    std::vector<int64_t> expectedIndices(queries.size() * k);
+    std::vector<float> expectedDistances(queries.size() * k);
+    tree.searchKNN(queries, k, expectedIndices.data(), expectedDistances.data());
+
+    for (bool mmap : {true, false}) {
+        Tree loaded;
+        loadVPTree(loaded, path, "l2", mmap);
+        EXPECT_EQ(loaded.flatBacking().borrowed(), mmap);
+        EXPECT_EQ(loaded.leafSize(), 4);
+
+        // a copy of a mapped tree shares the mapping and outlives the original
+        Tree copy(loaded);
+        loaded.clear();
+
+        std::vector<int64_t> indices(queries.size() * k);
+        std::vector<float> distances(queries.size() * k);
+        copy.searchKNN(queries, k, indices.data(), distances.data());
+        EXPECT_EQ(indices, expectedIndices);
+        EXPECT_EQ(distances, expectedDistances);
+    }
+
+    Tree wrongMetric;
+    EXPECT_THROW(loadVPTree(wrongMetric, path, "l1"), std::invalid_argument);
+    std::remove(path.c_str());
+}
+
+TEST(VPTests, TestAddRemove) {
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<float> distribution(-10, 10);
+
+    const size_t dim = 4;
+    const size_t numPoints = 4000;
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+    auto rows = [&](size_t from, size_t to) {
+        std::vector<FlatSpan> spans;
+        for (size_t i = from; i < to; ++i) spans.push_back(FlatSpan{data.data() + i * dim, dim});
+        return spans;
+    };
+
+    std::vector<float> queryData(20 * dim);
+    for (float &v : queryData) v = distribution(generator);
+    std::vector<FlatSpan> queries(20);
+    for (size_t i = 0; i < queries.size(); ++i) queries[i] = FlatSpan{queryData.data() + i * dim, dim};
+
+    using Tree = VPTree<FlatSpan, float, dist_l2sq_f_avx2>;
+    Tree tree;
+    tree.setLeafSize(4);
+    tree.set(rows(0, 1000));
+
+    // batches of every size, with the new points clustered in one corner so the tree skews
+    std::vector<uint8_t> live(numPoints, 0);
+    std::fill(live.begin(), live.begin() + 1000, 1);
+    for (size_t i = 1000; i < numPoints; ++i) {
+        if (i >= 2500)
+            for (size_t d = 0; d < dim; ++d) data[i * dim + d] = std::abs(data[i * dim + d]) * 0.1f + 5;
+    }
+    size_t next = 1000;
+    for (size_t batch : {1, 7, 400, 92, 1500, 1000}) {
+        std::vector<int64_t> ids = tree.add(rows(next, next + batch));
+        ASSERT_EQ(ids.size(), batch);
+        for (size_t j = 0; j < batch; ++j) {
+            EXPECT_EQ(ids[j], (int64_t)(next + j));
+            live[next + j] = 1;
+        }
+        next += batch;
+    }
+    ASSERT_EQ(next, numPoints);
+
+    std::vector<int64_t> removed;
+    for (size_t i = 0; i < numPoints; ++i)
+        if (generator() % 3 != 0 || (i >= 500 && i < 1500)) removed.push_back((int64_t)i);
+    tree.remove(std::vector<int64_t>(removed.begin(), removed.begin() + removed.size() / 2));
+    tree.remove(std::vector<int64_t>(removed.begin() + removed.size() / 2, removed.end()));
+    for (int64_t id : removed) live[id] = 0;
+    EXPECT_THROW(tree.remove({removed[0]}), std::invalid_argument);
+    EXPECT_THROW(tree.remove({(int64_t)numPoints}), std::invalid_argument);
+
+    auto checkExact = [&](Tree &t) {
+        EXPECT_EQ(t.size(), (size_t)std::count(live.begin(), live.end(), 1));
+
+        const size_t k = 7;
+        std::vector<int64_t> indices(queries.size() * k);
+        std::vector<float> distances(queries.size() * k);
+        t.searchKNN(queries, k, indices.data(), distances.data());
+        std::vector<int64_t> nearest;
+        std::vector<float> nearestDist;
+        t.search1NN(queries, nearest, nearestDist);
+        Tree::VPTreeRadiusSearchResult radius;
+        t.searchRadius(queries, 4.0f, radius);
+
+        for (size_t q = 0; q < queries.size(); ++q) {
+            std::vector<std::pair<float, int64_t>> expected;
+            for (size_t i = 0; i < numPoints; ++i)
+                if (live[i]) expected.push_back({std::sqrt(dist_l2sq_f_avx2(queries[q], rows(i, i + 1)[0])), (int64_t)i});
+            std::sort(expected.begin(), expected.end());
+            for (size_t j = 0; j < k; ++j) {
+                EXPECT_EQ(indices[q * k + j], expected[j].second);
+                EXPECT_NEAR(distances[q * k + j], expected[j].first, 1e-4);
+            }
+            EXPECT_EQ(nearest[q], expected[0].second);
+
+            size_t within = 0;
+            while (within < expected.size() && expected[within].first <= 4.0f) ++within;
+            ASSERT_EQ((size_t)(radius.offsets[q + 1] - radius.offsets[q]), within);
+            for (size_t j = 0; j < within; ++j) EXPECT_TRUE(live[radius.indexes[radius.offsets[q] + j]]);
+        }
+    };
+    checkExact(tree);
+
+    // tombstones survive a save / load, and a loaded tree accepts updates
+    const std::string path = testing::TempDir() + "pynear_vptree_update_test.idx";
+    saveVPTree(tree, path, "l2");
+    Tree loaded;
+    loadVPTree(loaded, path, "l2", true);
+    checkExact(loaded);
+    std::vector<int64_t> ids = loaded.add(rows(10, 11));
+    EXPECT_EQ(ids[0], (int64_t)numPoints);
+    live.push_back(1);
+    data.insert(data.end(), data.begin() + 10 * dim, data.begin() + 11 * dim);
+    loaded.remove({ids[0]});
+    live.back() = 0;
+    EXPECT_FALSE(loaded.flatBacking().borrowed());
+    checkExact(loaded);
+    std::remove(path.c_str());
+
+    tree.compact();
+    EXPECT_EQ(tree.indexPermutation().size(), tree.size());
+    live.pop_back();
+    data.resize(numPoints * dim);
+    checkExact(tree);
+
+    // removing everything leaves an empty tree that add() refills with fresh ids
+    std::vector<int64_t> rest;
+    for (size_t i = 0; i < numPoints; ++i)
+        if (live[i]) rest.push_back((int64_t)i);
+    tree.remove(rest);
+    EXPECT_EQ(tree.size(), 0u);
+    EXPECT_EQ(tree.add(rows(0, 3)), (std::vector<int64_t>{(int64_t)numPoints, (int64_t)numPoints + 1, (int64_t)numPoints + 2}));
+    EXPECT_EQ(tree.size(), 3u);
+}
+
+TEST(VPTests, TestAddRemoveGenericType) {
+    std::mt19937 generator(17);
+    std::uniform_real_distribution<double> distribution(-10, 10);
+
+    std::vector<Eigen::Vector3d> points(600);
+    for (auto &p : points) p = Eigen::Vector3d(distribution(generator), distribution(generator), distribution(generator));
+
+    VPTree<Eigen::Vector3d, float, distance> tree;
+    tree.setLeafSize(3);
+    tree.set(std::vector<Eigen::Vector3d>(points.begin(), points.begin() + 200));
+    tree.add(std::vector<Eigen::Vector3d>(points.begin() + 200, points.end()));
+
+    std::vector<int64_t> removed;
+    for (int64_t i = 0; i < 600; i += 2) removed.push_back(i);
+    tree.remove(removed);
+    EXPECT_EQ(tree.size(), 300u);
+
+    std::vector<Eigen::Vector3d> queries(30);
+    for (auto &q : queries) q = Eigen::Vector3d(distribution(generator), distribution(generator), distribution(generator));
+    std::vector<int64_t> indices;
+    std::vector<float> distances;
+    tree.search1NN(queries, indices, distances);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        int64_t best = -1;
+        float bestDist = std::numeric_limits<float>::max();
+        for (int64_t i = 1; i < 600; i += 2) {
+            if (distance(queries[q], points[i]) < bestDist) {
+                bestDist = distance(queries[q], points[i]);
+                best = i;
+            }
+        }
+        EXPECT_EQ(indices[q], best);
+    }
+}
+
+// reference Hamming distance without a pointer kernel, so trees over it keep per-point vectors
+int64_t hammingUnpacked(const arrayli &a, const arrayli &b) { return dist_hamming(a, b); }
+
+TEST(VPTests, TestPackedBinaryCodes) {
+    using Packed = SerializableVPTree<arrayli, int64_t, dist_hamming_256, ndarraySerializer<uint8_t>,
+                                      ndarrayDeserializer<uint8_t>>;
+    using Unpacked = SerializableVPTree<arrayli, int64_t, hammingUnpacked, ndarraySerializer<uint8_t>,
+                                        ndarrayDeserializer<uint8_t>>;
+    static_assert(Packed::PACKED_CODES && !Unpacked::PACKED_CODES);
+
+    std::mt19937 generator(23);
+    std::uniform_int_distribution<int> byte(0, 255);
+    auto randomCodes = [&](size_t n) {
+        std::vector<arrayli> codes(n, arrayli(32));
+        for (auto &code : codes)
+            for (auto &b : code) b = (uint8_t)byte(generator);
+        return codes;
+    };
+    const std::vector<arrayli> points = randomCodes(1500);
+    const std::vector<arrayli> queries = randomCodes(40);
+
+    Packed tree;
+    tree.setLeafSize(8);
+    tree.set(std::vector<arrayli>(points.begin(), points.begin() + 1000));
+    tree.add(std::vector<arrayli>(points.begin() + 1000, points.end()));
+    std::vector<int64_t> removed;
+    for (int64_t i = 0; i < 1500; i += 3) removed.push_back(i);
+    tree.remove(removed);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(tree.flatBacking().data()) % 64, 0u);
+    EXPECT_EQ(tree.flatBacking().size(), tree.numPoints() * 32);
+
+    // k nearest distances against brute force over the live points
+    const size_t k = 5;
+    auto expectExact = [&](Packed &index) {
+        std::vector<int64_t> indices(queries.size() * k);
+        std::vector<int64_t> distances(queries.size() * k);
+        index.searchKNN(queries, k, indices.data(), distances.data());
+        for (size_t q = 0; q < queries.size(); ++q) {
+            std::vector<int64_t> all;
+            for (int64_t i = 0; i < 1500; ++i)
+                if (i % 3 != 0) all.push_back(dist_hamming(queries[q], points[i]));
+            std::sort(all.begin(), all.end());
+            for (size_t j = 0; j < k; ++j) {
+                EXPECT_EQ(distances[q * k + j], all[j]);
+                EXPECT_NE(indices[q * k + j] % 3, 0);
+                EXPECT_EQ(dist_hamming(queries[q], points[indices[q * k + j]]), distances[q * k + j]);
+            }
+        }
+    };
+    expectExact(tree);
+
+    // the state keeps the per-point layout: trees without packed codes read it and vice versa
+    Unpacked unpacked;
+    unpacked.deserialize(tree.serialize());
+    Packed restored;
+    restored.deserialize(unpacked.serialize());
+    EXPECT_EQ(restored.size(), tree.size());
+    EXPECT_EQ(restored.nextId(), 1500);
+    expectExact(restored);
+
+    std::vector<int64_t> selfIndices(1500 * k), selfDistances(1500 * k);
+    restored.allKNN(k, selfIndices.data(), selfDistances.data());
+    for (int64_t i = 1; i < 1500; i += 3) {
+        EXPECT_NE(selfIndices[i * k], i);
+        EXPECT_EQ(dist_hamming(points[i], points[selfIndices[i * k]]), selfDistances[i * k]);
+    }
+
+    restored.compact();
+    expectExact(restored);
+}
+
+TEST(VPTests, TestSegmentedIndex) {
+    const size_t dim = 6, numPoints = 20000;
+    std::mt19937 generator(23);
+    std::uniform_real_distribution<float> distribution(-1, 1);
+    std::vector<float> data(numPoints * dim);
+    for (float &v : data) v = distribution(generator);
+
+    auto bruteForce = [&](const float *query, size_t upto, size_t k) {
+        std::vector<std::pair<float, int64_t>> all(upto);
+        for (size_t i = 0; i < upto; ++i)
+            all[i] = {std::sqrt(dist_l2sq_f_avx2(FlatSpan{query, dim}, FlatSpan{data.data() + i * dim, dim})),
+                      (int64_t)i};
+        std::partial_sort(all.begin(), all.begin() + k, all.end());
+        all.resize(k);
+        return all;
+    };
+
+    SegmentedVPTreeIndex<dist_l2sq_f_avx2> index(300, 3, 4);
+    std::atomic<size_t> written{0};
+    std::thread writer([&] {
+        std::mt19937 batches(5);
+        for (size_t i = 0; i < numPoints;) {
+            const size_t n = std::min<size_t>(numPoints - i, batches() % 700 + 1);
+            EXPECT_EQ(index.add(data.data() + i * dim, n, dim), (int64_t)i);
+            i += n;
+            written = i;
+        }
+    });
+
+    // searches running alongside the writer see every vector added before they started
+    const size_t k = 5;
+    std::mt19937 queries(7);
+    while (written < numPoints) {
+        float query[dim];
+        for (float &v : query) v = distribution(queries);
+        const size_t before = written;
+        int64_t indices[k];
+        float distances[k];
+        index.searchKNN(query, 1, dim, k, indices, distances);
+        const size_t after = written;
+        if (before < k) continue;
+        auto expected = bruteForce(query, before, k);
+        for (size_t j = 0; j < k; ++j) {
+            ASSERT_GE(indices[j], 0);
+            ASSERT_LT((size_t)indices[j], after);
+            EXPECT_LE(distances[j], expected[j].first + 1e-5f);
+        }
+    }
+    writer.join();
+
+    index.flush();
+    EXPECT_EQ(index.size(), numPoints);
+    EXPECT_GT(index.numSegments(), 0u);
+    EXPECT_EQ(index.vectors(), data);
+
+    const size_t nq = 50;
+    std::vector<int64_t> indices(nq * k);
+    std::vector<float> distances(nq * k);
+    index.searchKNN(data.data(), nq, dim, k, indices.data(), distances.data());
+    for (size_t q = 0; q < nq; ++q) {
+        auto expected = bruteForce(data.data() + q * dim, numPoints, k);
+        for (size_t j = 0; j < k; ++j) {
+            EXPECT_EQ(indices[q * k + j], expected[j].second);
+            EXPECT_NEAR(distances[q * k + j], expected[j].first, 1e-5);
+        }
+    }
+
+    EXPECT_THROW(index.add(data.data(), 1, dim + 1), std::invalid_argument);
+    EXPECT_THROW(index.searchKNN(data.data(), 1, dim + 1, k, indices.data(), distances.data()), std::invalid_argument);
+}
+
 } // namespace vptree::tests
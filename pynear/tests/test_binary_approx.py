@@ -95,6 +95,17 @@ class TestIVFFlatBinaryIndex:
         res_idx, _ = idx.searchKNN(q, k=3)
         assert len(res_idx) == 3
 
+    def test_2048bit(self):
+        db = _make_db(400, 256)  # 2048-bit perceptual-hash sized codes
+        ti = [0, 10, 20]
+        q = _make_near_queries(db, ti, n_flips=20)
+        idx = IVFFlatBinaryIndex(nlist=8, nprobe=8)
+        idx.set(db)
+        res_idx, res_dist = idx.searchKNN(q, k=3)
+        for i, true_i in enumerate(ti):
+            assert res_idx[i][0] == true_i
+            assert res_dist[i][0] == 20
+
     def test_results_sorted_by_distance(self):
         db = _make_db(500, 64)
         idx = IVFFlatBinaryIndex(nlist=16, nprobe=8)
@@ -102,7 +113,22 @@ class TestIVFFlatBinaryIndex:
         q = _make_near_queries(db, [0], n_flips=4)
         _, dist = idx.searchKNN(q, k=10)
         d = dist[0]
-        assert d == sorted(d), "Distances not sorted in ascending order"
+        assert np.all(np.diff(d) >= 0), "Distances not sorted in ascending order"
+
+    def test_filter(self):
+        db = _make_db(600, 32)
+        idx = IVFFlatBinaryIndex(nlist=4, nprobe=4)
+        idx.set(db)
+        allowed = np.arange(0, 600, 7)
+        mask = np.zeros(600, dtype=bool)
+        mask[allowed] = True
+        # probing every cluster makes the filtered search exhaustive over the allowed ids
+        for selection in (allowed, mask, np.tile(mask, (5, 1))):
+            res_idx, res_dist = idx.searchKNN(db[:5], k=3, filter=selection)
+            assert np.all(res_idx % 7 == 0)
+            for q in range(5):
+                exact = np.sort([pynear.dist_hamming_256(db[q], db[i]) for i in allowed])[:3]
+                assert np.array_equal(res_dist[q], exact)
 
     def test_k_greater_than_cluster(self):
         """Requesting k > cluster size should return fewer results without error."""
@@ -111,10 +137,23 @@ class TestIVFFlatBinaryIndex:
         idx.set(db)
         q = db[:3]
         res_idx, res_dist = idx.searchKNN(q, k=100)
-        assert len(res_idx) == 3
-        # Each result has ≤ 100 entries; no crash expected
-        for r in res_idx:
-            assert len(r) <= 100
+        assert res_idx.shape == res_dist.shape == (3, 100)
+        # Slots the probed cluster could not fill are padded with index -1
+        assert np.all((res_idx == -1) == (res_dist == np.iinfo(np.int64).max))
+        assert np.all(res_idx[:, 0] >= 0)
+
+    def test_strided_and_mismatched_input(self):
+        db = _make_db(300, 32)
+        idx = IVFFlatBinaryIndex(nlist=4, nprobe=4)
+        idx.set(db)
+        # a strided view is copied into a contiguous buffer, the result matches the copy
+        wide = np.hstack([db, db])
+        res_view = idx.searchKNN(wide[:10, :32], k=3)
+        res_copy = idx.searchKNN(np.ascontiguousarray(db[:10]), k=3)
+        assert np.array_equal(res_view[0], res_copy[0])
+        assert np.array_equal(res_view[1], res_copy[1])
+        with pytest.raises(ValueError):
+            idx.searchKNN(wide[:10], k=3)
 
 
 # ── MIHBinaryIndex ────────────────────────────────────────────────────────────
@@ -156,6 +195,16 @@ class TestMIHBinaryIndex:
         res_idx, _ = idx.searchKNN(q, k=5, radius=8)
         assert len(res_idx) == len(ti)
 
+    def test_1024bit_m16(self):
+        db = _make_db(500, 128)  # 1024-bit, m=16 → sub_nbytes=8
+        ti = list(range(0, 50, 5))
+        q = _make_near_queries(db, ti, n_flips=3)
+        idx = MIHBinaryIndex(m=16)
+        idx.set(db)
+        res_idx, res_dist = idx.searchKNN(q, k=1, radius=8)
+        assert [r[0] for r in res_idx] == ti
+        assert all(d[0] == 3 for d in res_dist)
+
     def test_128bit_m4(self):
         db = _make_db(400, 16)  # 128-bit, m=4 → sub_nbytes=4
         ti = [0, 10, 20]
@@ -205,7 +254,17 @@ class TestMIHBinaryIndex:
         idx.set(db)
         _, dist = idx.searchKNN(q, k=20, radius=8)
         d = dist[0]
-        assert d == sorted(d), "Distances not sorted in ascending order"
+        assert np.all(np.diff(d) >= 0), "Distances not sorted in ascending order"
+
+    def test_filter(self):
+        db = _make_db(800, 64)
+        near = _make_near_queries(db, [10], n_flips=2)
+        idx = MIHBinaryIndex(m=8)
+        idx.set(np.vstack([db, near]))
+        # the exact copy is filtered out, only the allowed near duplicate is found
+        res_idx, res_dist = idx.searchKNN(db[10:11], k=2, radius=8, filter=np.array([800]))
+        assert res_idx[0, 0] == 800 and res_dist[0, 0] == 2
+        assert res_idx[0, 1] == -1
 
     def test_empty_set(self):
         idx = MIHBinaryIndex(m=8)
@@ -214,8 +273,14 @@ class TestMIHBinaryIndex:
         db = _make_db(10, 64)
         idx2 = MIHBinaryIndex(m=8)
         idx2.set(db)
-        # Querying with no matches should return empty lists
+        # Rows without enough matches are padded with index -1
         res_idx, res_dist = idx2.searchKNN(db[:2], k=5, radius=0)
         # At least the exact copies (distance 0) are found
         assert 0 in res_idx[0]
         assert 1 in res_idx[1]
+
+    def test_mismatched_query_width(self):
+        idx = MIHBinaryIndex(m=8)
+        idx.set(_make_db(100, 64))
+        with pytest.raises(ValueError):
+            idx.searchKNN(_make_db(2, 32), k=1, radius=4)
@@ -9,6 +9,7 @@ CLASSES = [
     (pynear.BKTreeBinaryIndex256, 32),
     (pynear.BKTreeBinaryIndex512, 64),
     (pynear.BKTreeBinaryIndexN, 1),
+    (pynear.BKTreeBinaryIndexN, 256),
 ]
 
 
@@ -17,6 +18,10 @@ def hamming_distance_pairwise(a: np.ndarray, b: np.ndarray) -> np.ndarray:
     return np.count_nonzero((np.bitwise_xor(a[:, None, :], b[None, :, :]) & r) != 0, axis=(0, -1))
 
 
+def split_csr(offsets: np.ndarray, values: np.ndarray) -> list:
+    return [values[offsets[q] : offsets[q + 1]].tolist() for q in range(len(offsets) - 1)]
+
+
 @pytest.mark.parametrize("bktree_cls, dimensions", CLASSES)
 def test_bktree_empty_index(bktree_cls, dimensions):
     num_points = 2
@@ -28,18 +33,17 @@ def test_bktree_empty_index(bktree_cls, dimensions):
     empty = np.array([], dtype=np.uint8)
 
     tree = bktree_cls()
-    indices, distances, keys = tree.find_threshold(data, 1)
-    truth = [[]] * num_points
-    assert truth == indices
-    assert truth == distances
+    offsets, indices, distances = tree.find_threshold(data, 1)
+    assert offsets.tolist() == [0] * (num_points + 1)
+    assert len(indices) == len(distances) == 0
+    assert indices.dtype == np.int64 and distances.dtype == np.int64
     assert tree.empty()
     assert tree.values() == []
 
     tree.set(empty)
-    indices, distances, keys = tree.find_threshold(data, 1)
-    truth = [[]] * num_points
-    assert truth == indices
-    assert truth == distances
+    offsets, indices, distances = tree.find_threshold(data, 1)
+    assert offsets.tolist() == [0] * (num_points + 1)
+    assert len(indices) == len(distances) == 0
     assert tree.empty()
     assert tree.values() == []
 
@@ -55,10 +59,10 @@ def test_bktree_find_self(bktree_cls, dimensions):
 
     tree = bktree_cls()
     tree.set(data)
-    indices, distances, keys = tree.find_threshold(data, 0)
-    assert indices == [[i] for i in range(num_points)]
-    assert distances == [[0]] * num_points
-    assert keys == data[:, None, :].tolist()
+    offsets, indices, distances = tree.find_threshold(data, 0)
+    assert offsets.tolist() == list(range(num_points + 1))
+    assert indices.tolist() == list(range(num_points))
+    assert distances.tolist() == [0] * num_points
     assert tree.size() == num_points
     assert sorted(tree.values()) == sorted(data.tolist())
 
@@ -74,11 +78,13 @@ def test_bktree_find_all(bktree_cls, dimensions):
 
     tree = bktree_cls()
     tree.set(data)
-    indices, distances, keys = tree.find_threshold(data, dimensions * 8)
+    offsets, indices, distances = tree.find_threshold(data, dimensions * 8)
 
-    assert indices == [list(range(num_points))] * num_points
-    assert distances == hamming_distance_pairwise(data, data).tolist()
-    assert keys == np.broadcast_to(data, (num_points, num_points, dimensions)).tolist()
+    # nearest first, ties by id
+    pairwise = hamming_distance_pairwise(data, data)
+    expected = [sorted(range(num_points), key=lambda i: (pairwise[q][i], i)) for q in range(num_points)]
+    assert split_csr(offsets, indices) == expected
+    assert split_csr(offsets, distances) == [pairwise[q][expected[q]].tolist() for q in range(num_points)]
     assert tree.size() == num_points
     assert sorted(tree.values()) == sorted(data.tolist())
 
@@ -90,10 +96,9 @@ def test_bktree_find_duplicates(bktree_cls, dimensions):
 
     tree = bktree_cls()
     tree.set(data)
-    indices, distances, keys = tree.find_threshold(data, 255)
+    offsets, indices, distances = tree.find_threshold(data, 255)
 
-    assert indices == [list(range(num_points))] * num_points
-    assert distances == [[0] * num_points] * num_points
-    assert keys == np.broadcast_to(data, (num_points, num_points, dimensions)).tolist()
+    assert split_csr(offsets, indices) == [list(range(num_points))] * num_points
+    assert split_csr(offsets, distances) == [[0] * num_points] * num_points
     assert tree.size() == num_points
     assert sorted(tree.values()) == sorted(data.tolist())
@@ -0,0 +1,116 @@
+"""
+Tests for HNSWL2Index (approximate graph search).
+
+Correctness strategy: small datasets with a wide search beam must reproduce
+brute-force results; larger ones must reach a reasonable recall.
+"""
+
+import pickle
+
+import numpy as np
+import pytest
+
+from pynear import HNSWL2Index
+
+
+def brute_knn_l2(data, queries, k):
+    dists = np.sqrt(((queries[:, None, :] - data[None, :, :]) ** 2).sum(axis=2))
+    idx = np.argsort(dists, axis=1)[:, :k]
+    return idx, np.take_along_axis(dists, idx, axis=1)
+
+
+def recall(approx_indices, exact_indices):
+    return np.mean([len(set(a) & set(e)) / len(e) for a, e in zip(approx_indices, exact_indices)])
+
+
+def test_exact_on_small_dataset():
+    rng = np.random.default_rng(0)
+    data = rng.random((300, 8)).astype(np.float32)
+    queries = rng.random((20, 8)).astype(np.float32)
+
+    index = HNSWL2Index(M=8, ef_construction=100)
+    index.set(data)
+    indices, distances = index.searchKNN(queries, 5, ef=300)
+
+    exact_idx, exact_dist = brute_knn_l2(data, queries, 5)
+    np.testing.assert_array_equal(indices, exact_idx)
+    np.testing.assert_allclose(distances, exact_dist, rtol=1e-4, atol=1e-5)
+
+
+def test_recall_high_dim():
+    rng = np.random.default_rng(1)
+    centers = rng.random((20, 64)).astype(np.float32)
+    data = (centers[rng.integers(0, 20, 4000)] + 0.05 * rng.standard_normal((4000, 64))).astype(np.float32)
+    queries = (centers[rng.integers(0, 20, 50)] + 0.05 * rng.standard_normal((50, 64))).astype(np.float32)
+
+    index = HNSWL2Index(ef_search=64)
+    index.set(data)
+    indices, _ = index.searchKNN(queries, 10)
+    exact_idx, _ = brute_knn_l2(data, queries, 10)
+    assert recall(indices, exact_idx) >= 0.9
+
+
+def test_add_extends_index():
+    rng = np.random.default_rng(2)
+    data = rng.random((400, 6)).astype(np.float32)
+
+    index = HNSWL2Index()
+    index.set(data[:250])
+    index.add(data[250:])
+    assert index.size() == 400
+
+    # every point finds itself
+    indices, distances = index.searchKNN(data, 1, ef=100)
+    np.testing.assert_array_equal(indices[:, 0], np.arange(400))
+    np.testing.assert_allclose(distances[:, 0], 0, atol=1e-5)
+
+    with pytest.raises(ValueError):
+        index.add(rng.random((3, 5)).astype(np.float32))
+
+
+def test_search1nn_and_padding():
+    rng = np.random.default_rng(3)
+    data = rng.random((5, 4)).astype(np.float32)
+    queries = rng.random((3, 4)).astype(np.float32)
+
+    index = HNSWL2Index()
+    index.set(data)
+    idx1, dist1 = index.search1NN(queries)
+    idxk, distk = index.searchKNN(queries, 8)
+    assert idx1.shape == (3,)
+    np.testing.assert_array_equal(idx1, idxk[:, 0])
+    np.testing.assert_array_equal(dist1, distk[:, 0])
+    assert (idxk[:, 5:] == -1).all() and np.isinf(distk[:, 5:]).all()
+
+    out = (np.empty((3, 2), dtype=np.int64), np.empty((3, 2), dtype=np.float32))
+    indices, distances = index.searchKNN(queries, 2, out=out)
+    assert indices is out[0] and distances is out[1]
+
+
+def test_ef_search_property():
+    index = HNSWL2Index(ef_search=40)
+    assert index.ef_search == 40
+    index.ef_search = 120
+    assert index.ef_search == 120
+    with pytest.raises(ValueError):
+        index.ef_search = 0
+
+
+def test_pickle_roundtrip():
+    rng = np.random.default_rng(4)
+    data = rng.random((500, 16)).astype(np.float32)
+    queries = rng.random((10, 16)).astype(np.float32)
+
+    index = HNSWL2Index(M=12, ef_search=80)
+    index.set(data)
+    expected = index.searchKNN(queries, 5)
+
+    restored = pickle.loads(pickle.dumps(index))
+    assert restored.ef_search == 80 and restored.M() == 12
+    indices, distances = restored.searchKNN(queries, 5)
+    np.testing.assert_array_equal(indices, expected[0])
+    np.testing.assert_array_equal(distances, expected[1])
+
+    # the restored graph still accepts inserts
+    restored.add(data[:10])
+    assert restored.size() == 510
@@ -84,8 +84,8 @@ def test_search1nn_matches_searchknn():
     idx1, dist1 = index.search1NN(queries)
     idxk, distk = index.searchKNN(queries, 1)
 
-    assert idx1 == idxk
-    assert dist1 == distk
+    np.testing.assert_array_equal(idx1, idxk)
+    np.testing.assert_array_equal(dist1, distk)
 
 
 def test_single_query_vector():
@@ -97,8 +97,7 @@ def test_single_query_vector():
 
     q = rng.random(8).astype(np.float32)
     idx, dist = index.searchKNN(q, 3)
-    assert len(idx) == 1
-    assert len(idx[0]) == 3
+    assert idx.shape == (1, 3)
 
 
 def test_k_larger_than_cluster_size():
@@ -121,6 +120,29 @@ def test_fewer_points_than_clusters():
     assert index.n_clusters <= 10
 
 
+def test_exact_distances_and_out_buffers():
+    """With every cluster probed, rows match brute force and out= is filled in place."""
+    rng = np.random.default_rng(7)
+    data = rng.random((300, 16)).astype(np.float32)
+    queries = rng.random((130, 16)).astype(np.float32)  # spans several query tiles
+    k = 4
+
+    index = IVFFlatL2Index(n_clusters=12, n_probe=12)
+    index.set(data)
+
+    out = (np.empty((len(queries), k), dtype=np.int64), np.empty((len(queries), k), dtype=np.float32))
+    indices, distances = index.searchKNN(queries, k, out=out)
+    assert indices is out[0] and distances is out[1]
+
+    exact_idx, exact_dist = brute_knn_l2(data, queries, k)
+    np.testing.assert_array_equal(indices, exact_idx)
+    np.testing.assert_allclose(distances, exact_dist, rtol=1e-4, atol=1e-5)
+
+    # k beyond the dataset pads with -1 / inf
+    idx, dist = index.searchKNN(queries[:2], len(data) + 3)
+    assert (idx[:, -3:] == -1).all() and np.isinf(dist[:, -3:]).all()
+
+
 # ── high-dimensional smoke test ────────────────────────────────────────────────
 
 
@@ -134,8 +156,8 @@ def test_high_dim_1024():
     index.set(data)
 
     idx, dist = index.searchKNN(queries, k=5)
-    assert len(idx) == 5
-    assert all(len(r) == 5 for r in idx)
+    assert idx.shape == (5, 5)
+    assert dist.shape == (5, 5)
 
 
 # ── pickle ─────────────────────────────────────────────────────────────────────
@@ -157,5 +179,5 @@ def test_pickle_roundtrip():
 
     idx_after, dist_after = index2.searchKNN(queries, k)
 
-    assert idx_before == idx_after
+    np.testing.assert_array_equal(idx_before, idx_after)
     np.testing.assert_allclose(dist_before, dist_after)
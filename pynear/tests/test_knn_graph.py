@@ -0,0 +1,62 @@
+"""
+Tests for build_knn_graph (NN-descent).
+
+The graph is approximate, so quality is checked as recall against the exact
+self join of a VP-tree, while structure (no self loops, one row per point,
+nearest first) is checked exactly.
+"""
+
+import numpy as np
+import pytest
+
+pytest.importorskip("scipy", reason="scipy not installed")
+
+import pynear
+
+
+def test_recall_against_exact_graph():
+    rng = np.random.default_rng(0)
+    data = rng.standard_normal((3000, 8)).astype(np.float32)
+    k = 10
+
+    graph = pynear.build_knn_graph(data, k)
+    assert graph.shape == (3000, 3000)
+    assert graph.nnz == 3000 * k
+    assert graph.diagonal().sum() == 0
+
+    index = pynear.VPTreeL2Index()
+    index.set(data)
+    exact, exact_distances = index.allKNN(k)
+    found = graph.indices.reshape(-1, k)
+    hits = sum(len(np.intersect1d(found[i], exact[i])) for i in range(len(data)))
+    assert hits / exact.size > 0.9
+
+    # edge values are the true distances
+    row = graph.getrow(5)
+    np.testing.assert_allclose(row.data, np.linalg.norm(data[row.indices] - data[5], axis=1), rtol=1e-5)
+
+
+@pytest.mark.parametrize("metric", ["euclidean", "manhattan", "chebyshev"])
+def test_metrics_and_connectivity(metric):
+    rng = np.random.default_rng(1)
+    data = rng.random((500, 4))  # float64 input is converted
+
+    graph = pynear.build_knn_graph(data, 5, metric=metric, iters=3, mode="connectivity")
+    assert graph.nnz == 500 * 5
+    assert (graph.data == 1).all()
+
+
+def test_small_inputs_and_errors():
+    data = np.ones((3, 2), dtype=np.float32)
+    graph = pynear.build_knn_graph(data, 5)
+    # only the two other points exist
+    assert graph.nnz == 3 * 2
+    for i in range(3):
+        assert sorted(graph.getrow(i).indices) == [j for j in range(3) if j != i]
+
+    with pytest.raises(ValueError, match="Unsupported metric"):
+        pynear.build_knn_graph(data, 2, metric="hamming")
+    with pytest.raises(ValueError):
+        pynear.build_knn_graph(data, 2, mode="weights")
+    with pytest.raises(ValueError):
+        pynear.build_knn_graph(data, 0)
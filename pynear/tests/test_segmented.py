@@ -0,0 +1,126 @@
+"""
+Tests for SegmentedVPTreeL2Index (log-structured exact search).
+
+Correctness strategy: every search must match brute force over the vectors
+added so far, whether they sit in the memtable, in frozen tables or in
+merged segments.
+"""
+
+import pickle
+import threading
+
+import numpy as np
+import pytest
+
+from pynear import SegmentedVPTreeL2Index
+
+
+def brute_knn_l2(data, queries, k):
+    dists = np.sqrt(((queries[:, None, :] - data[None, :, :]) ** 2).sum(axis=2))
+    idx = np.argsort(dists, axis=1)[:, :k]
+    return idx, np.take_along_axis(dists, idx, axis=1)
+
+
+def test_matches_brute_force_across_segments():
+    rng = np.random.default_rng(0)
+    data = rng.random((3000, 8)).astype(np.float32)
+    queries = rng.random((20, 8)).astype(np.float32)
+
+    index = SegmentedVPTreeL2Index(memtable_size=100, merge_factor=3)
+    for start in range(0, 3000, 250):
+        ids = index.add(data[start : start + 250])
+        np.testing.assert_array_equal(ids, np.arange(start, start + 250))
+    assert index.size() == 3000
+
+    # before and after compaction the results are exact
+    for _ in range(2):
+        indices, distances = index.searchKNN(queries, 5)
+        exact_idx, exact_dist = brute_knn_l2(data, queries, 5)
+        np.testing.assert_array_equal(indices, exact_idx)
+        np.testing.assert_allclose(distances, exact_dist, rtol=1e-4, atol=1e-5)
+        index.flush()
+    assert index.num_segments() >= 1
+
+
+def test_search_while_adding():
+    rng = np.random.default_rng(1)
+    data = rng.random((20000, 4)).astype(np.float32)
+    queries = rng.random((10, 4)).astype(np.float32)
+    index = SegmentedVPTreeL2Index(memtable_size=256, merge_factor=2)
+
+    def writer():
+        for start in range(0, len(data), 500):
+            index.add(data[start : start + 500])
+
+    thread = threading.Thread(target=writer)
+    thread.start()
+    while thread.is_alive():
+        indices, _ = index.searchKNN(queries, 3)
+        assert ((indices == -1) | ((indices >= 0) & (indices < len(data)))).all()
+    thread.join()
+
+    index.flush()
+    indices, _ = index.searchKNN(queries, 3)
+    np.testing.assert_array_equal(indices, brute_knn_l2(data, queries, 3)[0])
+
+
+def test_empty_index_and_padding():
+    index = SegmentedVPTreeL2Index()
+    queries = np.zeros((2, 3), dtype=np.float32)
+    indices, distances = index.searchKNN(queries, 2)
+    assert (indices == -1).all() and np.isinf(distances).all()
+
+    index.add(np.ones((3, 3), dtype=np.float32))
+    indices, distances = index.searchKNN(queries, 5)
+    assert (indices[:, 3:] == -1).all() and np.isinf(distances[:, 3:]).all()
+    idx1, dist1 = index.search1NN(queries)
+    assert idx1.shape == (2,)
+    np.testing.assert_array_equal(idx1, indices[:, 0])
+
+    with pytest.raises(ValueError):
+        index.add(np.ones((2, 4), dtype=np.float32))
+    with pytest.raises(ValueError):
+        index.searchKNN(np.ones((1, 4), dtype=np.float32), 1)
+    with pytest.raises(ValueError):
+        SegmentedVPTreeL2Index(merge_factor=1)
+
+
+def test_search_during_first_add():
+    # queries of another width never read the first vectors as their own
+    data = np.ones((5000, 3), dtype=np.float32)
+    queries = np.ones((4, 8), dtype=np.float32)
+    for _ in range(20):
+        index = SegmentedVPTreeL2Index(memtable_size=64)
+        thread = threading.Thread(target=index.add, args=(data,))
+        thread.start()
+        while thread.is_alive():
+            try:
+                indices, _ = index.searchKNN(queries, 2)
+            except ValueError:
+                continue
+            assert (indices == -1).all()
+        thread.join()
+        with pytest.raises(ValueError):
+            index.searchKNN(queries, 2)
+
+
+def test_pickle_roundtrip():
+    rng = np.random.default_rng(2)
+    data = rng.random((1200, 16)).astype(np.float32)
+    queries = rng.random((10, 16)).astype(np.float32)
+
+    index = SegmentedVPTreeL2Index(memtable_size=200, merge_factor=4, leaf_size=8)
+    index.add(data)
+    expected = index.searchKNN(queries, 5)
+
+    restored = pickle.loads(pickle.dumps(index))
+    assert restored.memtable_size == 200 and restored.merge_factor == 4
+    indices, distances = restored.searchKNN(queries, 5)
+    np.testing.assert_array_equal(indices, expected[0])
+    np.testing.assert_allclose(distances, expected[1], rtol=1e-5)
+
+    # ids continue after the restored vectors
+    np.testing.assert_array_equal(restored.add(data[:2]), [1200, 1201])
+
+    empty = pickle.loads(pickle.dumps(SegmentedVPTreeL2Index()))
+    assert empty.size() == 0
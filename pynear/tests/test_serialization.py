@@ -1,6 +1,7 @@
 import pickle
 
 import numpy as np
+import pytest
 
 import pynear
 
@@ -49,7 +50,7 @@ def test_basic_serialization():
     assert data == recovered_data
 
     vptree_indices_rec, vptree_distances_rec = recovered.search1NN(queries)
-    assert vptree_indices_rec == vptree_indices and vptree_distances_rec == vptree_distances
+    assert np.array_equal(vptree_indices_rec, vptree_indices) and np.array_equal(vptree_distances_rec, vptree_distances)
 
 
 def test_string_serialization():
@@ -90,4 +91,30 @@ def test_binary_serialization():
     assert data == recovered_data
 
     vptree_indices_rec, vptree_distances_rec = recovered.search1NN(queries)
-    assert vptree_distances_rec == vptree_distances
+    assert np.array_equal(vptree_distances_rec, vptree_distances)
+
+
+def test_save_load_file(tmp_path):
+    np.random.seed(5)
+    data = np.random.rand(500, 12).astype(np.float32)
+    queries = np.random.rand(7, 12).astype(np.float32)
+
+    for index_type in (pynear.VPTreeL2Index, pynear.VPTreeL1Index, pynear.VPTreeChebyshevIndex):
+        index = index_type(leaf_size=8)
+        index.set(data)
+        expected_indices, expected_distances = index.searchKNN(queries, 5)
+
+        path = str(tmp_path / f"{index_type.__name__}.pynear")
+        index.save(path)
+
+        for mmap in (True, False):
+            loaded = index_type.load(path, mmap=mmap)
+            assert loaded.leaf_size() == 8
+            assert loaded.to_string() == index.to_string()
+            indices, distances = loaded.searchKNN(queries, 5)
+            assert np.array_equal(indices, expected_indices)
+            assert np.array_equal(distances, expected_distances)
+
+    # a file saved for one metric cannot be opened as another
+    with pytest.raises(ValueError):
+        pynear.VPTreeL1Index.load(str(tmp_path / "VPTreeL2Index.pynear"))
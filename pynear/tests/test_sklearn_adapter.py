@@ -91,6 +91,14 @@ class TestPyNearNearestNeighbors:
         for i, row in enumerate(ind):
             assert i not in row, f"point {i} found itself as a neighbour"
 
+    def test_kneighbors_no_query_keeps_duplicates(self):
+        X = make_X(n=50)
+        X[1] = X[0]
+        pn = PyNearNearestNeighbors(n_neighbors=2).fit(X)
+        dst, ind = pn.kneighbors()
+        assert ind[0, 0] == 1 and ind[1, 0] == 0
+        assert dst[0, 0] == 0 and dst[1, 0] == 0
+
     def test_n_neighbors_override(self):
         X = make_X()
         pn = PyNearNearestNeighbors(n_neighbors=5).fit(X)
@@ -3,10 +3,15 @@
 # Copyright 2021 Pablo Carneiro Elias
 #
 
+import asyncio
 from collections import Counter
 from functools import partial
+import json
 import os
+import pickle
+import subprocess
 import sys
+import threading
 from typing import Callable
 from typing import Tuple
 
@@ -125,6 +130,33 @@ def test_hamming():
     assert np.array_equal(truth, result)
 
 
+def test_simd_level():
+    assert pynear.simd_level() in ("scalar", "sse4.2", "avx2", "avx512")
+
+    # PYNEAR_SIMD caps the dispatched level; the scalar kernels must agree with the SIMD ones
+    script = (
+        "import json, numpy as np, pynear\n"
+        "rng = np.random.default_rng(0)\n"
+        "data = rng.random((2000, 37), dtype=np.float32)\n"
+        "index = pynear.VPTreeL2Index()\n"
+        "index.set(data)\n"
+        "indices, distances = index.searchKNN(data[:50], 5)\n"
+        "print(json.dumps([pynear.simd_level(), indices.tolist(), distances.tolist()]))\n"
+    )
+    env = dict(os.environ, PYNEAR_SIMD="scalar")
+    output = subprocess.run([sys.executable, "-c", script], env=env, capture_output=True, text=True, check=True).stdout
+    level, scalar_indices, scalar_distances = json.loads(output)
+    assert level == "scalar"
+
+    rng = np.random.default_rng(0)
+    data = rng.random((2000, 37), dtype=np.float32)
+    index = pynear.VPTreeL2Index()
+    index.set(data)
+    indices, distances = index.searchKNN(data[:50], 5)
+    np.testing.assert_array_equal(indices, scalar_indices)
+    np.testing.assert_allclose(distances, scalar_distances, rtol=1e-5, atol=1e-6)
+
+
 def exhaustive_search(
     metric_func: Callable[[np.ndarray, np.ndarray], np.ndarray],
     data: np.ndarray,
@@ -173,13 +205,29 @@ def test_binary(num_points, k):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.int64)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.int64)
 
     assert np.array_equal(exaustive_distances, vptree_distances)
     # assert np.array_equal(exaustive_indices, vptree_indices)  # indices order can vary for same distances
 
 
+@pytest.mark.parametrize("dimension", [100, 128, 256])
+def test_binary_long_codes(dimension):
+    # codes longer than 64 bytes go through the vectorised Hamming kernels
+    rng = np.random.default_rng(7)
+    data = rng.integers(0, 256, size=(3000, dimension), dtype=np.uint8)
+    queries = rng.integers(0, 256, size=(10, dimension), dtype=np.uint8)
+
+    truth = np.unpackbits(np.bitwise_xor(queries[:, None, :], data[None, :, :]), axis=-1).sum(axis=-1)
+    truth.sort(axis=1)
+
+    vptree = pynear.VPTreeBinaryIndex()
+    vptree.set(data)
+    _, distances = vptree.searchKNN(queries, 4)
+    assert np.array_equal(distances, truth[:, :4])
+
+
 def test_binary_duplicates():
     dimension = 32
     num_points = 2
@@ -191,8 +239,8 @@ def test_binary_duplicates():
     vptree.set(data)
     indices, distances = vptree.searchKNN(data, k)
 
-    assert [sorted(i) for i in indices] == [list(range(num_points))] * num_points
-    assert distances == [[0] * k] * num_points
+    assert np.sort(indices, axis=1).tolist() == [list(range(num_points))] * num_points
+    assert np.array_equal(distances, np.zeros((num_points, k)))
 
 
 @pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
@@ -212,8 +260,8 @@ def test_k_equals_dataset(vptree_cls, exaustive_metric):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.float64)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float64)
     dist_diff = vptree_distances - exaustive_distances
     ind_diff = vptree_indices - exaustive_indices
     print(">>>>>>>>>>>>", dist_diff[dist_diff > 1e-7])
@@ -241,8 +289,8 @@ def test_large_dataset(vptree_cls, exaustive_metric):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.float32)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
 
     vptree_distances2 = np.sort(vptree_distances, axis=-1)
     assert np.array_equal(vptree_distances, vptree_distances2)  # distances are sorted
@@ -268,8 +316,8 @@ def test_large_dataset_highdim(vptree_cls, exaustive_metric):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.float32)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
 
     vptree_distances2 = np.sort(vptree_distances, axis=-1)
     assert np.array_equal(vptree_distances, vptree_distances2)  # distances are sorted
@@ -294,8 +342,8 @@ def test_dataset_split_less_than_k(vptree_cls, exaustive_metric):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.float32)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
 
     assert np.array_equal(exaustive_indices, vptree_indices)
     np.testing.assert_allclose(exaustive_distances, vptree_distances, rtol=1e-06)
@@ -320,8 +368,8 @@ def test_query_larger_than_dataset(vptree_cls, exaustive_metric):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(np.array([queries[0]]), k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.float32)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
 
     assert np.array_equal(exaustive_indices, vptree_indices)
     np.testing.assert_allclose(exaustive_distances, vptree_distances, rtol=1e-06)
@@ -344,8 +392,8 @@ def test_compare_with_exaustive_knn(vptree_cls, exaustive_metric):
     vptree.set(data)
     vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
 
-    vptree_indices = np.array(vptree_indices, dtype=np.uint64)[:, ::-1]
-    vptree_distances = np.array(vptree_distances, dtype=np.float32)[:, ::-1]
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
 
     assert np.array_equal(exaustive_indices, vptree_indices)
     np.testing.assert_allclose(exaustive_distances, vptree_distances, rtol=1e-06)
@@ -374,3 +422,512 @@ def test_compare_with_exaustive_1nn(vptree_cls, exaustive_metric):
 
     assert np.array_equal(exaustive_indices, vptree_indices)
     np.testing.assert_allclose(exaustive_distances, vptree_distances, rtol=1e-06)
+
+
+@pytest.mark.parametrize("leaf_size", [1, 2, 7, 16, 64])
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_leaf_size(vptree_cls, exaustive_metric, leaf_size):
+    num_points = 5031
+    dimension = 11
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+
+    num_queries = 17
+    queries = np.random.rand(num_queries, dimension).astype(dtype=np.float32)
+
+    k = 4
+
+    exaustive_indices, exaustive_distances = exaustive_metric(data, queries, k)
+
+    vptree = vptree_cls(leaf_size=leaf_size)
+    assert vptree.leaf_size() == leaf_size
+    vptree.set(data)
+    vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
+
+    vptree_indices = np.array(vptree_indices, dtype=np.uint64)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
+
+    assert np.array_equal(exaustive_indices, vptree_indices)
+    np.testing.assert_allclose(exaustive_distances, vptree_distances, rtol=1e-06)
+
+    nn_indices, nn_distances = vptree.search1NN(queries)
+    assert np.array_equal(exaustive_indices[:, 0], np.array(nn_indices, dtype=np.uint64))
+
+
+@pytest.mark.parametrize("leaf_size", [1, 16, 100])
+def test_binary_leaf_size(leaf_size):
+    dimension = 32
+    num_points = 3021
+    k = 3
+    data = np.random.normal(scale=255, loc=0, size=(num_points, dimension)).astype(dtype=np.uint8)
+    queries = np.random.normal(scale=255, loc=0, size=(8, dimension)).astype(dtype=np.uint8)
+
+    _, exaustive_distances = exhaustive_search_hamming(data, queries, k)
+
+    vptree = pynear.VPTreeBinaryIndex(leaf_size=leaf_size)
+    vptree.set(data)
+    _, vptree_distances = vptree.searchKNN(queries, k)
+
+    vptree_distances = np.array(vptree_distances, dtype=np.int64)
+    assert np.array_equal(exaustive_distances, vptree_distances)
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_sampled_split(vptree_cls, exaustive_metric):
+    num_points = 30011
+    dimension = 8
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(13, dimension).astype(dtype=np.float32)
+    k = 5
+
+    exaustive_indices, exaustive_distances = exaustive_metric(data, queries, k)
+
+    vptree = vptree_cls(sampled_split=8192)
+    vptree.set(data)
+    assert 0 <= vptree.split_imbalance() <= 0.1
+    vptree_indices, vptree_distances = vptree.searchKNN(queries, k)
+
+    assert np.array_equal(exaustive_indices, np.array(vptree_indices, dtype=np.uint64))
+    np.testing.assert_allclose(exaustive_distances, np.array(vptree_distances, dtype=np.float32), rtol=1e-06)
+
+    with pytest.raises(ValueError):
+        vptree_cls(sampled_split=100)
+
+
+def test_binary_sampled_split():
+    dimension = 32
+    data = np.random.normal(scale=255, loc=0, size=(20011, dimension)).astype(dtype=np.uint8)
+    queries = np.random.normal(scale=255, loc=0, size=(8, dimension)).astype(dtype=np.uint8)
+
+    _, exaustive_distances = exhaustive_search_hamming(data, queries, 3)
+
+    vptree = pynear.VPTreeBinaryIndex(sampled_split=4096)
+    vptree.set(data)
+    assert 0 <= vptree.split_imbalance() <= 0.1
+    _, vptree_distances = vptree.searchKNN(queries, 3)
+    assert np.array_equal(exaustive_distances, np.array(vptree_distances, dtype=np.int64))
+
+    with pytest.raises(ValueError):
+        pynear.VPTreeBinaryIndex(sampled_split=100)
+
+
+@pytest.mark.parametrize("epsilon", [0.0, 0.25, 1.0])
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_approximate_epsilon(vptree_cls, exaustive_metric, epsilon):
+    num_points = 8021
+    dimension = 16
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+
+    num_queries = 19
+    queries = np.random.rand(num_queries, dimension).astype(dtype=np.float32)
+
+    k = 3
+
+    _, exaustive_distances = exaustive_metric(data, queries, k)
+
+    vptree = vptree_cls()
+    vptree.set(data)
+    _, vptree_distances = vptree.searchKNN(queries, k, epsilon=epsilon)
+    vptree_distances = np.array(vptree_distances, dtype=np.float32)
+
+    # each returned neighbour is at most (1 + epsilon) farther than the exact one
+    assert np.all(vptree_distances <= exaustive_distances * (1 + epsilon) * (1 + 1e-5))
+
+    _, nn_distances = vptree.search1NN(queries, epsilon=epsilon)
+    assert np.all(np.array(nn_distances) <= exaustive_distances[:, 0] * (1 + epsilon) * (1 + 1e-5))
+
+    if epsilon == 0.0:
+        np.testing.assert_allclose(exaustive_distances, vptree_distances, rtol=1e-06)
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_budgeted_search(vptree_cls, exaustive_metric):
+    num_points = 20021
+    dimension = 16
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(13, dimension).astype(dtype=np.float32)
+    k = 3
+
+    vptree = vptree_cls()
+    vptree.set(data)
+    exact_indices, exact_distances = vptree.searchKNN(queries, k)
+
+    indices, distances, exact = vptree.searchKNNBudgeted(queries, k, max_visits=num_points)
+    assert all(exact)
+    assert np.array_equal(indices, exact_indices)
+
+    indices, distances, exact = vptree.searchKNNBudgeted(queries, k, max_visits=2)
+    assert not any(exact)
+    assert distances.shape == (len(queries), k)
+    # rows cut short are padded with inf, so the k-th entry can only be worse
+    assert np.all(distances[:, -1] >= exact_distances[:, -1])
+
+    nn_indices, nn_distances, nn_exact = vptree.search1NNBudgeted(queries, max_visits=2)
+    assert not any(nn_exact)
+
+    _, _, exact = vptree.searchKNNBudgeted(queries, k, max_time_us=10_000_000)
+    assert all(exact)
+
+
+def test_binary_budgeted_search():
+    dimension = 32
+    data = np.random.normal(scale=255, loc=0, size=(5021, dimension)).astype(dtype=np.uint8)
+    queries = np.random.normal(scale=255, loc=0, size=(8, dimension)).astype(dtype=np.uint8)
+
+    vptree = pynear.VPTreeBinaryIndex()
+    vptree.set(data)
+    _, exact_distances = vptree.searchKNN(queries, 2)
+
+    _, distances, exact = vptree.searchKNNBudgeted(queries, 2, max_visits=len(data))
+    assert all(exact)
+    assert np.array_equal(distances, exact_distances)
+
+    _, _, exact = vptree.search1NNBudgeted(queries, max_visits=1)
+    assert not any(exact)
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_radius_search(vptree_cls, exaustive_metric):
+    num_points = 4021
+    dimension = 5
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(11, dimension).astype(dtype=np.float32)
+    radius = 0.2
+
+    exaustive_indices, all_distances = exaustive_metric(data, queries, num_points)
+
+    vptree = vptree_cls()
+    vptree.set(data)
+    offsets, indices, distances = vptree.searchRadius(queries, radius)
+
+    assert offsets.shape == (len(queries) + 1,)
+    assert offsets[-1] == len(indices) == len(distances)
+    for q in range(len(queries)):
+        found = indices[offsets[q] : offsets[q + 1]]
+        found_distances = distances[offsets[q] : offsets[q + 1]]
+        expected = exaustive_indices[q][all_distances[q] <= radius]
+
+        assert np.all(np.diff(found_distances) >= 0)
+        assert set(found.tolist()) == set(expected.tolist())
+
+    offsets_capped, indices_capped, _ = vptree.searchRadius(queries, radius, max_results=2)
+    assert np.all(np.diff(offsets_capped) == np.minimum(np.diff(offsets), 2))
+
+
+def test_binary_radius_search():
+    dimension = 8
+    data = np.random.randint(0, 256, size=(3021, dimension), dtype=np.uint8)
+    queries = data[:5]
+    threshold = 20
+
+    vptree = pynear.VPTreeBinaryIndex()
+    vptree.set(data)
+    offsets, indices, distances = vptree.searchRadius(queries, threshold)
+
+    for q in range(len(queries)):
+        expected = [i for i in range(len(data)) if dist_hamming(queries[q], data[i]) <= threshold]
+        found = indices[offsets[q] : offsets[q + 1]]
+        assert sorted(found.tolist()) == expected
+        assert distances[offsets[q]] == 0
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_search_result_arrays(vptree_cls, exaustive_metric):
+    num_points = 37
+    dimension = 5
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(6, dimension).astype(dtype=np.float32)
+
+    vptree = vptree_cls()
+    vptree.set(data)
+
+    k = 4
+    indices, distances = vptree.searchKNN(queries, k)
+    assert indices.dtype == np.int64 and distances.dtype == np.float32
+    assert indices.shape == distances.shape == (len(queries), k)
+    exaustive_indices, exaustive_distances = exaustive_metric(data, queries, k)
+    assert np.array_equal(exaustive_indices, indices)
+
+    # k beyond the dataset size pads each row with index -1 and distance inf
+    indices, distances = vptree.searchKNN(queries, num_points + 3)
+    assert np.all(indices[:, num_points:] == -1)
+    assert np.all(np.isinf(distances[:, num_points:]))
+    assert np.all(indices[:, :num_points] >= 0)
+
+    out = (np.empty((len(queries), k), dtype=np.int64), np.empty((len(queries), k), dtype=np.float32))
+    result = vptree.searchKNN(queries, k, out=out)
+    assert np.shares_memory(result[0], out[0])
+    assert np.array_equal(out[0], exaustive_indices)
+    np.testing.assert_allclose(out[1], exaustive_distances, rtol=1e-06)
+
+    with pytest.raises(ValueError):
+        vptree.searchKNN(queries, k, out=(np.empty((len(queries), k + 1), dtype=np.int64), out[1]))
+    with pytest.raises(ValueError):
+        vptree.searchKNN(queries, k, out=(out[0], np.empty((len(queries), k), dtype=np.float64)))
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_batched_search(vptree_cls, exaustive_metric):
+    dimension = 5
+    data = np.random.rand(4000, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(500, dimension).astype(dtype=np.float32)
+
+    vptree = vptree_cls(leaf_size=8)
+    vptree.set(data)
+
+    k = 6
+    expected_indices, expected_distances = vptree.searchKNN(queries, k)
+    for block_size in (1, 64, 1000):
+        indices, distances = vptree.searchKNNBatched(queries, k, block_size=block_size)
+        np.testing.assert_allclose(distances, expected_distances, rtol=1e-06)
+        assert np.mean(indices == expected_indices) > 0.99
+
+    out = (np.empty((len(queries), k), dtype=np.int64), np.empty((len(queries), k), dtype=np.float32))
+    result = vptree.searchKNNBatched(queries, k, out=out)
+    assert np.shares_memory(result[0], out[0])
+    with pytest.raises(ValueError):
+        vptree.searchKNNBatched(queries, k, block_size=0)
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+@pytest.mark.parametrize("query_dimension", [3, 8])
+def test_query_dimension_mismatch(vptree_cls, exaustive_metric, query_dimension):
+    data = np.random.rand(1000, 5).astype(dtype=np.float32)
+    queries = np.random.rand(4, query_dimension).astype(dtype=np.float32)
+
+    vptree = vptree_cls(leaf_size=8)
+    vptree.set(data)
+
+    with pytest.raises(ValueError):
+        vptree.searchKNN(queries, 3)
+    with pytest.raises(ValueError):
+        vptree.searchKNNBatched(queries, 3)
+    with pytest.raises(ValueError):
+        vptree.searchKNNBudgeted(queries, 3, max_visits=10)
+    with pytest.raises(ValueError):
+        vptree.search1NN(queries)
+    with pytest.raises(ValueError):
+        vptree.search1NNBudgeted(queries, max_visits=10)
+    with pytest.raises(ValueError):
+        vptree.searchRadius(queries, 0.5)
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_all_knn(vptree_cls, exaustive_metric):
+    dimension = 4
+    data = np.random.rand(1500, dimension).astype(dtype=np.float32)
+    data[1::10] = data[::10]  # exact duplicates still count as neighbours
+
+    vptree = vptree_cls(leaf_size=8)
+    vptree.set(data)
+
+    k = 5
+    indices, distances = vptree.allKNN(k)
+    expected_indices, expected_distances = vptree.searchKNN(data, k + 1)
+    np.testing.assert_allclose(distances, expected_distances[:, 1:], rtol=1e-06)
+    assert not (indices == np.arange(len(data))[:, None]).any()
+
+    indices, distances = vptree.allKNN(k, exclude_self=False)
+    np.testing.assert_allclose(distances, expected_distances[:, :k], rtol=1e-06)
+    assert (distances[:, 0] == 0).all()
+
+    # removed ids get padded rows and never show up as neighbours
+    vptree.remove(np.arange(0, len(data), 3))
+    indices, distances = vptree.allKNN(k)
+    assert (indices[::3] == -1).all() and np.isinf(distances[::3]).all()
+    assert (indices[1::3] % 3 != 0).all()
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_filtered_search(vptree_cls, exaustive_metric):
+    dimension = 4
+    data = np.random.rand(2000, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(7, dimension).astype(dtype=np.float32)
+
+    vptree = vptree_cls(leaf_size=8)
+    vptree.set(data)
+
+    k = 5
+    allowed = np.flatnonzero(np.random.rand(len(data)) < 0.02)
+    exaustive_indices, exaustive_distances = exaustive_metric(data[allowed], queries, k)
+
+    # a bool mask and an id list select the same points
+    mask = np.zeros(len(data), dtype=bool)
+    mask[allowed] = True
+    for selection in (mask, allowed):
+        indices, distances = vptree.searchKNN(queries, k, filter=selection)
+        assert np.array_equal(indices, allowed[exaustive_indices])
+        np.testing.assert_allclose(distances, exaustive_distances, rtol=1e-05)
+
+    # one mask per query; a query whose mask allows fewer than k points gets padding
+    masks = np.zeros((len(queries), len(data)), dtype=bool)
+    masks[0, :3] = True
+    masks[1:] = mask
+    indices, _ = vptree.searchKNN(queries, k, filter=masks)
+    assert set(indices[0, :3]) == {0, 1, 2} and np.all(indices[0, 3:] == -1)
+    assert np.array_equal(indices[1:], allowed[exaustive_indices[1:]])
+
+    with pytest.raises(ValueError):
+        vptree.searchKNN(queries, k, filter=masks[:3])
+    with pytest.raises(ValueError):
+        vptree.searchKNN(queries, k, filter=np.array([-1, 3]))
+
+
+def test_binary_filtered_search():
+    data = np.random.randint(0, 256, size=(1500, 8), dtype=np.uint8)
+    queries = data[:20]
+
+    vptree = pynear.VPTreeBinaryIndex(leaf_size=4)
+    vptree.set(data)
+    # every query may only return odd ids, so none finds itself
+    indices, distances = vptree.searchKNN(queries, 1, filter=np.arange(1, len(data), 2))
+    for q in range(len(queries)):
+        expected = min(dist_hamming(queries[q], data[i]) for i in range(1, len(data), 2))
+        assert distances[q, 0] == expected
+        assert indices[q, 0] % 2 == 1
+
+
+def test_binary_all_knn():
+    data = np.random.randint(0, 256, size=(800, 8), dtype=np.uint8)
+    vptree = pynear.VPTreeBinaryIndex(leaf_size=4)
+    vptree.set(data)
+
+    indices, distances = vptree.allKNN(1)
+    for i in range(0, len(data), 40):
+        expected = min(dist_hamming(data[i], data[j]) for j in range(len(data)) if j != i)
+        assert distances[i, 0] == expected
+        assert indices[i, 0] != i
+
+
+@pytest.mark.parametrize("vptree_cls, exaustive_metric", CLASSES)
+def test_add_remove(vptree_cls, exaustive_metric):
+    dimension = 6
+    data = np.random.rand(3000, dimension).astype(dtype=np.float32)
+    queries = np.random.rand(13, dimension).astype(dtype=np.float32)
+
+    vptree = vptree_cls(leaf_size=4)
+    vptree.set(data[:1000])
+    assert np.array_equal(vptree.add(data[1000:1001]), [1000])
+    assert np.array_equal(vptree.add(data[1001:]), np.arange(1001, 3000))
+
+    removed = np.random.choice(len(data), 1700, replace=False)
+    vptree.remove(removed)
+    with pytest.raises(ValueError):
+        vptree.remove(removed[:1])
+    with pytest.raises(ValueError):
+        vptree.add(np.random.rand(2, dimension + 1).astype(dtype=np.float32))
+
+    live = np.setdiff1d(np.arange(len(data)), removed)
+    assert vptree.size() == len(live)
+
+    k = 5
+    exaustive_indices, exaustive_distances = exaustive_metric(data[live], queries, k)
+    for index in (vptree, pickle.loads(pickle.dumps(vptree))):
+        indices, distances = index.searchKNN(queries, k)
+        assert np.array_equal(indices, live[exaustive_indices])
+        np.testing.assert_allclose(distances, exaustive_distances, rtol=1e-05)
+
+    # ids are not reused, even after compaction and a pickle round trip
+    vptree.compact()
+    restored = pickle.loads(pickle.dumps(vptree))
+    assert restored.add(data[:1])[0] == len(data)
+    indices, _ = restored.searchKNN(data[:1], 1)
+    assert indices[0, 0] == len(data)
+
+
+def test_binary_add_remove():
+    dimension = 8
+    data = np.random.randint(0, 256, size=(2000, dimension), dtype=np.uint8)
+
+    vptree = pynear.VPTreeBinaryIndex(leaf_size=4)
+    assert np.array_equal(vptree.add(data[:500]), np.arange(500))
+    assert np.array_equal(vptree.add(data[500:]), np.arange(500, 2000))
+
+    removed = np.arange(0, 2000, 3)
+    vptree.remove(removed)
+    assert vptree.size() == 2000 - len(removed)
+
+    queries = data[:30]
+    indices, distances = vptree.searchKNN(queries, 1)
+    for q in range(len(queries)):
+        expected = min(dist_hamming(queries[q], data[i]) for i in range(len(data)) if i % 3 != 0)
+        assert distances[q, 0] == expected
+        assert indices[q, 0] % 3 != 0
+
+
+def test_search_async():
+    num_points = 3021
+    dimension = 8
+    data = np.random.rand(num_points, dimension).astype(dtype=np.float32)
+    query_batches = [np.random.rand(11, dimension).astype(dtype=np.float32) for _ in range(4)]
+
+    vptree = pynear.VPTreeL2Index()
+    vptree.set(data)
+    expected = [vptree.searchKNN(q, 3) for q in query_batches]
+
+    async def run_all():
+        return await asyncio.gather(*(pynear.search_async(vptree, q, 3) for q in query_batches))
+
+    for (indices, distances), (expected_indices, expected_distances) in zip(asyncio.run(run_all()), expected):
+        assert np.array_equal(indices, expected_indices)
+        assert np.array_equal(distances, expected_distances)
+
+    # outside an event loop a concurrent.futures.Future is returned
+    nn_indices, _ = pynear.search_async(vptree, query_batches[0], method="search1NN").result()
+    assert np.array_equal(nn_indices, expected[0][0][:, 0])
+
+
+@pytest.mark.parametrize(
+    "index_cls, make_data",
+    [
+        (pynear.VPTreeL2Index, lambda rng, n: rng.random((n, 8)).astype(np.float32)),
+        (pynear.VPTreeBinaryIndex256, lambda rng, n: rng.integers(0, 256, size=(n, 32), dtype=np.uint8)),
+    ],
+)
+def test_search_while_setting(index_cls, make_data):
+    rng = np.random.default_rng(3)
+    datasets = [make_data(rng, 20000), make_data(rng, 5000)]
+    queries = make_data(rng, 16)
+
+    index = index_cls()
+    expected = []
+    for data in datasets:
+        index.set(data)
+        expected.append(index.searchKNN(queries, 3))
+
+    def writer():
+        for i in range(20):
+            index.set(datasets[i % 2])
+
+    # every search sees one whole index, never one being rebuilt
+    thread = threading.Thread(target=writer)
+    thread.start()
+    while thread.is_alive():
+        indices, distances = index.searchKNN(queries, 3)
+        assert any(np.array_equal(indices, e[0]) and np.array_equal(distances, e[1]) for e in expected)
+    thread.join()
+
+
+def test_search_while_updating():
+    rng = np.random.default_rng(4)
+    data = rng.random((30000, 6)).astype(np.float32)
+    queries = rng.random((16, 6)).astype(np.float32)
+
+    index = pynear.VPTreeL2Index()
+    index.set(data[:10000])
+
+    def writer():
+        for start in range(10000, len(data), 1000):
+            ids = index.add(data[start : start + 1000])
+            index.remove(ids[::7])
+        index.compact()
+
+    # every result holds real neighbours with their exact distances, nearest first
+    thread = threading.Thread(target=writer)
+    thread.start()
+    while thread.is_alive():
+        indices, distances = index.searchKNN(queries, 4)
+        assert (indices >= 0).all() and (indices < len(data)).all()
+        assert (np.diff(distances, axis=1) >= 0).all()
+        true_distances = np.linalg.norm(data[indices] - queries[:, None, :], axis=2)
+        np.testing.assert_allclose(distances, true_distances, rtol=1e-4, atol=1e-5)
+    thread.join()
@@ -1,5 +1,4 @@
 import os
-import platform
 import subprocess
 import sys
 import tempfile
@@ -33,19 +32,13 @@ def _tbb_available():
                 pass
 
 if sys.platform == "win32":
-    extra_compile_args = ["/Wall", "/arch:AVX", "/openmp"]  # /LTCG unrecognized here
+    extra_compile_args = ["/Wall", "/openmp"]  # /LTCG unrecognized here
     extra_link_args = ["/LTCG"]  # /openmp unrecognized here
     extra_macros = [("ENABLE_OMP_PARALLEL", "1")]
 elif sys.platform == "darwin":
     # ARCHFLAGS is set by cibuildwheel when cross-compiling (e.g. arm64 host -> x86_64 target).
-    # When set, avoid -march=native (which would tune for the host, not the target).
     archflags = os.environ.get("ARCHFLAGS", "")
-    is_x86_64 = "x86_64" in archflags or (not archflags and platform.machine() == "x86_64")
     is_cross_compiling = bool(archflags)
-    march = [] if archflags else ["-march=native"]
-    # When cross-compiling for x86_64 on Apple Silicon (Rosetta 2), AVX is not supported
-    # by Rosetta 2 (only up to SSE4.2), so -mavx would cause "Illegal instruction" at import.
-    avx = ["-mavx"] if (is_x86_64 and not is_cross_compiling) else []
     # When cross-compiling (ARCHFLAGS set), Homebrew LLVM is arm64-only:
     #   - its libomp.dylib cannot satisfy x86_64 link requests
     #   - its LTO bitcode (LLVM 22) is incompatible with the Apple linker's LTO reader (LLVM 15)
@@ -58,13 +51,13 @@ elif sys.platform == "darwin":
         lto = ["-flto"]
         omp_compile = ["-fopenmp"]
         omp_link = ["-fopenmp", "-lomp"]
-    extra_compile_args = lto + ["-Wall"] + march + avx + omp_compile
+    extra_compile_args = lto + ["-Wall"] + omp_compile
     extra_link_args = omp_link
     # Apple libc++ does not ship std::execution::par_unseq without explicit PSTL;
     # level-parallel OMP build still applies, only the TBB nth_element is disabled.
     extra_macros = [("ENABLE_OMP_PARALLEL", "1")]
 else:
-    extra_compile_args = ["-flto", "-Wall", "-march=native", "-mavx", "-fopenmp"]
+    extra_compile_args = ["-flto", "-Wall", "-fopenmp"]
     extra_link_args = ["-fopenmp", "-lgomp"]
     extra_macros = [("ENABLE_OMP_PARALLEL", "1")]
     # Enable TBB parallel nth_element only when libtbb is available (not present
@@ -106,6 +99,7 @@ setup(
     extras_require={
         "test": ["pytest>=6.0"],
         "sklearn": ["scikit-learn"],
+        "graph": ["scipy"],
     },
     python_requires=">=3.8",
     license_files=("LICENSE",),